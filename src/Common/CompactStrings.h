@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string_view>
+
 #include <Common/PODArray.h>
 #include <Service/memcopy.h>
 #include <common/StringRef.h>
@@ -49,14 +51,14 @@ public:
 
     void reserve(size_t n, size_t total_size = 0);
 
-    inline void push_back(const String & s)
+    inline void push_back(std::string_view s)
     {
         const size_t old_size = data.size();
         const size_t size_to_append = s.size();
         const size_t new_size = old_size + size_to_append;
 
         data.resize(new_size);
-        memcopy(data.data() + old_size, s.c_str(), size_to_append);
+        memcopy(data.data() + old_size, s.data(), size_to_append);
         offsets.push_back(new_size);
     }
 
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <Common/Allocator.h>
+#include <common/types.h>
+
+
+namespace RK
+{
+
+namespace SlabAllocatorDetail
+{
+    /// Live pools by id, thread caches look up their owner here before returning objects to it,
+    /// so that a cache outliving its pool does not touch freed memory.
+    struct Registry
+    {
+        std::mutex mutex;
+        std::unordered_map<UInt64, void *> pools;
+        UInt64 next_id = 1;
+    };
+
+    /// Never destroyed, thread caches may be flushed after static objects are destroyed.
+    inline Registry & registry()
+    {
+        static auto * instance = new Registry;
+        return *instance;
+    }
+}
+
+/** Memory pool for fixed-size objects.
+  * Usage scenario:
+  * - lots of small objects of the same size are allocated and freed one by one, for example data tree nodes;
+  * - memory is allocated by large slabs, so there is no per object malloc and bookkeeping overhead;
+  * - freed objects are kept in a free list and reused by the next allocation;
+  * - memory of slabs is returned to the system only when the pool is destroyed.
+  *
+  * It is thread-safe, objects may be freed in another thread than the one allocated them.
+  * Every thread allocates from and frees to its own cache without locking, objects move between
+  * the cache and the shared pool in batches of BATCH_SIZE under the pool mutex.
+  */
+template <size_t ObjectSize, size_t ObjectAlignment = alignof(std::max_align_t), size_t ObjectsPerSlab = 4096>
+class SlabAllocator : private boost::noncopyable, private Allocator<false>
+{
+public:
+    static constexpr size_t BATCH_SIZE = std::min<size_t>(256, ObjectsPerSlab);
+
+    SlabAllocator()
+    {
+        auto & registry = SlabAllocatorDetail::registry();
+        std::lock_guard lock(registry.mutex);
+        id = registry.next_id++;
+        registry.pools.emplace(id, this);
+    }
+
+    ~SlabAllocator()
+    {
+        {
+            auto & registry = SlabAllocatorDetail::registry();
+            std::lock_guard lock(registry.mutex);
+            registry.pools.erase(id);
+        }
+        /// The cache of this thread is dropped, caches of other threads are dropped when they are flushed.
+        auto & cache = localCache();
+        if (cache.owner_id == id)
+            cache = {};
+
+        for (auto * slab : slabs)
+            Allocator<false>::free(slab, SLAB_SIZE);
+    }
+
+    void * alloc()
+    {
+        auto & cache = localCache();
+        if (unlikely(cache.owner_id != id))
+            cache.rebind(id);
+
+        if (unlikely(!cache.free_list))
+            takeBatch(cache);
+
+        FreeObject * object = cache.free_list;
+        cache.free_list = object->next;
+        --cache.size;
+        return object;
+    }
+
+    void free(void * ptr)
+    {
+        if (!ptr)
+            return;
+
+        auto & cache = localCache();
+        if (unlikely(cache.owner_id != id))
+            cache.rebind(id);
+
+        auto * object = static_cast<FreeObject *>(ptr);
+        object->next = cache.free_list;
+        cache.free_list = object;
+
+        if (unlikely(++cache.size >= 2 * BATCH_SIZE))
+            returnBatch(cache);
+    }
+
+    /// Bytes allocated from the system.
+    size_t allocatedBytes() const
+    {
+        std::lock_guard lock(mutex);
+        return slabs.size() * SLAB_SIZE;
+    }
+
+    /// Objects not in the shared pool, objects cached by threads are counted as used.
+    size_t usedObjects() const
+    {
+        std::lock_guard lock(mutex);
+        return slabs.size() * ObjectsPerSlab - free_objects;
+    }
+
+private:
+    struct FreeObject
+    {
+        FreeObject * next;
+    };
+
+    struct Batch
+    {
+        FreeObject * head;
+        size_t size;
+    };
+
+    struct ThreadCache
+    {
+        UInt64 owner_id = 0;
+        FreeObject * free_list = nullptr;
+        size_t size = 0;
+
+        ~ThreadCache() { flush(); }
+
+        void rebind(UInt64 new_owner_id)
+        {
+            flush();
+            owner_id = new_owner_id;
+        }
+
+        /// Give all cached objects back to the owner pool if it is still alive.
+        void flush()
+        {
+            if (owner_id && free_list)
+            {
+                auto & registry = SlabAllocatorDetail::registry();
+                std::lock_guard lock(registry.mutex);
+                if (auto it = registry.pools.find(owner_id); it != registry.pools.end())
+                    static_cast<SlabAllocator *>(it->second)->putBatch({free_list, size});
+            }
+            owner_id = 0;
+            free_list = nullptr;
+            size = 0;
+        }
+    };
+
+    static constexpr size_t SLOT_SIZE
+        = (std::max(ObjectSize, sizeof(FreeObject)) + ObjectAlignment - 1) / ObjectAlignment * ObjectAlignment;
+    static constexpr size_t SLAB_SIZE = SLOT_SIZE * ObjectsPerSlab;
+
+    static ThreadCache & localCache()
+    {
+        static thread_local ThreadCache cache;
+        return cache;
+    }
+
+    void takeBatch(ThreadCache & cache)
+    {
+        std::lock_guard lock(mutex);
+        if (batches.empty())
+            allocSlab();
+
+        Batch batch = batches.back();
+        batches.pop_back();
+        free_objects -= batch.size;
+
+        cache.free_list = batch.head;
+        cache.size = batch.size;
+    }
+
+    /// Detach BATCH_SIZE objects from the cache out of lock and hand them to the pool.
+    void returnBatch(ThreadCache & cache)
+    {
+        FreeObject * head = cache.free_list;
+        FreeObject * tail = head;
+        for (size_t i = 1; i < BATCH_SIZE; ++i)
+            tail = tail->next;
+
+        cache.free_list = tail->next;
+        cache.size -= BATCH_SIZE;
+        tail->next = nullptr;
+
+        putBatch({head, BATCH_SIZE});
+    }
+
+    void putBatch(Batch batch)
+    {
+        std::lock_guard lock(mutex);
+        batches.push_back(batch);
+        free_objects += batch.size;
+    }
+
+    void allocSlab()
+    {
+        char * slab = static_cast<char *>(Allocator<false>::alloc(SLAB_SIZE, ObjectAlignment));
+        slabs.push_back(slab);
+
+        /// Link slots of a batch in address order, so that objects allocated together are adjacent in memory.
+        for (size_t begin = ObjectsPerSlab; begin > 0;)
+        {
+            size_t size = std::min(begin, BATCH_SIZE);
+            begin -= size;
+
+            FreeObject * head = nullptr;
+            for (size_t i = begin + size; i > begin; --i)
+            {
+                auto * object = reinterpret_cast<FreeObject *>(slab + (i - 1) * SLOT_SIZE);
+                object->next = head;
+                head = object;
+            }
+            batches.push_back({head, size});
+        }
+        free_objects += ObjectsPerSlab;
+    }
+
+    UInt64 id;
+
+    mutable std::mutex mutex;
+    /// Free objects in the shared pool, only full batches except those flushed by exiting threads.
+    std::vector<Batch> batches;
+    size_t free_objects = 0;
+    std::vector<char *> slabs;
+};
+
+}
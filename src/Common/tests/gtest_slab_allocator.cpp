@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <Common/SlabAllocator.h>
+
+using namespace RK;
+
+using TestSlabAllocator = SlabAllocator<48, 8, 1024>;
+
+TEST(Common, SlabAllocatorReuse)
+{
+    TestSlabAllocator allocator;
+
+    std::vector<void *> objects;
+    for (size_t i = 0; i < 5000; ++i)
+    {
+        objects.push_back(allocator.alloc());
+        memset(objects.back(), static_cast<int>(i), 48);
+    }
+    ASSERT_EQ(std::unordered_set<void *>(objects.begin(), objects.end()).size(), objects.size());
+    ASSERT_GE(allocator.usedObjects(), objects.size());
+
+    size_t allocated_bytes = allocator.allocatedBytes();
+    for (auto * object : objects)
+        allocator.free(object);
+    objects.clear();
+
+    /// Freed objects are reused
+    for (size_t i = 0; i < 5000; ++i)
+        objects.push_back(allocator.alloc());
+    ASSERT_EQ(allocator.allocatedBytes(), allocated_bytes);
+
+    for (auto * object : objects)
+        allocator.free(object);
+}
+
+TEST(Common, SlabAllocatorMultiThreads)
+{
+    TestSlabAllocator allocator;
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 8; ++t)
+    {
+        threads.emplace_back(
+            [&]
+            {
+                std::vector<void *> objects;
+                for (size_t round = 0; round < 100; ++round)
+                {
+                    for (size_t i = 0; i < 1000; ++i)
+                        objects.push_back(allocator.alloc());
+                    for (auto * object : objects)
+                        allocator.free(object);
+                    objects.clear();
+                }
+            });
+    }
+    for (auto & thread : threads)
+        thread.join();
+
+    /// Caches of exited threads are returned to the pool
+    ASSERT_EQ(allocator.usedObjects(), 0);
+
+    /// Objects freed in another thread
+    std::vector<void *> objects;
+    for (size_t i = 0; i < 3000; ++i)
+        objects.push_back(allocator.alloc());
+    std::thread(
+        [&]
+        {
+            for (auto * object : objects)
+                allocator.free(object);
+        })
+        .join();
+    ASSERT_LT(allocator.usedObjects(), 2 * TestSlabAllocator::BATCH_SIZE);
+}
@@ -122,6 +122,17 @@ void ACLMap::removeUsage(uint64_t acl_id)
         usage_counter.erase(acl_id);
     }
 }
+
+size_t ACLMap::getACLsBytes() const
+{
+    std::lock_guard lock(acl_mutex);
+    size_t bytes = 0;
+    for (const auto & [_, acls] : num_to_acl)
+        for (const auto & acl : acls)
+            bytes += sizeof(acl.permissions) + acl.scheme.size() + acl.id.size();
+    return bytes;
+}
+
 bool ACLMap::operator==(const ACLMap & rhs) const
 {
     if (acl_to_num.size() != rhs.acl_to_num.size())
@@ -62,6 +62,9 @@ public:
     void addUsage(uint64_t acl_id, uint64_t count = 1);
     void removeUsage(uint64_t acl_id);
 
+    /// Bytes of all ACLs, every distinct ACLs is stored only once.
+    size_t getACLsBytes() const;
+
     bool operator==(const ACLMap & rhs) const;
     bool operator!=(const ACLMap & rhs) const;
 
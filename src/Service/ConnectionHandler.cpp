@@ -685,7 +685,8 @@ void ConnectionHandler::updateStats(const Coordination::ZooKeeperResponsePtr & r
 {
     /// update statistics ignoring watch, close and heartbeat response.
     if (response->xid != Coordination::WATCH_XID && response->getOpNum() != Coordination::OpNum::Heartbeat
-        && response->getOpNum() != Coordination::OpNum::SetWatches && response->getOpNum() != Coordination::OpNum::Close)
+        && response->getOpNum() != Coordination::OpNum::SetWatches && response->getOpNum() != Coordination::OpNum::SetWatches2
+        && response->getOpNum() != Coordination::OpNum::Close)
     {
         const auto current_time = getCurrentTimeMilliseconds();
         // Use std::chrono::steady_clock to calculate elapsed time.
@@ -1,6 +1,18 @@
 #include <Service/Crc32.h>
+
+#include <cstring>
+
 #include <common/types.h>
 
+#if defined(__x86_64__)
+#    include <nmmintrin.h>
+#    include <wmmintrin.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#    include <arm_acle.h>
+#    include <asm/hwcap.h>
+#    include <sys/auxv.h>
+#endif
+
 namespace RK
 {
 
@@ -53,4 +65,214 @@ bool verifyCRC32(const char * data, size_t len, uint32_t value)
     return (value == getCRC32(data, len));
 }
 
+namespace
+{
+
+/// Reversed Castagnoli polynomial
+constexpr UInt32 CRC32C_POLY = 0x82f63b78;
+
+/// Tables of slicing-by-8, table[k][b] is the CRC of byte b followed by k zero bytes.
+struct CRC32CTables
+{
+    UInt32 table[8][256]{};
+
+    constexpr CRC32CTables()
+    {
+        for (UInt32 b = 0; b < 256; ++b)
+        {
+            UInt32 crc = b;
+            for (int bit = 0; bit < 8; ++bit)
+                crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+            table[0][b] = crc;
+        }
+        for (UInt32 b = 0; b < 256; ++b)
+            for (size_t k = 1; k < 8; ++k)
+                table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xff];
+    }
+};
+
+constexpr CRC32CTables CRC32C_TABLES;
+
+inline UInt64 loadUInt64(const char * p)
+{
+    UInt64 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/// Portable implementation, 'crc' is neither pre nor post inverted.
+UInt32 updateCRC32CSoftware(UInt32 crc, const char * data, size_t length)
+{
+    const auto & t = CRC32C_TABLES.table;
+    const auto * p = reinterpret_cast<const unsigned char *>(data);
+
+    while (length >= 8)
+    {
+        UInt64 word = loadUInt64(reinterpret_cast<const char *>(p)) ^ crc;
+        crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff] ^ t[5][(word >> 16) & 0xff] ^ t[4][(word >> 24) & 0xff]
+            ^ t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff] ^ t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+        p += 8;
+        length -= 8;
+    }
+    while (length--)
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+
+/// Bytes of each of the three streams computed in parallel, the sse4.2 crc32 instruction has latency 3
+/// and throughput 1, so interleaving three streams keeps it busy.
+constexpr size_t LONG_BLOCK = 8192;
+constexpr size_t SHORT_BLOCK = 256;
+
+/// a * b mod P in bit reflected form.
+constexpr UInt32 multModP(UInt32 a, UInt32 b)
+{
+    UInt32 product = 0;
+    for (UInt32 m = 1U << 31; m; m >>= 1)
+    {
+        if (a & m)
+            product ^= b;
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return product;
+}
+
+/// x^n mod P in bit reflected form.
+constexpr UInt32 xPowModP(size_t n)
+{
+    UInt32 result = 1U << 31;
+    UInt32 square = 1U << 30; /// x^1
+    for (; n; n >>= 1)
+    {
+        if (n & 1)
+            result = multModP(result, square);
+        square = multModP(square, square);
+    }
+    return result;
+}
+
+/// Constants to shift a crc over 'block' zero bytes with one carry-less multiplication, 33 bits are
+/// subtracted for the reflected product and the x^32 multiplied by crc32 instruction.
+struct ShiftConstants
+{
+    UInt64 long_one = xPowModP(LONG_BLOCK * 8 - 33);
+    UInt64 long_two = xPowModP(LONG_BLOCK * 2 * 8 - 33);
+    UInt64 short_one = xPowModP(SHORT_BLOCK * 8 - 33);
+    UInt64 short_two = xPowModP(SHORT_BLOCK * 2 * 8 - 33);
+};
+
+constexpr ShiftConstants SHIFT_CONSTANTS;
+
+__attribute__((target("sse4.2,pclmul"))) inline UInt32 shiftCRC32C(UInt32 crc, UInt64 constant)
+{
+    __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128(static_cast<int>(crc)), _mm_cvtsi64_si128(static_cast<Int64>(constant)), 0);
+    return static_cast<UInt32>(_mm_crc32_u64(0, static_cast<UInt64>(_mm_cvtsi128_si64(product))));
+}
+
+template <size_t block>
+__attribute__((target("sse4.2,pclmul"))) inline UInt32
+updateCRC32CBlocks(UInt32 crc, const char *& data, size_t & length, UInt64 shift_one, UInt64 shift_two)
+{
+    UInt64 crc0 = crc;
+    while (length >= 3 * block)
+    {
+        UInt64 crc1 = 0;
+        UInt64 crc2 = 0;
+        for (size_t i = 0; i < block; i += 8)
+        {
+            crc0 = _mm_crc32_u64(crc0, loadUInt64(data + i));
+            crc1 = _mm_crc32_u64(crc1, loadUInt64(data + block + i));
+            crc2 = _mm_crc32_u64(crc2, loadUInt64(data + 2 * block + i));
+        }
+        crc0 = shiftCRC32C(static_cast<UInt32>(crc0), shift_two) ^ shiftCRC32C(static_cast<UInt32>(crc1), shift_one) ^ crc2;
+        data += 3 * block;
+        length -= 3 * block;
+    }
+    return static_cast<UInt32>(crc0);
+}
+
+__attribute__((target("sse4.2,pclmul"))) UInt32 updateCRC32CHardware(UInt32 crc, const char * data, size_t length)
+{
+    crc = updateCRC32CBlocks<LONG_BLOCK>(crc, data, length, SHIFT_CONSTANTS.long_one, SHIFT_CONSTANTS.long_two);
+    crc = updateCRC32CBlocks<SHORT_BLOCK>(crc, data, length, SHIFT_CONSTANTS.short_one, SHIFT_CONSTANTS.short_two);
+
+    UInt64 crc64 = crc;
+    for (; length >= 8; data += 8, length -= 8)
+        crc64 = _mm_crc32_u64(crc64, loadUInt64(data));
+    crc = static_cast<UInt32>(crc64);
+    for (; length; ++data, --length)
+        crc = _mm_crc32_u8(crc, static_cast<unsigned char>(*data));
+    return crc;
+}
+
+bool hasHardwareCRC32C()
+{
+    /// May be invoked before constructors of libgcc.
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul");
+}
+
+#elif defined(__aarch64__) && defined(__linux__)
+
+__attribute__((target("+crc"))) UInt32 updateCRC32CHardware(UInt32 crc, const char * data, size_t length)
+{
+    for (; length >= 8; data += 8, length -= 8)
+        crc = __crc32cd(crc, loadUInt64(data));
+    for (; length; ++data, --length)
+        crc = __crc32cb(crc, static_cast<unsigned char>(*data));
+    return crc;
+}
+
+bool hasHardwareCRC32C()
+{
+    return getauxval(AT_HWCAP) & HWCAP_CRC32;
+}
+
+#else
+
+UInt32 updateCRC32CHardware(UInt32 crc, const char * data, size_t length)
+{
+    return updateCRC32CSoftware(crc, data, length);
+}
+
+bool hasHardwareCRC32C()
+{
+    return false;
+}
+
+#endif
+
+using UpdateCRC32C = UInt32 (*)(UInt32, const char *, size_t);
+
+/// Chosen once by the CPU we are running on.
+UpdateCRC32C getUpdateCRC32C()
+{
+    static const UpdateCRC32C update_crc32c = hasHardwareCRC32C() ? updateCRC32CHardware : updateCRC32CSoftware;
+    return update_crc32c;
+}
+
+}
+
+UInt32 getCRC32C(const char * data, size_t length)
+{
+    return ~getUpdateCRC32C()(~0U, data, length);
+}
+
+bool verifyCRC32C(const char * data, size_t len, uint32_t value)
+{
+    return value == getCRC32C(data, len);
+}
+
+UInt32 getCRC32CSoftware(const char * data, size_t length)
+{
+    return ~updateCRC32CSoftware(~0U, data, length);
+}
+
+bool isHardwareCRC32C()
+{
+    return getUpdateCRC32C() != updateCRC32CSoftware;
+}
+
 }
@@ -8,4 +8,16 @@ UInt32 getCRC32(const char * data, size_t length);
 
 bool verifyCRC32(const char * data, size_t len, uint32_t value);
 
+/// CRC32C (Castagnoli), computed with sse4.2 and pclmul on x86 or crc instructions on ARMv8 if
+/// the CPU supports them, otherwise with slicing-by-8 tables. Much faster than getCRC32.
+UInt32 getCRC32C(const char * data, size_t length);
+
+bool verifyCRC32C(const char * data, size_t len, uint32_t value);
+
+/// Portable implementation of getCRC32C, for testing.
+UInt32 getCRC32CSoftware(const char * data, size_t length);
+
+/// Whether getCRC32C is accelerated by CPU instructions.
+bool isHardwareCRC32C();
+
 }
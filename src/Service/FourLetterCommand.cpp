@@ -111,6 +111,9 @@ void FourLetterCommandFactory::registerCommands(KeeperDispatcher & keeper_dispat
         FourLetterCommandPtr data_size_command = std::make_shared<DataSizeCommand>(keeper_dispatcher);
         factory.registerCommand(data_size_command);
 
+        FourLetterCommandPtr prefix_memory_command = std::make_shared<PrefixMemoryCommand>(keeper_dispatcher);
+        factory.registerCommand(prefix_memory_command);
+
         FourLetterCommandPtr dump_command = std::make_shared<DumpCommand>(keeper_dispatcher);
         factory.registerCommand(dump_command);
 
@@ -281,6 +284,8 @@ String MonitorCommand::run()
     print(ret, "ephemerals_count", state_machine.getTotalEphemeralNodesCount());
     print(ret, "approximate_data_size", state_machine.getApproximateDataSize());
     print(ret, "in_snapshot", state_machine.isCreatingSnapshot());
+    print(ret, "log_cache_hits", keeper_info.log_cache_hits);
+    print(ret, "log_cache_misses", keeper_info.log_cache_misses);
 
 #if defined(__linux__) || defined(__APPLE__)
     print(ret, "open_file_descriptor_count", getCurrentProcessFDCount());
@@ -433,6 +438,13 @@ String DataSizeCommand::run()
     return buf.str();
 }
 
+String PrefixMemoryCommand::run()
+{
+    StringBuffer buf;
+    keeper_dispatcher.getStateMachine().dumpMemoryUsageByPrefix(buf);
+    return buf.str();
+}
+
 String DumpCommand::run()
 {
     StringBuffer buf;
@@ -506,6 +518,8 @@ String LogInfoCommand::run()
     append("leader_committed_log_idx", log_info.leader_committed_log_idx);
     append("target_committed_log_idx", log_info.target_committed_log_idx);
     append("last_snapshot_idx", log_info.last_snapshot_idx);
+    append("removing_log_segments", log_info.removing_log_segments);
+    append("removing_log_bytes", log_info.removing_log_bytes);
     return ret.str();
 }
 
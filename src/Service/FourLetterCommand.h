@@ -288,6 +288,19 @@ struct DataSizeCommand : public IFourLetterCommand
     ~DataSizeCommand() override = default;
 };
 
+/// Shows memory usage of data tree aggregated by path prefixes, used to find which prefix takes up the most memory.
+struct PrefixMemoryCommand : public IFourLetterCommand
+{
+    explicit PrefixMemoryCommand(KeeperDispatcher & keeper_dispatcher_)
+        : IFourLetterCommand(keeper_dispatcher_)
+    {
+    }
+
+    String name() override { return "pmem"; }
+    String run() override;
+    ~PrefixMemoryCommand() override = default;
+};
+
 /// Tests if server is running in read-only mode.
 /// The server will respond with "ro" if in read-only mode or "rw" if not in read-only mode.
 struct IsReadOnlyCommand : public IFourLetterCommand
@@ -0,0 +1,425 @@
+#include <Service/IOUringLogWriter.h>
+
+#include <cstring>
+
+#if defined(OS_LINUX)
+#    include <linux/io_uring.h>
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#endif
+
+#include <Common/Exception.h>
+
+
+namespace RK
+{
+
+namespace ErrorCodes
+{
+    extern const int CANNOT_WRITE_TO_FILE_DESCRIPTOR;
+    extern const int CANNOT_FSYNC;
+}
+
+#if defined(OS_LINUX)
+
+namespace
+{
+
+int ioUringSetup(unsigned entries, io_uring_params * params)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+/// Set when io_uring_setup failed, so that it is not tried for every segment.
+std::atomic<bool> io_uring_unavailable{false};
+
+}
+
+struct IOUringLogWriter::Ring
+{
+    int fd = -1;
+
+    void * sq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0;
+    void * cq_ring = MAP_FAILED;
+    size_t cq_ring_size = 0;
+    io_uring_sqe * sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    size_t sqes_size = 0;
+
+    unsigned * sq_head;
+    unsigned * sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned * sq_array;
+    unsigned * cq_head;
+    unsigned * cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe * cqes;
+
+    ~Ring()
+    {
+        if (sqes != MAP_FAILED)
+            ::munmap(sqes, sqes_size);
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+            ::munmap(cq_ring, cq_ring_size);
+        if (sq_ring != MAP_FAILED)
+            ::munmap(sq_ring, sq_ring_size);
+        if (fd != -1)
+            ::close(fd);
+    }
+
+    /// Return false and set errno if failed.
+    bool init(unsigned entries)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = ioUringSetup(entries, &params);
+        if (fd < 0)
+        {
+            fd = -1;
+            return false;
+        }
+
+        /// Completions are not dropped since Linux 5.5, and links are supported since 5.3.
+        if (!(params.features & IORING_FEAT_NODROP))
+        {
+            errno = ENOTSUP;
+            return false;
+        }
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+        sq_ring = ::mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED)
+            return false;
+
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            cq_ring = sq_ring;
+        else
+        {
+            cq_ring = ::mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cq_ring == MAP_FAILED)
+                return false;
+        }
+
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe *>(
+            ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED)
+            return false;
+
+        char * sq = static_cast<char *>(sq_ring);
+        sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_entries = params.sq_entries;
+        sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+        char * cq = static_cast<char *>(cq_ring);
+        cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    /// Entries queued by 'getSqe' are seen by kernel in the next io_uring_enter.
+    io_uring_sqe * getSqe()
+    {
+        unsigned tail = *sq_tail;
+        if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+            return nullptr;
+
+        io_uring_sqe * sqe = &sqes[tail & sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        sq_array[tail & sq_mask] = tail & sq_mask;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        return sqe;
+    }
+};
+
+std::unique_ptr<IOUringLogWriter> IOUringLogWriter::tryCreate(int fd, UInt64 written_size, const String & file_name)
+{
+    if (io_uring_unavailable.load(std::memory_order_relaxed))
+        return nullptr;
+
+    auto ring = std::make_unique<Ring>();
+    if (!ring->init(QUEUE_DEPTH))
+    {
+        int saved_errno = errno;
+        io_uring_unavailable = true;
+        LOG_WARNING(
+            &Poco::Logger::get("IOUringLogWriter"),
+            "io_uring is not available, log is written by pwritev, {}",
+            errnoToString(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, saved_errno));
+        return nullptr;
+    }
+
+    return std::unique_ptr<IOUringLogWriter>(new IOUringLogWriter(std::move(ring), fd, written_size, file_name));
+}
+
+IOUringLogWriter::IOUringLogWriter(std::unique_ptr<Ring> ring_, int fd_, UInt64 written_size_, const String & file_name_)
+    : ring(std::move(ring_)), fd(fd_), file_name(file_name_), written_size(written_size_), log(&Poco::Logger::get("IOUringLogWriter"))
+{
+    queued.reserve(ring->sq_entries);
+}
+
+IOUringLogWriter::~IOUringLogWriter()
+{
+    /// Buffers must not be freed while kernel is writing them.
+    try
+    {
+        std::unique_lock lock(mutex);
+        waitUntil(lock, [this] { return pending_writes.empty() && synced_id == next_sync_id; });
+    }
+    catch (...)
+    {
+        tryLogCurrentException(log, fmt::format("Fail to wait for writes of log segment {}", file_name));
+    }
+}
+
+void * IOUringLogWriter::queueEntry(std::unique_lock<std::mutex> & lock, UInt64 user_data)
+{
+    io_uring_sqe * sqe = ring->getSqe();
+    if (!sqe)
+    {
+        submitLocked();
+        sqe = ring->getSqe();
+        if (!sqe)
+        {
+            /// Kernel has not consumed submission queue, wait for completions and try again.
+            waitUntil(lock, [&] { return (sqe = ring->getSqe()) != nullptr; });
+        }
+    }
+    sqe->user_data = user_data;
+    queued.push_back({user_data, sqe});
+    return sqe;
+}
+
+void IOUringLogWriter::write(UInt64 offset, const LogEntryHeader & header, nuraft::ptr<nuraft::buffer> data)
+{
+    std::unique_lock lock(mutex);
+    throwIfFailed();
+
+    if (!reaping)
+        reapLocked();
+    if (pending_writes.size() >= QUEUE_DEPTH)
+        waitUntil(lock, [this] { return pending_writes.size() < QUEUE_DEPTH; });
+
+    /// Completions may be reaped while waiting for a free entry, so the write is added after it.
+    auto * sqe = static_cast<io_uring_sqe *>(queueEntry(lock, next_write_id));
+
+    auto & write = pending_writes.emplace_back();
+    write.header = header;
+    write.data = std::move(data);
+    write.vec[0].iov_base = &write.header;
+    write.vec[0].iov_len = LogEntryHeader::HEADER_SIZE;
+    write.vec[1].iov_base = write.data->data_begin();
+    write.vec[1].iov_len = header.data_length;
+    write.end = offset + LogEntryHeader::HEADER_SIZE + header.data_length;
+
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast<UInt64>(write.vec);
+    sqe->len = 2;
+    ++next_write_id;
+}
+
+void IOUringLogWriter::submit()
+{
+    std::lock_guard lock(mutex);
+    throwIfFailed();
+    submitLocked();
+}
+
+void IOUringLogWriter::submitLocked()
+{
+    size_t submitted = 0;
+    while (submitted < queued.size())
+    {
+        int ret = ioUringEnter(ring->fd, static_cast<unsigned>(queued.size() - submitted), 0, 0);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            /// Queue is full of completions, submit after they are reaped.
+            if ((errno == EBUSY || errno == EAGAIN) && submitted != 0)
+                break;
+            throwFromErrno(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, "Fail to submit writes of log segment {}", file_name);
+        }
+        for (size_t i = submitted; i < submitted + ret; ++i)
+            if (!(queued[i].user_data & SYNC_FLAG))
+                submitted_write_id = queued[i].user_data + 1;
+        submitted += ret;
+    }
+    queued.erase(queued.begin(), queued.begin() + submitted);
+}
+
+void IOUringLogWriter::reapLocked()
+{
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head)
+    {
+        const io_uring_cqe & cqe = ring->cqes[head & ring->cq_mask];
+        if (cqe.user_data & SYNC_FLAG)
+        {
+            if (cqe.res < 0 && !error_code)
+            {
+                error_code = ErrorCodes::CANNOT_FSYNC;
+                error = fmt::format("Fail to flush log segment {}, {}", file_name, errnoToString(error_code, -cqe.res));
+            }
+            synced_id = std::max<UInt64>(synced_id, (cqe.user_data & ~SYNC_FLAG) + 1);
+            continue;
+        }
+
+        auto & write = pending_writes[cqe.user_data - (next_write_id - pending_writes.size())];
+        if (cqe.res != static_cast<int>(write.vec[0].iov_len + write.vec[1].iov_len) && !error_code)
+        {
+            error_code = ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR;
+            error = cqe.res < 0 ? fmt::format("Fail to append log entry to {}, {}", file_name, errnoToString(error_code, -cqe.res))
+                                : fmt::format("Fail to append log entry to {}, written {} bytes", file_name, cqe.res);
+        }
+        write.done = true;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    /// A failed write leaves a hole in file, file is not written after it.
+    while (!pending_writes.empty() && pending_writes.front().done && !error_code)
+    {
+        written_size.store(pending_writes.front().end, std::memory_order_release);
+        pending_writes.pop_front();
+    }
+    if (error_code)
+    {
+        while (!pending_writes.empty() && pending_writes.front().done)
+            pending_writes.pop_front();
+    }
+}
+
+template <typename Done>
+void IOUringLogWriter::waitUntil(std::unique_lock<std::mutex> & lock, Done && done)
+{
+    while (!done())
+    {
+        submitLocked();
+
+        if (reaping)
+        {
+            cv.wait(lock);
+            continue;
+        }
+
+        /// Only this thread reaps completions until it returns, so the one it waits for is not taken by others.
+        reaping = true;
+        lock.unlock();
+        int ret = ioUringEnter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS);
+        int saved_errno = errno;
+        lock.lock();
+        reaping = false;
+
+        reapLocked();
+        cv.notify_all();
+
+        if (ret < 0 && saved_errno != EINTR)
+        {
+            errno = saved_errno;
+            throwFromErrno(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, "Fail to wait for writes of log segment {}", file_name);
+        }
+    }
+}
+
+void IOUringLogWriter::waitWritten(UInt64 size)
+{
+    if (writtenSize() >= size)
+        return;
+
+    std::unique_lock lock(mutex);
+    waitUntil(lock, [&] { return error_code || written_size.load(std::memory_order_relaxed) >= size; });
+    throwIfFailed();
+}
+
+void IOUringLogWriter::sync()
+{
+    std::unique_lock lock(mutex);
+    throwIfFailed();
+
+    /// Writes submitted before are not ordered before the fdatasync, wait for them.
+    UInt64 last_write_id = next_write_id;
+    waitUntil(
+        lock,
+        [&]
+        {
+            if (error_code)
+                return true;
+            UInt64 first_write_id = next_write_id - pending_writes.size();
+            UInt64 end = std::min(last_write_id, submitted_write_id);
+            for (UInt64 id = first_write_id; id < end; ++id)
+                if (!pending_writes[id - first_write_id].done)
+                    return false;
+            return true;
+        });
+    throwIfFailed();
+
+    /// Queued writes and the fdatasync are linked, they run in order, and the fdatasync fails if any of them fails.
+    for (auto & entry : queued)
+        static_cast<io_uring_sqe *>(entry.sqe)->flags |= IOSQE_IO_LINK;
+
+    UInt64 sync_id = next_sync_id++;
+    auto * sqe = static_cast<io_uring_sqe *>(queueEntry(lock, SYNC_FLAG | sync_id));
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+
+    waitUntil(lock, [&] { return error_code || synced_id > sync_id; });
+    throwIfFailed();
+}
+
+void IOUringLogWriter::throwIfFailed() const
+{
+    if (error_code)
+        throw Exception(error_code, error);
+}
+
+#else
+
+struct IOUringLogWriter::Ring
+{
+};
+
+std::unique_ptr<IOUringLogWriter> IOUringLogWriter::tryCreate(int, UInt64, const String &)
+{
+    return nullptr;
+}
+
+IOUringLogWriter::~IOUringLogWriter() = default;
+
+void IOUringLogWriter::write(UInt64, const LogEntryHeader &, nuraft::ptr<nuraft::buffer>)
+{
+}
+
+void IOUringLogWriter::submit()
+{
+}
+
+void IOUringLogWriter::waitWritten(UInt64)
+{
+}
+
+void IOUringLogWriter::sync()
+{
+}
+
+#endif
+
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sys/uio.h>
+
+#include <common/logger_useful.h>
+#include <libnuraft/nuraft.hxx>
+
+#include <Service/LogEntry.h>
+
+
+namespace RK
+{
+
+/// Writes entries of an open log segment by io_uring, so that appending queues a write and returns at once.
+///
+/// Queued writes are submitted together by 'submit', usually at the end of an append batch, or when the queue is full.
+/// Syncing links an fdatasync after the writes not submitted yet, so that a batch of writes and its sync cost one
+/// io_uring_enter, and writes submitted before are waited for first. An entry can be read from file only after its
+/// write completes, see 'waitWritten'.
+///
+/// io_uring is set up by raw io_uring_setup and io_uring_enter syscalls, liburing is not needed. It requires Linux 5.5,
+/// if it is not available, for example forbidden by seccomp, 'tryCreate' returns null and entries are written by pwritev.
+///
+/// Thread safe. A failed write or sync fails all following operations.
+class IOUringLogWriter
+{
+public:
+    /// Entries in submission queue, it also bounds writes not completed.
+    static constexpr unsigned QUEUE_DEPTH = 256;
+
+    /// 'written_size' is the file size already written.
+    static std::unique_ptr<IOUringLogWriter> tryCreate(int fd, UInt64 written_size, const String & file_name);
+
+    ~IOUringLogWriter();
+
+    /// Queue writing an entry at offset, which must be the end of the last queued entry. 'data' is kept until written.
+    void write(UInt64 offset, const LogEntryHeader & header, nuraft::ptr<nuraft::buffer> data);
+
+    /// Submit queued writes without waiting for them.
+    void submit();
+
+    /// Wait until file is written up to 'size'.
+    void waitWritten(UInt64 size);
+    UInt64 writtenSize() const { return written_size.load(std::memory_order_acquire); }
+
+    /// fdatasync after all writes queued before.
+    void sync();
+
+private:
+    struct Ring;
+
+    struct PendingWrite
+    {
+        UInt64 end;
+        LogEntryHeader header;
+        nuraft::ptr<nuraft::buffer> data;
+        struct iovec vec[2];
+        bool done = false;
+    };
+
+    /// Not submitted entry of submission queue.
+    struct QueuedEntry
+    {
+        UInt64 user_data;
+        void * sqe;
+    };
+
+    IOUringLogWriter(std::unique_ptr<Ring> ring_, int fd_, UInt64 written_size_, const String & file_name_);
+
+    /// Append an entry to submission queue, submit queued ones if it is full.
+    void * queueEntry(std::unique_lock<std::mutex> & lock, UInt64 user_data);
+    void submitLocked();
+
+    /// Handle all completions, must not be invoked while another thread is waiting for completions.
+    void reapLocked();
+
+    /// Submit queued entries and wait for completions until 'done' returns true.
+    template <typename Done>
+    void waitUntil(std::unique_lock<std::mutex> & lock, Done && done);
+
+    void throwIfFailed() const;
+
+    /// Highest bit of user data marks a sync, others are ids of writes or syncs.
+    static constexpr UInt64 SYNC_FLAG = UInt64(1) << 63;
+
+    std::unique_ptr<Ring> ring;
+    const int fd;
+    const String file_name;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    /// Whether a thread is waiting for completions in io_uring_enter, it is the only one to reap them.
+    bool reaping = false;
+
+    std::vector<QueuedEntry> queued;
+
+    /// Writes not completed or completed out of order, the front one has id 'next_write_id - pending_writes.size()'.
+    std::deque<PendingWrite> pending_writes;
+    UInt64 next_write_id = 0;
+    /// Writes with less id are submitted.
+    UInt64 submitted_write_id = 0;
+    std::atomic<UInt64> written_size;
+
+    UInt64 next_sync_id = 0;
+    UInt64 synced_id = 0;
+
+    int error_code = 0;
+    String error;
+
+    Poco::Logger * log;
+};
+
+}
@@ -31,6 +31,10 @@ struct Keeper4LWInfo
     uint64_t total_nodes_count;
     int64_t last_zxid;
 
+    /// Reads of recent logs served by memory cache and by log segments.
+    uint64_t log_cache_hits;
+    uint64_t log_cache_misses;
+
     String getRole() const
     {
         if (is_standalone)
@@ -72,6 +76,10 @@ struct KeeperLogInfo
 
     /// The largest committed log index in last snapshot.
     uint64_t last_snapshot_idx;
+
+    /// Log segments removed by compaction but whose files are not deleted yet, and their bytes.
+    uint64_t removing_log_segments = 0;
+    uint64_t removing_log_bytes = 0;
 };
 
 
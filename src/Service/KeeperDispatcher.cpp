@@ -193,6 +193,14 @@ bool KeeperDispatcher::pushRequest(const Coordination::ZooKeeperRequestPtr & req
             return false;
     }
 
+    /// Limit is applied here rather than when processing, so that all replicas remove the same nodes even if they are configured differently.
+    if (request->getOpNum() == Coordination::OpNum::RemoveRecursive)
+    {
+        auto & remove_request = dynamic_cast<Coordination::ZooKeeperRemoveRecursiveRequest &>(*request);
+        remove_request.remove_nodes_limit = static_cast<uint32_t>(
+            std::min<UInt64>(remove_request.remove_nodes_limit, configuration_and_settings->raft_settings->max_remove_recursive_nodes));
+    }
+
     RequestForSession request_info;
     request_info.request = request;
     request_info.session_id = session_id;
@@ -643,6 +651,9 @@ Keeper4LWInfo KeeperDispatcher::getKeeper4LWInfo()
     }
     result.total_nodes_count = server->getKeeperStateMachine()->getNodesCount();
     result.last_zxid = server->getKeeperStateMachine()->getLastProcessedZxid();
+    auto [log_cache_hits, log_cache_misses] = server->getLogCacheStats();
+    result.log_cache_hits = log_cache_hits;
+    result.log_cache_misses = log_cache_misses;
     return result;
 }
 
@@ -0,0 +1,461 @@
+#include <algorithm>
+#include <cstring>
+
+#include <Service/KeeperNodeChildren.h>
+#include <ZooKeeper/ZooKeeperIO.h>
+#include <Common/IO/WriteBufferFromString.h>
+
+namespace RK
+{
+
+KeeperNodeChildren::KeeperNodeChildren(std::initializer_list<std::string_view> names)
+{
+    for (const auto & name : names)
+        insert(name);
+}
+
+KeeperNodeChildren::KeeperNodeChildren(const KeeperNodeChildren & other)
+{
+    if (other.data)
+        data = std::make_unique<Data>(*other.data);
+}
+
+KeeperNodeChildren & KeeperNodeChildren::operator=(const KeeperNodeChildren & other)
+{
+    if (this != &other)
+        data = other.data ? std::make_unique<Data>(*other.data) : nullptr;
+    return *this;
+}
+
+std::string_view KeeperNodeChildren::nameAtOffset(Offset offset) const
+{
+    Offset size;
+    memcpy(&size, data->buffer.data() + offset, sizeof(Offset));
+    return {data->buffer.data() + offset + sizeof(Offset), size & ~ERASED_FLAG};
+}
+
+bool KeeperNodeChildren::isErased(Offset offset) const
+{
+    Offset size;
+    memcpy(&size, data->buffer.data() + offset, sizeof(Offset));
+    return size & ERASED_FLAG;
+}
+
+size_t KeeperNodeChildren::find(std::string_view name, size_t * slot) const
+{
+    if (!data)
+        return npos;
+
+    if (data->table.empty())
+    {
+        for (size_t pos = 0; pos < data->index.size(); ++pos)
+            if (nameAtOffset(data->index[pos]) == name)
+                return pos;
+        return npos;
+    }
+
+    size_t mask = data->table.size() - 1;
+    for (size_t i = hashName(name) & mask; data->table[i]; i = (i + 1) & mask)
+    {
+        size_t pos = data->table[i] - 1;
+        if (nameAtOffset(data->index[pos]) == name)
+        {
+            if (slot)
+                *slot = i;
+            return pos;
+        }
+    }
+    return npos;
+}
+
+KeeperNodeChildren::Offset KeeperNodeChildren::appendToBuffer(std::string_view name)
+{
+    if (!data)
+        data = std::make_unique<Data>();
+
+    auto offset = static_cast<Offset>(data->buffer.size());
+    auto size = static_cast<Offset>(name.size());
+    data->buffer.append(reinterpret_cast<const char *>(&size), sizeof(Offset));
+    data->buffer.append(name);
+    return offset;
+}
+
+void KeeperNodeChildren::addToIndex(Offset offset)
+{
+    data->index.push_back(offset);
+
+    size_t count = data->index.size();
+    if (data->table.empty())
+    {
+        if (count > HASH_TABLE_MIN_NAMES)
+            rebuildTable(HASH_TABLE_MIN_NAMES * 4);
+        return;
+    }
+
+    /// Keep load factor not more than 1/2
+    if (count * 2 > data->table.size())
+    {
+        rebuildTable(data->table.size() * 2);
+        return;
+    }
+
+    size_t mask = data->table.size() - 1;
+    size_t i = hashName(nameAtOffset(offset)) & mask;
+    while (data->table[i])
+        i = (i + 1) & mask;
+    data->table[i] = static_cast<UInt32>(count);
+}
+
+void KeeperNodeChildren::rebuildTable(size_t table_size)
+{
+    data->table.assign(table_size, 0);
+    size_t mask = table_size - 1;
+    for (size_t pos = 0; pos < data->index.size(); ++pos)
+    {
+        size_t i = hashName(nameAtOffset(data->index[pos])) & mask;
+        while (data->table[i])
+            i = (i + 1) & mask;
+        data->table[i] = static_cast<UInt32>(pos + 1);
+    }
+}
+
+void KeeperNodeChildren::eraseSlot(size_t slot)
+{
+    /// Backward shift deletion, so that there is no tombstone.
+    auto & table = data->table;
+    size_t mask = table.size() - 1;
+    size_t i = slot;
+    size_t j = slot;
+    while (true)
+    {
+        table[i] = 0;
+        while (true)
+        {
+            j = (j + 1) & mask;
+            if (!table[j])
+                return;
+            size_t k = hashName(nameAtOffset(data->index[table[j] - 1])) & mask;
+            /// The entry at j can stay if its ideal slot k is cyclically in (i, j].
+            bool stay = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+            if (!stay)
+                break;
+        }
+        table[i] = table[j];
+        i = j;
+    }
+}
+
+bool KeeperNodeChildren::insert(std::string_view name)
+{
+    if (find(name) != npos)
+        return false;
+
+    if (isShared() && data->base->contains(name))
+    {
+        /// Inserted again after erased from base.
+        if (!data->base_erased || !data->base_erased->erase(name))
+            return false;
+        invalidateCache();
+        return true;
+    }
+
+    Offset offset = appendToBuffer(name);
+    addToIndex(offset);
+    invalidateCache();
+    return true;
+}
+
+size_t KeeperNodeChildren::erase(std::string_view name)
+{
+    size_t slot = npos;
+    size_t pos = find(name, &slot);
+    if (pos == npos)
+    {
+        if (!inBase(name))
+            return 0;
+        if (!data->base_erased)
+            data->base_erased = std::make_unique<KeeperNodeChildren>();
+        data->base_erased->insert(name);
+        invalidateCache();
+        return 1;
+    }
+
+    if (data->index.size() == 1 && !data->base)
+    {
+        data.reset();
+        return 1;
+    }
+
+    Offset offset = data->index[pos];
+    Offset size = static_cast<Offset>(name.size()) | ERASED_FLAG;
+    memcpy(data->buffer.data() + offset, &size, sizeof(Offset));
+    data->garbage_bytes += sizeof(Offset) + name.size();
+
+    /// Move the last name to the erased position.
+    size_t last = data->index.size() - 1;
+    if (!data->table.empty())
+    {
+        eraseSlot(slot);
+        if (pos != last)
+        {
+            size_t last_slot = npos;
+            find(nameAtOffset(data->index[last]), &last_slot);
+            data->table[last_slot] = static_cast<UInt32>(pos + 1);
+        }
+    }
+    data->index[pos] = data->index[last];
+    data->index.pop_back();
+
+    size_t count = data->index.size();
+    if (!data->table.empty())
+    {
+        if (count <= HASH_TABLE_MIN_NAMES / 2)
+            std::vector<UInt32>().swap(data->table);
+        else if (count * 8 < data->table.size())
+            rebuildTable(data->table.size() / 2);
+    }
+
+    compactIfNeeded();
+    invalidateCache();
+    return 1;
+}
+
+bool KeeperNodeChildren::contains(std::string_view name) const
+{
+    return find(name) != npos || inBase(name);
+}
+
+bool KeeperNodeChildren::inBase(std::string_view name) const
+{
+    return isShared() && data->base->contains(name) && !(data->base_erased && data->base_erased->contains(name));
+}
+
+void KeeperNodeChildren::share(std::shared_ptr<KeeperNodeChildren> base)
+{
+    data.reset();
+    if (base->empty())
+        return;
+    data = std::make_unique<Data>();
+    data->base = std::move(base);
+}
+
+void KeeperNodeChildren::unshare()
+{
+    if (!isShared())
+        return;
+
+    KeeperNodeChildren children;
+    if (data->base.use_count() == 1)
+        children = std::move(*data->base);
+    else
+        children = *data->base;
+    data->base.reset();
+
+    if (data->base_erased)
+        for (auto name : *data->base_erased)
+            children.erase(name);
+    for (auto offset : data->index)
+        children.insert(nameAtOffset(offset));
+
+    *this = std::move(children);
+}
+
+void KeeperNodeChildren::append(std::string_view name)
+{
+    Offset offset = appendToBuffer(name);
+    data->index.push_back(offset);
+    data->indexed = false;
+    invalidateCache();
+}
+
+void KeeperNodeChildren::buildIndex()
+{
+    if (!data || data->indexed)
+        return;
+
+    std::vector<Offset> appended;
+    appended.swap(data->index);
+    data->index.reserve(appended.size());
+    std::vector<UInt32>().swap(data->table);
+
+    for (auto offset : appended)
+    {
+        auto name = nameAtOffset(offset);
+        /// Duplicated names are treated as erased.
+        if (find(name) != npos)
+        {
+            Offset size = static_cast<Offset>(name.size()) | ERASED_FLAG;
+            memcpy(data->buffer.data() + offset, &size, sizeof(Offset));
+            data->garbage_bytes += sizeof(Offset) + name.size();
+            continue;
+        }
+        addToIndex(offset);
+    }
+
+    data->indexed = true;
+    compactIfNeeded();
+}
+
+void KeeperNodeChildren::compactIfNeeded()
+{
+    /// Too small to be worth compacting.
+    if (data->garbage_bytes < 4096 || data->garbage_bytes * 2 < data->buffer.size())
+        return;
+
+    String buffer;
+    buffer.reserve(data->buffer.size() - data->garbage_bytes);
+    for (auto & offset : data->index)
+    {
+        auto name = nameAtOffset(offset);
+        auto new_offset = static_cast<Offset>(buffer.size());
+        buffer.append(data->buffer.data() + offset, sizeof(Offset) + name.size());
+        offset = new_offset;
+    }
+
+    data->buffer.swap(buffer);
+    data->garbage_bytes = 0;
+    data->index.shrink_to_fit();
+
+    /// Offsets in sorted order are stale.
+    std::lock_guard lock(data->cache_mutex);
+    data->sorted.reset();
+    data->sorted_buffer_size = 0;
+    data->merged.reset();
+}
+
+void KeeperNodeChildren::invalidateCache()
+{
+    std::lock_guard lock(data->cache_mutex);
+    data->sorted_valid = false;
+    data->serialized.reset();
+    data->merged.reset();
+}
+
+std::shared_ptr<const KeeperNodeChildren::Order> KeeperNodeChildren::sortedOrder() const
+{
+    if (!data)
+    {
+        static const auto empty = std::make_shared<const Order>();
+        return empty;
+    }
+
+    std::lock_guard lock(data->cache_mutex);
+    if (data->sorted && data->sorted_valid)
+        return data->sorted;
+
+    auto less = [this](Offset lhs, Offset rhs) { return nameAtOffset(lhs) < nameAtOffset(rhs); };
+
+    /// Only names appended since the last sort are sorted, then they are merged into the former order.
+    Order appended;
+    for (auto offset : data->index)
+        if (offset >= data->sorted_buffer_size)
+            appended.push_back(offset);
+    std::sort(appended.begin(), appended.end(), less);
+
+    auto order = std::make_shared<Order>();
+    order->reserve(data->index.size());
+    if (data->sorted)
+    {
+        Order former;
+        former.reserve(data->sorted->size());
+        for (auto offset : *data->sorted)
+            if (!isErased(offset))
+                former.push_back(offset);
+        std::merge(former.begin(), former.end(), appended.begin(), appended.end(), std::back_inserter(*order), less);
+    }
+    else
+    {
+        order->swap(appended);
+    }
+
+    data->sorted = order;
+    data->sorted_buffer_size = data->buffer.size();
+    data->sorted_valid = true;
+    return order;
+}
+
+std::shared_ptr<const KeeperNodeChildren::Names> KeeperNodeChildren::mergedNames() const
+{
+    {
+        std::lock_guard lock(data->cache_mutex);
+        if (data->merged)
+            return data->merged;
+    }
+
+    auto order = sortedOrder();
+    auto names = std::make_shared<Names>();
+    names->reserve(size());
+    auto own = order->begin();
+    for (auto name : *data->base)
+    {
+        if (data->base_erased && data->base_erased->contains(name))
+            continue;
+        for (; own != order->end() && nameAtOffset(*own) < name; ++own)
+            names->push_back(nameAtOffset(*own));
+        names->push_back(name);
+    }
+    for (; own != order->end(); ++own)
+        names->push_back(nameAtOffset(*own));
+
+    std::lock_guard lock(data->cache_mutex);
+    data->merged = names;
+    return names;
+}
+
+std::shared_ptr<const String> KeeperNodeChildren::getSerialized() const
+{
+    auto serialize = [this]()
+    {
+        WriteBufferFromOwnString out;
+        Coordination::write(static_cast<int32_t>(size()), out);
+        for (auto name : *this)
+        {
+            Coordination::write(static_cast<int32_t>(name.size()), out);
+            out.write(name.data(), name.size());
+        }
+        return std::make_shared<const String>(std::move(out.str()));
+    };
+
+    if (!data)
+    {
+        static const auto empty = serialize();
+        return empty;
+    }
+
+    {
+        std::lock_guard lock(data->cache_mutex);
+        if (data->serialized)
+            return data->serialized;
+    }
+
+    /// Serialize out of lock, concurrent readers may serialize the same children, it does not matter.
+    auto serialized = serialize();
+    std::lock_guard lock(data->cache_mutex);
+    data->serialized = serialized;
+    return serialized;
+}
+
+size_t KeeperNodeChildren::allocatedBytes() const
+{
+    if (!data)
+        return 0;
+    size_t bytes = sizeof(Data) + data->buffer.capacity() + data->index.capacity() * sizeof(Offset)
+        + data->table.capacity() * sizeof(UInt32);
+    std::lock_guard lock(data->cache_mutex);
+    if (data->sorted)
+        bytes += data->sorted->capacity() * sizeof(Offset);
+    if (data->merged)
+        bytes += data->merged->capacity() * sizeof(std::string_view);
+    if (data->base_erased)
+        bytes += data->base_erased->allocatedBytes();
+    return bytes;
+}
+
+bool KeeperNodeChildren::operator==(const KeeperNodeChildren & rhs) const
+{
+    if (size() != rhs.size())
+        return false;
+    return std::equal(begin(), end(), rhs.begin());
+}
+
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/// Children names of a data tree node.
+///
+/// Names are appended one after another to a contiguous buffer, their offsets are kept in an unordered
+/// index and a small open addressing hash table maps a name to its position in index. So creating or
+/// removing a child is O(1) regardless of the count of children, and a parent with 100k children costs a
+/// few allocations instead of 100k hash set entries. Erasing a name leaves a hole in the buffer, the buffer
+/// is compacted when holes take more than half of it. Leaf nodes, which are most of the data tree, allocate
+/// nothing, and parents with a few children do not build the hash table.
+///
+/// Names are sorted lazily when they are iterated or serialized. The sorted order is cached, and after
+/// modifications only the names appended since are sorted and merged into it. Children serialized in list
+/// response format are cached until the next modification, so repeated lists of an unchanged parent are
+/// one memcpy.
+///
+/// A copy made while the data tree is pinned for snapshot shares the children of the pinned node as an
+/// immutable base, see 'share', so that creating a child under a large parent does not copy all its names.
+///
+/// Modification happens in the request processor thread with the data tree bucket of the node locked exclusively,
+/// reading (including iterating and 'getSerialized') can be done in several threads with it locked shared.
+class KeeperNodeChildren
+{
+    using Offset = UInt32;
+    using Order = std::vector<Offset>;
+    using Names = std::vector<std::string_view>;
+
+public:
+    class Iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const std::string_view *;
+        using reference = std::string_view;
+
+        Iterator(const KeeperNodeChildren & children_, std::shared_ptr<const Order> order_, size_t pos_)
+            : children(&children_), order(std::move(order_)), pos(pos_)
+        {
+        }
+
+        explicit Iterator(std::shared_ptr<const Names> names_, size_t pos_) : names(std::move(names_)), pos(pos_) { }
+
+        std::string_view operator*() const { return names ? (*names)[pos] : children->nameAtOffset((*order)[pos]); }
+        Iterator & operator++()
+        {
+            ++pos;
+            return *this;
+        }
+        bool operator==(const Iterator & other) const { return pos == other.pos; }
+        bool operator!=(const Iterator & other) const { return pos != other.pos; }
+
+    private:
+        const KeeperNodeChildren * children = nullptr;
+        /// Sorted order the iterator walks, it is kept alive by the iterator.
+        std::shared_ptr<const Order> order;
+        /// Sorted names of children sharing a base, walked instead of order.
+        std::shared_ptr<const Names> names;
+        size_t pos;
+    };
+
+    using const_iterator = Iterator;
+    using value_type = std::string_view;
+
+    /// Approximate bytes taken by a name besides itself: its length prefix in buffer, its offset in index
+    /// and in sorted order, and its hash table slot which is about 2 offsets at the average load factor.
+    static constexpr size_t ENTRY_OVERHEAD_BYTES = 5 * sizeof(Offset);
+
+    KeeperNodeChildren() = default;
+    KeeperNodeChildren(std::initializer_list<std::string_view> names);
+
+    KeeperNodeChildren(const KeeperNodeChildren & other);
+    KeeperNodeChildren(KeeperNodeChildren && other) noexcept = default;
+    KeeperNodeChildren & operator=(const KeeperNodeChildren & other);
+    KeeperNodeChildren & operator=(KeeperNodeChildren && other) noexcept = default;
+
+    /// Return whether the name is inserted.
+    bool insert(std::string_view name);
+    bool emplace(std::string_view name) { return insert(name); }
+
+    /// Return count of erased names.
+    size_t erase(std::string_view name);
+
+    bool contains(std::string_view name) const;
+    size_t count(std::string_view name) const { return contains(name) ? 1 : 0; }
+
+    size_t size() const
+    {
+        if (!data)
+            return 0;
+        size_t count = data->index.size();
+        if (data->base)
+            count += data->base->size() - (data->base_erased ? data->base_erased->size() : 0);
+        return count;
+    }
+    bool empty() const { return size() == 0; }
+
+    void clear() { data.reset(); }
+
+    /// Iterate names in ascending order.
+    Iterator begin() const { return isShared() ? Iterator(mergedNames(), 0) : Iterator(*this, sortedOrder(), 0); }
+    Iterator end() const { return Iterator(*this, nullptr, size()); }
+
+    /// Append a name without looking it up, used to build data tree in bulk when loading snapshot.
+    /// 'buildIndex' must be invoked after all names are appended and before any other operation.
+    void append(std::string_view name);
+    void buildIndex();
+    bool isIndexed() const { return !data || data->indexed; }
+
+    /// Children serialized in the format of ZooKeeper list response, that is an int32 count followed by
+    /// ZooKeeper strings.
+    std::shared_ptr<const String> getSerialized() const;
+
+    /// Make these children the same as 'base' without copying it. 'base' must not be modified while it is
+    /// shared, names inserted or erased afterwards are kept aside of it until 'unshare'.
+    void share(std::shared_ptr<KeeperNodeChildren> base);
+    bool isShared() const { return data && data->base; }
+
+    /// Stop sharing the base. If nothing else shares it, names of the base are moved rather than copied, so
+    /// it must not be read any more, usually it is a node in the data tree which has been unpinned.
+    void unshare();
+
+    /// Bytes allocated for names, index, hash table and sorted order.
+    size_t allocatedBytes() const;
+
+    bool operator==(const KeeperNodeChildren & rhs) const;
+    bool operator!=(const KeeperNodeChildren & rhs) const { return !(*this == rhs); }
+
+private:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    /// Hash table is built when there are more names, a parent with fewer names is scanned.
+    static constexpr size_t HASH_TABLE_MIN_NAMES = 8;
+
+    /// The highest bit of length prefix marks an erased name.
+    static constexpr Offset ERASED_FLAG = Offset(1) << 31;
+
+    struct Data
+    {
+        Data() = default;
+        /// Caches are not copied.
+        Data(const Data & other)
+            : buffer(other.buffer)
+            , index(other.index)
+            , table(other.table)
+            , garbage_bytes(other.garbage_bytes)
+            , indexed(other.indexed)
+            , base(other.base)
+            , base_erased(other.base_erased ? std::make_unique<KeeperNodeChildren>(*other.base_erased) : nullptr)
+        {
+        }
+
+        /// Names, every name is prefixed with its length of type Offset.
+        String buffer;
+        /// Offsets of names in buffer, unordered.
+        std::vector<Offset> index;
+        /// Open addressing hash table with linear probing, a slot is 1 + position of a name in index, 0 means empty.
+        std::vector<UInt32> table;
+        /// Bytes of erased names in buffer.
+        size_t garbage_bytes = 0;
+        /// False if names are appended and index is not built.
+        bool indexed = true;
+
+        /// Shared children, names in it are children too unless they are in 'base_erased'. Names in buffer
+        /// are the ones inserted since, so they are never in base.
+        std::shared_ptr<KeeperNodeChildren> base;
+        std::unique_ptr<KeeperNodeChildren> base_erased;
+
+        /// Cached sorted order, it may contain names erased since, and names at or after 'sorted_buffer_size'
+        /// in buffer are not in it. Null if not cached.
+        mutable std::shared_ptr<const Order> sorted;
+        mutable size_t sorted_buffer_size = 0;
+        mutable bool sorted_valid = false;
+        /// Cached result of getSerialized, null if not cached.
+        mutable std::shared_ptr<const String> serialized;
+        /// Cached sorted names merged with base, null if not cached or there is no base.
+        mutable std::shared_ptr<const Names> merged;
+        mutable std::mutex cache_mutex;
+    };
+
+    std::string_view nameAtOffset(Offset offset) const;
+    bool isErased(Offset offset) const;
+
+    /// Whether the name is in base and not erased from it.
+    bool inBase(std::string_view name) const;
+
+    static size_t hashName(std::string_view name) { return std::hash<std::string_view>{}(name); }
+
+    /// Position of the name in index, npos if not found. 'slot' is set to its hash table slot if hash table is built.
+    size_t find(std::string_view name, size_t * slot = nullptr) const;
+
+    Offset appendToBuffer(std::string_view name);
+    /// Add a name which is not in children to index and hash table.
+    void addToIndex(Offset offset);
+    void rebuildTable(size_t table_size);
+    void eraseSlot(size_t slot);
+    void compactIfNeeded();
+    void invalidateCache();
+
+    /// Sorted order of names, built or merged if it is not valid.
+    std::shared_ptr<const Order> sortedOrder() const;
+    std::shared_ptr<const Names> mergedNames() const;
+
+    std::unique_ptr<Data> data;
+};
+
+}
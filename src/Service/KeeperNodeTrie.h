@@ -0,0 +1,534 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/smart_ptr/intrusive_ptr.hpp>
+
+#include <Service/KeeperPathComponents.h>
+#include <Service/KeeperUtils.h>
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/// KeeperNodeTrie is an alternative data tree engine to KeeperNodeMap.
+///
+/// Instead of keying every node by its full path, nodes are reached by walking path components
+/// from the root, so a common prefix like '/clickhouse/tables/01/table/replicas' is stored once
+/// for all its descendants. There is one trie for all buckets.
+///
+/// Names of inner trie nodes like 'replicas' or 'queue' repeat under many parents, they are interned in
+/// KeeperPathComponents and stored once. Names of leaves like 'queue-0000000123' are mostly unique, they
+/// are stored in the trie node if they are short, or in their own allocation. A leaf gets its name
+/// interned when it becomes an inner node and vice versa.
+///
+/// Children of a trie node are kept in a compact table of pointers, a dense array which is scanned for
+/// a few children and an open addressing hash table for more.
+///
+/// The public interface is the same as KeeperNodeMap, so it can be used as KeeperStore::DataTree.
+/// Keys must be absolute paths starting with '/'. Nodes are distributed into buckets by the hash of
+/// their parent path, a bucket is the list of trie nodes whose children are in it, so siblings are
+/// always in the same bucket.
+///
+/// It is not a thread-safe map. But it is accessed only in the request processor thread. When loading
+/// snapshot, 'emplace' with bucket id can be invoked by several threads for different buckets, and
+/// nothing else is invoked at the same time.
+template <typename Value, unsigned NumBuckets>
+class KeeperNodeTrie : private boost::noncopyable
+{
+    static_assert(NumBuckets <= std::numeric_limits<UInt16>::max());
+
+    struct TrieNode;
+
+public:
+    using Key = String;
+    using ValuePtr = boost::intrusive_ptr<Value>;
+
+    /// A bucket of the trie, nodes whose parent path has the same hash.
+    class InnerMap : private boost::noncopyable
+    {
+    public:
+        ValuePtr get(const String & key) { return trie->get(key); }
+
+        size_t size() const { return count; }
+
+        /// Paths are rebuilt from components when traversing.
+        template <typename F>
+        void forEach(F && fn)
+        {
+            String path = "/";
+            if (bucket_id == trie->root.bucket && trie->root.value)
+                fn(path, trie->root.value);
+
+            std::vector<std::string_view> names;
+            for (const auto * parent : parents)
+            {
+                names.clear();
+                for (const auto * node = parent; node != &trie->root; node = node->parent)
+                    names.push_back(node->name());
+
+                path.resize(1);
+                for (auto it = names.rbegin(); it != names.rend(); ++it)
+                {
+                    if (path.size() > 1)
+                        path.push_back('/');
+                    path.append(*it);
+                }
+
+                size_t prefix_size = path.size();
+                forEachChild(
+                    parent->children,
+                    [&](const TrieNode * child)
+                    {
+                        if (!child->value)
+                            return;
+                        if (prefix_size > 1)
+                            path.push_back('/');
+                        path.append(child->name());
+                        fn(path, child->value);
+                        path.resize(prefix_size);
+                    });
+            }
+        }
+
+    private:
+        friend class KeeperNodeTrie;
+
+        KeeperNodeTrie * trie = nullptr;
+        UInt32 bucket_id = 0;
+
+        /// Trie nodes whose children are in this bucket, a node knows its position by 'bucket_pos'.
+        std::vector<TrieNode *> parents;
+        /// Count of nodes holding value in this bucket.
+        size_t count = 0;
+        /// Protect 'parents' when loading snapshot in parallel.
+        std::mutex mutex;
+    };
+
+    KeeperNodeTrie()
+    {
+        for (UInt32 i = 0; i < NumBuckets; ++i)
+        {
+            buckets[i].trie = this;
+            buckets[i].bucket_id = i;
+        }
+        root.bucket = bucketOfChildren("/");
+    }
+
+    ~KeeperNodeTrie() { destroyChildren(root); }
+
+    ValuePtr get(const String & key)
+    {
+        const auto * node = find(key);
+        return node ? node->value : nullptr;
+    }
+
+    ValuePtr at(const String & key) { return get(key); }
+
+    /// Same semantic with unordered_map::insert_or_assign, return whether a new node is inserted.
+    template <typename T>
+    bool emplace(const String & key, T && value)
+    {
+        auto * node = findOrCreate<false>(key);
+        return node && assign(*node, std::forward<T>(value), node->parent ? node->parent->bucket : root.bucket);
+    }
+
+    /// Used to fill buckets in parallel, all nodes of a bucket must be emplaced by the same thread.
+    template <typename T>
+    bool emplace(const String & key, T && value, UInt32 bucket_id)
+    {
+        auto * node = findOrCreate<true>(key);
+        return node && assign(*node, std::forward<T>(value), bucket_id);
+    }
+
+    bool erase(const String & key)
+    {
+        auto * node = find(key);
+        if (!node || !node->value)
+            return false;
+
+        node->value.reset();
+        buckets[node->parent ? node->parent->bucket : root.bucket].count--;
+        node_count--;
+
+        /// Remove trie nodes which neither hold value nor lead to any value.
+        while (node != &root && !node->value && node->children.size == 0)
+        {
+            auto * parent = node->parent;
+            eraseChild(parent->children, node);
+            if (parent->children.size == 0)
+                removeParent(*parent);
+            destroyNode(node);
+            node = parent;
+        }
+
+        /// Became a leaf
+        if (node != &root && node->children.size == 0 && node->name_kind == NameKind::Interned)
+            setLeafName(*node, node->name(), true);
+        return true;
+    }
+
+    size_t count(const String & key) { return get(key) != nullptr ? 1 : 0; }
+
+    UInt32 getBucketIndex(const String & key)
+    {
+        auto pos = key.rfind('/');
+        return bucketOfChildren((pos == 0 || pos == String::npos) ? std::string_view("/") : std::string_view(key).substr(0, pos));
+    }
+
+    UInt32 getBucketNum() const { return NumBuckets; }
+
+    InnerMap & getMap(const UInt32 & bucket_id) { return buckets[bucket_id]; }
+
+    const KeeperPathComponents & getComponents() const { return components; }
+
+    void clear()
+    {
+        destroyChildren(root);
+        root.value.reset();
+        root.children = {};
+        for (auto & bucket : buckets)
+        {
+            bucket.parents.clear();
+            bucket.count = 0;
+        }
+        node_count.store(0);
+    }
+
+    size_t size() const
+    {
+        return node_count.load();
+    }
+
+private:
+    /// Names not longer than it are stored in trie node.
+    static constexpr size_t INLINE_NAME_SIZE = 16;
+    /// Children table is a dense array if its capacity is not larger than it.
+    static constexpr UInt32 DENSE_CHILDREN = 8;
+    static constexpr size_t TABLE_MUTEX_NUM = 64;
+
+    enum class NameKind : UInt8
+    {
+        Inline,
+        Owned,
+        Interned,
+    };
+
+    /// Dense array of 'size' children, or open addressing hash table with linear probing whose
+    /// capacity is power of 2 and empty slot is null.
+    struct ChildTable
+    {
+        TrieNode ** slots = nullptr;
+        UInt32 size = 0;
+        UInt32 capacity = 0;
+    };
+
+    struct TrieNode
+    {
+        TrieNode * parent = nullptr;
+        ValuePtr value;
+        ChildTable children;
+        /// Bucket of children, and position in parents of the bucket if there are children.
+        UInt32 bucket_pos = 0;
+        UInt16 bucket = 0;
+        NameKind name_kind = NameKind::Inline;
+        UInt32 name_size = 0;
+        union
+        {
+            char inline_name[INLINE_NAME_SIZE];
+            const char * external_name;
+        };
+
+        std::string_view name() const { return {name_kind == NameKind::Inline ? inline_name : external_name, name_size}; }
+    };
+
+    static size_t hashName(std::string_view name) { return std::hash<std::string_view>{}(name); }
+
+    UInt32 bucketOfChildren(std::string_view parent_path) const { return hash(parent_path) % NumBuckets; }
+
+    template <typename T>
+    bool assign(TrieNode & node, T && value, UInt32 bucket_id)
+    {
+        bool inserted = node.value == nullptr;
+        node.value = std::forward<T>(value);
+        if (inserted)
+        {
+            buckets[bucket_id].count++;
+            node_count++;
+        }
+        return inserted;
+    }
+
+    TrieNode * find(std::string_view path)
+    {
+        if (path.empty() || path[0] != '/')
+            return nullptr;
+
+        TrieNode * node = &root;
+        bool found = forEachPathComponent(
+            path,
+            [&node](std::string_view name)
+            {
+                node = findChild(node->children, name);
+                return node != nullptr;
+            });
+        return found ? node : nullptr;
+    }
+
+    /// If 'concurrent', children table of a trie node is locked when it is looked up or modified.
+    template <bool concurrent>
+    TrieNode * findOrCreate(std::string_view path)
+    {
+        if (path.empty() || path[0] != '/')
+            return nullptr;
+
+        TrieNode * node = &root;
+        bool found = forEachPathComponent(
+            path,
+            [this, &node, path](std::string_view name)
+            {
+                std::unique_lock<std::mutex> lock;
+                if constexpr (concurrent)
+                    lock = std::unique_lock(table_mutexes[(reinterpret_cast<uintptr_t>(node) >> 6) % TABLE_MUTEX_NUM]);
+
+                TrieNode * child = findChild(node->children, name);
+                if (!child)
+                {
+                    child = new TrieNode;
+                    child->parent = node;
+                    setLeafName(*child, name, false);
+
+                    if (node->children.size == 0)
+                    {
+                        size_t parent_path_size = name.data() - path.data() - 1;
+                        addParent<concurrent>(*node, bucketOfChildren(parent_path_size ? path.substr(0, parent_path_size) : std::string_view("/")));
+                    }
+                    insertChild(node->children, child);
+                }
+
+                /// Is going to have children, the name is read by others looking up in the locked table.
+                if (name.data() + name.size() != path.data() + path.size() && child->name_kind != NameKind::Interned)
+                {
+                    std::string_view interned = components.acquire(child->name());
+                    if (child->name_kind == NameKind::Owned)
+                        delete[] child->external_name;
+                    child->external_name = interned.data();
+                    child->name_kind = NameKind::Interned;
+                }
+
+                node = child;
+                return true;
+            });
+        return found ? node : nullptr;
+    }
+
+    /// 'name' may point to the interned name of the node, which is released after copied.
+    void setLeafName(TrieNode & node, std::string_view name, bool release_interned)
+    {
+        if (name.size() <= INLINE_NAME_SIZE)
+        {
+            memcpy(node.inline_name, name.data(), name.size());
+            node.name_kind = NameKind::Inline;
+        }
+        else
+        {
+            char * owned = new char[name.size()];
+            memcpy(owned, name.data(), name.size());
+            node.external_name = owned;
+            node.name_kind = NameKind::Owned;
+        }
+        node.name_size = static_cast<UInt32>(name.size());
+
+        if (release_interned)
+            components.release(name);
+    }
+
+    template <bool concurrent>
+    void addParent(TrieNode & node, UInt32 bucket_id)
+    {
+        auto & bucket = buckets[bucket_id];
+        std::unique_lock<std::mutex> lock;
+        if constexpr (concurrent)
+            lock = std::unique_lock(bucket.mutex);
+
+        node.bucket = static_cast<UInt16>(bucket_id);
+        node.bucket_pos = static_cast<UInt32>(bucket.parents.size());
+        bucket.parents.push_back(&node);
+    }
+
+    void removeParent(TrieNode & node)
+    {
+        auto & parents = buckets[node.bucket].parents;
+        parents[node.bucket_pos] = parents.back();
+        parents[node.bucket_pos]->bucket_pos = node.bucket_pos;
+        parents.pop_back();
+    }
+
+    static TrieNode * findChild(const ChildTable & table, std::string_view name)
+    {
+        if (table.capacity <= DENSE_CHILDREN)
+        {
+            for (UInt32 i = 0; i < table.size; ++i)
+                if (table.slots[i]->name() == name)
+                    return table.slots[i];
+            return nullptr;
+        }
+
+        size_t mask = table.capacity - 1;
+        for (size_t i = hashName(name) & mask; table.slots[i]; i = (i + 1) & mask)
+            if (table.slots[i]->name() == name)
+                return table.slots[i];
+        return nullptr;
+    }
+
+    template <typename F>
+    static void forEachChild(const ChildTable & table, F && fn)
+    {
+        if (table.capacity <= DENSE_CHILDREN)
+        {
+            for (UInt32 i = 0; i < table.size; ++i)
+                fn(table.slots[i]);
+            return;
+        }
+
+        for (UInt32 i = 0; i < table.capacity; ++i)
+            if (table.slots[i])
+                fn(table.slots[i]);
+    }
+
+    /// Move children to a new table of capacity, it is a hash table if capacity is larger than DENSE_CHILDREN.
+    static void resizeTable(ChildTable & table, UInt32 capacity)
+    {
+        auto ** slots = new TrieNode *[capacity]();
+        UInt32 size = 0;
+        forEachChild(
+            table,
+            [&](TrieNode * child)
+            {
+                if (capacity <= DENSE_CHILDREN)
+                {
+                    slots[size++] = child;
+                    return;
+                }
+                size_t mask = capacity - 1;
+                size_t i = hashName(child->name()) & mask;
+                while (slots[i])
+                    i = (i + 1) & mask;
+                slots[i] = child;
+                size++;
+            });
+
+        delete[] table.slots;
+        table.slots = slots;
+        table.capacity = capacity;
+        table.size = size;
+    }
+
+    static void insertChild(ChildTable & table, TrieNode * child)
+    {
+        if (table.capacity <= DENSE_CHILDREN && table.size + 1 <= DENSE_CHILDREN)
+        {
+            if (table.size == table.capacity)
+                resizeTable(table, std::max<UInt32>(table.capacity * 2, 1));
+            table.slots[table.size++] = child;
+            return;
+        }
+
+        /// Load factor is at most 3/4.
+        if (table.capacity <= DENSE_CHILDREN || (table.size + 1) * 4 > table.capacity * 3)
+            resizeTable(table, std::max<UInt32>(table.capacity * 2, DENSE_CHILDREN * 2));
+
+        size_t mask = table.capacity - 1;
+        size_t i = hashName(child->name()) & mask;
+        while (table.slots[i])
+            i = (i + 1) & mask;
+        table.slots[i] = child;
+        table.size++;
+    }
+
+    static void eraseChild(ChildTable & table, TrieNode * child)
+    {
+        if (table.capacity <= DENSE_CHILDREN)
+        {
+            for (UInt32 i = 0; i < table.size; ++i)
+            {
+                if (table.slots[i] == child)
+                {
+                    table.slots[i] = table.slots[--table.size];
+                    break;
+                }
+            }
+        }
+        else
+        {
+            size_t mask = table.capacity - 1;
+            size_t i = hashName(child->name()) & mask;
+            while (table.slots[i] != child)
+                i = (i + 1) & mask;
+
+            /// Shift following children of the same probe sequence back, so that no tombstone is needed.
+            for (size_t j = (i + 1) & mask; table.slots[j]; j = (j + 1) & mask)
+            {
+                size_t home = hashName(table.slots[j]->name()) & mask;
+                if (((j - home) & mask) >= ((j - i) & mask))
+                {
+                    table.slots[i] = table.slots[j];
+                    i = j;
+                }
+            }
+            table.slots[i] = nullptr;
+            table.size--;
+
+            if (table.size <= DENSE_CHILDREN / 2)
+                resizeTable(table, DENSE_CHILDREN);
+        }
+
+        if (table.size == 0)
+        {
+            delete[] table.slots;
+            table = {};
+        }
+    }
+
+    void destroyNode(TrieNode * node)
+    {
+        if (node->name_kind == NameKind::Owned)
+            delete[] node->external_name;
+        else if (node->name_kind == NameKind::Interned)
+            components.release(node->name());
+        delete node;
+    }
+
+    void destroyChildren(TrieNode & node)
+    {
+        forEachChild(
+            node.children,
+            [this](TrieNode * child)
+            {
+                destroyChildren(*child);
+                destroyNode(child);
+            });
+        delete[] node.children.slots;
+        node.children = {};
+    }
+
+    /// Represent path '/'
+    TrieNode root;
+    std::array<InnerMap, NumBuckets> buckets;
+    KeeperPathComponents components;
+    std::array<std::mutex, TABLE_MUTEX_NUM> table_mutexes;
+    std::hash<std::string_view> hash;
+    std::atomic<size_t> node_count{0};
+};
+
+}
@@ -0,0 +1,69 @@
+#include <cstring>
+
+#include <Service/KeeperPathComponents.h>
+
+namespace RK
+{
+
+KeeperPathComponents::~KeeperPathComponents()
+{
+    for (auto & shard : shards)
+        for (const auto & [name, _] : shard.components)
+            delete[] name.data();
+}
+
+std::string_view KeeperPathComponents::acquire(std::string_view name)
+{
+    auto & shard = shardFor(name);
+    std::lock_guard lock(shard.mutex);
+
+    auto it = shard.components.find(name);
+    if (it == shard.components.end())
+    {
+        char * interned = new char[name.size()];
+        memcpy(interned, name.data(), name.size());
+        it = shard.components.emplace(std::string_view(interned, name.size()), 0).first;
+        shard.bytes += name.size();
+    }
+    it->second++;
+    return it->first;
+}
+
+void KeeperPathComponents::release(std::string_view name)
+{
+    auto & shard = shardFor(name);
+    std::lock_guard lock(shard.mutex);
+
+    auto it = shard.components.find(name);
+    if (it == shard.components.end() || --it->second != 0)
+        return;
+
+    const char * interned = it->first.data();
+    shard.bytes -= it->first.size();
+    shard.components.erase(it);
+    delete[] interned;
+}
+
+size_t KeeperPathComponents::size() const
+{
+    size_t count = 0;
+    for (const auto & shard : shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        count += shard.components.size();
+    }
+    return count;
+}
+
+size_t KeeperPathComponents::bytes() const
+{
+    size_t total = 0;
+    for (const auto & shard : shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        total += shard.bytes;
+    }
+    return total;
+}
+
+}
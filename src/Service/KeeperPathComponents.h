@@ -0,0 +1,54 @@
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+#include <boost/noncopyable.hpp>
+
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/// Interned path components of a path trie.
+///
+/// Every distinct component is stored once with a reference count, trie nodes with the same name hold
+/// references to it instead of their own copies. Components are sharded by hash, so that buckets of the
+/// data tree can be filled in parallel when loading snapshot with little contention.
+class KeeperPathComponents : private boost::noncopyable
+{
+public:
+    KeeperPathComponents() = default;
+    ~KeeperPathComponents();
+
+    /// Return the interned copy of name and increase its reference count.
+    std::string_view acquire(std::string_view name);
+
+    /// Decrease reference count of an interned component, it is freed when the count drops to zero.
+    /// 'name' may point to the interned copy, do not use it after releasing.
+    void release(std::string_view name);
+
+    /// Count of distinct components and their total length in bytes.
+    size_t size() const;
+    size_t bytes() const;
+
+private:
+    static constexpr size_t NUM_SHARDS = 64;
+
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        /// Key points to the interned copy, value is its reference count.
+        std::unordered_map<std::string_view, size_t> components;
+        size_t bytes = 0;
+    };
+
+    Shard & shardFor(std::string_view name) { return shards[std::hash<std::string_view>{}(name) % NUM_SHARDS]; }
+
+    std::array<Shard, NUM_SHARDS> shards;
+};
+
+}
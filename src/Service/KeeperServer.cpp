@@ -57,7 +57,7 @@ KeeperServer::KeeperServer(
         data += fmt::format("server.{}={}:participant\n", s->get_id(), s->get_endpoint());
     }
     data += "version=0";
-    state_machine->getStore().getNode(ZOOKEEPER_CONFIG_NODE)->data = data;
+    state_machine->getStore().setNodeData(ZOOKEEPER_CONFIG_NODE, data);
 #endif
 
 }
@@ -135,13 +135,23 @@ ptr<nuraft::cmd_result<ptr<buffer>>> KeeperServer::pushRequestBatch(const std::v
 {
     LOG_DEBUG(log, "Push batch requests of size {}", request_batch.size());
     std::vector<ptr<buffer>> entries;
-    for (const auto & request : request_batch)
+    if (settings->raft_settings->batch_requests_in_log_entry)
     {
-        LOG_TRACE(log, "Push request {}", request.toSimpleString());
-        entries.push_back(serializeKeeperRequest(request));
+        entries.push_back(serializeKeeperRequests(request_batch));
+        state_machine->addLeaderRequests(*entries.back(), request_batch);
     }
-    /// append_entries write request
+    else
+    {
+        for (const auto & request : request_batch)
+        {
+            LOG_TRACE(log, "Push request {}", request.toSimpleString());
+            entries.push_back(serializeKeeperRequest(request));
+            state_machine->addLeaderRequests(*entries.back(), {request});
+        }
+    }
+    /// append_entries write request, entries accepted are pre-committed in it.
     ptr<nuraft::cmd_result<ptr<buffer>>> result = raft_instance->append_entries(entries);
+    state_machine->removePendingLeaderRequests(entries);
     return result;
 }
 
@@ -403,6 +413,12 @@ KeeperLogInfo KeeperServer::getKeeperLogInfo()
     {
         log_info.first_log_idx = log_store->start_index();
         log_info.first_log_term = log_store->term_at(log_info.first_log_idx);
+
+        if (auto * file_log_store = dynamic_cast<NuRaftFileLogStore *>(log_store.get()))
+        {
+            log_info.removing_log_segments = file_log_store->segmentStore()->removingSegmentsCount();
+            log_info.removing_log_bytes = file_log_store->segmentStore()->removingSegmentsBytes();
+        }
     }
 
     if (raft_instance)
@@ -418,6 +434,14 @@ KeeperLogInfo KeeperServer::getKeeperLogInfo()
     return log_info;
 }
 
+std::pair<UInt64, UInt64> KeeperServer::getLogCacheStats() const
+{
+    auto log_store = std::dynamic_pointer_cast<NuRaftFileLogStore>(state_manager->load_log_store());
+    if (!log_store)
+        return {0, 0};
+    return {log_store->logCache().getHits(), log_store->logCache().getMisses()};
+}
+
 bool KeeperServer::requestLeader()
 {
     return isLeader() || raft_instance->request_leadership();
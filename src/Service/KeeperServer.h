@@ -95,6 +95,9 @@ public:
     /// Return NuRaft log related information.
     KeeperLogInfo getKeeperLogInfo();
 
+    /// Return hits and misses of recent log cache.
+    std::pair<UInt64, UInt64> getLogCacheStats() const;
+
     /// Send request to become leader. Return true if scheduled task, or false.
     bool requestLeader();
 
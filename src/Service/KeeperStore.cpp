@@ -4,6 +4,7 @@
 #include <Service/KeeperStore.h>
 #include <Service/KeeperUtils.h>
 #include <ZooKeeper/IKeeper.h>
+#include <Common/SlabAllocator.h>
 
 namespace RK
 {
@@ -119,12 +120,13 @@ static bool shouldIncreaseZxid(const Coordination::ZooKeeperRequestPtr & zk_requ
         || dynamic_cast<Coordination::ZooKeeperAuthRequest *>(zk_request.get())
         || dynamic_cast<Coordination::ZooKeeperHeartbeatRequest *>(zk_request.get())
         || dynamic_cast<Coordination::ZooKeeperListRequest *>(zk_request.get())
-        || dynamic_cast<Coordination::ZooKeeperSimpleListRequest *>(zk_request.get()));
+        || dynamic_cast<Coordination::ZooKeeperSimpleListRequest *>(zk_request.get())
+        || dynamic_cast<Coordination::ZooKeeperAddWatchRequest *>(zk_request.get()));
 }
 
 KeeperNodePtr KeeperNode::clone() const
 {
-    auto node = std::make_shared<KeeperNode>();
+    auto node = KeeperNode::create();
     auto data_size = data.size();
     node->data.resize(data_size);
     memcopy(node->data.data(), data.data(), data_size);
@@ -138,7 +140,7 @@ KeeperNodePtr KeeperNode::clone() const
 
 KeeperNodePtr KeeperNode::cloneWithoutChildren() const
 {
-    auto node = std::make_shared<KeeperNode>();
+    auto node = KeeperNode::create();
     auto data_size = data.size();
     node->data.resize(data_size);
     memcopy(node->data.data(), data.data(), data_size);
@@ -149,6 +151,14 @@ KeeperNodePtr KeeperNode::cloneWithoutChildren() const
     return node;
 }
 
+KeeperNodePtr KeeperNode::cloneSharingChildren()
+{
+    auto node = cloneWithoutChildren();
+    KeeperNodePtr self(this);
+    node->children.share(std::shared_ptr<ChildrenSet>(&children, [self](ChildrenSet *) {}));
+    return node;
+}
+
 /// All stat for client should be generated by this function.
 /// This method will remove numChildren from persisted stat.
 Coordination::Stat KeeperNode::statForResponse() const
@@ -160,14 +170,136 @@ Coordination::Stat KeeperNode::statForResponse() const
     return stat_view;
 }
 
-KeeperStore::KeeperStore(int64_t dead_session_check_period_ms, const String & super_digest_)
-    : session_manager(dead_session_check_period_ms), super_digest(super_digest_)
+#ifdef KEEPER_NODE_SLAB_ALLOCATOR
+namespace
+{
+    using KeeperNodeSlabAllocator = SlabAllocator<sizeof(KeeperNode), alignof(KeeperNode)>;
+
+    /// Never destroyed, nodes may be released after static objects are destroyed.
+    KeeperNodeSlabAllocator & getKeeperNodeSlabAllocator()
+    {
+        static auto * allocator = new KeeperNodeSlabAllocator;
+        return *allocator;
+    }
+}
+
+void * KeeperNode::operator new(size_t size)
+{
+    if (unlikely(size != sizeof(KeeperNode)))
+        return ::operator new(size);
+    return getKeeperNodeSlabAllocator().alloc();
+}
+
+void KeeperNode::operator delete(void * ptr, size_t size)
+{
+    if (unlikely(size != sizeof(KeeperNode)))
+        ::operator delete(ptr);
+    else
+        getKeeperNodeSlabAllocator().free(ptr);
+}
+
+std::pair<size_t, size_t> KeeperNode::slabStatistics()
+{
+    auto & allocator = getKeeperNodeSlabAllocator();
+    return {allocator.usedObjects() * sizeof(KeeperNode), allocator.allocatedBytes()};
+}
+#endif
+
+KeeperStore::MemoryUsage & KeeperStore::MemoryUsage::operator+=(const MemoryUsage & rhs)
+{
+    nodes += rhs.nodes;
+    path_bytes += rhs.path_bytes;
+    data_bytes += rhs.data_bytes;
+    children_bytes += rhs.children_bytes;
+    return *this;
+}
+
+KeeperStore::MemoryUsage & KeeperStore::MemoryUsage::operator-=(const MemoryUsage & rhs)
+{
+    nodes -= rhs.nodes;
+    path_bytes -= rhs.path_bytes;
+    data_bytes -= rhs.data_bytes;
+    children_bytes -= rhs.children_bytes;
+    return *this;
+}
+
+KeeperStore::KeeperStore(int64_t dead_session_check_period_ms, const String & super_digest_, size_t memory_usage_prefix_depth_)
+    : memory_usage_prefix_depth(memory_usage_prefix_depth_), session_manager(dead_session_check_period_ms), super_digest(super_digest_)
 {
     log = &(Poco::Logger::get("KeeperStore"));
-    data_tree.emplace("/", std::make_shared<KeeperNode>());
+    auto root = KeeperNode::create();
+    updateMemoryUsage("/", nodeMemoryUsage("/", *root), true);
+    data_tree.emplace("/", std::move(root));
 }
 
-using Undo = std::function<void()>;
+/// Typed record to roll back a modification of a write request when a multi transaction fails.
+/// Unlike a closure, it needs no heap allocation itself, and records are kept in a vector reused
+/// across requests.
+struct Undo
+{
+    enum class Type : UInt8
+    {
+        None,
+        Create,
+        Remove,
+        Set,
+    };
+
+    Type type = Type::None;
+    /// Path of the modified node, refers to request or response which outlive the record.
+    std::string_view path;
+    /// Pzxid of parent before creating or removing a node.
+    int64_t parent_pzxid = 0;
+    /// Removed node, it is shared rather than copied because a removed node is not modified.
+    KeeperNodePtr prev_node;
+    /// Data and stat before set, node is not cloned, so children of a large parent are not copied.
+    /// Data is moved out of the node and moved back when rolling back.
+    String prev_data;
+    Coordination::Stat prev_stat{};
+
+    explicit operator bool() const { return type != Type::None; }
+
+    void apply(KeeperStore & store)
+    {
+        String node_path(path);
+        switch (type)
+        {
+            case Type::None:
+                break;
+            case Type::Create: {
+                auto node = store.getNode(node_path);
+                store.removeNode(node_path);
+                store.getACLMap().removeUsage(node->acl_id);
+                if (node->is_ephemeral)
+                    store.removeEphemeralNode(node->stat.ephemeralOwner, node_path);
+
+                auto parent = store.getNodeForUpdate(getParentPath(node_path));
+                --parent->stat.cversion;
+                --parent->stat.numChildren;
+                parent->stat.pzxid = parent_pzxid;
+                parent->children.erase(getBaseName(node_path));
+                break;
+            }
+            case Type::Remove: {
+                if (prev_node->is_ephemeral)
+                    store.addEphemeralNode(prev_node->stat.ephemeralOwner, node_path);
+                store.getACLMap().addUsage(prev_node->acl_id);
+                store.addNode(node_path, prev_node);
+
+                auto parent = store.getNodeForUpdate(getParentPath(node_path));
+                ++parent->stat.numChildren;
+                parent->stat.pzxid = parent_pzxid;
+                parent->children.insert(getBaseName(node_path));
+                break;
+            }
+            case Type::Set: {
+                auto node = store.setNodeData(node_path, std::move(prev_data));
+                node->stat = prev_stat;
+                break;
+            }
+        }
+    }
+};
 
 struct StoreRequest
 {
@@ -180,6 +312,9 @@ struct StoreRequest
 
     virtual bool checkAuth(KeeperStore & /*storage*/, int64_t /*session_id*/) const { return true; }
 
+    /// Data tree buckets locked when the request is processed, including the ones read by checkAuth.
+    virtual KeeperStore::Buckets getBuckets(KeeperStore & /*store*/) const { return KeeperStore::ALL_BUCKETS; }
+
     virtual ~StoreRequest() = default;
 };
 
@@ -189,6 +324,8 @@ struct StoreRequestHeartbeat final : public StoreRequest
 {
     using StoreRequest::StoreRequest;
 
+    KeeperStore::Buckets getBuckets(KeeperStore & /*store*/) const override { return 0; }
+
     std::pair<Coordination::ZooKeeperResponsePtr, Undo>
     process(KeeperStore & /* store */, int64_t /* zxid */, int64_t /* session_id */, int64_t /* time */) const override
     {
@@ -212,6 +349,8 @@ struct StoreRequestSync final : public StoreRequest
 {
     using StoreRequest::StoreRequest;
 
+    KeeperStore::Buckets getBuckets(KeeperStore & /*store*/) const override { return 0; }
+
     std::pair<Coordination::ZooKeeperResponsePtr, Undo>
     process(KeeperStore & /* storage */, int64_t /* zxid */, int64_t /* session_id */, int64_t /* time */) const override
     {
@@ -226,6 +365,29 @@ struct StoreRequestCreate final : public StoreRequest
 {
     using StoreRequest::StoreRequest;
 
+    static String getSequentialPath(const String & path, int32_t seq_num)
+    {
+        std::stringstream seq_num_str; // STYLE_CHECK_ALLOW_STD_STRING_STREAM
+        seq_num_str.exceptions(std::ios::failbit);
+        seq_num_str << std::setw(10) << std::setfill('0') << seq_num;
+        return path + seq_num_str.str();
+    }
+
+    KeeperStore::Buckets getBuckets(KeeperStore & store) const override
+    {
+        const auto & request = dynamic_cast<const Coordination::ZooKeeperCreateRequest &>(*zk_request);
+        auto parent_path = getParentPath(request.path);
+        auto buckets = store.bucketOf(parent_path);
+        if (!request.is_sequential)
+            return buckets | store.bucketOf(request.path);
+
+        /// Name of a sequential node depends on parent, it is read without lock because data tree is
+        /// modified only by the thread applying write requests, which is the one calling this method.
+        if (auto parent = store.getNode(parent_path))
+            buckets |= store.bucketOf(getSequentialPath(request.path, parent->stat.cversion));
+        return buckets;
+    }
+
     bool checkAuth(KeeperStore & store, int64_t session_id) const override
     {
         auto parent_path = getParentPath(zk_request->getPath());
@@ -277,17 +439,7 @@ struct StoreRequestCreate final : public StoreRequest
             return {response_ptr, undo};
         }
 
-        String path_created = request.path;
-        if (request.is_sequential)
-        {
-            auto seq_num = parent->stat.cversion;
-
-            std::stringstream seq_num_str; // STYLE_CHECK_ALLOW_STD_STRING_STREAM
-            seq_num_str.exceptions(std::ios::failbit);
-            seq_num_str << std::setw(10) << std::setfill('0') << seq_num;
-
-            path_created += seq_num_str.str();
-        }
+        String path_created = request.is_sequential ? getSequentialPath(request.path, parent->stat.cversion) : request.path;
         if (store.exists(path_created))
         {
             response.error = Coordination::Error::ZNODEEXISTS;
@@ -299,7 +451,7 @@ struct StoreRequestCreate final : public StoreRequest
             response.error = Coordination::Error::ZBADARGUMENTS;
             return {response_ptr, undo};
         }
-        std::shared_ptr<KeeperNode> created_node = std::make_shared<KeeperNode>();
+        KeeperNodePtr created_node = KeeperNode::create();
 
         Coordination::ACLs node_acls;
         uint64_t acl_id{};
@@ -334,8 +486,7 @@ struct StoreRequestCreate final : public StoreRequest
             created_node->stat.ephemeralOwner = session_id;
         created_node->is_sequential = request.is_sequential;
 
-        int64_t pzxid;
-
+        parent = store.getNodeForUpdate(getParentPath(request.path));
         {
             response.path_created = path_created;
 
@@ -344,7 +495,7 @@ struct StoreRequestCreate final : public StoreRequest
             ++parent->stat.cversion;
             ++parent->stat.numChildren;
 
-            pzxid = parent->stat.pzxid;
+            undo.parent_pzxid = parent->stat.pzxid;
             parent->stat.pzxid = zxid;
         }
 
@@ -353,32 +504,11 @@ struct StoreRequestCreate final : public StoreRequest
         if (request.is_ephemeral)
             store.addEphemeralNode(session_id, path_created);
 
-        undo = [&store,
-                session_id,
-                path_created,
-                pzxid,
-                is_ephemeral = request.is_ephemeral,
-                parent_path = getParentPath(request.path),
-                child_path,
-                acl_id] {
-            {
-                store.removeNode(path_created);
-                store.getACLMap().removeUsage(acl_id);
-            }
-            if (is_ephemeral)
-                store.removeEphemeralNode(session_id, path_created);
-
-            auto undo_parent = store.getNode(parent_path);
-            {
-                --undo_parent->stat.cversion;
-                --undo_parent->stat.numChildren;
-                undo_parent->stat.pzxid = pzxid;
-                undo_parent->children.erase(child_path);
-            }
-        };
+        undo.type = Undo::Type::Create;
+        undo.path = response.path_created;
 
         response.error = Coordination::Error::ZOK;
-        return {response_ptr, undo};
+        return {response_ptr, std::move(undo)};
     }
 };
 
@@ -386,6 +516,8 @@ struct StoreRequestGet final : public StoreRequest
 {
     using StoreRequest::StoreRequest;
 
+    KeeperStore::Buckets getBuckets(KeeperStore & store) const override { return store.bucketOf(zk_request->getPath()); }
+
     bool checkAuth(KeeperStore & store, int64_t session_id) const override
     {
         Poco::Logger * log = &(Poco::Logger::get("StoreRequestGet"));
@@ -442,6 +574,11 @@ struct StoreRequestRemove final : public StoreRequest
 {
     using StoreRequest::StoreRequest;
 
+    KeeperStore::Buckets getBuckets(KeeperStore & store) const override
+    {
+        return store.bucketOf(zk_request->getPath()) | store.bucketOf(getParentPath(zk_request->getPath()));
+    }
+
     bool checkAuth(KeeperStore & store, int64_t session_id) const override
     {
         auto parent = store.getNode(getParentPath(zk_request->getPath()));
@@ -495,45 +632,163 @@ struct StoreRequestRemove final : public StoreRequest
         {
             response.error = Coordination::Error::ZOK;
 
-            int64_t pzxid;
-            auto prev_node = node->clone();
-            auto child_basename = getBaseName(request.path);
-
-            auto parent = store.getNode(getParentPath(request.path));
+            auto parent = store.getNodeForUpdate(getParentPath(request.path));
             {
                 --parent->stat.numChildren;
-                pzxid = parent->stat.pzxid;
+                undo.parent_pzxid = parent->stat.pzxid;
                 parent->stat.pzxid = zxid;
-                parent->children.erase(child_basename);
+                parent->children.erase(getBaseName(request.path));
             }
 
-            store.acl_map.removeUsage(prev_node->acl_id);
+            store.acl_map.removeUsage(node->acl_id);
             store.removeNode(request.path);
 
-            int64_t ephemeral_owner{};
+            if (node->is_ephemeral)
+                store.removeEphemeralNode(node->stat.ephemeralOwner, request.path);
+
+            undo.type = Undo::Type::Remove;
+            undo.path = request.path;
+            undo.prev_node = std::move(node);
+        }
+
+        return {response_ptr, std::move(undo)};
+    }
+};
+
+struct StoreRequestRemoveRecursive final : public StoreRequest
+{
+    using StoreRequest::StoreRequest;
+
+    static bool checkDelete(KeeperStore & store, const KeeperNode & parent, int64_t session_id)
+    {
+        const auto & node_acls = store.acl_map.convertNumber(parent.acl_id);
+        if (node_acls.empty())
+            return true;
+
+        std::shared_lock r_lock(store.auth_mutex);
+        auto it = store.session_and_auth.find(session_id);
+        if (it != store.session_and_auth.end())
+            return checkACL(Coordination::ACL::Delete, node_acls, it->second);
+
+        std::vector<Coordination::AuthID> empty_auth_ids;
+        return checkACL(Coordination::ACL::Delete, node_acls, empty_auth_ids);
+    }
+
+    bool checkAuth(KeeperStore & store, int64_t session_id) const override
+    {
+        auto parent = store.getNode(getParentPath(zk_request->getPath()));
+        if (parent == nullptr)
+            return true;
+        return checkDelete(store, *parent, session_id);
+    }
+
+    std::pair<Coordination::ZooKeeperResponsePtr, Undo>
+    process(KeeperStore & store, int64_t zxid, int64_t session_id, int64_t /* time */) const override
+    {
+        Coordination::ZooKeeperResponsePtr response_ptr = zk_request->makeResponse();
+        auto & response = dynamic_cast<Coordination::ZooKeeperRemoveRecursiveResponse &>(*response_ptr);
+        auto & request = dynamic_cast<Coordination::ZooKeeperRemoveRecursiveRequest &>(*zk_request);
+
+        if (request.path == "/")
+        {
+            response.error = Coordination::Error::ZBADARGUMENTS;
+            return {response_ptr, {}};
+        }
+
+        auto root = store.getNode(request.path);
+        if (root == nullptr)
+        {
+            response.error = Coordination::Error::ZNONODE;
+            return {response_ptr, {}};
+        }
 
-            if (prev_node->is_ephemeral)
+        /// Collect the subtree from top to bottom, stop as soon as it exceeds the limit.
+        std::vector<std::pair<String, KeeperNodePtr>> nodes;
+        nodes.emplace_back(request.path, root);
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            /// Copy since nodes may be reallocated.
+            auto [path, node] = nodes[i];
+            if (node->children.empty())
+                continue;
+
+            /// Children are counted before gathering them, so rejecting a large subtree costs at most the limit.
+            if (nodes.size() + node->children.size() > request.remove_nodes_limit)
             {
-                ephemeral_owner = prev_node->stat.ephemeralOwner;
-                store.removeEphemeralNode(ephemeral_owner, request.path);
+                response.error = Coordination::Error::ZNOTEMPTY;
+                return {response_ptr, {}};
             }
 
-            undo = [prev_node, &store, ephemeral_owner, path = request.path, pzxid, child_basename] {
-                if (prev_node->is_ephemeral)
-                    store.addEphemeralNode(ephemeral_owner, path);
-                store.acl_map.addUsage(prev_node->acl_id);
+            /// Removing children requires the delete permission of their parent.
+            if (!checkDelete(store, *node, session_id))
+            {
+                response.error = Coordination::Error::ZNOAUTH;
+                return {response_ptr, {}};
+            }
 
-                store.addNode(path, prev_node);
-                auto undo_parent = store.getNode(getParentPath(path));
-                {
-                    ++(undo_parent->stat.numChildren);
-                    undo_parent->stat.pzxid = pzxid;
-                    undo_parent->children.insert(child_basename);
-                }
-            };
+            for (auto child : node->children)
+            {
+                String child_path = path + "/" + String(child);
+                auto child_node = store.getNode(child_path);
+                if (child_node)
+                    nodes.emplace_back(std::move(child_path), std::move(child_node));
+            }
         }
 
-        return {response_ptr, undo};
+        if (nodes.size() > request.remove_nodes_limit)
+        {
+            response.error = Coordination::Error::ZNOTEMPTY;
+            return {response_ptr, {}};
+        }
+
+        auto parent = store.getNodeForUpdate(getParentPath(request.path));
+        --parent->stat.numChildren;
+        parent->stat.pzxid = zxid;
+        parent->children.erase(getBaseName(request.path));
+
+        response.removed_paths.reserve(nodes.size());
+        for (auto & [path, node] : nodes)
+        {
+            store.acl_map.removeUsage(node->acl_id);
+            if (node->is_ephemeral)
+                store.removeEphemeralNode(node->stat.ephemeralOwner, path);
+            store.removeNode(path);
+            response.removed_paths.emplace_back(std::move(path));
+        }
+
+        response.error = Coordination::Error::ZOK;
+        return {response_ptr, {}};
+    }
+};
+
+struct StoreRequestAddWatch final : public StoreRequest
+{
+    using StoreRequest::StoreRequest;
+
+    bool checkAuth(KeeperStore & store, int64_t session_id) const override
+    {
+        auto node = store.getNode(zk_request->getPath());
+        if (node == nullptr)
+            return true;
+
+        const auto & node_acls = store.acl_map.convertNumber(node->acl_id);
+        if (node_acls.empty())
+            return true;
+
+        std::shared_lock r_lock(store.auth_mutex);
+        auto it = store.session_and_auth.find(session_id);
+        if (it != store.session_and_auth.end())
+            return checkACL(Coordination::ACL::Read, node_acls, it->second);
+
+        std::vector<Coordination::AuthID> empty_auth_ids;
+        return checkACL(Coordination::ACL::Read, node_acls, empty_auth_ids);
+    }
+
+    /// Watch is registered after processing, a node need not exist to be watched.
+    std::pair<Coordination::ZooKeeperResponsePtr, Undo>
+    process(KeeperStore & /* store */, int64_t /* zxid */, int64_t /* session_id */, int64_t /* time */) const override
+    {
+        return {zk_request->makeResponse(), {}};
     }
 };
 
@@ -541,6 +796,8 @@ struct StoreRequestExists final : public StoreRequest
 {
     using StoreRequest::StoreRequest;
 
+    KeeperStore::Buckets getBuckets(KeeperStore & store) const override { return store.bucketOf(zk_request->getPath()); }
+
     std::pair<Coordination::ZooKeeperResponsePtr, Undo>
     process(KeeperStore & store, int64_t /* zxid */, int64_t /* session_id */, int64_t /* time */) const override
     {
@@ -567,6 +824,8 @@ struct StoreRequestSet final : public StoreRequest
 {
     using StoreRequest::StoreRequest;
 
+    KeeperStore::Buckets getBuckets(KeeperStore & store) const override { return store.bucketOf(zk_request->getPath()); }
+
     bool checkAuth(KeeperStore & store, int64_t session_id) const override
     {
         auto node = store.getNode(zk_request->getPath());
@@ -607,27 +866,28 @@ struct StoreRequestSet final : public StoreRequest
         }
         else if (request_typed.version == -1 || request_typed.version == node->stat.version)
         {
-            auto prev_node = node->clone();
+            undo.type = Undo::Type::Set;
+            undo.path = request_typed.path;
+            undo.prev_stat = node->stat;
+
+            node = store.setNodeData(request_typed.path, request_typed.data, &undo.prev_data);
             {
                 ++node->stat.version;
                 node->stat.mzxid = zxid;
                 node->stat.mtime = time;
                 node->stat.dataLength = request_typed.data.length();
-                node->data = request_typed.data;
             }
 
             auto parent = store.getNode(getParentPath(request_typed.path));
             response_typed.stat = node->statForResponse();
             response_typed.error = Coordination::Error::ZOK;
-
-            undo = [prev_node, &store, path = request_typed.path] { store.addNode(path, prev_node); };
         }
         else
         {
             response_typed.error = Coordination::Error::ZBADVERSION;
         }
 
-        return {response, undo};
+        return {response, std::move(undo)};
     }
 };
 
@@ -635,6 +895,16 @@ struct StoreRequestList final : public StoreRequest
 {
     using StoreRequest::StoreRequest;
 
+    KeeperStore::Buckets getBuckets(KeeperStore & store) const override
+    {
+        /// Filtered list reads children nodes which may be in any bucket.
+        const auto * filtered_list_request = dynamic_cast<const Coordination::ZooKeeperFilteredListRequest *>(zk_request.get());
+        if (filtered_list_request
+            && filtered_list_request->list_request_type != Coordination::ZooKeeperFilteredListRequest::ListRequestType::ALL)
+            return KeeperStore::ALL_BUCKETS;
+        return store.bucketOf(zk_request->getPath());
+    }
+
     bool checkAuth(KeeperStore & store, int64_t session_id) const override
     {
         auto node = store.getNode(zk_request->getPath());
@@ -692,15 +962,18 @@ struct StoreRequestList final : public StoreRequest
 
             if (list_request_type == ALL)
             {
-                response_typed.names.reserve(node->children.size());
-                response_typed.names.push_back(node->children.begin(), node->children.end());
+                response_typed.serialized_names = node->children.getSerialized();
                 return {response, {}};
             }
 
-            auto add_child = [&](const auto & child)
+            String path_with_slash = request_typed.path;
+            if (path_with_slash != "/")
+                path_with_slash += '/';
+
+            auto add_child = [&](std::string_view child)
             {
-                auto child_node = store.getNode(request_typed.path + "/" + child);
-                if (node == nullptr)
+                auto child_node = store.getNode(path_with_slash + String(child));
+                if (child_node == nullptr)
                 {
                     LOG_ERROR(
                         &Poco::Logger::get("StoreRequestList"),
@@ -723,8 +996,7 @@ struct StoreRequestList final : public StoreRequest
         else
         {
             auto & response_typed = dynamic_cast<Coordination::ZooKeeperSimpleListResponse &>(*response);
-            response_typed.names.reserve(node->children.size());
-            response_typed.names.push_back(node->children.begin(), node->children.end());
+            response_typed.serialized_names = node->children.getSerialized();
         }
 
         response->error = Coordination::Error::ZOK;
@@ -737,6 +1009,8 @@ struct StoreRequestCheck final : public StoreRequest
 {
     using StoreRequest::StoreRequest;
 
+    KeeperStore::Buckets getBuckets(KeeperStore & store) const override { return store.bucketOf(zk_request->getPath()); }
+
     bool checkAuth(KeeperStore & store, int64_t session_id) const override
     {
         auto node = store.getNode(zk_request->getPath());
@@ -790,6 +1064,8 @@ struct StoreRequestSetACL final : public StoreRequest
 {
     using StoreRequest::StoreRequest;
 
+    KeeperStore::Buckets getBuckets(KeeperStore & store) const override { return store.bucketOf(zk_request->getPath()); }
+
     bool checkAuth(KeeperStore & store, int64_t session_id) const override
     {
         auto node = store.getNode(zk_request->getPath());
@@ -847,6 +1123,7 @@ struct StoreRequestSetACL final : public StoreRequest
             uint64_t acl_id = store.acl_map.convertACLs(node_acls);
             store.acl_map.addUsage(acl_id);
 
+            node = store.getNodeForUpdate(request_typed.path);
             node->acl_id = acl_id;
             ++node->stat.aversion;
 
@@ -863,6 +1140,8 @@ struct StoreRequestGetACL final : public StoreRequest
 {
     using StoreRequest::StoreRequest;
 
+    KeeperStore::Buckets getBuckets(KeeperStore & store) const override { return store.bucketOf(zk_request->getPath()); }
+
     bool checkAuth(KeeperStore & store, int64_t session_id) const override
     {
         auto node = store.getNode(zk_request->getPath());
@@ -914,6 +1193,8 @@ struct StoreRequestAuth final : public StoreRequest
 {
     using StoreRequest::StoreRequest;
 
+    KeeperStore::Buckets getBuckets(KeeperStore & /*store*/) const override { return 0; }
+
     std::pair<Coordination::ZooKeeperResponsePtr, Undo>
     process(KeeperStore & store, int64_t /*zxid*/, int64_t session_id, int64_t /* time */) const override
     {
@@ -965,6 +1246,20 @@ struct StoreRequestMultiTxn final : public StoreRequest
         return true;
     }
 
+    KeeperStore::Buckets getBuckets(KeeperStore & store) const override
+    {
+        KeeperStore::Buckets buckets = 0;
+        for (const auto & concrete_request : concrete_requests)
+        {
+            /// Name of a sequential node may depend on the former operations.
+            const auto * create_request = dynamic_cast<const Coordination::ZooKeeperCreateRequest *>(concrete_request->zk_request.get());
+            if (create_request && create_request->is_sequential)
+                return KeeperStore::ALL_BUCKETS;
+            buckets |= concrete_request->getBuckets(store);
+        }
+        return buckets;
+    }
+
     std::vector<StoreRequestPtr> concrete_requests;
     explicit StoreRequestMultiTxn(const Coordination::ZooKeeperRequestPtr & zk_request_) : StoreRequest(zk_request_)
     {
@@ -1028,7 +1323,17 @@ struct StoreRequestMultiTxn final : public StoreRequest
     {
         Coordination::ZooKeeperResponsePtr response = zk_request->makeResponse();
         Coordination::ZooKeeperMultiResponse & response_typed = dynamic_cast<Coordination::ZooKeeperMultiResponse &>(*response);
-        std::vector<Undo> undo_actions;
+
+        /// Reused across requests to avoid allocation, multi requests are processed one by one in a thread.
+        static thread_local std::vector<Undo> undo_actions;
+        undo_actions.clear();
+
+        auto rollback = [&store]()
+        {
+            for (auto it = undo_actions.rbegin(); it != undo_actions.rend(); ++it)
+                it->apply(store);
+            undo_actions.clear();
+        };
 
         try
         {
@@ -1040,6 +1345,9 @@ struct StoreRequestMultiTxn final : public StoreRequest
                 response_typed.responses[i] = cur_response;
                 if (cur_response->error != Coordination::Error::ZOK && operation_type == OperationType::Write)
                 {
+                    /// Roll back before responses are replaced, undo records refer to paths in them.
+                    rollback();
+
                     for (size_t j = 0; j <= i; ++j)
                     {
                         auto response_error = response_typed.responses[j]->error;
@@ -1053,10 +1361,6 @@ struct StoreRequestMultiTxn final : public StoreRequest
                         response_typed.responses[j]->error = Coordination::Error::ZRUNTIMEINCONSISTENCY;
                     }
 
-                    for (auto it = undo_actions.rbegin(); it != undo_actions.rend(); ++it)
-                        if (*it)
-                            (*it)();
-
                     return {response, {}};
                 }
                 else
@@ -1069,19 +1373,19 @@ struct StoreRequestMultiTxn final : public StoreRequest
                         response_typed.responses[i]->error = response_error;
                     }
 #endif
-                    undo_actions.emplace_back(std::move(undo_action));
+                    if (undo_action)
+                        undo_actions.emplace_back(std::move(undo_action));
                 }
                 ++i;
             }
 
+            undo_actions.clear();
             response_typed.error = Coordination::Error::ZOK;
             return {response, {}};
         }
         catch (...)
         {
-            for (auto it = undo_actions.rbegin(); it != undo_actions.rend(); ++it)
-                if (*it)
-                    (*it)();
+            rollback();
             throw;
         }
     }
@@ -1108,12 +1412,12 @@ void KeeperStore::finalize()
     for (const auto & [session_id, ephemerals_paths] : ephemerals)
         for (const String & ephemeral_path : ephemerals_paths)
         {
-            auto parent = data_tree.at(getParentPath(ephemeral_path));
+            auto parent = getNodeForUpdate(getParentPath(ephemeral_path));
             {
                 --parent->stat.numChildren;
                 parent->children.erase(getBaseName(ephemeral_path));
             }
-            data_tree.erase(ephemeral_path);
+            removeNode(ephemeral_path);
         }
 
     {
@@ -1174,12 +1478,15 @@ StoreRequestFactory::StoreRequestFactory()
 {
     registerNuKeeperRequestWrapper<Coordination::OpNum::Heartbeat, StoreRequestHeartbeat>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::SetWatches, StoreRequestSetWatches>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::SetWatches2, StoreRequestSetWatches>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Sync, StoreRequestSync>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Auth, StoreRequestAuth>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Close, StoreRequestClose>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Create, StoreRequestCreate>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Remove, StoreRequestRemove>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::RemoveRecursive, StoreRequestRemoveRecursive>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Exists, StoreRequestExists>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::AddWatch, StoreRequestAddWatch>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Get, StoreRequestGet>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Set, StoreRequestSet>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::List, StoreRequestList>(*this);
@@ -1215,6 +1522,10 @@ void KeeperStore::processRequest(
 
     if (zk_request->getOpNum() == Coordination::OpNum::Close)
     {
+        BucketLocks locks(*this, ALL_BUCKETS, true);
+        if (unlikely(cow_nodes_count.load() != 0) && !isDataTreePinned())
+            mergeCowNodes(COW_NODES_MERGE_STEP, locks.getBuckets());
+
         LOG_DEBUG(log, "Clean ephemeral nodes and watches for {}", toHexString(session_id));
         cleanEphemeralNodes(session_id, responses_queue, ignore_response);
         watch_manager.cleanDeadWatches(session_id);
@@ -1275,7 +1586,8 @@ void KeeperStore::processRequest(
         return;
     }
 
-    if (!session_manager.contains(session_id) && !new_last_zxid)
+    /// Update sessions expiration time for each request
+    if (!session_manager.updateSessionExpirationTime(session_id) && !new_last_zxid)
     {
         LOG_WARNING(
             log,
@@ -1285,8 +1597,6 @@ void KeeperStore::processRequest(
             zk_request->getPath());
         return;
     }
-    /// Update sessions expiration time for each request
-    session_manager.updateSessionExpirationTime(session_id);
 
     if (zk_request->getOpNum() == Coordination::OpNum::Heartbeat)
     {
@@ -1297,8 +1607,9 @@ void KeeperStore::processRequest(
         LOG_TRACE(log, "heart beat for session {}", toHexString(session_id));
         set_response(responses_queue, ResponseForSession{session_id, response}, ignore_response);
     }
-    else if (zk_request->getOpNum() == Coordination::OpNum::SetWatches)
+    else if (zk_request->getOpNum() == Coordination::OpNum::SetWatches || zk_request->getOpNum() == Coordination::OpNum::SetWatches2)
     {
+        BucketLocks locks(*this, ALL_BUCKETS, false);
         StoreRequestPtr store_request = StoreRequestFactory::instance().get(zk_request);
         auto [response, _] = store_request->process(*this, zxid, session_id, request_for_session.create_time);
         response->xid = zk_request->xid;
@@ -1310,7 +1621,7 @@ void KeeperStore::processRequest(
         std::unordered_map<String, std::pair<int64_t, int64_t>> watch_nodes_info;
         for (String & path : request->data_watches)
         {
-            if (auto node = data_tree.get(path))
+            if (auto node = getNode(path))
                 watch_nodes_info.emplace(path, std::make_pair(node->stat.mzxid, node->stat.pzxid));
         }
 
@@ -1325,6 +1636,13 @@ void KeeperStore::processRequest(
         StoreRequestPtr store_request = StoreRequestFactory::instance().get(zk_request);
         Coordination::ZooKeeperResponsePtr response;
 
+        /// Held until watches are registered or triggered, so that they are ordered with the requests changing the nodes.
+        BucketLocks locks(*this, store_request->getBuckets(*this), !zk_request->isReadRequest());
+
+        /// Read requests may be processed in parallel, they should never modify data tree.
+        if (unlikely(cow_nodes_count.load() != 0) && !isDataTreePinned() && !zk_request->isReadRequest())
+            mergeCowNodes(COW_NODES_MERGE_STEP, locks.getBuckets());
+
         if (check_acl && !store_request->checkAuth(*this, session_id))
         {
             response = zk_request->makeResponse();
@@ -1356,6 +1674,11 @@ void KeeperStore::processRequest(
                 LOG_TRACE(log, "Register watch for {}, path {}", request_for_session.toSimpleString(), zk_request->getPath());
                 watch_manager.registerWatches(zk_request->getPath(), session_id, zk_request->getOpNum());
             }
+            else if (zk_request->getOpNum() == Coordination::OpNum::AddWatch && response->error == Coordination::Error::ZOK)
+            {
+                const auto & add_watch_request = dynamic_cast<const Coordination::ZooKeeperAddWatchRequest &>(*zk_request);
+                watch_manager.registerPersistentWatch(add_watch_request.path, session_id, add_watch_request.mode);
+            }
             /// push response to queue
             set_response(responses_queue, ResponseForSession{session_id, response}, ignore_response);
         }
@@ -1386,6 +1709,20 @@ void KeeperStore::processRequest(
                         }
                     }
                 }
+                else if (zk_request->getOpNum() == Coordination::OpNum::RemoveRecursive)
+                {
+                    auto & remove_response = dynamic_cast<Coordination::ZooKeeperRemoveRecursiveResponse &>(*response);
+                    for (const auto & path : remove_response.removed_paths)
+                    {
+                        auto watch_responses = watch_manager.processWatches(path, Coordination::Event::DELETED);
+                        if (!watch_responses.empty())
+                        {
+                            LOG_TRACE(log, "{} triggered {} watches", request_for_session.toSimpleString(), watch_responses.size());
+                            set_response(responses_queue, watch_responses, ignore_response);
+                        }
+                    }
+                    remove_response.removed_paths.clear();
+                }
                 else
                 {
                     auto watch_responses = watch_manager.processWatches(zk_request->getPath(), zk_request->getOpNum());
@@ -1407,23 +1744,26 @@ void KeeperStore::buildChildrenSet(bool from_zk_snapshot)
 {
     for (UInt32 bucket_id = 0; bucket_id < data_tree.getBucketNum(); bucket_id++)
     {
-        for (const auto & it : data_tree.getMap(bucket_id).getMap())
+        data_tree.getMap(bucket_id).forEach([&](const String & path, const KeeperNodePtr &)
         {
-            if (it.first == "/")
-                continue;
+            if (path == "/")
+                return;
 
-            auto parent_path = getParentPath(it.first);
-            auto child_path = getBaseName(it.first);
+            auto parent_path = getParentPath(path);
+            auto child_path = getBaseName(path);
             auto parent = data_tree.get(parent_path);
 
             if (parent == nullptr)
-                throw RK::Exception(ErrorCodes::LOGICAL_ERROR, "Error when building children set, can not find parent for node {}", it.first);
+                throw RK::Exception(ErrorCodes::LOGICAL_ERROR, "Error when building children set, can not find parent for node {}", path);
 
-            parent->children.insert(child_path);
+            parent->children.append(child_path);
             if (from_zk_snapshot)
                 parent->stat.numChildren++;
-        }
+        });
     }
+
+    for (UInt32 bucket_id = 0; bucket_id < data_tree.getBucketNum(); bucket_id++)
+        data_tree.getMap(bucket_id).forEach([](const String &, const KeeperNodePtr & node) { node->children.buildIndex(); });
 }
 
 void KeeperStore::fillDataTreeBucket(const std::vector<BucketNodes> & all_objects_nodes, UInt32 bucket_id)
@@ -1440,6 +1780,7 @@ void KeeperStore::fillDataTreeBucket(const std::vector<BucketNodes> & all_object
 
 void KeeperStore::buildBucketChildren(const std::vector<BucketEdges> & all_objects_edges, UInt32 bucket_id)
 {
+    std::vector<KeeperNodePtr> parents;
     for (const auto & object_edges : all_objects_edges)
     {
         for (const auto & [parent_path, path] : object_edges[bucket_id])
@@ -1449,9 +1790,15 @@ void KeeperStore::buildBucketChildren(const std::vector<BucketEdges> & all_objec
             if (unlikely(parent == nullptr))
                 throw RK::Exception(RK::ErrorCodes::LOGICAL_ERROR, "Can not find parent for node {}", path);
 
-            parent->children.emplace(std::move(path));
+            if (parent->children.isIndexed())
+                parents.push_back(parent);
+            parent->children.append(path);
         }
     }
+
+    /// Children are indexed once after all of them are appended.
+    for (const auto & parent : parents)
+        parent->children.buildIndex();
 }
 
 void KeeperStore::cleanEphemeralNodes(int64_t session_id, ThreadSafeQueue<ResponseForSession> & responses_queue, bool ignore_response)
@@ -1466,7 +1813,7 @@ void KeeperStore::cleanEphemeralNodes(int64_t session_id, ThreadSafeQueue<Respon
         for (const auto & ephemeral_path : it->second)
         {
             LOG_TRACE(log, "Disconnect session {}, deleting its ephemeral node {}", toHexString(session_id), ephemeral_path);
-            auto parent = data_tree.at(getParentPath(ephemeral_path));
+            auto parent = getNodeForUpdate(getParentPath(ephemeral_path));
             if (!parent)
             {
                 LOG_ERROR(
@@ -1480,7 +1827,7 @@ void KeeperStore::cleanEphemeralNodes(int64_t session_id, ThreadSafeQueue<Respon
                 --parent->stat.numChildren;
                 parent->children.erase(getBaseName(ephemeral_path));
             }
-            data_tree.erase(ephemeral_path);
+            removeNode(ephemeral_path);
 
             auto responses = watch_manager.processWatches(ephemeral_path, Coordination::Event::DELETED);
             set_response(responses_queue, responses, ignore_response);
@@ -1528,8 +1875,14 @@ uint64_t KeeperStore::getTotalEphemeralNodesCount() const
 void KeeperStore::reset()
 {
     data_tree.clear();
+    for (auto & bucket_cow_nodes : cow_nodes)
+        bucket_cow_nodes.clear();
+    cow_nodes_count = 0;
+    cow_nodes_delta = 0;
     zxid = 0;
 
+    clearMemoryUsage();
+
     acl_map.reset();
     session_manager.reset();
     watch_manager.reset();
@@ -1543,76 +1896,439 @@ void KeeperStore::reset()
         std::lock_guard lock(ephemerals_mutex);
         ephemerals.clear();
     }
+
+    dirty_paths = DirtyPaths{.overflow = true};
+}
+
+KeeperNodePtr KeeperStore::getNodeForUpdate(const String & path)
+{
+    markDirty(path);
+
+    if (!isDataTreePinned())
+        return getNode(path);
+
+    auto & bucket_cow_nodes = cowNodesOf(path);
+    auto it = bucket_cow_nodes.find(path);
+    if (it != bucket_cow_nodes.end())
+        return it->second;
+
+    auto node = data_tree.get(path);
+    if (!node)
+        return nullptr;
+
+    /// Children of the pinned node are not copied, a large parent would take long to copy.
+    auto node_copy = node->cloneSharingChildren();
+    bucket_cow_nodes.emplace(path, node_copy);
+    ++cow_nodes_count;
+    return node_copy;
+}
+
+void KeeperStore::addNode(const String & path, KeeperNodePtr node)
+{
+    markDirty(path);
+    if (auto prev_node = getNode(path))
+        updateMemoryUsage(path, nodeMemoryUsage(path, *prev_node), false);
+    updateMemoryUsage(path, nodeMemoryUsage(path, *node), true);
+
+    if (isDataTreePinned())
+    {
+        /// A node restored by rolling back may be the one in the pinned data tree, which must not be modified in place.
+        if (node == data_tree.get(path))
+            node = node->cloneSharingChildren();
+        setCowNode(path, std::move(node));
+        return;
+    }
+
+    if (unlikely(cow_nodes_count.load() != 0))
+    {
+        auto & bucket_cow_nodes = cowNodesOf(path);
+        auto it = bucket_cow_nodes.find(path);
+        if (it != bucket_cow_nodes.end())
+            eraseCowNode(bucket_cow_nodes, it);
+    }
+    /// A copy-on-write node restored by rolling back.
+    node->children.unshare();
+    data_tree.emplace(path, std::move(node));
+}
+
+void KeeperStore::removeNode(const String & path)
+{
+    markDirty(path);
+    if (auto prev_node = getNode(path))
+        updateMemoryUsage(path, nodeMemoryUsage(path, *prev_node), false);
+
+    if (isDataTreePinned())
+    {
+        setCowNode(path, nullptr);
+        return;
+    }
+
+    if (unlikely(cow_nodes_count.load() != 0))
+    {
+        auto & bucket_cow_nodes = cowNodesOf(path);
+        auto it = bucket_cow_nodes.find(path);
+        if (it != bucket_cow_nodes.end())
+            eraseCowNode(bucket_cow_nodes, it);
+    }
+    data_tree.erase(path);
+}
+
+KeeperNodePtr KeeperStore::setNodeData(const String & path, String data, String * prev_data)
+{
+    auto node = getNodeForUpdate(path);
+    if (!node)
+        return nullptr;
+
+    MemoryUsage delta;
+    delta.data_bytes = static_cast<Int64>(data.size()) - static_cast<Int64>(node->data.size());
+    updateMemoryUsage(path, delta, true);
+
+    if (prev_data)
+        *prev_data = std::move(node->data);
+    node->data = std::move(data);
+    return node;
+}
+
+void KeeperStore::markDirty(const String & path)
+{
+    if (!track_dirty_paths || dirty_paths.overflow)
+        return;
+
+    dirty_paths.paths.insert(path);
+
+    /// A delta snapshot is no cheaper than a full one any more.
+    if (dirty_paths.paths.size() > getNodesCount() / 2 + 1024)
+    {
+        dirty_paths.overflow = true;
+        std::unordered_set<String>().swap(dirty_paths.paths);
+    }
+}
+
+void KeeperStore::enableDirtyPathsTracking()
+{
+    track_dirty_paths = true;
+}
+
+KeeperStore::DirtyPaths KeeperStore::takeDirtyPaths(UInt64 log_term, UInt64 log_index)
+{
+    /// Stay overflowed, so that no path is ever recorded.
+    if (!track_dirty_paths)
+        return DirtyPaths{.overflow = true};
+
+    DirtyPaths taken = std::move(dirty_paths);
+    dirty_paths = DirtyPaths{.base_log_term = log_term, .base_log_index = log_index};
+    return taken;
+}
+
+void KeeperStore::applySnapshotNode(const String & path, KeeperNodePtr node)
+{
+    if (auto prev_node = data_tree.get(path))
+    {
+        node->children = std::move(prev_node->children);
+        acl_map.removeUsage(prev_node->acl_id);
+        if (prev_node->stat.ephemeralOwner != 0)
+            eraseEphemeralNode(prev_node->stat.ephemeralOwner, path);
+    }
+    else if (path != "/")
+    {
+        auto parent = data_tree.get(getParentPath(path));
+        if (!parent)
+            throw RK::Exception(RK::ErrorCodes::LOGICAL_ERROR, "Can not find parent for node {}", path);
+        parent->children.insert(getBaseName(path));
+    }
+
+    acl_map.addUsage(node->acl_id);
+    if (node->stat.ephemeralOwner != 0)
+        addEphemeralNode(node->stat.ephemeralOwner, path);
+
+    data_tree.emplace(path, std::move(node));
+}
+
+void KeeperStore::applySnapshotRemovedNode(const String & path)
+{
+    auto prev_node = data_tree.get(path);
+    if (!prev_node)
+        return;
+
+    if (auto parent = data_tree.get(getParentPath(path)))
+        parent->children.erase(getBaseName(path));
+
+    acl_map.removeUsage(prev_node->acl_id);
+    if (prev_node->stat.ephemeralOwner != 0)
+        eraseEphemeralNode(prev_node->stat.ephemeralOwner, path);
+
+    data_tree.erase(path);
 }
 
-std::shared_ptr<KeeperStore::BucketNodes> KeeperStore::dumpDataTree()
+void KeeperStore::eraseEphemeralNode(int64_t session_id, const String & path)
 {
-    auto result = std::make_shared<KeeperStore::BucketNodes>();
-    ThreadPool object_thread_pool(DATA_TREE_BUCKET_NUM);
+    std::lock_guard lock(ephemerals_mutex);
+    auto it = ephemerals.find(session_id);
+    if (it == ephemerals.end())
+        return;
 
-    for (UInt32 thread_idx = 0; thread_idx < DATA_TREE_BUCKET_NUM; thread_idx++)
+    it->second.erase(path);
+    if (it->second.empty())
+        ephemerals.erase(it);
+}
+
+void KeeperStore::resetSessions()
+{
+    session_manager.reset();
     {
-        object_thread_pool.trySchedule(
-            [thread_idx, this, &result]
+        std::lock_guard lock(auth_mutex);
+        session_and_auth.clear();
+    }
+}
+
+void KeeperStore::setCowNode(const String & path, KeeperNodePtr node)
+{
+    Int64 in_data_tree = data_tree.count(path);
+    auto [it, inserted] = cowNodesOf(path).try_emplace(path);
+    if (inserted)
+        ++cow_nodes_count;
+    else
+        cow_nodes_delta -= static_cast<Int64>(it->second != nullptr) - in_data_tree;
+
+    it->second = std::move(node);
+    cow_nodes_delta += static_cast<Int64>(it->second != nullptr) - in_data_tree;
+}
+
+void KeeperStore::eraseCowNode(CowNodes & bucket_cow_nodes, CowNodes::iterator it)
+{
+    Int64 in_data_tree = data_tree.count(it->first);
+    cow_nodes_delta -= static_cast<Int64>(it->second != nullptr) - in_data_tree;
+    bucket_cow_nodes.erase(it);
+    --cow_nodes_count;
+}
+
+void KeeperStore::mergeCowNodes(size_t max_count, Buckets buckets)
+{
+    for (UInt32 bucket_id = 0; bucket_id < DATA_TREE_BUCKET_NUM && max_count > 0; ++bucket_id)
+    {
+        if (!(buckets & (Buckets(1) << bucket_id)))
+            continue;
+
+        auto & bucket_cow_nodes = cow_nodes[bucket_id];
+        for (; max_count > 0 && !bucket_cow_nodes.empty(); --max_count)
+        {
+            auto it = bucket_cow_nodes.begin();
+            String path = it->first;
+            KeeperNodePtr node = it->second;
+
+            /// Node count is not changed, the difference is moved from cow_nodes_delta to data tree.
+            eraseCowNode(bucket_cow_nodes, it);
+            if (node)
             {
-                for (UInt32 bucket_idx = 0; bucket_idx < DATA_TREE_BUCKET_NUM; bucket_idx++)
-                {
-                    if (bucket_idx % DATA_TREE_BUCKET_NUM != thread_idx)
-                        continue;
+                /// The node in data tree is replaced, so its children can be taken rather than copied.
+                node->children.unshare();
+                data_tree.emplace(path, std::move(node));
+            }
+            else
+                data_tree.erase(path);
+        }
+    }
+}
 
-                    LOG_INFO(log, "Dump data tree for bucket {}", bucket_idx);
+KeeperStore::BucketLocks::BucketLocks(KeeperStore & store_, Buckets buckets_, bool exclusive_) : store(store_), exclusive(exclusive_)
+{
+    if (exclusive && !INDEPENDENT_BUCKETS && buckets_ != 0)
+        buckets_ = ALL_BUCKETS;
 
-                    auto && bucket = this->data_tree.getMap(bucket_idx).getMap();
-                    auto & bucket_in_result = (*result)[bucket_idx];
-                    bucket_in_result.reserve(bucket.size());
+    try
+    {
+        for (UInt32 bucket_id = 0; bucket_id < DATA_TREE_BUCKET_NUM; ++bucket_id)
+        {
+            Buckets bucket = Buckets(1) << bucket_id;
+            if (!(buckets_ & bucket))
+                continue;
 
-                    size_t key_size = 0;
-                    for (auto it = bucket.begin(); it != bucket.end(); ++it)
-                    {
-                        auto data_size = it->first.size();
-                        key_size += data_size;
+            if (exclusive)
+                store.bucket_mutexes[bucket_id].mutex.lock();
+            else
+                store.bucket_mutexes[bucket_id].mutex.lock_shared();
+            buckets |= bucket;
+        }
+    }
+    catch (...)
+    {
+        unlock();
+        throw;
+    }
+}
 
-                        String path_copied;
-                        path_copied.resize(data_size);
-                        memcopy(path_copied.data(), it->first.data(), data_size);
+void KeeperStore::BucketLocks::unlock()
+{
+    for (UInt32 bucket_id = 0; bucket_id < DATA_TREE_BUCKET_NUM; ++bucket_id)
+    {
+        if (!(buckets & (Buckets(1) << bucket_id)))
+            continue;
 
-                        bucket_in_result.emplace_back(std::move(path_copied), it->second->cloneWithoutChildren());
+        if (exclusive)
+            store.bucket_mutexes[bucket_id].mutex.unlock();
+        else
+            store.bucket_mutexes[bucket_id].mutex.unlock_shared();
+    }
+    buckets = 0;
+}
 
-                        /// Prefetch the next element, may slightly improve performance in this case.
-                        auto next_it = std::next(it);
-                        if (likely(next_it != bucket.end()))
-                        {
-                            __builtin_prefetch(next_it->first.data(), 0, 3);
-                            __builtin_prefetch(next_it->second.get(), 0, 3);
-                        }
-                    }
-                    LOG_INFO(log, "Dump data tree for bucket {} done, key_size {}, result size {}", bucket_idx, key_size, bucket_in_result.size());
-                }
-            });
+KeeperStore::DataTreeViewPtr KeeperStore::pinDataTree()
+{
+    if (isDataTreePinned())
+        throw RK::Exception(ErrorCodes::LOGICAL_ERROR, "Data tree is already pinned by another snapshot");
+
+    /// Copy-on-write nodes of the last snapshot should have been merged when processing requests,
+    /// if not, merge them here. There is no write request being processed now, but read requests may be.
+    if (size_t count = cow_nodes_count.load())
+    {
+        BucketLocks locks(*this, ALL_BUCKETS, true);
+        LOG_INFO(log, "Merge {} copy-on-write nodes of the last snapshot into data tree", count);
+        mergeCowNodes(count, ALL_BUCKETS);
     }
 
-    object_thread_pool.wait();
-    return result;
+    data_tree_pinned.store(true, std::memory_order_release);
+    return std::make_shared<DataTreeView>(*this);
 }
 
 uint64_t KeeperStore::getApproximateDataSize() const
 {
-    UInt64 node_count = data_tree.size();
-    UInt64 size_bytes = data_tree.getBucketNum() * sizeof(DataTree::InnerMap) /* Inner map size */
-        + node_count * 8 / 0.75 /*hash map array size*/
-        + node_count * sizeof(KeeperNode) /*node size*/
-        + node_count * 100; /*path and child of node size*/
-    return size_bytes;
+    /// Hash table of data tree, a bucket pointer per node at load factor 0.75.
+    UInt64 data_tree_bytes = sizeof(DataTree) + getNodesCount() * 8 / 0.75;
+    return getMemoryUsage().totalBytes() + data_tree_bytes + acl_map.getACLsBytes();
+}
+
+KeeperStore::MemoryUsage KeeperStore::nodeMemoryUsage(const String & path, const KeeperNode & node)
+{
+    MemoryUsage usage;
+    usage.nodes = 1;
+    usage.path_bytes = static_cast<Int64>(path.size());
+    usage.data_bytes = static_cast<Int64>(node.data.size());
+    /// Root is not in any children set.
+    if (path != "/")
+        usage.children_bytes = static_cast<Int64>(path.size() - path.rfind('/') - 1 + KeeperNodeChildren::ENTRY_OVERHEAD_BYTES);
+    return usage;
+}
+
+void KeeperStore::AtomicMemoryUsage::apply(const MemoryUsage & usage, bool add)
+{
+    /// Single writer, no need for read-modify-write operations.
+    auto apply_field = [add](std::atomic<Int64> & field, Int64 value)
+    { field.store(field.load(std::memory_order_relaxed) + (add ? value : -value), std::memory_order_relaxed); };
+
+    apply_field(nodes, usage.nodes);
+    apply_field(path_bytes, usage.path_bytes);
+    apply_field(data_bytes, usage.data_bytes);
+    apply_field(children_bytes, usage.children_bytes);
+}
+
+KeeperStore::MemoryUsage KeeperStore::AtomicMemoryUsage::load() const
+{
+    MemoryUsage usage;
+    usage.nodes = nodes.load(std::memory_order_relaxed);
+    usage.path_bytes = path_bytes.load(std::memory_order_relaxed);
+    usage.data_bytes = data_bytes.load(std::memory_order_relaxed);
+    usage.children_bytes = children_bytes.load(std::memory_order_relaxed);
+    return usage;
+}
+
+void KeeperStore::updateMemoryUsage(const String & path, const MemoryUsage & usage, bool add)
+{
+    memory_usage.apply(usage, add);
+
+    /// Prefixes of "/a/b/c" are "/a", "/a/b" and "/a/b/c".
+    size_t depth = 0;
+    size_t pos = 0;
+    while (depth < memory_usage_prefix_depth && pos + 1 < path.size())
+    {
+        pos = path.find('/', pos + 1);
+        if (pos == String::npos)
+            pos = path.size();
+        ++depth;
+
+        std::string_view prefix(path.data(), pos);
+        auto it = memory_usage_by_prefix.find(prefix);
+        if (it == memory_usage_by_prefix.end())
+        {
+            std::lock_guard lock(memory_usage_prefix_mutex);
+            it = memory_usage_by_prefix.emplace(String(prefix), std::make_unique<AtomicMemoryUsage>()).first;
+        }
+
+        it->second->apply(usage, add);
+        if (it->second->nodes.load(std::memory_order_relaxed) == 0)
+        {
+            std::lock_guard lock(memory_usage_prefix_mutex);
+            memory_usage_by_prefix.erase(it);
+        }
+    }
+}
+
+void KeeperStore::clearMemoryUsage()
+{
+    memory_usage.apply(memory_usage.load(), false);
+    std::lock_guard lock(memory_usage_prefix_mutex);
+    memory_usage_by_prefix.clear();
+}
+
+KeeperStore::MemoryUsage KeeperStore::getMemoryUsage() const
+{
+    return memory_usage.load();
+}
+
+KeeperStore::MemoryUsageByPrefix KeeperStore::getMemoryUsageByPrefix() const
+{
+    MemoryUsageByPrefix result;
+    std::lock_guard lock(memory_usage_prefix_mutex);
+    for (const auto & [prefix, usage] : memory_usage_by_prefix)
+        result.emplace(prefix, usage->load());
+    return result;
+}
+
+void KeeperStore::dumpMemoryUsageByPrefix(WriteBufferFromOwnString & buf) const
+{
+    auto write_usage = [&buf](const String & prefix, const MemoryUsage & usage)
+    {
+        buf << prefix << "\t" << usage.nodes << "\t" << usage.path_bytes << "\t" << usage.data_bytes << "\t" << usage.children_bytes
+            << "\t" << usage.totalBytes() << "\n";
+    };
+
+    buf << "prefix\tnodes\tpath_bytes\tdata_bytes\tchildren_bytes\ttotal_bytes\n";
+    for (const auto & [prefix, usage] : getMemoryUsageByPrefix())
+        write_usage(prefix, usage);
+    write_usage("total", getMemoryUsage());
+    buf << "acl_bytes\t" << acl_map.getACLsBytes() << "\n";
+}
+
+void KeeperStore::rebuildMemoryUsage()
+{
+    clearMemoryUsage();
+
+    for (UInt32 bucket_id = 0; bucket_id < data_tree.getBucketNum(); bucket_id++)
+    {
+        data_tree.getMap(bucket_id).forEach([this](const String & path, const KeeperNodePtr & node)
+                                            { updateMemoryUsage(path, nodeMemoryUsage(path, *node), true); });
+    }
+
+    /// Copy-on-write nodes override their versions in data tree.
+    for (const auto & bucket_cow_nodes : cow_nodes)
+    {
+        for (const auto & [path, node] : bucket_cow_nodes)
+        {
+            if (auto prev_node = data_tree.get(path))
+                updateMemoryUsage(path, nodeMemoryUsage(path, *prev_node), false);
+            if (node)
+                updateMemoryUsage(path, nodeMemoryUsage(path, *node), true);
+        }
+    }
 }
 
 void KeeperStore::initializeSystemNodes()
 {
     auto add_node = [&](const String & path)
     {
-        if (!data_tree.count(path))
+        if (!exists(path))
         {
-            data_tree.emplace(path, std::make_shared<KeeperNode>());
-            getNode(getParentPath(path))->children.insert(getBaseName(path));
+            addNode(path, KeeperNode::create());
+            getNodeForUpdate(getParentPath(path))->children.insert(getBaseName(path));
         }
     };
 
@@ -1624,7 +2340,7 @@ void KeeperStore::initializeSystemNodes()
     add_node(CLICKHOUSE_KEEPER_SYSTEM_PATH);
     add_node(CLICKHOUSE_KEEPER_API_VERSION_PATH);
 
-    data_tree.get(CLICKHOUSE_KEEPER_API_VERSION_PATH)->data = toString(static_cast<uint8_t>(CURRENT_KEEPER_API_VERSION));
+    setNodeData(CLICKHOUSE_KEEPER_API_VERSION_PATH, toString(static_cast<uint8_t>(CURRENT_KEEPER_API_VERSION)));
 #endif
 }
 
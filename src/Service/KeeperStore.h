@@ -1,14 +1,20 @@
 #pragma once
 
 #include <functional>
+#include <map>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/smart_ptr/intrusive_ptr.hpp>
+#include <boost/smart_ptr/intrusive_ref_counter.hpp>
 #include <Service/ACLMap.h>
 #include <Service/SessionManager.h>
 #include <Service/WatchManager.h>
 #include <Service/ThreadSafeQueue.h>
 #include <Service/KeeperCommon.h>
+#include <Service/KeeperNodeChildren.h>
+#include <Service/KeeperNodeTrie.h>
 #include <Service/formatHex.h>
 #include <ZooKeeper/IKeeper.h>
 #include <Poco/Logger.h>
@@ -22,12 +28,17 @@
 namespace RK
 {
 
+struct KeeperNode;
+
+/// Nodes are reference counted intrusively, there is no separate control block like shared_ptr.
+using KeeperNodePtr = boost::intrusive_ptr<KeeperNode>;
+
 /**
  * Represent an entry in data tree.
  */
-struct KeeperNode
+struct KeeperNode : public boost::intrusive_ref_counter<KeeperNode>
 {
-    using ChildrenSet = std::unordered_set<String>;
+    using ChildrenSet = KeeperNodeChildren;
 
     String data;
     uint64_t acl_id = 0;
@@ -38,8 +49,12 @@ struct KeeperNode
     Coordination::Stat stat{};
     ChildrenSet children;
 
-    std::shared_ptr<KeeperNode> clone() const;
-    std::shared_ptr<KeeperNode> cloneWithoutChildren() const;
+    static KeeperNodePtr create() { return KeeperNodePtr(new KeeperNode); }
+
+    KeeperNodePtr clone() const;
+    KeeperNodePtr cloneWithoutChildren() const;
+    /// Copy sharing children with this node, which is kept alive until the copy unshares them.
+    KeeperNodePtr cloneSharingChildren();
 
     /// All stat for client should be generated by this function.
     /// This method will remove numChildren from persisted stat.
@@ -51,9 +66,16 @@ struct KeeperNode
             && children == rhs.children;
     }
     bool operator!=(const KeeperNode & rhs) const { return !(rhs == *this); }
-};
 
-using KeeperNodePtr = std::shared_ptr<KeeperNode>;
+#ifdef KEEPER_NODE_SLAB_ALLOCATOR
+    /// Allocate nodes from a slab pool instead of malloc, see SlabAllocator.
+    static void * operator new(size_t size);
+    static void operator delete(void * ptr, size_t size);
+
+    /// Used bytes and bytes allocated from the system of the slab pool.
+    static std::pair<size_t, size_t> slabStatistics();
+#endif
+};
 
 struct KeeperNodeWithPath
 {
@@ -62,58 +84,250 @@ struct KeeperNodeWithPath
 };
 
 /// KeeperNodeMap is a two-level unordered_map which is designed to reduce latency for unordered_map scaling.
-/// It is not a thread-safe map. But it is accessed only in the request processor thread.
+/// It is not a thread-safe map, buckets are locked by KeeperStore when read requests are processed in several threads.
 template <typename Value, unsigned NumBuckets>
 class KeeperNodeMap
 {
 public:
     using Key = String;
-    using ValuePtr = std::shared_ptr<Value>;
+    using ValuePtr = boost::intrusive_ptr<Value>;
     using NestedMap = std::unordered_map<String, ValuePtr>;
-    using Action = std::function<void(const String &, const ValuePtr &)>;
 
+    /// InnerMap grows incrementally just like redis dict. When 'map' is going to exceed its load factor,
+    /// it is moved to 'rehashing_map' and a new map with double capacity takes its place, then every
+    /// write operation moves a few nodes from 'rehashing_map' to 'map'. So no single operation pays
+    /// for a full rehash of millions of nodes. The bucket array of the new map is allocated in background
+    /// when 'map' is 3/4 full and the old one is released in background, so neither does any operation
+    /// pay for allocating or releasing a large bucket array.
     class InnerMap
     {
     public:
+        InnerMap() = default;
+        ~InnerMap() { waitBackgroundTask(); }
+
+        /// Nodes moved per write operation, must be large enough to drain 'rehashing_map' before 'map' is full again.
+        static constexpr size_t REHASH_STEP = 8;
+        /// Smaller maps are rehashed by unordered_map itself.
+        static constexpr size_t MIN_INCREMENTAL_REHASH_SIZE = 4096;
+
+        /// Read only, rehashing is driven by write operations.
         ValuePtr get(const String & key)
         {
             auto i = map.find(key);
-            return (i != map.end()) ? i->second : nullptr;
+            if (i != map.end())
+                return i->second;
+
+            if (isRehashing())
+            {
+                i = rehashing_map.find(key);
+                if (i != rehashing_map.end())
+                    return i->second;
+            }
+            return nullptr;
         }
 
         template <typename T>
         bool emplace(const String & key, T && value)
         {
-            return map.insert_or_assign(key, value).second;
+            rehashStep();
+
+            if (isRehashing())
+            {
+                auto node = rehashing_map.extract(key);
+                if (!node.empty())
+                {
+                    node.mapped() = std::forward<T>(value);
+                    prepareInsert();
+                    map.insert(std::move(node));
+                    prepareNextMap();
+                    return false;
+                }
+            }
+
+            auto i = map.find(key);
+            if (i != map.end())
+            {
+                i->second = std::forward<T>(value);
+                return false;
+            }
+
+            prepareInsert();
+            map.emplace(key, std::forward<T>(value));
+            prepareNextMap();
+            return true;
         }
 
         bool erase(const String & key)
         {
-            return map.erase(key);
+            rehashStep();
+            if (map.erase(key))
+                return true;
+            return isRehashing() && rehashing_map.erase(key);
         }
 
         size_t size() const
         {
-            return map.size();
+            return map.size() + rehashing_map.size();
         }
 
         void clear()
         {
+            waitBackgroundTask();
+            next_map.reset();
+            next_map_requested = false;
             map.clear();
+            rehashing_map.clear();
         }
 
-        void forEach(const Action & fn)
+        template <typename F>
+        void forEach(F && fn)
         {
-            for (const auto & [key, value] : map)
-                fn(key, value);
+            forEachIn(map, fn);
+            forEachIn(rehashing_map, fn);
         }
 
+        bool isRehashing() const { return !rehashing_map.empty(); }
+
         /// This method will destroy InnerMap thread safety property.
         /// Deprecated, please use forEach instead.
-        NestedMap & getMap() { return map; }
+        NestedMap & getMap()
+        {
+            finishRehash();
+            return map;
+        }
 
     private:
+        template <typename F>
+        static void forEachIn(const NestedMap & nested_map, F & fn)
+        {
+            for (auto it = nested_map.begin(); it != nested_map.end(); ++it)
+            {
+                /// Prefetch the next element, may slightly improve performance in this case.
+                auto next_it = std::next(it);
+                if (likely(next_it != nested_map.end()))
+                {
+                    __builtin_prefetch(next_it->first.data(), 0, 3);
+                    __builtin_prefetch(next_it->second.get(), 0, 3);
+                }
+                fn(it->first, it->second);
+            }
+        }
+
+        /// Nodes 'map' can hold without rehashing itself.
+        size_t capacity() const { return static_cast<size_t>(map.bucket_count() * map.max_load_factor()); }
+
+        /// Make sure inserting a node into 'map' will not trigger a full rehash of it.
+        void prepareInsert()
+        {
+            if (map.size() + 1 <= capacity() || map.size() < MIN_INCREMENTAL_REHASH_SIZE)
+                return;
+
+            /// Should not happen, rehashing is always done before 'map' is full.
+            if (unlikely(isRehashing()))
+                finishRehash();
+
+            /// Only the bucket array is allocated, nodes are moved later. Usually it is already
+            /// allocated in background, wait for it if it is not finished yet.
+            size_t new_capacity = capacity() * 2;
+            waitBackgroundTask();
+
+            NestedMap new_map;
+            if (next_map && next_map_capacity == new_capacity)
+            {
+                new_map.swap(*next_map);
+            }
+            else
+            {
+                new_map.max_load_factor(map.max_load_factor());
+                new_map.reserve(new_capacity);
+            }
+            next_map.reset();
+            next_map_requested = false;
+
+            rehashing_map.swap(map);
+            map.swap(new_map);
+        }
+
+        /// Allocate the bucket array of the next map in background when 'map' is 3/4 full.
+        void prepareNextMap()
+        {
+            if (next_map_requested || map.size() < MIN_INCREMENTAL_REHASH_SIZE || map.size() * 4 < capacity() * 3)
+                return;
+
+            next_map_requested = true;
+            next_map_capacity = capacity() * 2;
+            runInBackground(
+                [this, new_capacity = next_map_capacity, load_factor = map.max_load_factor()]
+                {
+                    /// If it fails, the bucket array is allocated in 'prepareInsert'.
+                    try
+                    {
+                        auto new_map = std::make_unique<NestedMap>();
+                        new_map->max_load_factor(load_factor);
+                        new_map->reserve(new_capacity);
+                        next_map = std::move(new_map);
+                    }
+                    catch (...)
+                    {
+                    }
+                });
+        }
+
+        void rehashStep()
+        {
+            for (size_t i = 0; i < REHASH_STEP && isRehashing(); ++i)
+                map.insert(rehashing_map.extract(rehashing_map.begin()));
+
+            /// Release the bucket array of the old map in background.
+            if (!isRehashing() && rehashing_map.bucket_count() > 1)
+            {
+                auto old_map = std::make_shared<NestedMap>();
+                old_map->swap(rehashing_map);
+                /// The last reference may be dropped in either thread, release the bucket array explicitly.
+                runInBackground([old_map] { NestedMap().swap(*old_map); });
+            }
+        }
+
+        void finishRehash()
+        {
+            while (isRehashing())
+                map.insert(rehashing_map.extract(rehashing_map.begin()));
+            NestedMap().swap(rehashing_map);
+        }
+
+        /// Run task in background after the former one is finished, or in place if no thread is available.
+        void runInBackground(std::function<void()> task)
+        {
+            waitBackgroundTask();
+            try
+            {
+                background_thread = std::make_unique<ThreadFromGlobalPool>(task);
+            }
+            catch (...)
+            {
+                task();
+            }
+        }
+
+        void waitBackgroundTask()
+        {
+            if (background_thread)
+            {
+                background_thread->join();
+                background_thread.reset();
+            }
+        }
+
         NestedMap map;
+        NestedMap rehashing_map;
+
+        /// Empty map with the bucket array for 'next_map_capacity' nodes, it is set by 'background_thread'
+        /// and accessed only after the thread is joined.
+        std::unique_ptr<NestedMap> next_map;
+        size_t next_map_capacity = 0;
+        bool next_map_requested = false;
+        /// Allocate the next bucket array or release the old one.
+        std::unique_ptr<ThreadFromGlobalPool> background_thread;
     };
 
 private:
@@ -185,7 +399,23 @@ class KeeperStore
 public:
     /// bucket num for KeeperNodeMap
     static constexpr int DATA_TREE_BUCKET_NUM = 16;
+    /// How many copy-on-write nodes are merged back to data tree when processing a request
+    static constexpr size_t COW_NODES_MERGE_STEP = 16;
+#ifdef DATA_TREE_ENGINE_TRIE
+    using DataTree = KeeperNodeTrie<KeeperNode, DATA_TREE_BUCKET_NUM>;
+#else
     using DataTree = KeeperNodeMap<KeeperNode, DATA_TREE_BUCKET_NUM>;
+#endif
+
+    /// Set of data tree buckets, bit i stands for bucket i.
+    using Buckets = UInt32;
+    static constexpr Buckets ALL_BUCKETS = (1ULL << DATA_TREE_BUCKET_NUM) - 1;
+#ifdef DATA_TREE_ENGINE_TRIE
+    /// Trie nodes are shared by buckets, so a write request locks all buckets.
+    static constexpr bool INDEPENDENT_BUCKETS = false;
+#else
+    static constexpr bool INDEPENDENT_BUCKETS = true;
+#endif
 
     using KeeperResponsesQueue = ThreadSafeQueue<ResponseForSession>;
 
@@ -197,9 +427,31 @@ public:
     using Edge = std::pair<String, String>;
     using Edges = std::vector<Edge>;
     using BucketEdges = std::array<Edges, DATA_TREE_BUCKET_NUM>;
-    using BucketNodes = std::array<std::vector<std::pair<String, std::shared_ptr<KeeperNode>>>, DATA_TREE_BUCKET_NUM>;
+    using BucketNodes = std::array<std::vector<std::pair<String, KeeperNodePtr>>, DATA_TREE_BUCKET_NUM>;
+
+    /// Estimated memory used by data tree nodes, computed from sizes of node parts rather than measured
+    /// from the allocator: string capacity, allocator rounding and the sorted cache of children sets are
+    /// not included. Distinct ACLs are shared by nodes and are accounted by ACLMap.
+    struct MemoryUsage
+    {
+        Int64 nodes = 0;
+        /// Bytes of node paths in data tree
+        Int64 path_bytes = 0;
+        Int64 data_bytes = 0;
+        /// Bytes of names in the children set of parent
+        Int64 children_bytes = 0;
+
+        /// Fixed size part of nodes, including stat and ACL id, plus variable size parts.
+        Int64 totalBytes() const { return nodes * static_cast<Int64>(sizeof(KeeperNode)) + path_bytes + data_bytes + children_bytes; }
+
+        MemoryUsage & operator+=(const MemoryUsage & rhs);
+        MemoryUsage & operator-=(const MemoryUsage & rhs);
+    };
+
+    using MemoryUsageByPrefix = std::map<String, MemoryUsage, std::less<>>;
 
-    explicit KeeperStore(int64_t dead_session_check_period_ms, const String & super_digest_ = "");
+    /// memory_usage_prefix_depth_ is the max depth of path prefixes memory usage is aggregated by, 0 means disabled.
+    explicit KeeperStore(int64_t dead_session_check_period_ms, const String & super_digest_ = "", size_t memory_usage_prefix_depth_ = 0);
 
     /// process request
     void processRequest(
@@ -222,8 +474,51 @@ public:
     /// Clear whole store and set to initial state.
     void reset();
 
-    /// Used when creating snapshot
-    std::shared_ptr<BucketNodes> dumpDataTree();
+    /// A frozen view of data tree for creating snapshot. Data tree is copy-on-write until the view is
+    /// destroyed, so the view can be read in another thread while write requests are being applied.
+    class DataTreeView
+    {
+    public:
+        explicit DataTreeView(KeeperStore & store_) : store(store_) { }
+        ~DataTreeView() { store.unpinDataTree(); }
+
+        DataTree & getDataTree() { return store.data_tree; }
+        size_t size() const { return store.data_tree.size(); }
+
+    private:
+        KeeperStore & store;
+    };
+
+    using DataTreeViewPtr = std::shared_ptr<DataTreeView>;
+
+    /// Pin data tree in O(1) for creating snapshot, must run on the request processor thread (or when it is not
+    /// running), see RequestProcessor::runInProcessorThread, so that no write request is being processed.
+    DataTreeViewPtr pinDataTree();
+
+    /// Paths of nodes created, changed or removed since a snapshot, used to create delta snapshot on it.
+    struct DirtyPaths
+    {
+        std::unordered_set<String> paths;
+        /// Too many nodes are changed and paths are not tracked, or the base snapshot is unknown.
+        bool overflow = false;
+        /// Snapshot the paths are relative to.
+        UInt64 base_log_term = 0;
+        UInt64 base_log_index = 0;
+    };
+
+    /// Take paths changed since the last snapshot and track changes since the snapshot of log term and index
+    /// from now on. Same threading requirement as pinDataTree, usually invoked together with it.
+    DirtyPaths takeDirtyPaths(UInt64 log_term, UInt64 log_index);
+
+    /// Dirty paths are only tracked when delta snapshots are enabled, otherwise they are always overflowed.
+    void enableDirtyPathsTracking();
+
+    /// Nodes in a delta snapshot replace the ones in data tree, invoked when loading snapshot.
+    void applySnapshotNode(const String & path, KeeperNodePtr node);
+    void applySnapshotRemovedNode(const String & path);
+
+    /// Clear sessions before loading the ones in a delta snapshot.
+    void resetSessions();
 
     int64_t getZxid() const
     {
@@ -272,25 +567,34 @@ public:
         return data_tree.getBucketNum();
     }
 
+    /// The returned node must not be modified, use getNodeForUpdate instead.
     inline KeeperNodePtr getNode(const String & path)
     {
+        if (unlikely(cow_nodes_count.load(std::memory_order_relaxed) != 0))
+        {
+            const auto & bucket_cow_nodes = cowNodesOf(path);
+            auto it = bucket_cow_nodes.find(path);
+            if (it != bucket_cow_nodes.end())
+                return it->second;
+        }
         return data_tree.get(path);
     }
 
     inline bool exists(const String & path)
     {
-        return data_tree.count(path);
+        return getNode(path) != nullptr;
     }
 
-    inline void addNode(const String & path, KeeperNodePtr node)
-    {
-        data_tree.emplace(path, node);
-    }
+    /// Get a node which is going to be modified. If data tree is pinned by a snapshot, the node is copied on write,
+    /// the copy shares children with the pinned node.
+    KeeperNodePtr getNodeForUpdate(const String & path);
 
-    inline void removeNode(const String & path)
-    {
-        data_tree.erase(path);
-    }
+    void addNode(const String & path, KeeperNodePtr node);
+    void removeNode(const String & path);
+
+    /// Replace data of node, return the updated node or nullptr if node does not exist.
+    /// Previous data is moved to 'prev_data' if it is not null.
+    KeeperNodePtr setNodeData(const String & path, String data, String * prev_data = nullptr);
 
     inline void addEphemeralNode(int64_t session_id, const String & path)
     {
@@ -312,9 +616,19 @@ public:
 
     /// Introspection functions mostly used in 4-letter commands ///
 
-    uint64_t getNodesCount() const { return data_tree.size(); }
+    uint64_t getNodesCount() const { return data_tree.size() + cow_nodes_delta.load(); }
     uint64_t getApproximateDataSize() const;
 
+    /// Memory usage is updated by the request processor without lock, so a result read concurrently
+    /// may mix fields before and after a request. It is approximate, for monitoring only.
+    MemoryUsage getMemoryUsage() const;
+    /// Memory usage aggregated by path prefixes, for example "/a" and "/a/b" for node "/a/b/c" if depth is 2.
+    MemoryUsageByPrefix getMemoryUsageByPrefix() const;
+    void dumpMemoryUsageByPrefix(WriteBufferFromOwnString & buf) const;
+
+    /// Recalculate memory usage after data tree is built without addNode, for example loading snapshot.
+    void rebuildMemoryUsage();
+
     uint64_t getSessionWithEphemeralNodesCount() const
     {
         std::lock_guard lock(ephemerals_mutex);
@@ -369,6 +683,12 @@ public:
         return data_tree.getBucketIndex(path);
     }
 
+    /// Bucket a request should lock to access the node.
+    inline Buckets bucketOf(const String & path)
+    {
+        return Buckets(1) << data_tree.getBucketIndex(path);
+    }
+
     ACLMap & getACLMap()
     {
         return acl_map;
@@ -421,12 +741,102 @@ public:
     ACLMap acl_map;
 
 private:
+    using CowNodes = std::unordered_map<String, KeeperNodePtr>;
+
+    /// Lock data tree buckets in ascending order. Read requests lock buckets of the nodes they read in shared mode
+    /// and write requests lock buckets of the nodes they modify exclusively, so read requests are processed by
+    /// several threads while write requests are being applied.
+    class BucketLocks : private boost::noncopyable
+    {
+    public:
+        BucketLocks(KeeperStore & store_, Buckets buckets_, bool exclusive_);
+        ~BucketLocks() { unlock(); }
+
+        /// Buckets which are actually locked, all of them for a write request if buckets are not independent.
+        Buckets getBuckets() const { return buckets; }
+
+    private:
+        void unlock();
+
+        KeeperStore & store;
+        Buckets buckets = 0;
+        bool exclusive;
+    };
+
     int64_t fetchAndGetZxid() { return zxid++; }
+
+    void unpinDataTree() { data_tree_pinned.store(false, std::memory_order_release); }
+    bool isDataTreePinned() const { return data_tree_pinned.load(std::memory_order_acquire); }
+
+    void markDirty(const String & path);
+    /// Remove ephemeral node of session, and the session if it has no ephemeral nodes any more.
+    void eraseEphemeralNode(int64_t session_id, const String & path);
+
+    CowNodes & cowNodesOf(const String & path) { return cow_nodes[data_tree.getBucketIndex(path)]; }
+    void setCowNode(const String & path, KeeperNodePtr node);
+    void eraseCowNode(CowNodes & bucket_cow_nodes, CowNodes::iterator it);
+    /// Move copy-on-write nodes in the buckets back to data tree, the buckets must be locked exclusively.
+    void mergeCowNodes(size_t max_count, Buckets buckets);
     void cleanEphemeralNodes(int64_t session_id, ThreadSafeQueue<ResponseForSession> & responses_queue, bool ignore_response);
 
+    /// Depends only on the path and node content, so adding and later removing a node cancel out exactly.
+    static MemoryUsage nodeMemoryUsage(const String & path, const KeeperNode & node);
+    /// Only invoked by the thread applying requests or loading snapshot, so it is lock free except
+    /// when a prefix is added or removed.
+    void updateMemoryUsage(const String & path, const MemoryUsage & usage, bool add);
+    void clearMemoryUsage();
+
     /// data tree
     DataTree data_tree;
 
+    /// Whether data tree is pinned by a snapshot.
+    std::atomic<bool> data_tree_pinned{false};
+
+    /// Nodes modified when data tree is pinned by data tree bucket, nullptr means the node is removed. They are
+    /// moved back to data tree incrementally when processing requests after the snapshot is done.
+    std::array<CowNodes, DATA_TREE_BUCKET_NUM> cow_nodes;
+    /// Total size of cow_nodes, read requests skip looking up cow_nodes if it is 0.
+    std::atomic<size_t> cow_nodes_count{0};
+
+    /// Node count difference between cow_nodes and data tree.
+    std::atomic<Int64> cow_nodes_delta{0};
+
+    /// Base snapshot is unknown until a snapshot is loaded or created.
+    DirtyPaths dirty_paths{.overflow = true};
+    bool track_dirty_paths = false;
+
+    /// Aligned to cache line so that reader threads locking different buckets do not contend.
+    struct alignas(64) BucketMutex
+    {
+        std::shared_mutex mutex;
+    };
+    std::array<BucketMutex, DATA_TREE_BUCKET_NUM> bucket_mutexes;
+
+    /// MemoryUsage with a single writer and concurrent readers, fields are read independently.
+    struct AtomicMemoryUsage
+    {
+        std::atomic<Int64> nodes{0};
+        std::atomic<Int64> path_bytes{0};
+        std::atomic<Int64> data_bytes{0};
+        std::atomic<Int64> children_bytes{0};
+
+        void apply(const MemoryUsage & usage, bool add);
+        MemoryUsage load() const;
+    };
+
+    struct StringViewHash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view str) const { return std::hash<std::string_view>{}(str); }
+    };
+
+    /// Maintained incrementally when nodes are added, removed or their data is set.
+    AtomicMemoryUsage memory_usage;
+    std::unordered_map<String, std::unique_ptr<AtomicMemoryUsage>, StringViewHash, std::equal_to<>> memory_usage_by_prefix;
+    size_t memory_usage_prefix_depth;
+    /// Protect structure of memory_usage_by_prefix, values are updated without lock.
+    mutable std::mutex memory_usage_prefix_mutex;
+
     SessionManager session_manager;
     WatchManager watch_manager;
 
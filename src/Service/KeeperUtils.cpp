@@ -1,5 +1,7 @@
 #include <Service/KeeperUtils.h>
 
+#include <limits>
+
 #include <Poco/Base64Encoder.h>
 #include <Poco/SHA1Engine.h>
 
@@ -21,6 +23,7 @@ namespace RK
 namespace ErrorCodes
 {
     extern const int INVALID_CONFIG_PARAMETER;
+    extern const int CORRUPTED_LOG;
 }
 
 String checkAndGetSuperDigest(const String & user_and_digest)
@@ -37,19 +40,29 @@ String checkAndGetSuperDigest(const String & user_and_digest)
     return user_and_digest;
 }
 
-ptr<buffer> serializeKeeperRequest(const RequestForSession & request)
+namespace
+{
+
+/// A batch log entry starts with a session id which is never used and a negative request length,
+/// followed by requests count and requests each in the format of single request entry. Single request
+/// entry starts with session id and a non-negative request length, so they can not be confused.
+constexpr int64_t BATCH_ENTRY_SESSION_ID = std::numeric_limits<int64_t>::min();
+constexpr int32_t BATCH_ENTRY_LENGTH = -1;
+/// Session id, length and requests count
+constexpr size_t BATCH_ENTRY_HEADER_SIZE = sizeof(int64_t) + sizeof(int32_t) + sizeof(int32_t);
+/// Session id, length, xid, opnum and create time of a request without body
+constexpr size_t MIN_REQUEST_SIZE = sizeof(int64_t) + sizeof(int32_t) + sizeof(int32_t) + sizeof(int32_t) + sizeof(int64_t);
+
+void writeKeeperRequest(const RequestForSession & request, WriteBuffer & out)
 {
-    WriteBufferFromNuraftBuffer out;
     writeIntBinary(request.session_id, out);
     request.request->write(out);
     Coordination::write(request.create_time, out);
-    return out.getBuffer();
 }
 
-ptr<RequestForSession> deserializeKeeperRequest(nuraft::buffer & data)
+ptr<RequestForSession> readKeeperRequest(ReadBuffer & buffer)
 {
     ptr<RequestForSession> request = cs_new<RequestForSession>();
-    ReadBufferFromNuRaftBuffer buffer(data);
     readIntBinary(request->session_id, buffer);
 
     int32_t length;
@@ -73,6 +86,72 @@ ptr<RequestForSession> deserializeKeeperRequest(nuraft::buffer & data)
     return request;
 }
 
+}
+
+bool isBatchEntry(nuraft::buffer & data)
+{
+    if (data.size() < sizeof(int64_t) + sizeof(int32_t))
+        return false;
+
+    ReadBufferFromNuRaftBuffer buffer(data);
+    int64_t session_id;
+    readIntBinary(session_id, buffer);
+    int32_t length;
+    Coordination::read(length, buffer);
+    return session_id == BATCH_ENTRY_SESSION_ID && length == BATCH_ENTRY_LENGTH;
+}
+
+ptr<buffer> serializeKeeperRequest(const RequestForSession & request)
+{
+    WriteBufferFromNuraftBuffer out;
+    writeKeeperRequest(request, out);
+    return out.getBuffer();
+}
+
+ptr<RequestForSession> deserializeKeeperRequest(nuraft::buffer & data)
+{
+    ReadBufferFromNuRaftBuffer buffer(data);
+    return readKeeperRequest(buffer);
+}
+
+ptr<buffer> serializeKeeperRequests(const RequestsForSessions & requests)
+{
+    WriteBufferFromNuraftBuffer out;
+    writeIntBinary(BATCH_ENTRY_SESSION_ID, out);
+    Coordination::write(BATCH_ENTRY_LENGTH, out);
+    Coordination::write(static_cast<int32_t>(requests.size()), out);
+    for (const auto & request : requests)
+        writeKeeperRequest(request, out);
+    return out.getBuffer();
+}
+
+std::vector<ptr<RequestForSession>> deserializeKeeperRequests(nuraft::buffer & data)
+{
+    std::vector<ptr<RequestForSession>> requests;
+    if (!isBatchEntry(data))
+    {
+        requests.push_back(deserializeKeeperRequest(data));
+        return requests;
+    }
+
+    ReadBufferFromNuRaftBuffer buffer(data);
+    buffer.ignore(sizeof(int64_t) + sizeof(int32_t));
+
+    int32_t count;
+    Coordination::read(count, buffer);
+
+    /// Do not trust the count before reserving memory for it.
+    size_t remaining_bytes = data.size() - BATCH_ENTRY_HEADER_SIZE;
+    if (count < 0 || static_cast<size_t>(count) > remaining_bytes / MIN_REQUEST_SIZE)
+        throw Exception(
+            ErrorCodes::CORRUPTED_LOG, "Batch log entry is corrupted, {} requests can not be in {} bytes", count, remaining_bytes);
+
+    requests.reserve(count);
+    for (int32_t i = 0; i < count; ++i)
+        requests.push_back(readKeeperRequest(buffer));
+    return requests;
+}
+
 ptr<log_entry> cloneLogEntry(const ptr<log_entry> & entry)
 {
     ptr<log_entry> cloned = cs_new<log_entry>(
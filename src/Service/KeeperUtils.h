@@ -25,6 +25,13 @@ inline UInt64 getCurrentTimeMicroseconds()
 nuraft::ptr<nuraft::buffer> serializeKeeperRequest(const RequestForSession & request);
 nuraft::ptr<RequestForSession> deserializeKeeperRequest(nuraft::buffer & data);
 
+/// Serialize a batch of requests to one log entry, which saves per entry costs of raft and log store.
+nuraft::ptr<nuraft::buffer> serializeKeeperRequests(const RequestsForSessions & requests);
+/// Deserialize requests from a log entry, both single request entry and batch entry are accepted.
+std::vector<nuraft::ptr<RequestForSession>> deserializeKeeperRequests(nuraft::buffer & data);
+/// Whether a log entry is serialized by serializeKeeperRequests
+bool isBatchEntry(nuraft::buffer & data);
+
 nuraft::ptr<nuraft::log_entry> cloneLogEntry(const nuraft::ptr<nuraft::log_entry> & entry);
 
 /// Parent of a path, for example: got '/a/b' from '/a/b/c'
@@ -32,6 +39,26 @@ String getParentPath(const String & path);
 /// Base name of a path, for example: got 'c' from '/a/b/c'
 String getBaseName(const String & path);
 
+/// Invoke fn for every component of a path from top to bottom, for example: 'a', 'b' and 'c' of '/a/b/c',
+/// stop and return false if fn returns false. Root path has no component.
+template <typename F>
+bool forEachPathComponent(std::string_view path, F && fn)
+{
+    if (path.size() <= 1)
+        return true;
+
+    size_t begin = 1;
+    while (true)
+    {
+        size_t end = path.find('/', begin);
+        if (!fn(path.substr(begin, end == std::string_view::npos ? std::string_view::npos : end - begin)))
+            return false;
+        if (end == std::string_view::npos)
+            return true;
+        begin = end + 1;
+    }
+}
+
 String base64Encode(const String & decoded);
 String getSHA1(const String & userdata);
 String generateDigest(const String & userdata);
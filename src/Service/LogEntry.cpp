@@ -23,13 +23,18 @@ ptr<buffer> LogEntryBody::serialize(const ptr<log_entry> & entry)
 
 ptr<log_entry> LogEntryBody::deserialize(const ptr<buffer> & serialized_entry)
 {
-    auto type = static_cast<nuraft::log_val_type>(*serialized_entry->data_begin());
-    auto data = buffer::alloc(serialized_entry->size() - 1);
+    return deserialize(reinterpret_cast<const char *>(serialized_entry->data_begin()), serialized_entry->size());
+}
 
-    data->put_raw(serialized_entry->data_begin() + 1, serialized_entry->size() - 1);
-    data->pos(0);
+ptr<log_entry> LogEntryBody::deserialize(const char * data, size_t size)
+{
+    auto type = static_cast<nuraft::log_val_type>(*data);
+    auto entry_data = buffer::alloc(size - 1);
+
+    entry_data->put_raw(reinterpret_cast<const byte *>(data + 1), size - 1);
+    entry_data->pos(0);
 
-    return cs_new<log_entry>(0, data, type); /// TODO term is set latter, it is not an intuitive way
+    return cs_new<log_entry>(0, entry_data, type); /// TODO term is set latter, it is not an intuitive way
 }
 
 }
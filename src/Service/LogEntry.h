@@ -20,7 +20,7 @@ struct LogEntryHeader
     /// The length of the batch data (uncompressed)
     UInt32 data_length;
 
-    /// The CRC32C of the log.
+    /// The CRC32C of the log, CRC32 for log segment before V2.
     /// If compression is enabled, this is the checksum of the compressed data.
     UInt32 data_crc;
 
@@ -39,6 +39,8 @@ class LogEntryBody
 public:
     static ptr<buffer> serialize(const ptr<log_entry> & entry);
     static ptr<log_entry> deserialize(const ptr<buffer> & serialized_entry);
+    /// Deserialize from memory, for example a mapped log segment file, data is copied once.
+    static ptr<log_entry> deserialize(const char * data, size_t size);
 };
 
 }
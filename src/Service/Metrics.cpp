@@ -135,6 +135,12 @@ Metrics::Metrics()
     snap_time_ms = getSummary("snap_time_ms", SummaryLevel::SIMPLE);
     snap_blocking_time_ms = getSummary("snap_blocking_time_ms", SummaryLevel::SIMPLE);
     snap_count = getSummary("snap_count", SummaryLevel::SIMPLE);
+    snap_uncompressed_bytes = getSummary("snap_uncompressed_bytes", SummaryLevel::SIMPLE);
+    snap_compressed_bytes = getSummary("snap_compressed_bytes", SummaryLevel::SIMPLE);
+    snap_compression_time_us = getSummary("snap_compression_time_us", SummaryLevel::SIMPLE);
+    snap_decompression_time_us = getSummary("snap_decompression_time_us", SummaryLevel::SIMPLE);
+
+    replay_log_entries_per_second = getSummary("replay_log_entries_per_second", SummaryLevel::SIMPLE);
 }
 
 SummaryPtr Metrics::getSummary(const RK::String & name, RK::SummaryLevel level)
@@ -199,6 +199,11 @@ public:
     SummaryPtr snap_time_ms;
     SummaryPtr snap_blocking_time_ms;
     SummaryPtr snap_count;
+    SummaryPtr snap_uncompressed_bytes;
+    SummaryPtr snap_compressed_bytes;
+    SummaryPtr snap_compression_time_us;
+    SummaryPtr snap_decompression_time_us;
+    SummaryPtr replay_log_entries_per_second;
 
 private:
     Metrics();
@@ -1,50 +1,214 @@
 #include <Service/NuRaftFileLogStore.h>
+#include <Common/BitHelpers.h>
 #include <Common/setThreadName.h>
 
 namespace RK
 {
 using namespace nuraft;
 
-ptr<log_entry> LogEntryQueue::getEntry(const UInt64 & index)
+LogEntryCache::LogEntryCache(UInt64 capacity_)
+    : capacity(capacity_ / WORD_SIZE * WORD_SIZE)
+    , slot_count(roundUpToPowerOfTwoOrZero(std::max<UInt64>(capacity_ / BYTES_PER_SLOT, 1024)))
+    , slot_mask(slot_count - 1)
 {
-    std::shared_lock read_lock(queue_mutex);
+}
+
+void LogEntryCache::allocate()
+{
+    arena.reset(new std::atomic<UInt64>[capacity / WORD_SIZE]);
+    slots.reset(new Slot[slot_count]);
+}
+
+void LogEntryCache::copyToArena(UInt64 offset, const nuraft::byte * data, UInt64 size)
+{
+    std::atomic<UInt64> * words = arena.get() + offset / WORD_SIZE;
+    for (UInt64 i = 0; i < size; i += WORD_SIZE)
+    {
+        UInt64 word = 0;
+        memcpy(&word, data + i, std::min(WORD_SIZE, size - i));
+        words[i / WORD_SIZE].store(word, std::memory_order_relaxed);
+    }
+}
 
-    /// match index
-    if (index > max_index || max_index - index >= MAX_VECTOR_SIZE)
+void LogEntryCache::copyFromArena(UInt64 offset, nuraft::byte * data, UInt64 size) const
+{
+    const std::atomic<UInt64> * words = arena.get() + offset / WORD_SIZE;
+    for (UInt64 i = 0; i < size; i += WORD_SIZE)
+    {
+        UInt64 word = words[i / WORD_SIZE].load(std::memory_order_relaxed);
+        memcpy(data + i, &word, std::min(WORD_SIZE, size - i));
+    }
+}
+
+ptr<log_entry> LogEntryCache::getEntry(UInt64 index)
+{
+    auto entry = tryGetEntry(index);
+    if (entry)
+        hits.fetch_add(1, std::memory_order_relaxed);
+    else
+        misses.fetch_add(1, std::memory_order_relaxed);
+    return entry;
+}
+
+ptr<log_entry> LogEntryCache::tryGetEntry(UInt64 index) const
+{
+    UInt64 curr_generation = generation.load(std::memory_order_acquire);
+    /// Arena and slots are allocated before any log is visible.
+    if (index < min_index.load(std::memory_order_acquire) || index > max_index.load(std::memory_order_acquire))
+        return nullptr;
+
+    const Slot & slot = slots[index & slot_mask];
+    UInt64 sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence & 1 || slot.generation.load(std::memory_order_relaxed) != curr_generation
+        || slot.index.load(std::memory_order_relaxed) != index)
+        return nullptr;
+
+    UInt64 term = slot.term.load(std::memory_order_relaxed);
+    UInt64 offset = slot.offset.load(std::memory_order_relaxed);
+    UInt64 size = slot.size.load(std::memory_order_relaxed);
+    UInt64 timestamp = slot.timestamp.load(std::memory_order_relaxed);
+    UInt32 crc32 = slot.crc32.load(std::memory_order_relaxed);
+    bool has_crc32 = slot.has_crc32.load(std::memory_order_relaxed);
+    auto type = static_cast<nuraft::log_val_type>(slot.type.load(std::memory_order_relaxed));
+    if (offset + size > capacity)
+        return nullptr;
+
+    /// Data may be overwritten while copying, it is checked below.
+    auto data = buffer::alloc(size);
+    copyFromArena(offset, data->data_begin(), size);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != sequence || index < min_index.load(std::memory_order_relaxed)
+        || generation.load(std::memory_order_relaxed) != curr_generation)
         return nullptr;
 
-    /// match cycle
-    if (index >> BIT_SIZE == batch_index || index >> BIT_SIZE == batch_index - 1)
-        return entry_vec[index & (MAX_VECTOR_SIZE - 1)];
+    return cs_new<log_entry>(term, data, type, timestamp, has_crc32, crc32, false);
+}
+
+void LogEntryCache::putEntry(UInt64 index, const ptr<log_entry> & entry)
+{
+    std::lock_guard write_lock(write_mutex);
+
+    if (unlikely(!arena))
+        allocate();
+
+    UInt64 curr_min_index = min_index.load(std::memory_order_relaxed);
+    UInt64 curr_max_index = max_index.load(std::memory_order_relaxed);
+    bool empty = curr_min_index > curr_max_index;
+
+    if (!empty && index != curr_max_index + 1)
+    {
+        clearImpl();
+        empty = true;
+    }
+
+    const buffer & data = entry->get_buf();
+    const UInt64 size = data.size();
+    const UInt64 space = alignedSize(size);
 
-    return nullptr;
+    if (space > capacity)
+    {
+        /// Too large to cache, start from the next log.
+        clearImpl();
+        min_index.store(index + 1, std::memory_order_release);
+        max_index.store(index, std::memory_order_release);
+        return;
+    }
+
+    if (empty)
+    {
+        head = 0;
+        min_index.store(index, std::memory_order_release);
+    }
+    else
+    {
+        /// Evict the oldest logs until there is enough space at head, or at the beginning of arena if the
+        /// space before end of arena is not enough. Also the slot of index must be free.
+        while (min_index.load(std::memory_order_relaxed) <= max_index.load(std::memory_order_relaxed))
+        {
+            UInt64 oldest = min_index.load(std::memory_order_relaxed);
+            UInt64 tail = slots[oldest & slot_mask].offset.load(std::memory_order_relaxed);
+
+            bool slot_free = index - oldest < slot_count;
+            bool space_free;
+            if (head > tail)
+            {
+                if (head + space <= capacity)
+                    space_free = true;
+                else if (space <= tail)
+                {
+                    head = 0;
+                    space_free = true;
+                }
+                else
+                    space_free = false;
+            }
+            else
+                space_free = head + space <= tail;
+
+            if (slot_free && space_free)
+                break;
+            min_index.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (min_index.load(std::memory_order_relaxed) > max_index.load(std::memory_order_relaxed))
+            head = 0;
+    }
+
+    /// Evicted logs must be invisible before their data is overwritten.
+    std::atomic_thread_fence(std::memory_order_release);
+
+    Slot & slot = slots[index & slot_mask];
+    UInt64 sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.generation.store(generation.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    slot.index.store(index, std::memory_order_relaxed);
+    slot.term.store(entry->get_term(), std::memory_order_relaxed);
+    slot.offset.store(head, std::memory_order_relaxed);
+    slot.size.store(size, std::memory_order_relaxed);
+    slot.timestamp.store(entry->get_timestamp(), std::memory_order_relaxed);
+    slot.crc32.store(entry->get_crc32(), std::memory_order_relaxed);
+    slot.has_crc32.store(entry->has_crc32(), std::memory_order_relaxed);
+    slot.type.store(static_cast<UInt8>(entry->get_val_type()), std::memory_order_relaxed);
+    copyToArena(head, data.data_begin(), size);
+
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    head += space;
+
+    max_index.store(index, std::memory_order_release);
 }
 
-void LogEntryQueue::putEntry(UInt64 & index, const ptr<log_entry> & entry)
+void LogEntryCache::clear()
 {
-    LOG_TRACE(log, "put entry {}, index {}, batch {}", index, index & (MAX_VECTOR_SIZE - 1), batch_index);
-    std::lock_guard write_lock(queue_mutex);
-    entry_vec[index & (MAX_VECTOR_SIZE - 1)] = entry;
-    batch_index = std::max(batch_index, index >> BIT_SIZE);
-    max_index = std::max(max_index, index);
+    std::lock_guard write_lock(write_mutex);
+    clearImpl();
 }
 
-void LogEntryQueue::clear()
+void LogEntryCache::clearImpl()
 {
-    LOG_INFO(log, "clear log queue.");
-    std::lock_guard write_lock(queue_mutex);
-    batch_index = 0;
-    max_index = 0;
-    for (auto & i : entry_vec)
-        i = nullptr;
+    generation.fetch_add(1, std::memory_order_relaxed);
+    min_index.store(max_index.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
 }
 
-NuRaftFileLogStore::NuRaftFileLogStore( const String & log_dir, bool force_new, FsyncMode log_fsync_mode_, UInt64 log_fsync_interval_, UInt64 max_log_segment_file_size_)
-    : log_fsync_mode(log_fsync_mode_)
+NuRaftFileLogStore::NuRaftFileLogStore(
+    const String & log_dir,
+    bool force_new,
+    FsyncMode log_fsync_mode_,
+    UInt64 log_fsync_interval_,
+    UInt64 max_log_segment_file_size_,
+    bool preallocate_log_segment_,
+    UInt64 log_entry_cache_size_,
+    bool io_uring_log_write_)
+    : log_cache(log_entry_cache_size_)
+    , log_fsync_mode(log_fsync_mode_)
     , log_fsync_interval(log_fsync_interval_)
     , log(&Poco::Logger::get("FileLogStore"))
 {
-    segment_store = LogSegmentStore::getInstance(log_dir, force_new, max_log_segment_file_size_);
+    segment_store = LogSegmentStore::getInstance(
+        log_dir, force_new, max_log_segment_file_size_, preallocate_log_segment_, io_uring_log_write_);
     segment_store->init();
 
     if (segment_store->lastLogIndex() < 1)
@@ -122,7 +286,7 @@ ulong NuRaftFileLogStore::append(ptr<log_entry> & entry)
 {
     const ptr<log_entry> cloned = cloneLogEntry(entry);
     UInt64 log_index = segment_store->appendEntry(entry);
-    log_queue.putEntry(log_index, cloned);
+    log_cache.putEntry(log_index, entry);
 
     last_log_entry = cloned;
 
@@ -136,7 +300,8 @@ void NuRaftFileLogStore::write_at(ulong index, ptr<log_entry> & entry)
 {
     segment_store->writeAt(index, entry);
 
-    log_queue.clear();
+    /// Logs after index are truncated, which clears the cache.
+    log_cache.putEntry(index, entry);
     last_log_entry = entry;
 
     /// log store file fsync
@@ -152,6 +317,8 @@ void NuRaftFileLogStore::end_of_append_batch(ulong start, ulong cnt)
 
     if (log_fsync_mode == FsyncMode::FSYNC_PARALLEL)
     {
+        /// Writes of the batch go to disk while the fsync thread waits for them.
+        segment_store->submitWrites();
         parallel_fsync_event->set();
     }
     else if (log_fsync_mode == FsyncMode::FSYNC_BATCH)
@@ -162,6 +329,8 @@ void NuRaftFileLogStore::end_of_append_batch(ulong start, ulong cnt)
             to_flush_count = 0;
             flush();
         }
+        else
+            segment_store->submitWrites();
     }
     else if (log_fsync_mode == FsyncMode::FSYNC)
     {
@@ -188,9 +357,24 @@ ptr<std::vector<ptr<log_entry>>> NuRaftFileLogStore::log_entries_ext(ulong start
 
     for (auto i = start; i < end; i++)
     {
-        auto entry = entry_at(i);
+        auto entry = log_cache.getEntry(i);
         if (!entry)
-            return nullptr;
+        {
+            /// Lagging follower, read the rest from log segments in bulk.
+            if (batch_size_hint_in_bytes > 0 && get_size >= batch_size_hint_in_bytes)
+                break;
+
+            UInt64 max_bytes = batch_size_hint_in_bytes > 0 ? batch_size_hint_in_bytes - get_size : 0;
+            for (auto & entry_from_disk : segment_store->getEntries(i, end - 1, max_bytes))
+            {
+                if (!entry_from_disk)
+                    return nullptr;
+                ret->push_back(entry_from_disk);
+            }
+
+            LOG_TRACE(log, "Get logs [{}, {}) from disk", i, start + ret->size());
+            break;
+        }
 
         int64_t entry_size = entry->get_buf().size() + sizeof(ulong) + sizeof(char);
 
@@ -206,41 +390,32 @@ ptr<std::vector<ptr<log_entry>>> NuRaftFileLogStore::log_entries_ext(ulong start
 
 ptr<std::vector<LogEntryWithVersion>> NuRaftFileLogStore::log_entries_version_ext(ulong start, ulong end, int64 batch_size_hint_in_bytes)
 {
-    ptr<std::vector<LogEntryWithVersion>> ret = cs_new<std::vector<LogEntryWithVersion>>();
-
-    int64 get_size = 0;
-
-    for (auto i = start; i < end; i++)
-    {
-        auto entry = entry_at(i);
-        if (!entry)
-            return nullptr;
-
-        int64 entry_size = entry->get_buf().size() + sizeof(ulong) + sizeof(char);
+    auto entries = log_entries_ext(start, end, batch_size_hint_in_bytes);
+    if (!entries)
+        return nullptr;
 
-        if (batch_size_hint_in_bytes > 0 && get_size + entry_size > batch_size_hint_in_bytes)
-            break;
+    ptr<std::vector<LogEntryWithVersion>> ret = cs_new<std::vector<LogEntryWithVersion>>();
+    ret->reserve(entries->size());
 
-        ret->push_back({segment_store->getVersion(i), entry});
-        get_size += entry_size;
-    }
+    for (size_t i = 0; i < entries->size(); i++)
+        ret->push_back({segment_store->getVersion(start + i), (*entries)[i]});
 
     return ret;
 }
 
 ptr<log_entry> NuRaftFileLogStore::entry_at(ulong index)
 {
-    auto res = log_queue.getEntry(index);
+    auto res = log_cache.getEntry(index);
     if (res)
     {
-        LOG_TRACE(log, "Get log {} from queue", index);
+        LOG_TRACE(log, "Get log {} from cache", index);
     }
     else
     {
         LOG_TRACE(log, "Get log {} from disk", index);
         res = segment_store->getEntry(index);
     }
-    return res ? cloneLogEntry(res) : nullptr;
+    return res;
 }
 
 ulong NuRaftFileLogStore::term_at(ulong index)
@@ -299,6 +474,7 @@ void NuRaftFileLogStore::apply_pack(ulong index, buffer & pack)
 
         ptr<log_entry> le = log_entry::deserialize(*buf_local);
         segment_store->writeAt(cur_idx, le);
+        log_cache.putEntry(cur_idx, le);
     }
 
     if (log_fsync_mode == FsyncMode::FSYNC_PARALLEL)
@@ -310,7 +486,7 @@ void NuRaftFileLogStore::apply_pack(ulong index, buffer & pack)
 bool NuRaftFileLogStore::compact(ulong last_log_index)
 {
     auto removed_count = segment_store->removeSegment(last_log_index + 1);
-    log_queue.clear();
+    log_cache.clear();
     LOG_DEBUG(log, "Compact log to {} and removed {} log segments", last_log_index, removed_count);
     return true;
 }
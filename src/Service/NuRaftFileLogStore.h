@@ -1,6 +1,9 @@
 #pragma once
 
 #include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include <Service/NuRaftLogSegment.h>
 #include <Service/Settings.h>
 #include <libnuraft/nuraft.hxx>
@@ -13,37 +16,88 @@ using nuraft::int32;
 using nuraft::int64;
 using nuraft::ulong;
 
-/// Act as a ring cache who will cache latest append logs.
-/// TODO make it as a common tool.
-class LogEntryQueue
+/// Cache of latest appended logs, bounded by bytes of log data.
+///
+/// Data of logs is copied into a ring arena, and every log has a slot of its index, term, type and
+/// position in arena. Slots are protected by seqlock, so reading never takes a lock: a reader copies
+/// the log out and checks that neither the slot is rewritten nor the log is evicted meanwhile.
+/// Arena is made of atomic words accessed with relaxed order, so that a reader copying a log being
+/// overwritten gets garbage it discards rather than a data race.
+/// Logs must be put in order of index, putting a non-consecutive index clears the cache.
+/// Writers are serialized by a mutex. Arena and slots are allocated by the first put.
+class LogEntryCache
 {
 public:
-    LogEntryQueue() : batch_index(0), max_index(0), log(&(Poco::Logger::get("LogEntryQueue"))) { }
+    static constexpr UInt64 DEFAULT_CAPACITY = 128 * 1024 * 1024;
 
-    /// get log from cache, return null if not exists.
-    ptr<log_entry> getEntry(const UInt64 & index);
+    explicit LogEntryCache(UInt64 capacity_ = DEFAULT_CAPACITY);
 
-    /// put log into the queue
-    void putEntry(UInt64 & index, const ptr<log_entry> & entry);
+    /// Return a copy of the log, null if not cached.
+    ptr<log_entry> getEntry(UInt64 index);
+
+    void putEntry(UInt64 index, const ptr<log_entry> & entry);
 
     /// clean all log
     void clear();
 
-private:
-    static constexpr UInt8 BIT_SIZE = 16;
-    static constexpr UInt32 MAX_VECTOR_SIZE = 65536; /// 2^16
-
-    /// every max_index log, increase batch_index
-    UInt64 batch_index;
-
-    /// queue capacity
-    UInt64 max_index;
+    UInt64 getHits() const { return hits.load(std::memory_order_relaxed); }
+    UInt64 getMisses() const { return misses.load(std::memory_order_relaxed); }
 
-    /// logs
-    ptr<log_entry> entry_vec[MAX_VECTOR_SIZE];
-
-    std::shared_mutex queue_mutex;
-    Poco::Logger * log;
+private:
+    /// Average log size the count of slots is estimated by.
+    static constexpr UInt64 BYTES_PER_SLOT = 256;
+
+    struct Slot
+    {
+        /// Odd when the slot is being written.
+        std::atomic<UInt64> sequence{0};
+        /// Generation of cache when the slot is written, a slot written before clearing is invalid.
+        std::atomic<UInt64> generation{0};
+        std::atomic<UInt64> index{0};
+        std::atomic<UInt64> term{0};
+        std::atomic<UInt64> offset{0};
+        std::atomic<UInt64> size{0};
+        std::atomic<UInt64> timestamp{0};
+        std::atomic<UInt32> crc32{0};
+        std::atomic<bool> has_crc32{false};
+        std::atomic<UInt8> type{0};
+    };
+
+    ptr<log_entry> tryGetEntry(UInt64 index) const;
+
+    /// Invoked with write_mutex locked.
+    void clearImpl();
+    void allocate();
+
+    void copyToArena(UInt64 offset, const nuraft::byte * data, UInt64 size);
+    void copyFromArena(UInt64 offset, nuraft::byte * data, UInt64 size) const;
+
+    /// Logs are placed at word boundaries.
+    static constexpr UInt64 WORD_SIZE = sizeof(UInt64);
+    static UInt64 alignedSize(UInt64 size) { return (size + WORD_SIZE - 1) / WORD_SIZE * WORD_SIZE; }
+
+    /// In bytes, multiple of WORD_SIZE.
+    const UInt64 capacity;
+    std::unique_ptr<std::atomic<UInt64>[]> arena;
+
+    const UInt64 slot_count;
+    const UInt64 slot_mask;
+    std::unique_ptr<Slot[]> slots;
+
+    /// Cached logs are [min_index, max_index], empty if min_index > max_index.
+    std::atomic<UInt64> min_index{1};
+    std::atomic<UInt64> max_index{0};
+
+    /// Increased when cleared, so that logs before clearing are invisible.
+    std::atomic<UInt64> generation{1};
+
+    /// Next position in arena to write, only accessed by writer.
+    UInt64 head = 0;
+
+    std::atomic<UInt64> hits{0};
+    std::atomic<UInt64> misses{0};
+
+    std::mutex write_mutex;
 };
 
 class NuRaftFileLogStore : public nuraft::log_store
@@ -53,7 +107,10 @@ class NuRaftFileLogStore : public nuraft::log_store
          bool force_new = false,
          FsyncMode log_fsync_mode_ = FsyncMode::FSYNC_PARALLEL,
          UInt64 log_fsync_interval_ = 1000,
-         UInt64 max_log_segment_file_size_ = LogSegmentStore::MAX_LOG_SEGMENT_FILE_SIZE);
+         UInt64 max_log_segment_file_size_ = LogSegmentStore::MAX_LOG_SEGMENT_FILE_SIZE,
+         bool preallocate_log_segment_ = false,
+         UInt64 log_entry_cache_size_ = LogEntryCache::DEFAULT_CAPACITY,
+         bool io_uring_log_write_ = false);
 
     ~NuRaftFileLogStore() override;
 
@@ -185,6 +242,7 @@ class NuRaftFileLogStore : public nuraft::log_store
     void setRaftServer(nuraft::ptr<nuraft::raft_server> raft_instance_) { raft_instance = raft_instance_; }
 
     ptr<LogSegmentStore> segmentStore() const { return segment_store; }
+    const LogEntryCache & logCache() const { return log_cache; }
 
 private:
     /// Thread used to flush log, only used in FSYNC_PARALLEL mode
@@ -194,7 +252,7 @@ private:
     ptr<LogSegmentStore> segment_store;
 
     /// Memory log cache
-    LogEntryQueue log_queue;
+    LogEntryCache log_cache;
 
     /// last log entry
     ptr<log_entry> last_log_entry;
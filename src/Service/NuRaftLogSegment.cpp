@@ -1,15 +1,24 @@
 #include <Service/NuRaftLogSegment.h>
 
+#include <algorithm>
 #include <charconv>
 #include <fcntl.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
 #include <unistd.h>
+#include <vector>
 
 #include <Poco/File.h>
 
+#include <Common/IO/ReadBufferFromFile.h>
+#include <Common/IO/ReadBufferFromMemory.h>
+#include <Common/IO/ReadHelpers.h>
+#include <Common/IO/WriteBufferFromString.h>
+#include <Common/IO/WriteHelpers.h>
 #include <Common/ThreadPool.h>
+#include <Common/setThreadName.h>
+#include <common/unaligned.h>
 
 #include <Service/Crc32.h>
 #include <Service/KeeperUtils.h>
@@ -30,6 +39,7 @@ namespace ErrorCodes
     extern const int FILE_DOESNT_EXIST;
     extern const int CORRUPTED_LOG;
     extern const int INVALID_LOG_SEGMENT_FILE_NAME;
+    extern const int CANNOT_TRUNCATE_FILE;
 }
 
 using namespace nuraft;
@@ -39,6 +49,53 @@ bool compareSegment(const ptr<NuRaftLogSegment> & lhs, const ptr<NuRaftLogSegmen
     return lhs->firstIndex() < rhs->firstIndex();
 }
 
+namespace
+{
+
+/// Overwrite [offset, offset + length) of the file with zeros.
+void writeZeros(int fd, UInt64 offset, UInt64 length, const String & file_name)
+{
+    static constexpr size_t ZEROS_SIZE = 1024 * 1024;
+    static const std::vector<char> zeros(ZEROS_SIZE, 0);
+
+    while (length > 0)
+    {
+        ssize_t ret = ::pwrite(fd, zeros.data(), std::min<UInt64>(length, ZEROS_SIZE), offset);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throwFromErrno(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, "Fail to write zeros to log segment {}", file_name);
+        }
+        offset += ret;
+        length -= ret;
+    }
+}
+
+/// Allocate disk space of [offset, offset + length) for the file and fill it with zeros. fallocate alone leaves
+/// unwritten extents, whose first write still changes extent metadata which fdatasync has to journal, so the
+/// space is written once and synced, after which appending to it never changes file metadata.
+void preallocateFile(int fd, UInt64 offset, UInt64 length, const String & file_name)
+{
+#if defined(OS_LINUX)
+    /// Only for contiguous allocation, not fatal if the file system does not support it.
+    if (fallocate(fd, 0, offset, length) != 0)
+        LOG_WARNING(
+            &Poco::Logger::get("NuRaftLogSegment"), "Fail to preallocate {} bytes for log segment {}, errno {}", length, file_name, errno);
+#endif
+    writeZeros(fd, offset, length, file_name);
+
+#if defined(OS_DARWIN)
+    int ret = ::fsync(fd);
+#else
+    int ret = ::fdatasync(fd);
+#endif
+    if (ret == -1)
+        throwFromErrno(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, "Fail to sync preallocated log segment {}", file_name);
+}
+
+}
+
 NuRaftLogSegment::NuRaftLogSegment(const String & log_dir_, UInt64 first_index_)
     : log_dir(log_dir_)
     , first_index(first_index_)
@@ -88,6 +145,58 @@ NuRaftLogSegment::NuRaftLogSegment(const String & log_dir_, UInt64 first_index_,
 {
 }
 
+NuRaftLogSegment::NuRaftLogSegment(const String & log_dir_, UInt64 first_index_, int prepared_fd, const String & prepared_path)
+    : log_dir(log_dir_)
+    , first_index(first_index_)
+    , last_index(first_index_ - 1)
+    , is_open(true)
+    , seg_fd(prepared_fd)
+    , file_size(MAGIC_AND_VERSION_SIZE)
+    , version(CURRENT_LOG_VERSION)
+    , log(&(Poco::Logger::get("NuRaftLogSegment")))
+{
+    Poco::DateTime now;
+    create_time = Poco::DateTimeFormatter::format(now, "%Y%m%d%H%M%S");
+
+    std::lock_guard write_lock(log_mutex);
+
+    file_name = getOpenFileName();
+    String full_path = getOpenPath();
+
+    LOG_INFO(log, "Creating new log segment {} from prepared file", file_name);
+
+    if (Poco::File(full_path).exists())
+        throw Exception(ErrorCodes::LOGICAL_ERROR, "Try to create a log segment but file {} already exists.", full_path);
+
+    Poco::File(prepared_path).renameTo(full_path);
+
+    struct stat st_buf;
+    if (fstat(seg_fd, &st_buf) != 0)
+        throwFromErrno(ErrorCodes::CANNOT_READ_FROM_FILE_DESCRIPTOR, "Fail to get the stat of log segment file {}", file_name);
+    preallocated_size = st_buf.st_size;
+}
+
+int NuRaftLogSegment::prepareFile(const String & path, UInt64 preallocate_size)
+{
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        throwFromErrno(ErrorCodes::CANNOT_OPEN_FILE, "Fail to create log segment file {}", path);
+
+    try
+    {
+        writeHeader(fd, CURRENT_LOG_VERSION, path);
+        if (preallocate_size > MAGIC_AND_VERSION_SIZE)
+            preallocateFile(fd, MAGIC_AND_VERSION_SIZE, preallocate_size - MAGIC_AND_VERSION_SIZE, path);
+    }
+    catch (...)
+    {
+        ::close(fd);
+        throw;
+    }
+
+    return fd;
+}
+
 String NuRaftLogSegment::getOpenFileName()
 {
     return fmt::format("log_{}_open_{}", first_index, create_time);
@@ -141,6 +250,10 @@ void NuRaftLogSegment::openFileIfNeeded()
 void NuRaftLogSegment::closeFileIfNeeded()
 {
     LOG_INFO(log, "Closing log segment file {}", file_name);
+    closeWriter();
+    mapped_data = {};
+    mapped_file.reset();
+
     if (seg_fd != -1)
     {
         if (::close(seg_fd) != 0)
@@ -149,6 +262,31 @@ void NuRaftLogSegment::closeFileIfNeeded()
     }
 }
 
+void NuRaftLogSegment::closeWriter()
+{
+    if (!writer)
+        return;
+    writer->waitWritten(file_size.load(std::memory_order_acquire));
+    writer.reset();
+}
+
+void NuRaftLogSegment::mapFileIfNeeded()
+{
+    /// Open segment is being written.
+    if (is_open || mapped_file || seg_fd == -1)
+        return;
+
+    try
+    {
+        mapped_file.emplace(seg_fd, 0, file_size.load(std::memory_order_acquire));
+        mapped_data = {mapped_file->buffer().begin(), mapped_file->buffer().size()};
+    }
+    catch (...)
+    {
+        tryLogCurrentException(log, fmt::format("Fail to map log segment {}, entries will be read by pread", file_name));
+    }
+}
+
 void NuRaftLogSegment::writeHeader()
 {
     if (!is_open)
@@ -157,22 +295,26 @@ void NuRaftLogSegment::writeHeader()
     if (seg_fd < 0)
         throw Exception(ErrorCodes::LOGICAL_ERROR, "File {} not open yet", file_name);
 
+    std::lock_guard write_lock(log_mutex);
+    writeHeader(seg_fd, version, file_name);
+    file_size.fetch_add(MAGIC_AND_VERSION_SIZE, std::memory_order_release);
+}
+
+void NuRaftLogSegment::writeHeader(int fd, LogVersion version, const String & file_name)
+{
     union
     {
         uint64_t magic_num;
         uint8_t magic_array[8] = {0, 'R', 'a', 'f', 't', 'L', 'o', 'g'};
     };
 
-    std::lock_guard write_lock(log_mutex);
     auto version_uint8 = static_cast<uint8_t>(version);
 
-    if (write(seg_fd, &magic_num, 8) != 8)
+    if (write(fd, &magic_num, 8) != 8)
         throwFromErrno(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, "Cannot write magic to {}", file_name);
 
-    if (write(seg_fd, &version_uint8, 1) != 1)
+    if (write(fd, &version_uint8, 1) != 1)
         throwFromErrno(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, "Cannot write version to {}", file_name);
-
-    file_size.fetch_add(MAGIC_AND_VERSION_SIZE, std::memory_order_release);
 }
 
 void NuRaftLogSegment::load()
@@ -188,14 +330,30 @@ void NuRaftLogSegment::load()
 
     /// load header
     readHeader();
+
+    if (!is_open && loadIndex(file_size_read))
+    {
+        LOG_INFO(log, "Load closed segment {} from index file, last index {}", file_name, last_index.load());
+        file_size = file_size_read;
+        return;
+    }
+
     size_t entry_off = version == LogVersion::V0 ? 0 : MAGIC_AND_VERSION_SIZE;
 
     /// load log entry
     UInt64 last_index_read = first_index - 1;
+    bool reach_preallocated_space = false;
     for (; entry_off < file_size_read;)
     {
         LogEntryHeader header = loadEntryHeader(entry_off);
 
+        /// Zeros after the last entry of a preallocated open segment, entries are never empty.
+        if (is_open && header.data_length == 0)
+        {
+            reach_preallocated_space = true;
+            break;
+        }
+
         const UInt64 log_entry_len = sizeof(LogEntryHeader) + header.data_length;
 
         if (entry_off + log_entry_len > file_size_read)
@@ -236,7 +394,16 @@ void NuRaftLogSegment::load()
         last_index = last_index_read;
     }
 
-    if (entry_off != file_size_read)
+    if (reach_preallocated_space)
+    {
+        LOG_INFO(log, "Open segment {} is preallocated to {} bytes, entries end at {}", file_name, file_size_read, entry_off);
+        preallocated_size = file_size_read;
+
+        /// An incomplete last entry is followed by zeros, check it as the size of file can not tell.
+        if (!offsets.empty())
+            loadEntry(offsets.back());
+    }
+    else if (entry_off != file_size_read)
     {
         throw Exception(
             ErrorCodes::CORRUPTED_LOG,
@@ -252,6 +419,135 @@ void NuRaftLogSegment::load()
     /// seek to end of file if it is open
     if (is_open)
         ::lseek(seg_fd, entry_off, SEEK_SET);
+    else
+        writeIndex(); /// Segment closed by old version or index file is broken
+}
+
+String NuRaftLogSegment::getIndexPath()
+{
+    return getClosedPath() + INDEX_FILE_SUFFIX;
+}
+
+void NuRaftLogSegment::writeIndex()
+{
+    String index_path = getIndexPath();
+    try
+    {
+        const UInt64 curr_file_size = file_size.load(std::memory_order_acquire);
+
+        WriteBufferFromOwnString out;
+        writeIntBinary(INDEX_VERSION, out);
+        writeIntBinary(first_index, out);
+        writeIntBinary(last_index.load(std::memory_order_acquire), out);
+        writeIntBinary(curr_file_size, out);
+        writeIntBinary(static_cast<UInt64>(offsets.empty() ? curr_file_size : offsets.front()), out);
+        for (size_t i = 0; i < offsets.size(); ++i)
+        {
+            UInt64 next_offset = i + 1 < offsets.size() ? offsets[i + 1] : curr_file_size;
+            writeIntBinary(static_cast<UInt32>(next_offset - offsets[i]), out);
+        }
+
+        String & data = out.str();
+        UInt32 checksum = getCRC32C(data.data(), data.size());
+        data.append(reinterpret_cast<const char *>(&checksum), sizeof(checksum));
+
+        int fd = ::open(index_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1)
+            throwFromErrno(ErrorCodes::CANNOT_OPEN_FILE, "Fail to create index file {}", index_path);
+
+        ssize_t size_written = ::write(fd, data.data(), data.size());
+        ::close(fd);
+        if (size_written != static_cast<ssize_t>(data.size()))
+            throwFromErrno(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, "Fail to write index file {}", index_path);
+    }
+    catch (...)
+    {
+        /// Not fatal, segment is scanned when loading.
+        tryLogCurrentException(log, fmt::format("Fail to write index of log segment {}", file_name));
+        if (Poco::File index_file(index_path); index_file.exists())
+            index_file.remove();
+    }
+}
+
+bool NuRaftLogSegment::loadIndex(UInt64 file_size_read)
+{
+    String index_path = getIndexPath();
+    if (!Poco::File(index_path).exists())
+        return false;
+
+    const UInt64 curr_last_index = last_index.load(std::memory_order_relaxed);
+    if (curr_last_index < first_index)
+        return false;
+
+    try
+    {
+        String data;
+        {
+            ReadBufferFromFile in(index_path);
+            readStringUntilEOF(data, in);
+        }
+
+        const UInt64 count = curr_last_index - first_index + 1;
+        if (data.size() != sizeof(UInt8) + 4 * sizeof(UInt64) + count * sizeof(UInt32) + sizeof(UInt32))
+        {
+            LOG_WARNING(log, "Size {} of index file {} does not match {} entries, scan the segment", data.size(), index_path, count);
+            return false;
+        }
+
+        UInt32 checksum = unalignedLoad<UInt32>(data.data() + data.size() - sizeof(UInt32));
+        if (!verifyCRC32C(data.data(), data.size() - sizeof(UInt32), checksum))
+        {
+            LOG_WARNING(log, "Checking CRC failed for index file {}, scan the segment", index_path);
+            return false;
+        }
+
+        ReadBufferFromMemory in(data.data(), data.size() - sizeof(UInt32));
+        UInt8 index_version;
+        UInt64 index_first_index, index_last_index, index_file_size, offset;
+        readIntBinary(index_version, in);
+        readIntBinary(index_first_index, in);
+        readIntBinary(index_last_index, in);
+        readIntBinary(index_file_size, in);
+        readIntBinary(offset, in);
+
+        if (index_version != INDEX_VERSION || index_first_index != first_index || index_last_index != curr_last_index
+            || index_file_size != file_size_read)
+        {
+            LOG_WARNING(log, "Index file {} does not match the segment, scan the segment", index_path);
+            return false;
+        }
+
+        std::vector<int64_t> offsets_read(count);
+        for (UInt64 i = 0; i < count; ++i)
+        {
+            offsets_read[i] = offset;
+            UInt32 entry_len;
+            readIntBinary(entry_len, in);
+            offset += entry_len;
+        }
+
+        if (offset != file_size_read)
+        {
+            LOG_WARNING(log, "Entries in index file {} end at {}, not {}, scan the segment", index_path, offset, file_size_read);
+            return false;
+        }
+
+        /// Check the last entry, which is the most likely to be broken.
+        LogEntryHeader header = loadEntryHeader(offsets_read.back());
+        if (offsets_read.back() + LogEntryHeader::HEADER_SIZE + header.data_length != file_size_read)
+        {
+            LOG_WARNING(log, "The last entry does not match index file {}, scan the segment", index_path);
+            return false;
+        }
+
+        offsets.swap(offsets_read);
+        return true;
+    }
+    catch (...)
+    {
+        tryLogCurrentException(log, fmt::format("Fail to load index file {}, scan the segment", index_path));
+        return false;
+    }
 }
 
 void NuRaftLogSegment::readHeader()
@@ -290,6 +586,21 @@ void NuRaftLogSegment::readHeader()
 void NuRaftLogSegment::close(bool is_full)
 {
     std::lock_guard write_lock(log_mutex);
+    closeWriter();
+
+    if (is_open && is_full && seg_fd != -1)
+    {
+        /// Release preallocated space after the last entry.
+        if (preallocated_size != 0)
+        {
+            if (ftruncate(seg_fd, file_size) != 0)
+                throwFromErrno(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, "Fail to truncate log segment {}", file_name);
+            preallocated_size = 0;
+        }
+
+        /// Only the open segment is synced by flush, entries of it must be durable before rolling over.
+        syncFile(seg_fd);
+    }
 
     closeFileIfNeeded();
 
@@ -310,33 +621,79 @@ void NuRaftLogSegment::close(bool is_full)
     is_open = false;
 }
 
+void NuRaftLogSegment::writeIndexIfClosed()
+{
+    std::shared_lock read_lock(log_mutex);
+    if (is_open || !Poco::File(getPath()).exists())
+        return;
+    writeIndex();
+}
+
 UInt64 NuRaftLogSegment::flush() const
 {
-    std::lock_guard write_lock(log_mutex);
+    /// Appending is not blocked while syncing, entries appended before taking last index are synced.
+    /// The fd and writer are not closed concurrently, for they are closed only when segment store is locked exclusively.
+    int fd;
+    IOUringLogWriter * segment_writer;
+    UInt64 flushed_index;
+    {
+        std::shared_lock read_lock(log_mutex);
+        fd = seg_fd;
+        segment_writer = writer.get();
+        flushed_index = last_index.load(std::memory_order_acquire);
+    }
 
+    if (segment_writer)
+        segment_writer->sync();
+    else
+        syncFile(fd);
+    return flushed_index;
+}
+
+void NuRaftLogSegment::syncFile(int fd) const
+{
     int ret;
 #if defined(OS_DARWIN)
-    ret = ::fsync(seg_fd);
+    ret = ::fsync(fd);
 #else
-    ret = ::fdatasync(seg_fd);
+    ret = ::fdatasync(fd);
 #endif
     if (ret == -1)
         throwFromErrno(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, "Fail to flush log segment {}", file_name);
-
-    return last_index;
 }
 
 void NuRaftLogSegment::remove()
 {
     std::lock_guard write_lock(log_mutex);
     closeFileIfNeeded();
+
+    if (!is_open)
+    {
+        if (Poco::File index_file(getIndexPath()); index_file.exists())
+            index_file.remove();
+    }
     String full_path = getPath();
     Poco::File f(full_path);
     if (f.exists())
         f.remove();
 }
 
-UInt64 NuRaftLogSegment::appendEntry(const ptr<log_entry> & entry, std::atomic<UInt64> & last_log_index)
+bool NuRaftLogSegment::detach(const String & path)
+{
+    std::lock_guard write_lock(log_mutex);
+    closeFileIfNeeded();
+
+    if (Poco::File index_file(getIndexPath()); index_file.exists())
+        index_file.remove();
+
+    Poco::File f(getPath());
+    if (!f.exists())
+        return false;
+    f.renameTo(path);
+    return true;
+}
+
+UInt64 NuRaftLogSegment::appendEntry(const ptr<log_entry> & entry, std::atomic<UInt64> & last_log_index, bool use_io_uring)
 {
     LogEntryHeader header;
     struct iovec vec[2];
@@ -358,7 +715,8 @@ UInt64 NuRaftLogSegment::appendEntry(const ptr<log_entry> & entry, std::atomic<U
 
         header.term = entry->get_term();
         header.data_length = data_size;
-        header.data_crc = RK::getCRC32(data_in_buf, header.data_length);
+        header.data_crc = version >= LogVersion::V2 ? RK::getCRC32C(data_in_buf, header.data_length)
+                                                    : RK::getCRC32(data_in_buf, header.data_length);
 
         vec[0].iov_base = &header;
         vec[0].iov_len = LogEntryHeader::HEADER_SIZE;
@@ -369,12 +727,23 @@ UInt64 NuRaftLogSegment::appendEntry(const ptr<log_entry> & entry, std::atomic<U
     {
         std::lock_guard write_lock(log_mutex);
         header.index = last_index.load(std::memory_order_acquire) + 1;
-        ssize_t size_written = writev(seg_fd, vec, 2);
+        UInt64 offset = file_size.load(std::memory_order_relaxed);
 
-        if (size_written != static_cast<ssize_t>(vec[0].iov_len + vec[1].iov_len))
-            throwFromErrno(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, "Fail to append log entry to {}", file_name);
+        if (use_io_uring && !writer)
+            writer = IOUringLogWriter::tryCreate(seg_fd, offset, file_name);
 
-        offsets.push_back(file_size.load(std::memory_order_relaxed));
+        if (writer)
+        {
+            writer->write(offset, header, entry_buf);
+        }
+        else
+        {
+            ssize_t size_written = pwritev(seg_fd, vec, 2, offset);
+            if (size_written != static_cast<ssize_t>(vec[0].iov_len + vec[1].iov_len))
+                throwFromErrno(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, "Fail to append log entry to {}", file_name);
+        }
+
+        offsets.push_back(offset);
         file_size.fetch_add(LogEntryHeader::HEADER_SIZE + header.data_length, std::memory_order_release);
 
         last_index.fetch_add(1, std::memory_order_release);
@@ -394,6 +763,13 @@ UInt64 NuRaftLogSegment::appendEntry(const ptr<log_entry> & entry, std::atomic<U
     return header.index;
 }
 
+void NuRaftLogSegment::submitWrites()
+{
+    std::shared_lock read_lock(log_mutex);
+    if (writer)
+        writer->submit();
+}
+
 
 int64_t NuRaftLogSegment::getEntryOffset(UInt64 index) const
 {
@@ -404,8 +780,30 @@ int64_t NuRaftLogSegment::getEntryOffset(UInt64 index) const
     return offsets[inner_index];
 }
 
+UInt64 NuRaftLogSegment::getEntryEnd(UInt64 index) const
+{
+    if (index < last_index.load(std::memory_order_relaxed))
+        return offsets[index + 1 - first_index];
+    return file_size.load(std::memory_order_acquire);
+}
+
 LogEntryHeader NuRaftLogSegment::loadEntryHeader(int64_t offset) const
 {
+    LogEntryHeader header;
+
+    if (!mapped_data.empty())
+    {
+        if (offset + LogEntryHeader::HEADER_SIZE > mapped_data.size())
+            throw Exception(ErrorCodes::CORRUPTED_LOG, "Fail to read header with offset {} of log segment {}", offset, file_name);
+
+        const char * pos = mapped_data.data() + offset;
+        header.term = unalignedLoad<UInt64>(pos);
+        header.index = unalignedLoad<UInt64>(pos + 8);
+        header.data_length = unalignedLoad<UInt32>(pos + 16);
+        header.data_crc = unalignedLoad<UInt32>(pos + 20);
+        return header;
+    }
+
     ptr<buffer> buf = buffer::alloc(LogEntryHeader::HEADER_SIZE);
     buf->pos(0);
 
@@ -417,7 +815,6 @@ LogEntryHeader NuRaftLogSegment::loadEntryHeader(int64_t offset) const
     buffer_serializer bs(buf);
     bs.pos(0);
 
-    LogEntryHeader header;
     header.term = bs.get_u64();
     header.index = bs.get_u64();
 
@@ -429,18 +826,40 @@ LogEntryHeader NuRaftLogSegment::loadEntryHeader(int64_t offset) const
 
 ptr<log_entry> NuRaftLogSegment::loadEntry(int64_t offset) const
 {
-    LogEntryHeader header = loadEntryHeader(offset);
+    return loadEntry(offset, loadEntryHeader(offset));
+}
 
-    ptr<buffer> buf = buffer::alloc(header.data_length);
-    ssize_t size_read = pread(seg_fd, buf->data_begin(), header.data_length, offset + LogEntryHeader::HEADER_SIZE);
+ptr<log_entry> NuRaftLogSegment::loadEntry(int64_t offset, const LogEntryHeader & header) const
+{
+    const UInt64 data_offset = offset + LogEntryHeader::HEADER_SIZE;
+    const char * data;
+    ptr<buffer> buf;
 
-    if (size_read != header.data_length)
-        throwFromErrno(ErrorCodes::CORRUPTED_LOG, "Fail to read log entry with offset {} from log segment {}", offset, file_name);
+    if (header.data_length == 0)
+        throw Exception(ErrorCodes::CORRUPTED_LOG, "Empty log entry with offset {} in log segment {}", offset, file_name);
 
-    if (!verifyCRC32(reinterpret_cast<const char *>(buf->data_begin()), header.data_length, header.data_crc))
-        throw Exception(ErrorCodes::CORRUPTED_LOG, "Checking CRC32 failed for log segment {}.", file_name);
+    if (!mapped_data.empty())
+    {
+        if (data_offset + header.data_length > mapped_data.size())
+            throw Exception(ErrorCodes::CORRUPTED_LOG, "Fail to read log entry with offset {} from log segment {}", offset, file_name);
+        data = mapped_data.data() + data_offset;
+    }
+    else
+    {
+        buf = buffer::alloc(header.data_length);
+        ssize_t size_read = pread(seg_fd, buf->data_begin(), header.data_length, data_offset);
+
+        if (size_read != header.data_length)
+            throwFromErrno(ErrorCodes::CORRUPTED_LOG, "Fail to read log entry with offset {} from log segment {}", offset, file_name);
+        data = reinterpret_cast<const char *>(buf->data_begin());
+    }
 
-    auto entry = LogEntryBody::deserialize(buf);
+    bool crc_matched = version >= LogVersion::V2 ? verifyCRC32C(data, header.data_length, header.data_crc)
+                                                 : verifyCRC32(data, header.data_length, header.data_crc);
+    if (!crc_matched)
+        throw Exception(ErrorCodes::CORRUPTED_LOG, "Checking CRC failed for log segment {}.", file_name);
+
+    auto entry = LogEntryBody::deserialize(data, header.data_length);
     entry->set_term(header.term);
 
     return entry;
@@ -451,11 +870,48 @@ ptr<log_entry> NuRaftLogSegment::getEntry(UInt64 index)
     {
         std::lock_guard write_lock(log_mutex);
         openFileIfNeeded();
+        mapFileIfNeeded();
     }
 
     std::shared_lock read_lock(log_mutex);
     auto offset = getEntryOffset(index);
-    return offset == -1 ? nullptr : loadEntry(offset);
+    if (offset == -1)
+        return nullptr;
+
+    /// The entry may be queued and not written yet.
+    if (writer)
+        writer->waitWritten(getEntryEnd(index));
+    return loadEntry(offset);
+}
+
+bool NuRaftLogSegment::getEntries(
+    UInt64 start_index, UInt64 end_index, UInt64 max_bytes, std::vector<ptr<log_entry>> & entries, UInt64 & bytes)
+{
+    {
+        std::lock_guard write_lock(log_mutex);
+        openFileIfNeeded();
+        mapFileIfNeeded();
+    }
+
+    std::shared_lock read_lock(log_mutex);
+    if (writer && start_index <= lastIndex())
+        writer->waitWritten(getEntryEnd(std::min(end_index, lastIndex())));
+
+    for (UInt64 index = start_index; index <= end_index; ++index)
+    {
+        auto offset = getEntryOffset(index);
+        if (offset == -1)
+            return false;
+
+        LogEntryHeader header = loadEntryHeader(offset);
+        UInt64 entry_size = header.data_length + sizeof(ulong);
+        if (max_bytes != 0 && bytes + entry_size > max_bytes)
+            return false;
+
+        entries.push_back(loadEntry(offset, header));
+        bytes += entry_size;
+    }
+    return true;
 }
 
 bool NuRaftLogSegment::truncate(const UInt64 last_index_kept)
@@ -479,6 +935,9 @@ bool NuRaftLogSegment::truncate(const UInt64 last_index_kept)
 
             closeFileIfNeeded();
 
+            if (Poco::File index_file(getIndexPath()); index_file.exists())
+                index_file.remove();
+
             String old_path = getClosedPath();
             String new_path = getOpenPath();
 
@@ -493,6 +952,8 @@ bool NuRaftLogSegment::truncate(const UInt64 last_index_kept)
 
     {
         std::lock_guard write_lock(log_mutex);
+        /// Truncated entries must not be written after truncating, the writer is created again when appending.
+        closeWriter();
         if (last_index <= last_index_kept)
         {
             LOG_INFO(log, "Log segment {} truncates nothing, last_index {}, last_index_kept {}", file_name, last_index.load(), last_index_kept);
@@ -516,7 +977,13 @@ bool NuRaftLogSegment::truncate(const UInt64 last_index_kept)
 
     reopen_closed_segment();
 
-    if (ftruncate(seg_fd, file_size_to_keep) != 0)
+    if (preallocated_size > file_size_to_keep)
+    {
+        /// Keep the preallocated space written, only truncated entries are overwritten with zeros.
+        if (file_size > file_size_to_keep)
+            writeZeros(seg_fd, file_size_to_keep, file_size - file_size_to_keep, file_name);
+    }
+    else if (ftruncate(seg_fd, file_size_to_keep) != 0)
         throwFromErrno(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, "Fail to truncate log segment {}", file_name);
 
     LOG_INFO(log, "Truncate file {} with fd {}, from {} to size {}", file_name, seg_fd, file_size_to_keep, file_size.load());
@@ -535,24 +1002,50 @@ bool NuRaftLogSegment::truncate(const UInt64 last_index_kept)
     return true;
 }
 
-ptr<LogSegmentStore> LogSegmentStore::getInstance(const String & log_dir_, bool force_new, UInt32 max_log_segment_file_size_)
+ptr<LogSegmentStore> LogSegmentStore::getInstance(
+    const String & log_dir_, bool force_new, UInt32 max_log_segment_file_size_, bool preallocate_log_segment_, bool io_uring_log_write_)
 {
     static ptr<LogSegmentStore> segment_store;
     if (segment_store == nullptr || force_new)
-        segment_store = cs_new<LogSegmentStore>(log_dir_, max_log_segment_file_size_);
+        segment_store
+            = cs_new<LogSegmentStore>(log_dir_, max_log_segment_file_size_, preallocate_log_segment_, io_uring_log_write_);
     return segment_store;
 }
 
+LogSegmentStore::~LogSegmentStore()
+{
+    int fd = takePreparedSegment();
+    if (fd != -1)
+        ::close(fd);
+
+    /// Files not deleted are picked up when the store is initialized next time.
+    {
+        std::lock_guard lock(remove_mutex);
+        remove_thread_stopped = true;
+    }
+    remove_cv.notify_all();
+    if (remove_thread)
+        remove_thread->join();
+}
+
 void LogSegmentStore::init()
 {
     LOG_INFO(log, "Initializing log segment store with directory {}", log_dir);
 
     Poco::File(log_dir).createDirectories();
 
+    /// Prepared file left by last run is not a segment.
+    int fd = takePreparedSegment();
+    if (fd != -1)
+        ::close(fd);
+    if (Poco::File prepared_file(getPreparedSegmentPath()); prepared_file.exists())
+        prepared_file.remove();
+
     first_log_index.store(1);
     last_log_index.store(0);
 
     open_segment = nullptr;
+    closed_segments.clear();
 
     loadSegmentMetaData();
     loadSegments();
@@ -576,7 +1069,8 @@ void LogSegmentStore::close()
 
 UInt64 LogSegmentStore::flush()
 {
-    std::lock_guard shared_lock(seg_mutex);
+    /// Shared lock, so that appending is not blocked by syncing.
+    std::shared_lock read_lock(seg_mutex);
     if (open_segment)
         return open_segment->flush();
     throw Exception(ErrorCodes::LOGICAL_ERROR, "Flush log segment store failed, open segment is nullptr.");
@@ -595,14 +1089,63 @@ void LogSegmentStore::openNewSegmentIfNeeded()
     {
         open_segment->close(true);
         closed_segments.push_back(open_segment);
+        scheduleIndexWriting(open_segment);
         open_segment = nullptr;
     }
 
     UInt64 next_idx = last_log_index.load(std::memory_order_acquire) + 1;
-    ptr<NuRaftLogSegment> new_seg = cs_new<NuRaftLogSegment>(log_dir, next_idx);
 
-    open_segment = new_seg;
-    open_segment->writeHeader();
+    if (!preallocate_log_segment)
+    {
+        open_segment = cs_new<NuRaftLogSegment>(log_dir, next_idx);
+        open_segment->writeHeader();
+        return;
+    }
+
+    /// Usually the file is prepared when the last segment is opened, rolling over is just renaming it.
+    /// Filling a file with zeros is too slow for appending to wait, the segment is not preallocated if there is none.
+    int fd = takePreparedSegment();
+    if (fd == -1)
+    {
+        LOG_INFO(log, "No prepared file for log segment {}, create it without preallocation", next_idx);
+        open_segment = cs_new<NuRaftLogSegment>(log_dir, next_idx);
+        open_segment->writeHeader();
+    }
+    else
+    {
+        open_segment = cs_new<NuRaftLogSegment>(log_dir, next_idx, fd, getPreparedSegmentPath());
+    }
+    scheduleSegmentPreparing();
+}
+
+void LogSegmentStore::scheduleSegmentPreparing()
+{
+    prepare_thread = std::make_unique<ThreadFromGlobalPool>(
+        [this]
+        {
+            try
+            {
+                prepared_fd = NuRaftLogSegment::prepareFile(getPreparedSegmentPath(), max_log_segment_file_size);
+            }
+            catch (...)
+            {
+                /// Not fatal, the file will be prepared when rolling over.
+                tryLogCurrentException(log, "Fail to prepare file for next log segment");
+            }
+        });
+}
+
+int LogSegmentStore::takePreparedSegment()
+{
+    if (prepare_thread)
+    {
+        prepare_thread->join();
+        prepare_thread.reset();
+    }
+
+    int fd = prepared_fd;
+    prepared_fd = -1;
+    return fd;
 }
 
 ptr<NuRaftLogSegment> LogSegmentStore::getSegment(UInt64 index) const
@@ -647,7 +1190,14 @@ UInt64 LogSegmentStore::appendEntry(const ptr<log_entry> & entry)
 {
     openNewSegmentIfNeeded();
     std::shared_lock read_lock(seg_mutex);
-    return open_segment->appendEntry(entry, last_log_index);
+    return open_segment->appendEntry(entry, last_log_index, io_uring_log_write);
+}
+
+void LogSegmentStore::submitWrites()
+{
+    std::shared_lock read_lock(seg_mutex);
+    if (open_segment)
+        open_segment->submitWrites();
 }
 
 void LogSegmentStore::writeAt(UInt64 index, const ptr<log_entry> & entry)
@@ -668,13 +1218,26 @@ ptr<log_entry> LogSegmentStore::getEntry(UInt64 index) const
     return seg->getEntry(index);
 }
 
-std::vector<ptr<log_entry>> LogSegmentStore::getEntries(UInt64 start_index, UInt64 end_index) const
+std::vector<ptr<log_entry>> LogSegmentStore::getEntries(UInt64 start_index, UInt64 end_index, UInt64 max_bytes) const
 {
     std::vector<ptr<log_entry>> entries;
-    for (UInt64 index = start_index; index <= end_index; index++)
+    UInt64 bytes = 0;
+
+    std::shared_lock read_lock(seg_mutex);
+    for (UInt64 index = start_index; index <= end_index;)
     {
-        auto entry_pt = getEntry(index);
-        entries.push_back(entry_pt);
+        ptr<NuRaftLogSegment> seg = getSegment(index);
+        if (!seg)
+        {
+            entries.push_back(nullptr);
+            ++index;
+            continue;
+        }
+
+        UInt64 last_index_in_segment = std::min(end_index, seg->lastIndex());
+        if (!seg->getEntries(index, last_index_in_segment, max_bytes, entries, bytes))
+            break;
+        index = last_index_in_segment + 1;
     }
     return entries;
 }
@@ -736,10 +1299,13 @@ int LogSegmentStore::removeSegment(UInt64 first_index_kept)
         }
     }
 
+    /// Renaming is cheap, deleting large files is left to the removing thread.
     for (auto & seg : to_be_removed)
     {
         LOG_INFO(log, "Remove log segment, file {}", seg->getFileName());
-        seg->remove();
+        String removed_path = log_dir + "/" + REMOVED_SEGMENT_FILE_PREFIX + seg->getFileName();
+        if (seg->detach(removed_path))
+            scheduleSegmentRemoving(removed_path);
     }
 
     /// reset last_log_index
@@ -749,6 +1315,154 @@ int LogSegmentStore::removeSegment(UInt64 first_index_kept)
     return to_be_removed.size();
 }
 
+void LogSegmentStore::scheduleSegmentRemoving(const String & path)
+{
+    UInt64 file_size = 0;
+    struct stat file_stat;
+    if (::stat(path.c_str(), &file_stat) == 0)
+        file_size = file_stat.st_size;
+
+    std::lock_guard lock(remove_mutex);
+    if (remove_thread_stopped)
+        return;
+
+    for (const auto & [file, _] : files_to_remove)
+        if (file == path)
+            return;
+
+    files_to_remove.emplace_back(path, file_size);
+    removing_segments.fetch_add(1, std::memory_order_relaxed);
+    removing_bytes.fetch_add(file_size, std::memory_order_relaxed);
+
+    startBackgroundThreadIfNeeded();
+    remove_cv.notify_all();
+}
+
+void LogSegmentStore::scheduleIndexWriting(const ptr<NuRaftLogSegment> & segment)
+{
+    std::lock_guard lock(remove_mutex);
+    if (remove_thread_stopped)
+        return;
+
+    segments_to_index.push_back(segment);
+    startBackgroundThreadIfNeeded();
+    remove_cv.notify_all();
+}
+
+void LogSegmentStore::startBackgroundThreadIfNeeded()
+{
+    if (!remove_thread)
+        remove_thread = std::make_unique<ThreadFromGlobalPool>([this] { backgroundThread(); });
+}
+
+void LogSegmentStore::backgroundThread()
+{
+    setThreadName("LogSegRemover");
+
+    while (true)
+    {
+        String path;
+        UInt64 remaining_bytes = 0;
+        ptr<NuRaftLogSegment> segment;
+        {
+            std::unique_lock lock(remove_mutex);
+            remove_cv.wait(lock, [this] { return remove_thread_stopped || !files_to_remove.empty() || !segments_to_index.empty(); });
+            if (remove_thread_stopped)
+                return;
+            /// Writing index is cheap and makes the next startup fast, do it first.
+            if (!segments_to_index.empty())
+                segment = segments_to_index.front();
+            else
+                std::tie(path, remaining_bytes) = files_to_remove.front();
+        }
+
+        if (segment)
+        {
+            /// Not fatal if the index is missing, the segment is scanned when loading.
+            segment->writeIndexIfClosed();
+            {
+                std::lock_guard lock(remove_mutex);
+                segments_to_index.pop_front();
+            }
+            remove_cv.notify_all();
+            continue;
+        }
+
+        try
+        {
+            if (!removeFileInSteps(path, remaining_bytes))
+                return;
+            LOG_INFO(log, "Removed log segment file {}", path);
+        }
+        catch (...)
+        {
+            tryLogCurrentException(log, "Fail to remove log segment file " + path);
+        }
+
+        removing_bytes.fetch_sub(remaining_bytes, std::memory_order_relaxed);
+        removing_segments.fetch_sub(1, std::memory_order_relaxed);
+        {
+            std::lock_guard lock(remove_mutex);
+            files_to_remove.pop_front();
+        }
+        remove_cv.notify_all();
+    }
+}
+
+bool LogSegmentStore::removeFileInSteps(const String & path, UInt64 & remaining_bytes)
+{
+    int fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        if (errno == ENOENT)
+            return true;
+        throwFromErrno(ErrorCodes::CANNOT_OPEN_FILE, "Fail to open removed log segment file {}", path);
+    }
+
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0)
+    {
+        ::close(fd);
+        throwFromErrno(ErrorCodes::CANNOT_OPEN_FILE, "Fail to stat removed log segment file {}", path);
+    }
+
+    UInt64 file_size = file_stat.st_size;
+    while (file_size > 0)
+    {
+        UInt64 new_size = file_size > REMOVE_SEGMENT_STEP_BYTES ? file_size - REMOVE_SEGMENT_STEP_BYTES : 0;
+        if (::ftruncate(fd, new_size) != 0)
+        {
+            ::close(fd);
+            throwFromErrno(ErrorCodes::CANNOT_TRUNCATE_FILE, "Fail to truncate removed log segment file {}", path);
+        }
+
+        UInt64 truncated = std::min(remaining_bytes, file_size - new_size);
+        removing_bytes.fetch_sub(truncated, std::memory_order_relaxed);
+        remaining_bytes -= truncated;
+        file_size = new_size;
+
+        if (file_size > 0)
+        {
+            std::unique_lock lock(remove_mutex);
+            if (remove_cv.wait_for(lock, std::chrono::milliseconds(REMOVE_SEGMENT_STEP_INTERVAL_MS), [this] { return remove_thread_stopped; }))
+            {
+                ::close(fd);
+                return false;
+            }
+        }
+    }
+
+    ::close(fd);
+    Poco::File(path).remove();
+    return true;
+}
+
+void LogSegmentStore::waitBackgroundTasks()
+{
+    std::unique_lock lock(remove_mutex);
+    remove_cv.wait(lock, [this] { return remove_thread_stopped || (files_to_remove.empty() && segments_to_index.empty()); });
+}
+
 bool LogSegmentStore::truncateLog(UInt64 last_index_kept)
 {
     if (last_log_index.load(std::memory_order_acquire) <= last_index_kept)
@@ -873,12 +1587,31 @@ void LogSegmentStore::loadSegmentMetaData()
 
     for (const auto & file : files)
     {
+        /// Removed segment left by last run
+        if (file.starts_with(REMOVED_SEGMENT_FILE_PREFIX))
+        {
+            LOG_INFO(log, "Find removed log segment file {}, delete it in background", file);
+            scheduleSegmentRemoving(log_dir + "/" + file);
+            continue;
+        }
+
         if (!file.starts_with("log_"))
         {
             LOG_WARNING(log, "Skip non-log-segment file {}", file);
             continue;
         }
 
+        /// Index file is loaded with its segment
+        if (file.ends_with(NuRaftLogSegment::INDEX_FILE_SUFFIX))
+        {
+            if (!Poco::File(log_dir + "/" + file.substr(0, file.size() - std::string_view(NuRaftLogSegment::INDEX_FILE_SUFFIX).size())).exists())
+            {
+                LOG_INFO(log, "Remove index file {} whose segment is removed", file);
+                Poco::File(log_dir + "/" + file).remove();
+            }
+            continue;
+        }
+
         LOG_INFO(log, "Find log segment file {}", file);
 
         UInt64 first_index;
@@ -1,18 +1,26 @@
 #pragma once
 
+#include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <mutex>
+#include <optional>
 #include <shared_mutex>
+#include <string_view>
 #include <vector>
 
 #include <Poco/DateTime.h>
 #include <Poco/DateTimeFormatter.h>
 
+#include <Common/IO/MMapReadBufferFromFileDescriptor.h>
+#include <Common/ThreadPool.h>
 #include <common/logger_useful.h>
 #include <libnuraft/basic_types.hxx>
 #include <libnuraft/nuraft.hxx>
 
+#include <Service/IOUringLogWriter.h>
 #include <Service/KeeperUtils.h>
 #include <Service/LogEntry.h>
 
@@ -25,6 +33,7 @@ enum class LogVersion : uint8_t
 {
     V0 = 0,
     V1 = 1, /// with ctime, mtime, magic and version
+    V2 = 2, /// checksum of log entry is CRC32C instead of CRC32
 
     UNKNOWN = 255
 };
@@ -36,7 +45,7 @@ struct LogEntryWithVersion
     ptr<log_entry> entry;
 };
 
-static constexpr auto CURRENT_LOG_VERSION = LogVersion::V1;
+static constexpr auto CURRENT_LOG_VERSION = LogVersion::V2;
 
 class NuRaftLogSegment
 {
@@ -48,14 +57,27 @@ public:
     NuRaftLogSegment(const String & log_dir_, UInt64 first_index_, UInt64 last_index_, const String & file_name_, const String & create_time_);
     /// For existing open segment
     NuRaftLogSegment(const String & log_dir_, UInt64 first_index_, const String & file_name_, const String & create_time_);
+    /// For new open segment from a file created by 'prepareFile', the file is renamed to open segment.
+    NuRaftLogSegment(const String & log_dir_, UInt64 first_index_, int prepared_fd, const String & prepared_path);
+
+    /// Create a file with header written and disk space of preallocate_size allocated and filled with zeros, so that
+    /// a new open segment can be created from it by only renaming. It is slow, so call it in background. Return fd of the file.
+    static int prepareFile(const String & path, UInt64 preallocate_size);
 
     void load();
-    inline UInt64 flush() const;
+    /// Sync entries to disk and return last synced log index, it can run concurrently with appending.
+    UInt64 flush() const;
 
     /// Close an open segment
-    /// is_full: whether the segment is full, if true, close full open log segment and rename to finish file name
+    /// is_full: whether the segment is full, if true, close full open log segment and rename to finish file name.
+    /// Index of the closed segment is not written, see writeIndexIfClosed.
     void close(bool is_full);
+    /// Write index file of a closed segment, skipped if it is reopened or detached meanwhile.
+    void writeIndexIfClosed();
     void remove();
+    /// Remove index file and rename segment file to path, so that the file can be deleted later.
+    /// Return false if the segment file does not exist.
+    bool detach(const String & path);
 
     /**
      * log segment file header
@@ -68,12 +90,20 @@ public:
     /// get data format version
     LogVersion getVersion() const { return version; }
 
-    /// serialize entry, and append to open segment, return appended log index
-    UInt64 appendEntry(const ptr<log_entry> & entry, std::atomic<UInt64> & last_log_index);
+    /// Serialize entry, and append to open segment, return appended log index.
+    /// If use_io_uring is true and io_uring is available, the entry is queued to be written, see IOUringLogWriter.
+    UInt64 appendEntry(const ptr<log_entry> & entry, std::atomic<UInt64> & last_log_index, bool use_io_uring = false);
+
+    /// Submit entries queued to be written.
+    void submitWrites();
 
     /// get entry by index, return null if not exist.
     ptr<log_entry> getEntry(UInt64 index);
 
+    /// Append entries in [start_index, end_index] to 'entries' and add their size to 'bytes'. If max_bytes is not 0,
+    /// stop before 'bytes' exceeds it. Size of an entry is its data length plus term. Return false if stopped early.
+    bool getEntries(UInt64 start_index, UInt64 end_index, UInt64 max_bytes, std::vector<ptr<log_entry>> & entries, UInt64 & bytes);
+
     /// Truncate segment from tail to last_index_kept.
     /// Return true if some logs are removed.
     /// This method will re-open the segment file if it is a closed one.
@@ -91,6 +121,9 @@ public:
     /// Segment file name, see LOG_FINISH_FILE_NAME and LOG_OPEN_FILE_NAME
     String getFileName();
 
+    /// Suffix of index file of closed segment, the file is named as segment file name with the suffix.
+    static constexpr auto INDEX_FILE_SUFFIX = ".idx";
+
 private:
     /// invoked when create new segment
     String getOpenFileName();
@@ -104,21 +137,50 @@ private:
     /// current segment file path
     String getPath();
 
+    /**
+     * Index file of closed segment, with which the segment is loaded without scanning entries.
+     *      version: 1 byte
+     *      first_index, last_index, file_size, offset of first entry: 8 bytes each
+     *      length of every entry including header: 4 bytes each
+     *      checksum: CRC32C of above, 4 bytes
+     * It is not synced, a broken one is detected by checksum and the segment is scanned.
+     */
+    String getIndexPath();
+    void writeIndex();
+    /// Load offsets from index file, return false if it is missing or does not match the segment file.
+    bool loadIndex(UInt64 file_size_read);
+
     /// open file by fd
     void openFileIfNeeded();
 
     /// close file, throw exception if failed
     void closeFileIfNeeded();
 
+    /// Wait until queued entries are written and stop writing by io_uring.
+    void closeWriter();
+
+    /// Map closed segment file into memory, so that reading entries costs no syscall.
+    /// Not fatal if failed, entries are read by pread.
+    void mapFileIfNeeded();
+
     /// get offset in file for log of index.
     /// return -1 if index out of range.
     int64_t getEntryOffset(UInt64 index) const;
+    /// End offset in file of an existing log.
+    UInt64 getEntryEnd(UInt64 index) const;
 
     /// load log entry
     ptr<log_entry> loadEntry(int64_t offset) const;
+    ptr<log_entry> loadEntry(int64_t offset, const LogEntryHeader & header) const;
     LogEntryHeader loadEntryHeader(int64_t offset) const;
 
+    static void writeHeader(int fd, LogVersion version, const String & file_name);
+
+    /// fdatasync the file, fsync on Mac OS
+    void syncFile(int fd) const;
+
     static constexpr size_t MAGIC_AND_VERSION_SIZE = 9;
+    static constexpr UInt8 INDEX_VERSION = 1;
 
     /// segment file directory
     String log_dir;
@@ -146,6 +208,17 @@ private:
     /// segment file size
     std::atomic<UInt64> file_size = 0;
 
+    /// Writer of open segment if entries are written by io_uring.
+    std::unique_ptr<IOUringLogWriter> writer;
+
+    /// Size of disk space allocated for open segment, 0 if not preallocated. The file is filled with zeros
+    /// after the last entry, and it is truncated to file_size when closed as full.
+    UInt64 preallocated_size = 0;
+
+    /// Mapped file of closed segment, it is unmapped when file is closed.
+    std::optional<MMapReadBufferFromFileDescriptor> mapped_file;
+    std::string_view mapped_data;
+
     /// global mutex
     mutable std::shared_mutex log_mutex;
 
@@ -167,6 +240,7 @@ private:
  * SegmentLog file layout:
  *      log_1_1000_create_time: closed segment
  *      log_open_1001_create_time: open segment
+ *      prepared_log_segment: file prepared in background for the next open segment
  */
 class LogSegmentStore final
 {
@@ -176,22 +250,43 @@ public:
     static constexpr UInt64 MAX_LOG_SEGMENT_FILE_SIZE = 1024 * 1024 * 1024; /// 1GB, 0.3K/Log, 3M logs
     static constexpr size_t LOAD_THREAD_NUM = 8;
 
-    explicit LogSegmentStore(const String & log_dir_, UInt64 max_log_segment_file_size_ = MAX_LOG_SEGMENT_FILE_SIZE)
+    static constexpr auto PREPARED_SEGMENT_FILE_NAME = "prepared_log_segment";
+
+    /// Segments removed by compaction are renamed with the prefix and deleted in background.
+    static constexpr auto REMOVED_SEGMENT_FILE_PREFIX = "removed_";
+    /// Removed segment file is truncated by the step at a time, so that deleting large file does not stall disk.
+    static constexpr UInt64 REMOVE_SEGMENT_STEP_BYTES = 64 * 1024 * 1024;
+    static constexpr UInt64 REMOVE_SEGMENT_STEP_INTERVAL_MS = 10;
+
+    explicit LogSegmentStore(
+        const String & log_dir_,
+        UInt64 max_log_segment_file_size_ = MAX_LOG_SEGMENT_FILE_SIZE,
+        bool preallocate_log_segment_ = false,
+        bool io_uring_log_write_ = false)
         : log_dir(log_dir_)
         , first_log_index(1)
         , last_log_index(0)
         , max_log_segment_file_size(max_log_segment_file_size_)
+        , preallocate_log_segment(preallocate_log_segment_)
+        , io_uring_log_write(io_uring_log_write_)
         , log(&Poco::Logger::get("LogSegmentStore"))
     {
     }
 
-    static ptr<LogSegmentStore> getInstance(const String & log_dir, bool force_new = false, UInt32 max_log_segment_file_size_ = MAX_LOG_SEGMENT_FILE_SIZE);
+    ~LogSegmentStore();
+
+    static ptr<LogSegmentStore> getInstance(
+        const String & log_dir,
+        bool force_new = false,
+        UInt32 max_log_segment_file_size_ = MAX_LOG_SEGMENT_FILE_SIZE,
+        bool preallocate_log_segment_ = false,
+        bool io_uring_log_write_ = false);
 
     /// Init log store, will create dir if not exist
     void init();
 
     void close();
-    /// Return last flushed log index
+    /// Return last flushed log index. Appending is not blocked by flushing.
     UInt64 flush();
 
     /// first log index in whole log store
@@ -203,17 +298,28 @@ public:
     /// Append entry to log store
     UInt64 appendEntry(const ptr<log_entry> & entry);
 
+    /// Submit entries queued to be written by io_uring, usually invoked at the end of an append batch.
+    void submitWrites();
+
     /// First truncate log whose index is larger than or equals with index of entry, then append it.
     void writeAt(UInt64 index, const ptr<log_entry> & entry);
     ptr<log_entry> getEntry(UInt64 index) const;
 
-    /// Just for test
-    std::vector<ptr<log_entry>> getEntries(UInt64 start_index, UInt64 end_index) const;
+    /// Get entries in [start_index, end_index] segment by segment, null for entries not exist. If max_bytes is not 0,
+    /// stop before total size of entries exceeds it, see NuRaftLogSegment::getEntries.
+    std::vector<ptr<log_entry>> getEntries(UInt64 start_index, UInt64 end_index, UInt64 max_bytes = 0) const;
 
     /// Remove segments from storage's head, logs in [1, first_index_kept) will be discarded, usually invoked when compaction.
-    /// return number of segments removed
+    /// Segments are detached at once and their files are deleted in background. Return number of segments removed.
     int removeSegment(UInt64 first_index_kept);
 
+    /// Removed segment files and their bytes not deleted yet.
+    UInt64 removingSegmentsCount() const { return removing_segments.load(std::memory_order_relaxed); }
+    UInt64 removingSegmentsBytes() const { return removing_bytes.load(std::memory_order_relaxed); }
+
+    /// Wait until all removed segment files are deleted and indexes of closed segments are written, just for tests.
+    void waitBackgroundTasks();
+
     /// Delete uncommitted logs from storage's tail, (last_index_kept, infinity) will be discarded
     /// Return true if some logs are removed
     bool truncateLog(UInt64 last_index_kept);
@@ -232,6 +338,21 @@ private:
     /// open a new segment, invoked when init
     void openNewSegmentIfNeeded();
 
+    /// Prepare file for the next open segment in background.
+    void scheduleSegmentPreparing();
+    /// Wait preparing and take the prepared file, return -1 if there is none.
+    int takePreparedSegment();
+    String getPreparedSegmentPath() const { return log_dir + "/" + PREPARED_SEGMENT_FILE_NAME; }
+
+    /// Hand removed segment file to the background thread.
+    void scheduleSegmentRemoving(const String & path);
+    /// Hand closed segment to the background thread to write its index, out of seg_mutex.
+    void scheduleIndexWriting(const ptr<NuRaftLogSegment> & segment);
+    void startBackgroundThreadIfNeeded();
+    void backgroundThread();
+    /// Truncate file step by step and delete it, return false if it is interrupted by shutdown.
+    bool removeFileInSteps(const String & path, UInt64 & remaining_bytes);
+
     /// list segments, invoked when init
     void loadSegmentMetaData();
 
@@ -251,6 +372,31 @@ private:
     /// max segment file size
     UInt32 max_log_segment_file_size;
 
+    /// Whether to preallocate disk space of max_log_segment_file_size for open segment and prepare the next
+    /// open segment in background, so that appending never extends file and rolling over segment is cheap.
+    bool preallocate_log_segment;
+
+    /// Whether to write entries by io_uring if it is available, see IOUringLogWriter.
+    bool io_uring_log_write;
+
+    /// Thread preparing the next open segment, and fd of the prepared file or -1.
+    std::unique_ptr<ThreadFromGlobalPool> prepare_thread;
+    int prepared_fd = -1;
+
+    /// Thread writing indexes of closed segments and deleting removed segment files one by one, started
+    /// when the first task is scheduled.
+    std::unique_ptr<ThreadFromGlobalPool> remove_thread;
+    std::mutex remove_mutex;
+    std::condition_variable remove_cv;
+    /// Files and their bytes not deleted yet, the front one is being deleted.
+    std::deque<std::pair<String, UInt64>> files_to_remove;
+    /// Closed segments whose index is not written yet, the front one is being written.
+    std::deque<ptr<NuRaftLogSegment>> segments_to_index;
+    bool remove_thread_stopped = false;
+
+    std::atomic<UInt64> removing_segments{0};
+    std::atomic<UInt64> removing_bytes{0};
+
     Poco::Logger * log;
 
     /// closed segments
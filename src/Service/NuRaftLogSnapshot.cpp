@@ -1,7 +1,10 @@
 #include <algorithm>
+#include <atomic>
 #include <fcntl.h>
 #include <filesystem>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <tuple>
 #include <unistd.h>
 
 #include <Poco/DateTime.h>
@@ -10,7 +13,10 @@
 #include <Poco/NumberFormatter.h>
 
 #include <Common/Exception.h>
+#include <Common/IO/MMapReadBufferFromFile.h>
 #include <Common/Stopwatch.h>
+#include <Common/getNumberOfPhysicalCPUCores.h>
+#include <common/scope_guard.h>
 #include <fmt/format.h>
 
 #include <Service/Crc32.h>
@@ -40,9 +46,22 @@ using nuraft::cs_new;
 void KeeperSnapshotStore::getObjectPath(ulong object_id, String & obj_path) const
 {
     SnapObject s_obj(curr_time.c_str(), last_log_term, last_log_index, object_id);
+    if (is_delta)
+    {
+        s_obj.is_delta = true;
+        s_obj.parent_log_term = parent_log_term;
+        s_obj.parent_log_index = parent_log_index;
+    }
     obj_path = snap_dir + "/" + s_obj.getObjectName();
 }
 
+String KeeperSnapshotStore::getReceivingObjectPath(ulong object_id) const
+{
+    String obj_path;
+    getObjectPath(object_id, obj_path);
+    return snap_dir + "/" + RECEIVING_OBJECT_PREFIX + std::filesystem::path(obj_path).filename().string();
+}
+
 size_t KeeperSnapshotStore::getObjectIdx(const String & file_name)
 {
     auto it = file_name.find_last_of('_');
@@ -58,7 +77,7 @@ size_t KeeperSnapshotStore::serializeDataTreeV2(KeeperStore & storage)
     uint32_t checksum = 0;
 
     serializeNodeV2(out, batch, storage, "/", processed, checksum);
-    auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+    auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, compression_method, compression_level);
     checksum = new_checksum;
 
     writeTailAndClose(out, checksum);
@@ -72,8 +91,8 @@ size_t KeeperSnapshotStore::serializeDataTreeAsync(SnapTask & snap_task) const
     std::shared_ptr<WriteBufferFromFile> out;
     ptr<SnapshotBatchBody> batch;
 
-    auto checksum = serializeNodeAsync(out, batch, *snap_task.buckets_nodes);
-    auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+    auto checksum = serializeNodeAsync(out, batch, snap_task.data_tree_view->getDataTree());
+    auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, compression_method, compression_level);
     checksum = new_checksum;
 
     writeTailAndClose(out, checksum);
@@ -96,7 +115,7 @@ void KeeperSnapshotStore::serializeNodeV2(
     if (!node)
         return;
 
-    std::shared_ptr<KeeperNode> node_copy = node->clone();
+    KeeperNodePtr node_copy = node->clone();
 
     if (processed % max_object_node_size == 0)
     {
@@ -106,7 +125,7 @@ void KeeperSnapshotStore::serializeNodeV2(
         if (obj_id != 0)
         {
             /// flush last batch data
-            auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+            auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, compression_method, compression_level);
             checksum = new_checksum;
 
             /// close current object file
@@ -129,7 +148,7 @@ void KeeperSnapshotStore::serializeNodeV2(
         if (processed != 0)
         {
             /// flush data in batch to file
-            auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+            auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, compression_method, compression_level);
             checksum = new_checksum;
         }
         else
@@ -148,19 +167,20 @@ void KeeperSnapshotStore::serializeNodeV2(
         path_with_slash += '/';
 
     for (const auto & child : node->children)
-        serializeNodeV2(out, batch, store, path_with_slash + child, processed, checksum);
+        serializeNodeV2(out, batch, store, path_with_slash + String(child), processed, checksum);
 }
 
 uint32_t KeeperSnapshotStore::serializeNodeAsync(
     ptr<WriteBufferFromFile> & out,
     ptr<SnapshotBatchBody> & batch,
-    BucketNodes & bucket_nodes) const
+    KeeperStore::DataTree & data_tree) const
 {
     uint64_t processed = 0;
     uint32_t checksum = 0;
-    for (auto && bucket : bucket_nodes)
+    for (UInt32 bucket_id = 0; bucket_id < data_tree.getBucketNum(); bucket_id++)
     {
-        for (auto && [path, node] : bucket)
+        /// Nodes in a pinned data tree are never modified, so there is no need to copy them.
+        data_tree.getMap(bucket_id).forEach([&](const String & path, const KeeperNodePtr & node)
         {
             if (processed % max_object_node_size == 0)
             {
@@ -170,7 +190,7 @@ uint32_t KeeperSnapshotStore::serializeNodeAsync(
                 if (obj_id != 0)
                 {
                     /// flush last batch data
-                    auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+                    auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, compression_method, compression_level);
                     checksum = new_checksum;
 
                     /// close current object file
@@ -193,7 +213,7 @@ uint32_t KeeperSnapshotStore::serializeNodeAsync(
                 if (processed != 0)
                 {
                     /// flush data in batch to file
-                    auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+                    auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, compression_method, compression_level);
                     checksum = new_checksum;
                 }
                 else
@@ -206,14 +226,21 @@ uint32_t KeeperSnapshotStore::serializeNodeAsync(
             LOG_TRACE(log, "Append node path {}", path);
             appendNodeToBatchV2(batch, path, node, version);
             processed++;
-        }
+        });
     }
     return checksum;
 }
 
 void KeeperSnapshotStore::appendNodeToBatchV2(
-    ptr<SnapshotBatchBody> batch, const String & path, std::shared_ptr<KeeperNode> node, SnapshotVersion version)
+    ptr<SnapshotBatchBody> batch, const String & path, KeeperNodePtr node, SnapshotVersion version)
 {
+    /// Nodes are encoded together when the batch is saved.
+    if (version >= SnapshotVersion::V4)
+    {
+        batch->nodes.emplace_back(path, std::move(node));
+        return;
+    }
+
     WriteBufferFromNuraftBuffer buf;
 
     Coordination::write(path, buf);
@@ -397,64 +424,224 @@ size_t KeeperSnapshotStore::createObjectsAsyncImpl(SnapTask & snap_task)
     return total_obj_count;
 }
 
-void KeeperSnapshotStore::init(const String & create_time)
+size_t KeeperSnapshotStore::createDeltaObjects(
+    KeeperStore & store, const KeeperStore::DirtyPaths & dirty_paths, int64_t next_zxid, int64_t next_session_id)
 {
-    if (create_time.empty())
+    auto session_and_timeout = store.getSessionAndTimeOut();
+    auto session_and_auth = store.getSessionAndAuth();
+    auto get_node = [&store](const String & path) -> KeeperNodePtr
     {
-        Poco::LocalDateTime now;
-        curr_time = Poco::DateTimeFormatter::format(now, "%Y%m%d%H%M%S");
+        auto node = store.getNode(path);
+        return node ? node->clone() : nullptr;
+    };
+    return createDeltaObjectsImpl(
+        dirty_paths, get_node, next_zxid, next_session_id, session_and_timeout, session_and_auth, store.getACLMap().getMapping());
+}
+
+size_t KeeperSnapshotStore::createDeltaObjectsAsync(SnapTask & snap_task)
+{
+    /// Nodes in a pinned data tree are never modified, so there is no need to copy them.
+    auto get_node = [&snap_task](const String & path) { return snap_task.data_tree_view->getDataTree().get(path); };
+    return createDeltaObjectsImpl(
+        snap_task.dirty_paths,
+        get_node,
+        snap_task.next_zxid,
+        snap_task.next_session_id,
+        snap_task.session_and_timeout,
+        snap_task.session_and_auth,
+        snap_task.acl_map);
+}
+
+size_t KeeperSnapshotStore::createDeltaObjectsImpl(
+    const KeeperStore::DirtyPaths & dirty_paths,
+    const std::function<KeeperNodePtr(const String &)> & get_node,
+    int64_t next_zxid,
+    int64_t next_session_id,
+    SessionAndTimeout & session_and_timeout,
+    SessionAndAuth & session_and_auth,
+    const NumToACLMap & acl_map)
+{
+    if (snap_meta->size() == 0)
+    {
+        return 0;
     }
-    else
+
+    Poco::File(snap_dir).createDirectories();
+
+    /// Parent path is less than its children, so that parents are created before children when loading.
+    std::vector<String> paths(dirty_paths.paths.begin(), dirty_paths.paths.end());
+    std::sort(paths.begin(), paths.end());
+
+    std::vector<std::pair<String, KeeperNodePtr>> changed_nodes;
+    std::vector<String> removed_paths;
+    for (auto & path : paths)
     {
-        curr_time = create_time;
+        if (auto node = get_node(path))
+            changed_nodes.emplace_back(std::move(path), std::move(node));
+        else
+            removed_paths.emplace_back(std::move(path));
+    }
+
+    size_t data_object_count = std::max<size_t>(1, (changed_nodes.size() + max_object_node_size - 1) / max_object_node_size);
+    size_t total_obj_count = data_object_count + 3;
+
+    LOG_INFO(
+        log,
+        "Creating delta snapshot on term {} log index {} with changed nodes {}, removed nodes {}, total_obj_count {}, next zxid {}, "
+        "next session id {}",
+        parent_log_term,
+        parent_log_index,
+        changed_nodes.size(),
+        removed_paths.size(),
+        total_obj_count,
+        next_zxid,
+        next_session_id);
+
+    /// 1. Save uint map before nodes
+    IntMap int_map;
+    int_map["ZXID"] = next_zxid;
+    int_map["SESSIONID"] = next_session_id;
+    int_map["OBJECTCOUNT"] = total_obj_count;
+
+    String map_path;
+    getObjectPath(1, map_path);
+    serializeMapV2(int_map, save_batch_size, version, map_path);
+
+    /// 2. Save sessions, they are always saved entirely for there are not many of them.
+    String session_path;
+    getObjectPath(2, session_path);
+    serializeSessionsV2(session_and_timeout, session_and_auth, save_batch_size, version, session_path);
+
+    /// 3. Save acls
+    String acl_path;
+    getObjectPath(3, acl_path);
+    serializeAclsV2(acl_map, acl_path, save_batch_size, version);
+
+    /// 4. Save changed nodes
+    ptr<WriteBufferFromFile> out;
+    ptr<SnapshotBatchBody> batch;
+    uint32_t checksum = 0;
+
+    auto flush_batch = [&]
+    {
+        auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, compression_method, compression_level);
+        checksum = new_checksum;
+    };
+
+    for (size_t i = 0; i < changed_nodes.size(); i++)
+    {
+        if (i % max_object_node_size == 0)
+        {
+            if (i != 0)
+            {
+                flush_batch();
+                writeTailAndClose(out, checksum);
+                checksum = 0;
+            }
+
+            String new_obj_path;
+            getObjectPath(i / max_object_node_size + 4, new_obj_path);
+            LOG_INFO(log, "Creating new delta snapshot object {}, path {}", i / max_object_node_size + 4, new_obj_path);
+            out = openFileAndWriteHeader(new_obj_path, version);
+            batch = cs_new<SnapshotBatchBody>();
+        }
+        else if (i % save_batch_size == 0)
+        {
+            flush_batch();
+        }
+
+        appendNodeToBatchV2(batch, changed_nodes[i].first, changed_nodes[i].second, version);
+    }
+
+    if (!out)
+    {
+        String new_obj_path;
+        getObjectPath(4, new_obj_path);
+        out = openFileAndWriteHeader(new_obj_path, version);
+    }
+
+    if (batch && !batch->empty())
+        flush_batch();
+
+    /// 5. Save removed paths in the last object, children are removed before parents.
+    batch = cs_new<SnapshotBatchBody>();
+    batch->type = SnapshotBatchType::SNAPSHOT_TYPE_DATA_REMOVED;
+    for (auto it = removed_paths.rbegin(); it != removed_paths.rend(); ++it)
+    {
+        batch->add(*it);
+        if (batch->size() == save_batch_size)
+        {
+            flush_batch();
+            batch->type = SnapshotBatchType::SNAPSHOT_TYPE_DATA_REMOVED;
+        }
+    }
+
+    if (batch->size() != 0)
+        flush_batch();
+
+    writeTailAndClose(out, checksum);
+
+    for (size_t i = 1; i < total_obj_count + 1; i++)
+    {
+        String path;
+        getObjectPath(i, path);
+        addObjectPath(i, path);
     }
+
+    return total_obj_count;
 }
 
-void KeeperSnapshotStore::parseBatchHeader(ptr<std::fstream> fs, SnapshotBatchHeader & head)
+void KeeperSnapshotStore::init(const String & create_time)
 {
-    head.reset();
-    if (readUInt32(fs, head.data_length) != 0)
+    if (create_time.empty())
     {
-        if (!fs->eof())
-            throwFromErrno("Can't read header data_length from snapshot file", ErrorCodes::CORRUPTED_SNAPSHOT);
+        Poco::LocalDateTime now;
+        curr_time = Poco::DateTimeFormatter::format(now, "%Y%m%d%H%M%S");
     }
-
-    if (readUInt32(fs, head.data_crc) != 0)
+    else
     {
-        if (!fs->eof())
-            throwFromErrno("Can't read header data_crc from snapshot file", ErrorCodes::CORRUPTED_SNAPSHOT);
+        curr_time = create_time;
     }
 }
 
 void KeeperSnapshotStore::parseObject(KeeperStore & store, String obj_path, BucketEdges & buckets_edges, BucketNodes & bucket_nodes)
 {
-    ptr<std::fstream> snap_fs = cs_new<std::fstream>();
-    snap_fs->open(obj_path, std::ios::in | std::ios::binary);
+    readObject(
+        obj_path,
+        [&](std::string_view body, SnapshotVersion version_from_obj)
+        { parseBatchBodyV2(store, body, buckets_edges, bucket_nodes, version_from_obj); });
+}
 
-    if (snap_fs->fail())
-        throwFromErrno("Open snapshot object " + obj_path + " for read failed", ErrorCodes::CORRUPTED_SNAPSHOT);
+void KeeperSnapshotStore::readObject(
+    const String & obj_path, const std::function<void(std::string_view, SnapshotVersion)> & on_batch, bool decompress)
+{
+    /// Batches are walked in place in the mapped object and passed to on_batch without copying.
+    MMapReadBufferFromFile mapped_file(obj_path, 0);
+    const char * data = mapped_file.buffer().begin();
+    size_t file_size = mapped_file.buffer().size();
 
-    snap_fs->seekg(0, snap_fs->end);
-    size_t file_size = snap_fs->tellg();
-    snap_fs->seekg(0, snap_fs->beg);
+    if (file_size != 0)
+        ::madvise(const_cast<char *>(data), file_size, MADV_SEQUENTIAL);
 
     LOG_INFO(log, "Open snapshot object {} for read, file size {}", obj_path, file_size);
 
     size_t read_size = 0;
-    SnapshotBatchHeader header;
     UInt32 checksum = 0;
     SnapshotVersion version_from_obj = SnapshotVersion::UNKNOWN;
 
-    while (!snap_fs->eof())
+    auto read_int = [&](auto & x)
     {
-        size_t cur_read_size = read_size;
-        UInt64 magic;
+        memcpy(&x, data + read_size, sizeof(x));
+        read_size += sizeof(x);
+    };
 
+    while (true)
+    {
         // If raft snapshot version is v0, we get eof when read magic.
         // Just log it, and break;
-        if (readUInt64(snap_fs, magic) != 0)
+        if (read_size + sizeof(UInt64) > file_size)
         {
-            if (snap_fs->eof() && version_from_obj == SnapshotVersion::V0)
+            if (version_from_obj == SnapshotVersion::V0)
             {
                 LOG_DEBUG(log, "obj_path {}, read file tail, version {}", obj_path, uint8_t(version_from_obj));
                 break;
@@ -463,22 +650,27 @@ void KeeperSnapshotStore::parseObject(KeeperStore & store, String obj_path, Buck
                 ErrorCodes::CORRUPTED_SNAPSHOT, "snapshot {} load magic error, version {}", obj_path, toString(version_from_obj));
         }
 
-        read_size += 8;
+        size_t cur_read_size = read_size;
+        UInt64 magic;
+        read_int(magic);
+
         if (isSnapshotFileHeader(magic))
         {
-            char * buf = reinterpret_cast<char *>(&version_from_obj);
-            snap_fs->read(buf, sizeof(uint8_t));
-            read_size += 1;
+            if (read_size + sizeof(UInt8) > file_size)
+                throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "snapshot {} load version error", obj_path);
+
+            read_int(version_from_obj);
             LOG_DEBUG(log, "Got snapshot file header with version {}", toString(version_from_obj));
             if (version_from_obj > CURRENT_SNAPSHOT_VERSION)
                 throw Exception(ErrorCodes::UNKNOWN_FORMAT_VERSION, "Unsupported snapshot version {}", toString(version_from_obj));
         }
         else if (isSnapshotFileTail(magic))
         {
+            if (read_size + sizeof(UInt32) > file_size)
+                throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "snapshot {} load checksum error", obj_path);
+
             UInt32 file_checksum;
-            char * buf = reinterpret_cast<char *>(&file_checksum);
-            snap_fs->read(buf, sizeof(UInt32));
-            read_size += 4;
+            read_int(file_checksum);
             LOG_DEBUG(log, "obj_path {}, file_checksum {}, checksum {}.", obj_path, file_checksum, checksum);
             if (file_checksum != checksum)
                 throw Exception(ErrorCodes::CHECKSUM_DOESNT_MATCH, "snapshot {} checksum doesn't match", obj_path);
@@ -493,62 +685,69 @@ void KeeperSnapshotStore::parseObject(KeeperStore & store, String obj_path, Buck
             }
 
             LOG_DEBUG(log, "obj_path {}, didn't read the header and tail of the file", obj_path);
-            snap_fs->seekg(cur_read_size);
             read_size = cur_read_size;
         }
 
-        parseBatchHeader(snap_fs, header);
+        if (read_size + SnapshotBatchHeader::HEADER_SIZE > file_size)
+            throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Can't read batch header from snapshot object file {}", obj_path);
 
-        checksum = updateCheckSum(checksum, header.data_crc);
-        String body_string(header.data_length, '0');
-        char * body_buf = body_string.data();
-        read_size += (SnapshotBatchHeader::HEADER_SIZE + header.data_length);
+        SnapshotBatchHeader header;
+        read_int(header.data_length);
+        read_int(header.data_crc);
 
-        if (!snap_fs->read(body_buf, header.data_length))
-        {
-            throwFromErrno(
-                "Can't read snapshot object file " + obj_path + ", batch size " + std::to_string(header.data_length) + ", only "
-                    + std::to_string(snap_fs->gcount()) + " could be read",
-                ErrorCodes::CORRUPTED_SNAPSHOT);
-        }
+        if (read_size + header.data_length > file_size)
+            throw Exception(
+                ErrorCodes::CORRUPTED_SNAPSHOT,
+                "Can't read snapshot object file {}, batch size {}, only {} could be read",
+                obj_path,
+                header.data_length,
+                file_size - read_size);
 
-        if (!verifyCRC32(body_buf, header.data_length, header.data_crc))
-        {
-            throwFromErrno("Can't read snapshot object file " + obj_path + ", batch crc not match.", ErrorCodes::CORRUPTED_SNAPSHOT);
-        }
+        std::string_view body(data + read_size, header.data_length);
+        read_size += header.data_length;
+
+        checksum = updateCheckSum(checksum, header.data_crc);
+        if (getBatchChecksum(body.data(), body.size(), version_from_obj) != header.data_crc)
+            throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Can't read snapshot object file {}, batch crc not match.", obj_path);
 
-        parseBatchBodyV2(store, body_string, buckets_edges, bucket_nodes, version_from_obj);
+        if (decompress && version_from_obj >= SnapshotVersion::V4 && isCompressedSnapshotBatch(body))
+            on_batch(decompressSnapshotBatch(body), version_from_obj);
+        else
+            on_batch(body, version_from_obj);
     }
 }
 
 void KeeperSnapshotStore::parseBatchBodyV2(
     KeeperStore & store,
-    const String & body_string,
+    std::string_view body,
     BucketEdges & buckets_edges,
     BucketNodes & bucket_nodes,
     SnapshotVersion version_)
 {
-    ptr<SnapshotBatchBody> batch;
-    batch = SnapshotBatchBody::parse(body_string);
-    switch (batch->type)
+    auto batch = SnapshotBatchBodyView::parse(body);
+    switch (batch.type)
     {
         case SnapshotBatchType::SNAPSHOT_TYPE_DATA:
-            LOG_DEBUG(log, "Parsing batch data from snapshot, data count {}", batch->size());
-            parseBatchDataV2(store, *batch, buckets_edges, bucket_nodes, version_);
+            LOG_DEBUG(log, "Parsing batch data from snapshot, data count {}", batch.size());
+            parseBatchDataV2(store, batch, buckets_edges, bucket_nodes, version_);
+            break;
+        case SnapshotBatchType::SNAPSHOT_TYPE_DATA_COMPACT:
+            LOG_DEBUG(log, "Parsing batch compact data from snapshot");
+            parseBatchCompactData(store, batch, buckets_edges, bucket_nodes);
             break;
         case SnapshotBatchType::SNAPSHOT_TYPE_SESSION: {
-            LOG_DEBUG(log, "Parsing batch session from snapshot, session count {}", batch->size());
-            parseBatchSessionV2(store, *batch, version_);
+            LOG_DEBUG(log, "Parsing batch session from snapshot, session count {}", batch.size());
+            parseBatchSessionV2(store, batch, version_);
         }
         break;
         case SnapshotBatchType::SNAPSHOT_TYPE_ACLMAP:
-            LOG_DEBUG(log, "Parsing batch acl from snapshot, acl count {}", batch->size());
-            parseBatchAclMapV2(store, *batch, version_);
+            LOG_DEBUG(log, "Parsing batch acl from snapshot, acl count {}", batch.size());
+            parseBatchAclMapV2(store, batch, version_);
             break;
         case SnapshotBatchType::SNAPSHOT_TYPE_UINTMAP:
-            LOG_DEBUG(log, "Parsing batch int_map from snapshot, element count {}", batch->size());
+            LOG_DEBUG(log, "Parsing batch int_map from snapshot, element count {}", batch.size());
             loaded_objects_count.reset();
-            parseBatchIntMapV2(store, loaded_objects_count, *batch, version_);
+            parseBatchIntMapV2(store, loaded_objects_count, batch, version_);
             LOG_DEBUG(log, "Parsed zxid {}, session_id_counter {}", store.getZxid(), store.getSessionIDCounter());
             break;
         case SnapshotBatchType::SNAPSHOT_TYPE_CONFIG:
@@ -559,42 +758,51 @@ void KeeperSnapshotStore::parseBatchBodyV2(
     }
 }
 
-void KeeperSnapshotStore::loadLatestSnapshot(KeeperStore & store)
+void KeeperSnapshotStore::checkObjectsContinuous() const
 {
     size_t objects_cnt = objects_path.size();
 
     // The object IDs are consecutive starting from 1,
     // so the first number must be 1, and the last number must be the total count.
-    if (objects_path.begin()->first != 1 || objects_path.rbegin()->first != objects_cnt)
+    if (objects_path.empty() || objects_path.begin()->first != 1 || objects_path.rbegin()->first != objects_cnt)
     {
         throw Exception(ErrorCodes::SNAPSHOT_OBJECT_INCOMPLETE,
         "Loading snapshot objects error, expecting 1 ~ {} objects, got {} ~ {} objects",
-        objects_cnt, objects_path.begin()->first, objects_path.rbegin()->first);
+        objects_cnt, objects_path.empty() ? 0 : objects_path.begin()->first, objects_path.empty() ? 0 : objects_path.rbegin()->first);
     }
+}
+
+void KeeperSnapshotStore::loadLatestSnapshot(KeeperStore & store)
+{
+    size_t objects_cnt = objects_path.size();
+    checkObjectsContinuous();
 
-    ThreadPool thread_pool(SNAPSHOT_THREAD_NUM);
+    /// Objects and buckets are taken by threads one by one, for objects may differ in size a lot.
+    size_t thread_num = std::max(static_cast<size_t>(SNAPSHOT_THREAD_NUM), static_cast<size_t>(getNumberOfPhysicalCPUCores()));
+    ThreadPool thread_pool(thread_num);
 
     all_objects_edges = std::vector<BucketEdges>(objects_cnt);
     all_objects_nodes = std::vector<BucketNodes>(objects_cnt);
 
-    LOG_INFO(log, "Parsing snapshot objects from disk");
+    std::vector<String> paths;
+    paths.reserve(objects_cnt);
+    for (const auto & [_, obj_path] : objects_path)
+        paths.push_back(obj_path);
+
+    LOG_INFO(log, "Parsing snapshot objects from disk with {} threads", std::min(thread_num, objects_cnt));
     Stopwatch watch;
 
-    for (UInt32 thread_id = 0; thread_id < SNAPSHOT_THREAD_NUM; thread_id++)
+    std::atomic<size_t> next_object = 0;
+    for (size_t thread_id = 0; thread_id < std::min(thread_num, objects_cnt); thread_id++)
     {
         thread_pool.trySchedule(
-            [this, thread_id, &store]
+            [this, thread_id, &store, &paths, &next_object]
             {
                 Poco::Logger * thread_log = &(Poco::Logger::get("KeeperSnapshotStore.parseObjectThread#" + std::to_string(thread_id)));
-                UInt32 obj_idx = 0;
-                for (auto it = this->objects_path.begin(); it != this->objects_path.end(); it++)
+                for (size_t obj_idx = next_object++; obj_idx < paths.size(); obj_idx = next_object++)
                 {
-                    if (obj_idx % SNAPSHOT_THREAD_NUM == thread_id)
-                    {
-                        LOG_INFO(thread_log, "Parsing snapshot object {}", it->second);
-                        parseObject(store, it->second, all_objects_edges[obj_idx], all_objects_nodes[obj_idx]);
-                    }
-                    obj_idx++;
+                    LOG_INFO(thread_log, "Parsing snapshot object {}", paths[obj_idx]);
+                    parseObject(store, paths[obj_idx], all_objects_edges[obj_idx], all_objects_nodes[obj_idx]);
                 }
             });
     }
@@ -612,27 +820,35 @@ void KeeperSnapshotStore::loadLatestSnapshot(KeeperStore & store)
     LOG_INFO(log, "Building data tree from snapshot objects");
     watch.restart();
 
-    /// Build data tree relationship in parallel
-    for (UInt32 thread_id = 0; thread_id < SNAPSHOT_THREAD_NUM; thread_id++)
+    /// Build data tree relationship in parallel. Children are built after all buckets are filled,
+    /// for the trie engine shares nodes between buckets.
+    for (bool fill : {true, false})
     {
-        thread_pool.trySchedule(
-            [this, thread_id, &store]
-            {
-                Poco::Logger * thread_log = &(Poco::Logger::get("KeeperSnapshotStore.buildDataTreeThread#" + std::to_string(thread_id)));
-                for (UInt32 bucket_id = 0; bucket_id < store.getDataTreeBucketNum(); bucket_id++)
+        std::atomic<UInt32> next_bucket = 0;
+        for (size_t thread_id = 0; thread_id < std::min<size_t>(thread_num, store.getDataTreeBucketNum()); thread_id++)
+        {
+            thread_pool.trySchedule(
+                [this, thread_id, fill, &store, &next_bucket]
                 {
-                    if (bucket_id % SNAPSHOT_THREAD_NUM == thread_id)
+                    Poco::Logger * thread_log = &(Poco::Logger::get("KeeperSnapshotStore.buildDataTreeThread#" + std::to_string(thread_id)));
+                    for (UInt32 bucket_id = next_bucket++; bucket_id < store.getDataTreeBucketNum(); bucket_id = next_bucket++)
                     {
-                        LOG_INFO(thread_log, "Filling bucket {} in data tree", bucket_id);
-                        store.fillDataTreeBucket(all_objects_nodes, bucket_id);
-                        LOG_INFO(thread_log, "Building children set for data tree bucket {}", bucket_id);
-                        store.buildBucketChildren(all_objects_edges, bucket_id);
+                        if (fill)
+                        {
+                            LOG_INFO(thread_log, "Filling bucket {} in data tree", bucket_id);
+                            store.fillDataTreeBucket(all_objects_nodes, bucket_id);
+                        }
+                        else
+                        {
+                            LOG_INFO(thread_log, "Building children set for data tree bucket {}", bucket_id);
+                            store.buildBucketChildren(all_objects_edges, bucket_id);
+                        }
                     }
-                }
-            });
+                });
+        }
+        thread_pool.wait();
     }
-
-    thread_pool.wait();
+    store.rebuildMemoryUsage();
     LOG_INFO(log, "Building data tree costs {}ms", watch.elapsedMilliseconds());
 
     all_objects_edges.clear();
@@ -648,6 +864,100 @@ void KeeperSnapshotStore::loadLatestSnapshot(KeeperStore & store)
         store.getZxid());
 }
 
+void KeeperSnapshotStore::applyDeltaBatch(KeeperStore & store, std::string_view body, SnapshotVersion version_)
+{
+    auto batch = SnapshotBatchBodyView::parse(body);
+    switch (batch.type)
+    {
+        case SnapshotBatchType::SNAPSHOT_TYPE_DATA:
+            LOG_DEBUG(log, "Applying batch data from delta snapshot, data count {}", batch.size());
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+                ptr<KeeperNodeWithPath> node_with_path;
+                try
+                {
+                    node_with_path = parseKeeperNode(batch[i], version_);
+                }
+                catch (...)
+                {
+                    throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Snapshot is corrupted, can't parse the {}th node in batch", i + 1);
+                }
+
+                /// Some strange ACLID during deserialization from ZooKeeper
+                if (node_with_path->node->acl_id == std::numeric_limits<uint64_t>::max())
+                    node_with_path->node->acl_id = 0;
+
+                store.applySnapshotNode(node_with_path->path, std::move(node_with_path->node));
+            }
+            break;
+        case SnapshotBatchType::SNAPSHOT_TYPE_DATA_COMPACT:
+            LOG_DEBUG(log, "Applying batch compact data from delta snapshot");
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+                parseKeeperNodesCompact(
+                    batch[i],
+                    [&](String && path, KeeperNodePtr && node)
+                    {
+                        if (node->acl_id == std::numeric_limits<uint64_t>::max())
+                            node->acl_id = 0;
+                        store.applySnapshotNode(path, std::move(node));
+                    });
+            }
+            break;
+        case SnapshotBatchType::SNAPSHOT_TYPE_DATA_REMOVED:
+            LOG_DEBUG(log, "Applying batch removed data from delta snapshot, data count {}", batch.size());
+            for (size_t i = 0; i < batch.size(); i++)
+                store.applySnapshotRemovedNode(String(batch[i]));
+            break;
+        case SnapshotBatchType::SNAPSHOT_TYPE_SESSION:
+            parseBatchSessionV2(store, batch, version_);
+            break;
+        case SnapshotBatchType::SNAPSHOT_TYPE_ACLMAP:
+            parseBatchAclMapV2(store, batch, version_);
+            break;
+        case SnapshotBatchType::SNAPSHOT_TYPE_UINTMAP:
+            loaded_objects_count.reset();
+            parseBatchIntMapV2(store, loaded_objects_count, batch, version_);
+            break;
+        default:
+            break;
+    }
+}
+
+void KeeperSnapshotStore::loadDelta(KeeperStore & store)
+{
+    checkObjectsContinuous();
+
+    LOG_INFO(log, "Applying delta snapshot term {} log index {} on term {} log index {}",
+        last_log_term, last_log_index, parent_log_term, parent_log_index);
+    Stopwatch watch;
+
+    /// Sessions are saved entirely in every snapshot.
+    store.resetSessions();
+
+    /// ACLs object is applied after nodes, for mapping of an ACL may be dropped when its usage
+    /// is temporarily decreased to zero while applying nodes.
+    std::vector<String> paths_in_order;
+    for (const auto & [obj_id, obj_path] : objects_path)
+        if (obj_id != 3)
+            paths_in_order.push_back(obj_path);
+    paths_in_order.push_back(objects_path.at(3));
+
+    for (const auto & obj_path : paths_in_order)
+        readObject(obj_path, [&](std::string_view body, SnapshotVersion version_from_obj)
+                   { applyDeltaBatch(store, body, version_from_obj); });
+
+    if (loaded_objects_count && *loaded_objects_count != objects_path.size())
+    {
+        throw Exception(ErrorCodes::SNAPSHOT_OBJECT_INCOMPLETE,
+            "Loading snapshot objects error, expecting {} objects, got {} objects",
+            *loaded_objects_count, objects_path.size());
+    }
+
+    LOG_INFO(log, "Applying delta snapshot costs {}ms, nodes {}, sessions {}, zxid {}",
+        watch.elapsedMilliseconds(), store.getNodesCount(), store.getSessionCount(), store.getZxid());
+}
+
 bool KeeperSnapshotStore::existObject(ulong obj_id)
 {
     return (objects_path.find(obj_id) != objects_path.end());
@@ -738,21 +1048,129 @@ void KeeperSnapshotStore::saveObject(ulong obj_id, buffer & buffer)
     LOG_INFO(log, "Save object path {}, file size {}, obj_id {}.", obj_path, buffer.size(), obj_id);
 }
 
+void KeeperSnapshotStore::loadObjectChunk(ulong obj_id, size_t offset, size_t max_size, ptr<buffer> & buffer, bool & is_last_chunk)
+{
+    if (!existObject(obj_id))
+        throw Exception(ErrorCodes::SNAPSHOT_OBJECT_NOT_EXISTS, "Snapshot object {} does not exist", obj_id);
+
+    String obj_path = objects_path.at(obj_id);
+    int snap_fd = openFileForRead(obj_path);
+    SCOPE_EXIT({ ::close(snap_fd); });
+
+    size_t file_size = ::lseek(snap_fd, 0, SEEK_END);
+    if (offset > file_size)
+        throw Exception(
+            ErrorCodes::SNAPSHOT_OBJECT_NOT_EXISTS,
+            "Chunk at offset {} of snapshot object {} exceeds file size {}",
+            offset,
+            obj_path,
+            file_size);
+
+    size_t chunk_size = std::min(max_size, file_size - offset);
+    is_last_chunk = offset + chunk_size == file_size;
+
+    buffer = buffer::alloc(sizeof(UInt8) + chunk_size);
+    char * chunk = reinterpret_cast<char *>(buffer->data_begin());
+    chunk[0] = is_last_chunk;
+
+    size_t read_size = 0;
+    while (read_size < chunk_size)
+    {
+        ssize_t ret = pread(snap_fd, chunk + sizeof(UInt8) + read_size, chunk_size - read_size, offset + read_size);
+        if (ret <= 0)
+            throwFromErrno(
+                ErrorCodes::CORRUPTED_SNAPSHOT, "Fail to read snapshot file {}, offset {}, length {}", obj_path, offset, chunk_size);
+        read_size += ret;
+    }
+    buffer->pos(0);
+
+    LOG_DEBUG(log, "Load chunk of object obj_id {}, offset {}, size {}, is_last_chunk {}.", obj_id, offset, chunk_size, is_last_chunk);
+}
+
+void KeeperSnapshotStore::saveObjectChunk(ulong obj_id, size_t offset, const char * data, size_t size)
+{
+    Poco::File(snap_dir).createDirectories();
+    String receiving_path = getReceivingObjectPath(obj_id);
+
+    int snap_fd = openFileForWrite(receiving_path);
+    SCOPE_EXIT({ ::close(snap_fd); });
+
+    /// Drop what is left by a former transfer
+    if (offset == 0 && ::ftruncate(snap_fd, 0) < 0)
+        throwFromErrno(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, "Fail to truncate snapshot file {}", receiving_path);
+
+    size_t written = 0;
+    while (written < size)
+    {
+        ssize_t ret = pwrite(snap_fd, data + written, size - written, offset + written);
+        if (ret < 0)
+            throwFromErrno(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, "Fail to write a snapshot file {}", receiving_path);
+        written += ret;
+    }
+}
+
+bool KeeperSnapshotStore::verifyReceivedObject(ulong obj_id)
+{
+    String receiving_path = getReceivingObjectPath(obj_id);
+
+    /// Batch crcs are computed on the compressed data, so batches are checked without decompressing them.
+    try
+    {
+        readObject(receiving_path, [](std::string_view, SnapshotVersion) {}, false);
+    }
+    catch (Exception & e)
+    {
+        if (e.code() != ErrorCodes::CORRUPTED_SNAPSHOT && e.code() != ErrorCodes::CHECKSUM_DOESNT_MATCH)
+            throw;
+        LOG_WARNING(log, "Received snapshot object {} is corrupted, discard it: {}", receiving_path, e.message());
+        Poco::File(receiving_path).remove();
+        return false;
+    }
+    return true;
+}
+
+void KeeperSnapshotStore::addReceivedObject(ulong obj_id)
+{
+    String receiving_path = getReceivingObjectPath(obj_id);
+    String obj_path;
+    getObjectPath(obj_id, obj_path);
+
+    Poco::File file(receiving_path);
+    size_t file_size = file.getSize();
+    file.renameTo(obj_path);
+    objects_path[obj_id] = obj_path;
+
+    LOG_INFO(log, "Save object path {}, file size {}, obj_id {}.", obj_path, file_size, obj_id);
+}
+
+size_t KeeperSnapshotStore::getReceivedObjectSize(ulong obj_id) const
+{
+    Poco::File file(getReceivingObjectPath(obj_id));
+    return file.exists() ? file.getSize() : 0;
+}
+
 void KeeperSnapshotStore::addObjectPath(ulong obj_id, String & path)
 {
     objects_path[obj_id] = path;
 }
 
-size_t KeeperSnapshotManager::createSnapshotAsync(SnapTask & snap_task, SnapshotVersion version)
+size_t KeeperSnapshotManager::createSnapshotAsync(SnapTask & snap_task, std::optional<SnapshotVersion> version_)
 {
     auto && meta = snap_task.s;
     meta->set_size(snap_task.nodes_count);
-    ptr<KeeperSnapshotStore> snap_store = cs_new<KeeperSnapshotStore>(snap_dir, *meta, object_node_size, SAVE_BATCH_SIZE, version);
+    ptr<KeeperSnapshotStore> snap_store = cs_new<KeeperSnapshotStore>(
+        snap_dir, *meta, object_node_size, SAVE_BATCH_SIZE, version_.value_or(version), compression_method, compression_level);
+
+    bool is_delta = shouldCreateDelta(*meta, snap_task.dirty_paths);
+    if (is_delta)
+        snap_store->setParent(snap_task.dirty_paths.base_log_term, snap_task.dirty_paths.base_log_index);
+
     snap_store->init();
     LOG_INFO(
         log,
-        "Creating snapshot with last_log_term {}, last_log_idx {}, size {}, nodes {}, ephemeral nodes {}, sessions {}, session_id_counter {}, "
-        "zxid {}",
+        "Creating {} snapshot with last_log_term {}, last_log_idx {}, size {}, nodes {}, ephemeral nodes {}, sessions {}, "
+        "session_id_counter {}, zxid {}",
+        is_delta ? "delta" : "full",
         meta->get_last_log_term(),
         meta->get_last_log_idx(),
         meta->size(),
@@ -761,22 +1179,30 @@ size_t KeeperSnapshotManager::createSnapshotAsync(SnapTask & snap_task, Snapshot
         snap_task.session_count,
         snap_task.next_session_id,
         snap_task.next_zxid);
-    size_t obj_size = snap_store->createObjectsAsync(snap_task);
+    size_t obj_size = is_delta ? snap_store->createDeltaObjectsAsync(snap_task) : snap_store->createObjectsAsync(snap_task);
     snapshots[getSnapshotStoreMapKey(*meta)] = snap_store;
     return obj_size;
 }
 
 size_t KeeperSnapshotManager::createSnapshot(
-    snapshot & meta, KeeperStore & store, int64_t next_zxid, int64_t next_session_id, SnapshotVersion version)
+    snapshot & meta, KeeperStore & store, int64_t next_zxid, int64_t next_session_id, std::optional<SnapshotVersion> version_)
 {
     size_t store_size = store.getNodesCount();
     meta.set_size(store_size);
-    ptr<KeeperSnapshotStore> snap_store = cs_new<KeeperSnapshotStore>(snap_dir, meta, object_node_size, SAVE_BATCH_SIZE, version);
+    ptr<KeeperSnapshotStore> snap_store = cs_new<KeeperSnapshotStore>(
+        snap_dir, meta, object_node_size, SAVE_BATCH_SIZE, version_.value_or(version), compression_method, compression_level);
+
+    auto dirty_paths = store.takeDirtyPaths(meta.get_last_log_term(), meta.get_last_log_idx());
+    bool is_delta = shouldCreateDelta(meta, dirty_paths);
+    if (is_delta)
+        snap_store->setParent(dirty_paths.base_log_term, dirty_paths.base_log_index);
+
     snap_store->init();
     LOG_INFO(
         log,
-        "Creating snapshot with last_log_term {}, last_log_idx {}, size {}, nodes {}, ephemeral nodes {}, sessions {}, session_id_counter {}, "
-        "zxid {}",
+        "Creating {} snapshot with last_log_term {}, last_log_idx {}, size {}, nodes {}, ephemeral nodes {}, sessions {}, "
+        "session_id_counter {}, zxid {}",
+        is_delta ? "delta" : "full",
         meta.get_last_log_term(),
         meta.get_last_log_idx(),
         meta.size(),
@@ -785,83 +1211,362 @@ size_t KeeperSnapshotManager::createSnapshot(
         store.getSessionCount(),
         next_session_id,
         next_zxid);
-    size_t obj_size = snap_store->createObjects(store, next_zxid, next_session_id);
+    size_t obj_size = is_delta ? snap_store->createDeltaObjects(store, dirty_paths, next_zxid, next_session_id)
+                               : snap_store->createObjects(store, next_zxid, next_session_id);
     snapshots[getSnapshotStoreMapKey(meta)] = snap_store;
     return obj_size;
 }
 
-bool KeeperSnapshotManager::receiveSnapshotMeta(snapshot & meta)
+bool KeeperSnapshotManager::shouldCreateDelta(const snapshot & meta, const KeeperStore::DirtyPaths & dirty_paths) const
 {
-    ptr<KeeperSnapshotStore> snap_store = cs_new<KeeperSnapshotStore>(snap_dir, meta, object_node_size);
-    snap_store->init();
-    snapshots[getSnapshotStoreMapKey(meta)] = snap_store;
+    if (max_delta_snapshots == 0 || dirty_paths.overflow)
+        return false;
+
+    auto base_key = getSnapshotStoreMapKeyImpl(dirty_paths.base_log_term, dirty_paths.base_log_index);
+    if (base_key >= getSnapshotStoreMapKey(meta))
+        return false;
+
+    /// The chain of base snapshot consists of a full snapshot and the delta snapshots on it.
+    auto chain = getSnapshotChainImpl(base_key);
+    return !chain.empty() && chain.size() - 1 < max_delta_snapshots;
+}
+
+KeeperSnapshotManager::SnapshotChain KeeperSnapshotManager::getSnapshotChain(const snapshot & meta) const
+{
+    return getSnapshotChainImpl(getSnapshotStoreMapKey(meta));
+}
+
+KeeperSnapshotManager::SnapshotChain KeeperSnapshotManager::getSnapshotChainImpl(uint128_t key) const
+{
+    SnapshotChain chain;
+    while (true)
+    {
+        auto it = snapshots.find(key);
+        if (it == snapshots.end())
+        {
+            auto [log_term, log_index] = getTermLogFromSnapshotStoreMapKey(key);
+            LOG_WARNING(log, "Snapshot with term {} log index {} in snapshot chain does not exist", log_term, log_index);
+            return {};
+        }
+
+        chain.push_back(it->second);
+        if (!it->second->isDelta())
+            break;
+
+        auto parent_key = getSnapshotStoreMapKeyImpl(it->second->getParentLogTerm(), it->second->getParentLogIndex());
+        if (parent_key >= key)
+        {
+            LOG_WARNING(log, "Delta snapshot is not newer than its parent, it's a bug");
+            return {};
+        }
+        key = parent_key;
+    }
+
+    std::reverse(chain.begin(), chain.end());
+    return chain;
+}
+
+ptr<buffer> KeeperSnapshotManager::serializeSnapshotChain(const snapshot & meta) const
+{
+    auto it = snapshots.find(getSnapshotStoreMapKey(meta));
+    if (it == snapshots.end() || (!it->second->isDelta() && !transfer_chunk_size))
+        return nullptr;
+
+    SnapshotChain chain;
+    if (it->second->isDelta())
+    {
+        chain = getSnapshotChain(meta);
+        if (chain.empty())
+            throw Exception(
+                ErrorCodes::SNAPSHOT_NOT_EXISTS, "Snapshot chain of delta snapshot {} is incomplete", meta.get_last_log_idx());
+    }
+
+    /// section count, (log term, log index, is delta, object count) of every section, and the chunk size
+    size_t chain_size = sizeof(Int32) + chain.size() * (sizeof(UInt64) * 3 + sizeof(UInt8));
+    ptr<buffer> chain_buf = buffer::alloc(chain_size + (transfer_chunk_size ? sizeof(UInt64) : 0));
+    nuraft::buffer_serializer bs(chain_buf);
+    bs.put_i32(static_cast<Int32>(chain.size()));
+    for (const auto & store : chain)
+    {
+        bs.put_u64(store->getSnapshotMeta()->get_last_log_term());
+        bs.put_u64(store->getSnapshotMeta()->get_last_log_idx());
+        bs.put_u8(store->isDelta());
+        bs.put_u64(store->getObjectsCount());
+    }
+    if (transfer_chunk_size)
+        bs.put_u64(transfer_chunk_size);
+    return chain_buf;
+}
+
+bool KeeperSnapshotManager::receiveSnapshotMeta(snapshot & meta, buffer * chain_data)
+{
+    Int32 section_count = 0;
+    receiving_chunk_size = 0;
+    corrupted_object_retries = 0;
+
+    /// (log term, log index, is delta, object count) of every section
+    std::vector<std::tuple<UInt64, UInt64, bool, UInt64>> sections;
+    if (chain_data && chain_data->size() > sizeof(Int32))
+    {
+        chain_data->pos(0);
+        nuraft::buffer_serializer bs(*chain_data);
+        section_count = bs.get_i32();
+        for (Int32 i = 0; i < section_count; i++)
+        {
+            UInt64 log_term = bs.get_u64();
+            UInt64 log_index = bs.get_u64();
+            bool is_delta = bs.get_u8();
+            UInt64 objects_count = bs.get_u64();
+            sections.emplace_back(log_term, log_index, is_delta, objects_count);
+        }
+        if (bs.pos() + sizeof(UInt64) <= chain_data->size())
+            receiving_chunk_size = bs.get_u64();
+    }
+
+    auto it = snapshots.find(getSnapshotStoreMapKey(meta));
+    if (receiving_chunk_size && it != snapshots.end() && it->second->isReceiving())
+    {
+        LOG_INFO(log, "Resume receiving snapshot term {} log index {}", meta.get_last_log_term(), meta.get_last_log_idx());
+        return true;
+    }
+
+    if (sections.empty())
+    {
+        ptr<KeeperSnapshotStore> snap_store = cs_new<KeeperSnapshotStore>(snap_dir, meta, object_node_size);
+        snap_store->init();
+        snap_store->setReceiving(true);
+        snapshots[getSnapshotStoreMapKey(meta)] = snap_store;
+        return true;
+    }
+
+    /// Receive a delta snapshot with the snapshots it is based on, objects of them are sent one by one.
+    UInt64 parent_log_term = 0;
+    UInt64 parent_log_index = 0;
+    for (Int32 i = 0; i < section_count; i++)
+    {
+        auto [log_term, log_index, is_delta, objects_count] = sections[i];
+
+        bool is_last = i == section_count - 1;
+        if ((is_delta && i == 0) || (is_last && getSnapshotStoreMapKeyImpl(log_term, log_index) != getSnapshotStoreMapKey(meta)))
+            throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Invalid snapshot chain of snapshot {}", meta.get_last_log_idx());
+
+        ptr<KeeperSnapshotStore> snap_store;
+        if (is_last)
+        {
+            snap_store = cs_new<KeeperSnapshotStore>(snap_dir, meta, object_node_size);
+        }
+        else
+        {
+            ptr<nuraft::cluster_config> config = cs_new<nuraft::cluster_config>(log_index, log_index - 1);
+            nuraft::snapshot section_meta(log_index, log_term, config);
+            snap_store = cs_new<KeeperSnapshotStore>(snap_dir, section_meta, object_node_size);
+        }
+
+        if (is_delta)
+            snap_store->setParent(parent_log_term, parent_log_index);
+        snap_store->setExpectedObjectsCount(objects_count);
+        snap_store->init();
+        snap_store->setReceiving(true);
+        snapshots[getSnapshotStoreMapKeyImpl(log_term, log_index)] = snap_store;
+
+        LOG_INFO(log, "Receiving snapshot term {} log index {}, is delta {}, object count {}", log_term, log_index, is_delta, objects_count);
+        parent_log_term = log_term;
+        parent_log_index = log_index;
+    }
+
     return true;
 }
 
+std::pair<ptr<KeeperSnapshotStore>, ulong> KeeperSnapshotManager::locateObject(const snapshot & meta, ulong obj_id) const
+{
+    for (const auto & store : getSnapshotChain(meta))
+    {
+        if (obj_id <= store->getObjectsCount())
+            return {store, obj_id};
+        obj_id -= store->getObjectsCount();
+    }
+    return {nullptr, 0};
+}
+
 bool KeeperSnapshotManager::existSnapshot(const snapshot & meta) const
 {
     return snapshots.find(getSnapshotStoreMapKey(meta)) != snapshots.end();
 }
 
-bool KeeperSnapshotManager::existSnapshotObject(const snapshot & meta, ulong obj_id) const
+std::pair<ptr<KeeperSnapshotStore>, ulong> KeeperSnapshotManager::findObject(const snapshot & meta, ulong obj_id) const
+{
+    auto it = snapshots.find(getSnapshotStoreMapKey(meta));
+    if (it == snapshots.end())
+        return {nullptr, 0};
+    if (it->second->isDelta())
+        return locateObject(meta, obj_id);
+    return {it->second, obj_id};
+}
+
+std::pair<ptr<KeeperSnapshotStore>, ulong> KeeperSnapshotManager::getObjectForSave(snapshot & meta, ulong obj_id)
 {
     auto it = snapshots.find(getSnapshotStoreMapKey(meta));
     if (it == snapshots.end())
+    {
+        meta.set_size(0);
+        ptr<KeeperSnapshotStore> store = cs_new<KeeperSnapshotStore>(snap_dir, meta);
+        store->init();
+        snapshots[getSnapshotStoreMapKey(meta)] = store;
+        return {store, obj_id};
+    }
+
+    if (!it->second->isDelta())
+        return {it->second, obj_id};
+
+    auto [store, store_obj_id] = locateObject(meta, obj_id);
+    if (!store)
+        throw Exception(
+            ErrorCodes::CORRUPTED_SNAPSHOT, "Snapshot object {} is out of snapshot chain of {}", obj_id, meta.get_last_log_idx());
+    return {store, store_obj_id};
+}
+
+bool KeeperSnapshotManager::existSnapshotObject(const snapshot & meta, ulong obj_id) const
+{
+    if (!existSnapshot(meta))
     {
         LOG_INFO(log, "Not exists snapshot last_log_idx {}", meta.get_last_log_idx());
         return false;
     }
-    ptr<KeeperSnapshotStore> store = it->second;
-    bool exist = store->existObject(obj_id);
+
+    auto [store, store_obj_id] = findObject(meta, obj_id);
+    bool exist = store && store->existObject(store_obj_id);
     LOG_INFO(log, "Find object {} by last_log_idx {} and object id {}", exist, meta.get_last_log_idx(), obj_id);
     return exist;
 }
 
 bool KeeperSnapshotManager::loadSnapshotObject(const snapshot & meta, ulong obj_id, ptr<buffer> & buffer)
 {
-    auto it = snapshots.find(getSnapshotStoreMapKey(meta));
-
-    if (it == snapshots.end())
+    if (!existSnapshot(meta))
         throw Exception(
             ErrorCodes::SNAPSHOT_NOT_EXISTS,
             "Error when loading snapshot object {}, for snapshot {} does not exist",
             obj_id,
             meta.get_last_log_idx());
 
+    auto [store, store_obj_id] = findObject(meta, obj_id);
+    if (!store)
+        throw Exception(
+            ErrorCodes::SNAPSHOT_OBJECT_NOT_EXISTS, "Snapshot object {} of snapshot {} does not exist", obj_id, meta.get_last_log_idx());
 
-    ptr<KeeperSnapshotStore> store = it->second;
-    store->loadObject(obj_id, buffer);
+    store->loadObject(store_obj_id, buffer);
     return true;
 }
 
 bool KeeperSnapshotManager::saveSnapshotObject(snapshot & meta, ulong obj_id, buffer & buffer)
 {
-    auto it = snapshots.find(getSnapshotStoreMapKey(meta));
+    auto [store, store_obj_id] = getObjectForSave(meta, obj_id);
+    store->saveObject(store_obj_id, buffer);
+    return true;
+}
+
+ulong KeeperSnapshotManager::getNextTransferId(const snapshot & meta) const
+{
+    if (!receiving_chunk_size)
+        return 1;
+
+    ulong obj_id = 1;
+    while (existSnapshotObject(meta, obj_id))
+        obj_id++;
+
+    auto [store, store_obj_id] = findObject(meta, obj_id);
+    ulong chunk_idx = store ? store->getReceivedObjectSize(store_obj_id) / receiving_chunk_size : 0;
+    if (obj_id > 1 || chunk_idx > 0)
+        LOG_INFO(
+            log, "Skip received objects and chunks of snapshot {}, request object {} chunk {}", meta.get_last_log_idx(), obj_id, chunk_idx);
+    return getTransferId(obj_id, chunk_idx);
+}
+
+bool KeeperSnapshotManager::loadSnapshotChunk(const snapshot & meta, ulong transfer_id, ptr<buffer> & buffer)
+{
+    ulong obj_id = transfer_id & 0xFFFFFFFF;
+    ulong chunk_idx = transfer_id >> 32;
+
+    auto [store, store_obj_id] = findObject(meta, obj_id);
+    if (!store)
+        throw Exception(
+            ErrorCodes::SNAPSHOT_OBJECT_NOT_EXISTS, "Snapshot object {} of snapshot {} does not exist", obj_id, meta.get_last_log_idx());
+
+    bool is_last_chunk;
+    store->loadObjectChunk(store_obj_id, chunk_idx * transfer_chunk_size, transfer_chunk_size, buffer, is_last_chunk);
+    return is_last_chunk && !existSnapshotObject(meta, obj_id + 1);
+}
+
+ulong KeeperSnapshotManager::saveSnapshotChunk(
+    snapshot & meta, ulong transfer_id, buffer & buffer, bool is_last_obj, std::mutex & snapshot_mutex)
+{
+    ulong obj_id = transfer_id & 0xFFFFFFFF;
+    ulong chunk_idx = transfer_id >> 32;
+
+    if (buffer.size() < sizeof(UInt8))
+        throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Chunk {} of snapshot object {} is empty", chunk_idx, obj_id);
+
+    const char * chunk = reinterpret_cast<const char *>(buffer.data_begin());
+    bool is_last_chunk = chunk[0];
+
     ptr<KeeperSnapshotStore> store;
-    if (it == snapshots.end())
+    ulong store_obj_id;
     {
-        meta.set_size(0);
-        store = cs_new<KeeperSnapshotStore>(snap_dir, meta);
-        store->init();
-        snapshots[getSnapshotStoreMapKey(meta)] = store;
+        std::lock_guard lock(snapshot_mutex);
+        std::tie(store, store_obj_id) = getObjectForSave(meta, obj_id);
     }
-    else
+
+    /// Only the file the object is received into is touched, which is not visible to others until it is added.
+    store->saveObjectChunk(store_obj_id, chunk_idx * receiving_chunk_size, chunk + sizeof(UInt8), buffer.size() - sizeof(UInt8));
+    if (!is_last_chunk)
+        return getTransferId(obj_id, chunk_idx + 1);
+
+    /// Verify the object while later ones are arriving, so that a corrupted object is received again by itself
+    /// rather than failing the whole snapshot when it is applied.
+    bool intact = store->verifyReceivedObject(store_obj_id);
+
+    std::lock_guard lock(snapshot_mutex);
+    if (!intact)
     {
-        store = it->second;
+        if (++corrupted_object_retries > MAX_CORRUPTED_OBJECT_RETRIES)
+        {
+            corrupted_object_retries = 0;
+            throw Exception(
+                ErrorCodes::CORRUPTED_SNAPSHOT,
+                "Snapshot object {} of snapshot {} is received corrupted {} times, give up installing the snapshot",
+                obj_id,
+                meta.get_last_log_idx(),
+                MAX_CORRUPTED_OBJECT_RETRIES + 1);
+        }
+        return getTransferId(obj_id, 0);
     }
-    store->saveObject(obj_id, buffer);
-    return true;
+
+    corrupted_object_retries = 0;
+    store->addReceivedObject(store_obj_id);
+
+    if (is_last_obj)
+    {
+        for (const auto & received : getSnapshotChain(meta))
+            received->setReceiving(false);
+    }
+    return getTransferId(obj_id + 1, 0);
 }
 
 bool KeeperSnapshotManager::parseSnapshot(const snapshot & meta, KeeperStore & storage)
 {
-    auto it = snapshots.find(getSnapshotStoreMapKey(meta));
-    if (it == snapshots.end())
+    auto chain = getSnapshotChain(meta);
+    if (chain.empty())
     {
         throw Exception(ErrorCodes::SNAPSHOT_NOT_EXISTS, "Error when parsing snapshot {}, for it does not exist", meta.get_last_log_idx());
     }
-    ptr<KeeperSnapshotStore> store = it->second;
-    store->loadLatestSnapshot(storage);
+
+    chain.front()->loadLatestSnapshot(storage);
+
+    if (chain.size() > 1)
+    {
+        for (size_t i = 1; i < chain.size(); i++)
+            chain[i]->loadDelta(storage);
+        storage.rebuildMemoryUsage();
+    }
     return true;
 }
 
@@ -879,6 +1584,13 @@ size_t KeeperSnapshotManager::loadSnapshotMetas()
 
     for (const auto & file : files)
     {
+        if (file.starts_with(KeeperSnapshotStore::RECEIVING_OBJECT_PREFIX))
+        {
+            LOG_INFO(log, "Remove partially received snapshot object {}", file);
+            Poco::File(snap_dir + "/" + file).remove();
+            continue;
+        }
+
         if (!file.starts_with("snapshot_"))
         {
             LOG_WARNING(log, "Skip non-snapshot file {}", file);
@@ -896,6 +1608,8 @@ size_t KeeperSnapshotManager::loadSnapshotMetas()
             ptr<nuraft::cluster_config> config = cs_new<nuraft::cluster_config>(s_obj.log_last_index, s_obj.log_last_index - 1);
             nuraft::snapshot meta(s_obj.log_last_index, s_obj.log_last_term, config);
             ptr<KeeperSnapshotStore> snap_store = cs_new<KeeperSnapshotStore>(snap_dir, meta, object_node_size);
+            if (s_obj.is_delta)
+                snap_store->setParent(s_obj.parent_log_term, s_obj.parent_log_index);
             snap_store->init(s_obj.create_time);
             snapshots[key] = snap_store;
         }
@@ -920,13 +1634,25 @@ ptr<snapshot> KeeperSnapshotManager::lastSnapshot()
 
 size_t KeeperSnapshotManager::removeSnapshots()
 {
-    Int64 remove_count = static_cast<Int64>(snapshots.size()) - static_cast<Int64>(keep_max_snapshot_count);
-
-    LOG_INFO(log, "There are {} snapshots, we will try to move {} of them", snapshots.size(), remove_count);
+    LOG_INFO(log, "There are {} snapshots, keep_max_snapshot_count {}", snapshots.size(), keep_max_snapshot_count);
 
-    while (remove_count > 0)
+    while (snapshots.size() > keep_max_snapshot_count)
     {
-        auto it = snapshots.begin();
+        /// Snapshots which delta snapshots are based on can not be removed, nor the latest snapshot.
+        std::set<uint128_t> parent_keys;
+        for (const auto & [_, store] : snapshots)
+            if (store->isDelta())
+                parent_keys.insert(getSnapshotStoreMapKeyImpl(store->getParentLogTerm(), store->getParentLogIndex()));
+
+        auto it = std::find_if(
+            snapshots.begin(), std::prev(snapshots.end()), [&](const auto & entry) { return !parent_keys.contains(entry.first); });
+
+        if (it == std::prev(snapshots.end()))
+        {
+            LOG_INFO(log, "Keep {} snapshots, for delta snapshots are based on them", snapshots.size());
+            break;
+        }
+
         uint128_t remove_term_log_index = it->first;
         auto [log_term, log_index] = getTermLogFromSnapshotStoreMapKey(remove_term_log_index);
         LOG_INFO(log, "Remove snapshot with term {} log index {}", log_term, log_index);
@@ -953,27 +1679,18 @@ size_t KeeperSnapshotManager::removeSnapshots()
                 {
                     LOG_INFO(
                         log,
-                        "remove_count {}, snapshot size {}, remove term with term {} log index {}, file {}",
-                        remove_count,
+                        "snapshot size {}, remove term with term {} log index {}, file {}",
                         snapshots.size(),
                         log_term,
                         log_index,
                         file);
                     Poco::File(snap_dir + "/" + file).remove();
-                    if (snapshots.find(key) != snapshots.end())
-                    {
-                        snapshots.erase(it);
-                    }
                 }
             }
         }
-        remove_count--;
+        snapshots.erase(it);
     }
 
-    if (snapshots.size() > keep_max_snapshot_count)
-        LOG_ERROR(log, "Snapshots size() is still large than keep_max_snapshot_count {}, it's a bug",
-                  snapshots.size(), keep_max_snapshot_count);
-
     return snapshots.size();
 }
 
@@ -4,6 +4,10 @@
 #include <Service/Metrics.h>
 #include <Common/Stopwatch.h>
 #include <charconv>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <set>
 
 
 namespace RK
@@ -23,7 +27,10 @@ struct SnapTask
     SessionAndTimeout session_and_timeout;
     std::unordered_map<uint64_t, Coordination::ACLs> acl_map;
     KeeperStore::SessionAndAuth session_and_auth;
-    std::shared_ptr<KeeperStore::BucketNodes> buckets_nodes;
+    /// Pinned data tree, it is copy-on-write until the task is done.
+    KeeperStore::DataTreeViewPtr data_tree_view;
+    /// Nodes changed since the last snapshot, used to create delta snapshot.
+    KeeperStore::DirtyPaths dirty_paths;
     nuraft::async_result<bool>::handler_type when_done;
 
     SnapTask(const ptr<snapshot> & s_, KeeperStore & store, nuraft::async_result<bool>::handler_type & when_done_)
@@ -36,16 +43,13 @@ struct SnapTask
 
         acl_map = store.getACLMap().getMapping();
         Stopwatch watch;
-        buckets_nodes = store.dumpDataTree();
-        LOG_INFO(log, "Dumping data tree costs {}ms", watch.elapsedMilliseconds());
+        data_tree_view = store.pinDataTree();
+        LOG_INFO(log, "Pinning data tree costs {}ms", watch.elapsedMilliseconds());
         Metrics::getMetrics().snap_blocking_time_ms->add(watch.elapsedMilliseconds());
 
-        for (auto && bucket : *buckets_nodes)
-        {
-            LOG_DEBUG(log, "Get bucket size {}", bucket.size());
-        }
+        dirty_paths = store.takeDirtyPaths(s->get_last_log_term(), s->get_last_log_idx());
 
-        nodes_count = store.getNodesCount();
+        nodes_count = data_tree_view->size();
         ephemeral_nodes_count = store.getTotalEphemeralNodesCount();
     }
 };
@@ -58,11 +62,19 @@ struct SnapObject
     /// create_time, last_log_term, last_log_index, object_id
     static constexpr char SNAPSHOT_FILE_NAME_V1[] = "snapshot_{}_{}_{}_{}";
 
+    /// create_time, last_log_term, last_log_index, parent_log_term, parent_log_index, object_id
+    static constexpr char DELTA_SNAPSHOT_FILE_NAME[] = "snapshot_{}_{}_{}_delta_{}_{}_{}";
+
     String create_time;
     UInt64 log_last_term;
     UInt64 log_last_index;
     UInt64 object_id;
 
+    /// Delta snapshot only contains nodes changed since its parent snapshot.
+    bool is_delta = false;
+    UInt64 parent_log_term = 0;
+    UInt64 parent_log_index = 0;
+
     explicit SnapObject(const String & _create_time = "", UInt64 _log_last_term = 1, UInt64 _log_last_index = 1, UInt64 _object_id = 1)
         :create_time(_create_time), log_last_term(_log_last_term), log_last_index(_log_last_index), object_id(_object_id)
     {
@@ -70,6 +82,8 @@ struct SnapObject
 
     String getObjectName()
     {
+        if (is_delta)
+            return fmt::format(DELTA_SNAPSHOT_FILE_NAME, create_time, log_last_term, log_last_index, parent_log_term, parent_log_index, object_id);
         return fmt::format(SNAPSHOT_FILE_NAME_V1, create_time, log_last_term, log_last_index, object_id);
     }
 
@@ -103,6 +117,25 @@ struct SnapObject
             if (!tryReadUInt64Text(tokens[4], object_id))
                 return false;
         }
+        else if (tokens.size() == 8 && tokens[4] == "delta")
+        {
+            if (!tryReadUInt64Text(tokens[2], log_last_term))
+                return false;
+
+            if (!tryReadUInt64Text(tokens[3], log_last_index))
+                return false;
+
+            if (!tryReadUInt64Text(tokens[5], parent_log_term))
+                return false;
+
+            if (!tryReadUInt64Text(tokens[6], parent_log_index))
+                return false;
+
+            if (!tryReadUInt64Text(tokens[7], object_id))
+                return false;
+
+            is_delta = true;
+        }
         else
         {
             return false;
@@ -126,6 +159,10 @@ struct SnapObject
  *
  * Snapshot object format:
  *      SnapshotHeader + (SnapshotBatch)[...] + SnapshotTail
+ *
+ * A delta snapshot has the same objects, but its data objects only contain nodes created or changed
+ * since its parent snapshot and paths of removed nodes, see DELTA_SNAPSHOT_FILE_NAME. It is loaded by
+ * applying it on its parent which may be a delta snapshot too, down to a full snapshot.
  */
 class KeeperSnapshotStore
 {
@@ -135,11 +172,15 @@ public:
         snapshot & meta,
         UInt32 max_object_node_size_ = MAX_OBJECT_NODE_SIZE,
         UInt32 save_batch_size_ = SAVE_BATCH_SIZE,
-        SnapshotVersion version_ = CURRENT_SNAPSHOT_VERSION)
+        SnapshotVersion version_ = CURRENT_SNAPSHOT_VERSION,
+        SnapshotCompressionMethod compression_method_ = SnapshotCompressionMethod::NONE,
+        Int32 compression_level_ = DEFAULT_SNAPSHOT_COMPRESSION_LEVEL)
         : version(version_)
         , snap_dir(snap_dir_)
         , max_object_node_size(max_object_node_size_)
         , save_batch_size(save_batch_size_)
+        , compression_method(compression_method_)
+        , compression_level(compression_level_)
         , log(&(Poco::Logger::get("KeeperSnapshotStore")))
     {
         last_log_index = meta.get_last_log_idx();
@@ -163,12 +204,35 @@ public:
     /// Create async snapshot object by snap_task, return the size of objects
     size_t createObjectsAsync(SnapTask & snap_task);
 
+    /// Create delta snapshot objects of nodes changed since the parent snapshot, return the size of objects
+    size_t createDeltaObjects(KeeperStore & store, const KeeperStore::DirtyPaths & dirty_paths, int64_t next_zxid, int64_t next_session_id);
+    size_t createDeltaObjectsAsync(SnapTask & snap_task);
+
+    /// Make the snapshot a delta snapshot on the parent, should be invoked before init.
+    void setParent(UInt64 parent_log_term_, UInt64 parent_log_index_)
+    {
+        is_delta = true;
+        parent_log_term = parent_log_term_;
+        parent_log_index = parent_log_index_;
+    }
+
+    bool isDelta() const { return is_delta; }
+    UInt64 getParentLogTerm() const { return parent_log_term; }
+    UInt64 getParentLogIndex() const { return parent_log_index; }
+
+    /// Count of objects, which is known before they are received when receiving snapshot chain.
+    size_t getObjectsCount() const { return expected_objects_count ? *expected_objects_count : objects_path.size(); }
+    void setExpectedObjectsCount(size_t count) { expected_objects_count = count; }
+
     /// initialize a snapshot store
     void init(const String & create_time  = "");
 
     /// Load the latest snapshot object.
     void loadLatestSnapshot(KeeperStore & store);
 
+    /// Apply delta snapshot on store which holds its parent snapshot.
+    void loadDelta(KeeperStore & store);
+
     /// load on object of the latest snapshot
     void loadObject(ulong obj_id, ptr<buffer> & buffer);
 
@@ -178,6 +242,26 @@ public:
     /// save an object
     void saveObject(ulong obj_id, buffer & buffer);
 
+    /// Load a chunk of at most max_size bytes of an object from offset, the chunk is prefixed with a byte telling
+    /// whether it is the last chunk of the object.
+    void loadObjectChunk(ulong obj_id, size_t offset, size_t max_size, ptr<buffer> & buffer, bool & is_last_chunk);
+
+    /// Save a chunk of an object which is being received into a file prefixed with RECEIVING_OBJECT_PREFIX.
+    void saveObjectChunk(ulong obj_id, size_t offset, const char * data, size_t size);
+
+    /// Verify checksums of a received object without decompressing its batches, a corrupted object is discarded.
+    bool verifyReceivedObject(ulong obj_id);
+
+    /// Add a received and verified object to the snapshot.
+    void addReceivedObject(ulong obj_id);
+
+    /// Size of the received part of an object, whose chunks are saved in a file prefixed with RECEIVING_OBJECT_PREFIX.
+    size_t getReceivedObjectSize(ulong obj_id) const;
+
+    /// Whether the snapshot is being received from leader
+    bool isReceiving() const { return receiving; }
+    void setReceiving(bool receiving_) { receiving = receiving_; }
+
     void addObjectPath(ulong obj_id, String & path);
 
     /// get snapshot metadata
@@ -186,6 +270,9 @@ public:
     /// parse object id from file name
     static size_t getObjectIdx(const String & file_name);
 
+    static inline const String RECEIVING_OBJECT_PREFIX = "receiving_";
+
+    /// Min count of threads loading snapshot, there are more threads on a machine with more cores.
     static constexpr int SNAPSHOT_THREAD_NUM = 8;
     static constexpr int IO_BUFFER_SIZE = 16384; /// 16K
 
@@ -203,15 +290,35 @@ private:
     /// get path of an object
     void getObjectPath(ulong object_id, String & path) const;
 
+    /// get path of the file an object is received into
+    String getReceivingObjectPath(ulong object_id) const;
+
     /// Parse an snapshot object. We should take the version from snapshot in general.
     void parseObject(KeeperStore & store, String obj_path, BucketEdges &, BucketNodes &);
 
-    /// Parse batch header in an object
-    /// TODO use internal buffer
-    void parseBatchHeader(ptr<std::fstream> fs, SnapshotBatchHeader & head);
+    /// Read batches of an object and verify its checksum, every batch body is passed to callback.
+    /// The object is mapped into memory and batch bodies refer to the mapped data.
+    /// Compressed batches are passed as they are if decompress is false.
+    void readObject(
+        const String & obj_path, const std::function<void(std::string_view, SnapshotVersion)> & on_batch, bool decompress = true);
+
+    /// Check that objects ids are consecutive starting from 1.
+    void checkObjectsContinuous() const;
+
+    /// Parse a batch of delta snapshot and apply it to store
+    void applyDeltaBatch(KeeperStore & store, std::string_view body, SnapshotVersion version_);
+
+    size_t createDeltaObjectsImpl(
+        const KeeperStore::DirtyPaths & dirty_paths,
+        const std::function<KeeperNodePtr(const String &)> & get_node,
+        int64_t next_zxid,
+        int64_t next_session_id,
+        SessionAndTimeout & session_and_timeout,
+        SessionAndAuth & session_and_auth,
+        const NumToACLMap & acl_map);
 
     /// Parse a batch
-    void parseBatchBodyV2(KeeperStore & store, const String &, BucketEdges &, BucketNodes &, SnapshotVersion version_);
+    void parseBatchBodyV2(KeeperStore & store, std::string_view body, BucketEdges &, BucketNodes &, SnapshotVersion version_);
 
     /// For snapshot version v2
     size_t serializeDataTreeV2(KeeperStore & storage);
@@ -232,11 +339,11 @@ private:
     uint32_t serializeNodeAsync(
         ptr<WriteBufferFromFile> & out,
         ptr<SnapshotBatchBody> & batch,
-        BucketNodes & bucket_nodes) const;
+        KeeperStore::DataTree & data_tree) const;
 
     /// Append node to batch version v2
     inline static void
-    appendNodeToBatchV2(ptr<SnapshotBatchBody> batch, const String & path, std::shared_ptr<KeeperNode> node, SnapshotVersion version);
+    appendNodeToBatchV2(ptr<SnapshotBatchBody> batch, const String & path, KeeperNodePtr node, SnapshotVersion version);
 
     /// Snapshot directory, note than the directory may contain more than one snapshot.
     String snap_dir;
@@ -247,6 +354,10 @@ private:
     /// How many items a batch can contain
     UInt32 save_batch_size;
 
+    /// Codec compressing data batches when creating snapshot, batches are decompressed according to themselves when loading.
+    SnapshotCompressionMethod compression_method;
+    Int32 compression_level;
+
     Poco::Logger * log;
 
     /// metadata of a snapshot
@@ -258,6 +369,14 @@ private:
     /// Lost log index term in the snapshot
     UInt64 last_log_term;
 
+    bool is_delta = false;
+    UInt64 parent_log_term = 0;
+    UInt64 parent_log_index = 0;
+
+    std::optional<size_t> expected_objects_count;
+
+    bool receiving = false;
+
     std::map<ulong, String> objects_path;
 
     /// Loaded snapshot object count which is read from object1
@@ -305,29 +424,76 @@ using KeeperSnapshotStoreMap = std::map<uint128_t, ptr<KeeperSnapshotStore>>;
 class KeeperSnapshotManager
 {
 public:
-    KeeperSnapshotManager(const String & snap_dir_, UInt32 keep_max_snapshot_count_, UInt32 object_node_size_)
+    using SnapshotChain = std::vector<ptr<KeeperSnapshotStore>>;
+
+    KeeperSnapshotManager(
+        const String & snap_dir_,
+        UInt32 keep_max_snapshot_count_,
+        UInt32 object_node_size_,
+        UInt32 max_delta_snapshots_ = 0,
+        SnapshotCompressionMethod compression_method_ = SnapshotCompressionMethod::NONE,
+        UInt64 transfer_chunk_size_ = 0,
+        Int32 compression_level_ = DEFAULT_SNAPSHOT_COMPRESSION_LEVEL,
+        SnapshotVersion version_ = CURRENT_SNAPSHOT_VERSION)
         : snap_dir(snap_dir_)
         , keep_max_snapshot_count(keep_max_snapshot_count_)
         , object_node_size(object_node_size_)
+        , max_delta_snapshots(max_delta_snapshots_)
+        , compression_method(compression_method_)
+        , compression_level(compression_level_)
+        , transfer_chunk_size(transfer_chunk_size_)
+        , version(version_)
         , log(&(Poco::Logger::get("KeeperSnapshotManager")))
     {
     }
 
     ~KeeperSnapshotManager() = default;
 
+    /// Snapshots are created in the version given to the manager if version is not specified.
     size_t createSnapshotAsync(
         SnapTask & snap_task,
-        SnapshotVersion version = CURRENT_SNAPSHOT_VERSION);
+        std::optional<SnapshotVersion> version = {});
 
     size_t createSnapshot(
         snapshot & meta,
         KeeperStore & store,
         int64_t next_zxid = 0,
         int64_t next_session_id = 0,
-        SnapshotVersion version = CURRENT_SNAPSHOT_VERSION);
+        std::optional<SnapshotVersion> version = {});
+
+    /// save snapshot meta, invoked when we receive an snapshot from leader. chain_data is the first object
+    /// sent by leader, which describes the snapshot chain if the snapshot is a delta one and the chunk size
+    /// if objects are sent in chunks. Receiving a snapshot in chunks is resumed if it is received again.
+    bool receiveSnapshotMeta(snapshot & meta, buffer * chain_data = nullptr);
+
+    /// Describe the snapshot chain, whose objects are sent one by one as objects of the snapshot, followed by
+    /// transfer_chunk_size if objects are sent in chunks. Return nullptr if neither is the case.
+    ptr<buffer> serializeSnapshotChain(const snapshot & meta) const;
+
+    /// Objects are sent in chunks if transfer_chunk_size > 0, a chunk is identified by a transfer id
+    /// which is (chunk index << 32 | object id).
+    static ulong getTransferId(ulong obj_id, ulong chunk_idx) { return chunk_idx << 32 | obj_id; }
+
+    UInt64 getTransferChunkSize() const { return transfer_chunk_size; }
+
+    /// Whether the snapshot being received is sent in chunks
+    bool isReceivingInChunks() const { return receiving_chunk_size > 0; }
+
+    /// The first object or chunk to request after receiving snapshot meta, objects and chunks received are skipped.
+    ulong getNextTransferId(const snapshot & meta) const;
 
-    /// save snapshot meta, invoked when we receive an snapshot from leader.
-    bool receiveSnapshotMeta(snapshot & meta);
+    /// Load a chunk by transfer id, invoked when leader sends snapshot to others. Return whether it is the last one.
+    bool loadSnapshotChunk(const snapshot & meta, ulong transfer_id, ptr<buffer> & buffer);
+
+    /// Save a chunk by transfer id, invoked when we receive an snapshot from leader. Return transfer id of the next chunk.
+    /// snapshot_mutex is held only to look up and update snapshots, not while writing the chunk or verifying the object.
+    /// Throw if an object is received corrupted more than MAX_CORRUPTED_OBJECT_RETRIES times in a row.
+    ulong saveSnapshotChunk(snapshot & meta, ulong transfer_id, buffer & buffer, bool is_last_obj, std::mutex & snapshot_mutex);
+
+    static constexpr size_t MAX_CORRUPTED_OBJECT_RETRIES = 3;
+
+    /// Snapshots the snapshot is loaded from, starting from a full snapshot. Empty if any of them is missing.
+    SnapshotChain getSnapshotChain(const snapshot & meta) const;
 
     /// save snapshot object, invoked when we receive an snapshot from leader.
     bool saveSnapshotObject(snapshot & meta, ulong obj_id, buffer & buffer);
@@ -356,6 +522,20 @@ public:
     const KeeperSnapshotStoreMap & getSnapshots() const { return snapshots; }
 
 private:
+    /// Whether to create a delta snapshot on the latest snapshot
+    bool shouldCreateDelta(const snapshot & meta, const KeeperStore::DirtyPaths & dirty_paths) const;
+
+    SnapshotChain getSnapshotChainImpl(uint128_t key) const;
+
+    /// Find the store and object id in it of an object of the snapshot, objects of a snapshot chain are numbered in order.
+    std::pair<ptr<KeeperSnapshotStore>, ulong> locateObject(const snapshot & meta, ulong obj_id) const;
+
+    /// Find the store and object id in it of an object of the snapshot, store is nullptr if there is not the snapshot.
+    std::pair<ptr<KeeperSnapshotStore>, ulong> findObject(const snapshot & meta, ulong obj_id) const;
+
+    /// Find the store and object id in it to save a received object, the store is created if it does not exist.
+    std::pair<ptr<KeeperSnapshotStore>, ulong> getObjectForSave(snapshot & meta, ulong obj_id);
+
     /// snapshot directory
     String snap_dir;
 
@@ -364,6 +544,26 @@ private:
 
     /// item limit of an object
     UInt32 object_node_size;
+
+    /// Max count of delta snapshots between two full snapshots, 0 means delta snapshot is disabled.
+    UInt32 max_delta_snapshots;
+
+    /// Codec compressing data batches of created snapshots
+    SnapshotCompressionMethod compression_method;
+    Int32 compression_level;
+
+    /// Max bytes of an object sent in one chunk, 0 means objects are sent whole.
+    UInt64 transfer_chunk_size;
+
+    /// Format version of created snapshots
+    SnapshotVersion version;
+
+    /// Chunk size of the snapshot being received, told by leader.
+    UInt64 receiving_chunk_size = 0;
+
+    /// How many times in a row the object being received is corrupted.
+    size_t corrupted_object_retries = 0;
+
     Poco::Logger * log;
 
     KeeperSnapshotStoreMap snapshots;
@@ -1,13 +1,16 @@
 #include <atomic>
+#include <condition_variable>
+#include <map>
 #include <mutex>
 #include <string>
 
+#include <Common/ThreadPool.h>
 #include <Common/setThreadName.h>
+#include <common/scope_guard.h>
 
 #include <Service/NuRaftFileLogStore.h>
 #include <Service/NuRaftStateMachine.h>
 #include <Service/RequestProcessor.h>
-#include <Service/ThreadSafeQueue.h>
 #include <ZooKeeper/ZooKeeperIO.h>
 
 
@@ -21,12 +24,20 @@ namespace ErrorCodes
     extern const int GAP_BETWEEN_SNAPSHOT_AND_LOG;
 }
 
+/// Number of log entries loaded and decoded as a unit when replaying, about 3MB.
+static constexpr ulong REPLAY_LOG_BATCH_SIZE = 10000;
+/// Number of threads loading and decoding logs ahead of the apply thread.
+static constexpr size_t REPLAY_LOG_THREAD_NUM = 4;
+/// Max number of loaded but not yet applied batches.
+static constexpr ulong MAX_PENDING_REPLAY_LOG_BATCHES = 16;
+
 struct ReplayLogBatch
 {
     ulong batch_start_index = 0;
     ulong batch_end_index = 0;
     ptr<std::vector<LogEntryWithVersion>> log_entries;
-    ptr<std::vector<ptr<RequestForSession>>> requests;
+    /// Requests of every log entry, empty for non app log.
+    ptr<std::vector<std::vector<ptr<RequestForSession>>>> requests;
 };
 
 NuRaftStateMachine::NuRaftStateMachine(
@@ -43,7 +54,7 @@ NuRaftStateMachine::NuRaftStateMachine(
     UInt32 object_node_size,
     std::shared_ptr<RequestProcessor> request_processor_)
     : raft_settings(raft_settings_)
-    , store(raft_settings->dead_session_check_period_ms, super_digest)
+    , store(raft_settings->dead_session_check_period_ms, super_digest, raft_settings->memory_usage_prefix_depth)
     , responses_queue(responses_queue_)
     , request_processor(request_processor_)
     , last_committed_idx(0)
@@ -55,8 +66,19 @@ NuRaftStateMachine::NuRaftStateMachine(
 {
     LOG_INFO(log, "Begin to initialize state machine");
 
+    if (raft_settings->max_delta_snapshots > 0)
+        store.enableDirtyPathsTracking();
+
     snapshot_dir = snap_dir;
-    snap_mgr = cs_new<KeeperSnapshotManager>(snapshot_dir, keep_max_snapshot_count, object_node_size);
+    snap_mgr = cs_new<KeeperSnapshotManager>(
+        snapshot_dir,
+        keep_max_snapshot_count,
+        object_node_size,
+        raft_settings->max_delta_snapshots,
+        raft_settings->snapshot_compression_method,
+        raft_settings->snapshot_transfer_chunk_size,
+        raft_settings->snapshot_compression_level,
+        raft_settings->snapshot_version);
 
     /// Load snapshot meta from disk
     auto snapshots_count = snap_mgr->loadSnapshotMetas();
@@ -122,6 +144,9 @@ void NuRaftStateMachine::snapThread()
                 current_task->s->get_last_log_idx());
 
             create_snapshot_async(*current_task);
+            /// Unpin data tree before next snapshot can be created.
+            current_task->data_tree_view.reset();
+
             ptr<std::exception> except(nullptr);
             bool ret = true;
 
@@ -139,26 +164,79 @@ void NuRaftStateMachine::snapThread()
     }
 }
 
-ptr<buffer> NuRaftStateMachine::pre_commit(const ulong, buffer &)
+ptr<buffer> NuRaftStateMachine::pre_commit(const ulong log_idx, buffer & data)
 {
+    std::lock_guard lock(leader_requests_mutex);
+    auto it = pending_leader_requests.find(&data);
+    if (it != pending_leader_requests.end())
+    {
+        leader_requests[log_idx] = std::move(it->second);
+        pending_leader_requests.erase(it);
+    }
     return nullptr;
 }
 
-/// Do nothing, as doesn't do anything on pre-commit.
 void NuRaftStateMachine::rollback(const ulong log_idx, buffer & data)
 {
-    LOG_TRACE(log, "pre commit, log index {}, data size {}", log_idx, data.size());
+    LOG_TRACE(log, "Rollback log {}, data size {}", log_idx, data.size());
+    std::lock_guard lock(leader_requests_mutex);
+    leader_requests.erase(log_idx);
+}
+
+void NuRaftStateMachine::addLeaderRequests(const buffer & data, const RequestsForSessions & requests)
+{
+    std::vector<ptr<RequestForSession>> parsed;
+    parsed.reserve(requests.size());
+
+    /// Keep only what is in the log entry, the same as deserialized ones.
+    for (const auto & request : requests)
+        parsed.push_back(cs_new<RequestForSession>(request.request, request.session_id, request.create_time));
+
+    std::lock_guard lock(leader_requests_mutex);
+    pending_leader_requests[&data] = std::move(parsed);
+}
+
+void NuRaftStateMachine::removePendingLeaderRequests(const std::vector<ptr<buffer>> & entries)
+{
+    std::lock_guard lock(leader_requests_mutex);
+    for (const auto & entry : entries)
+        pending_leader_requests.erase(entry.get());
 }
 
 ptr<buffer> NuRaftStateMachine::commit(const ulong log_idx, buffer & data, bool ignore_response)
 {
-    auto request_for_session = deserializeKeeperRequest(data);
-    LOG_TRACE(log, "Commit log {}, request {}", log_idx, request_for_session->toSimpleString());
+    std::vector<ptr<RequestForSession>> requests;
+    bool parsed_on_leader = false;
+    {
+        std::lock_guard lock(leader_requests_mutex);
+        if (!leader_requests.empty())
+        {
+            auto it = leader_requests.lower_bound(log_idx);
+            if (it != leader_requests.end() && it->first == log_idx)
+            {
+                requests = std::move(it->second);
+                parsed_on_leader = true;
+                ++it;
+            }
+            /// Entries before are committed or overwritten.
+            leader_requests.erase(leader_requests.begin(), it);
+        }
+    }
 
-    if (request_processor)
-        request_processor->commit(*request_for_session);
-    else
-        store.processRequest(responses_queue, *request_for_session, {}, true, ignore_response);
+    /// Followers and learners, or leader for entries appended by previous leader.
+    if (!parsed_on_leader)
+        requests = deserializeKeeperRequests(data);
+
+    /// A log entry may contain a batch of requests, they are committed in order.
+    for (const auto & request_for_session : requests)
+    {
+        LOG_TRACE(log, "Commit log {}, request {}", log_idx, request_for_session->toSimpleString());
+
+        if (request_processor)
+            request_processor->commit(*request_for_session);
+        else
+            store.processRequest(responses_queue, *request_for_session, {}, true, ignore_response);
+    }
 
     last_committed_idx = log_idx;
     committed_log_manager->push(last_committed_idx);
@@ -209,9 +287,19 @@ void NuRaftStateMachine::create_snapshot(snapshot & s, async_result<bool>::handl
 
     LOG_INFO(log, "Creating snapshot last_log_term {}, last_log_idx {}", s.get_last_log_term(), s.get_last_log_idx());
 
+    /// The commit queue is empty, but the request processor may still be applying the last request it
+    /// popped. Capture the store on the processor thread so that we never race with request applying.
+    auto run_in_processor_thread = [this](std::function<void()> task)
+    {
+        if (request_processor)
+            request_processor->runInProcessorThread(std::move(task));
+        else
+            task();
+    };
+
     if (!raft_settings->async_snapshot)
     {
-        create_snapshot(s, store.getZxid(), store.getSessionIDCounter());
+        run_in_processor_thread([&] { create_snapshot(s, store.getZxid(), store.getSessionIDCounter()); });
         ptr<std::exception> except(nullptr);
         bool ret = true;
         when_done(ret, except);
@@ -229,7 +317,7 @@ void NuRaftStateMachine::create_snapshot(snapshot & s, async_result<bool>::handl
         /// Need make a copy of s
         ptr<buffer> snp_buf = s.serialize();
         auto snap_copy = snapshot::deserialize(*snp_buf);
-        snap_task = std::make_shared<SnapTask>(snap_copy, store, when_done);
+        run_in_processor_thread([&] { snap_task = std::make_shared<SnapTask>(snap_copy, store, when_done); });
         snap_task_ready = true;
 
         LOG_INFO(log, "Scheduling asynchronous creating snapshot task, time cost {} ms", getCurrentTimeMilliseconds() - snap_start_time);
@@ -273,18 +361,30 @@ int NuRaftStateMachine::read_logical_snp_obj(snapshot & s, void *& user_snp_ctx,
 
     if (obj_id == 0)
     {
-        // Object ID == 0: first object
-        data_out = buffer::alloc(sizeof(UInt32));
-        nuraft::buffer_serializer bs(data_out);
-        bs.put_i32(0);
+        // Object ID == 0: first object, it describes the snapshot chain if the snapshot is a delta one.
+        data_out = snap_mgr->serializeSnapshotChain(s);
+        if (!data_out)
+        {
+            data_out = buffer::alloc(sizeof(UInt32));
+            nuraft::buffer_serializer bs(data_out);
+            bs.put_i32(0);
+        }
         is_last_obj = false;
         LOG_INFO(log, "Read snapshot object, last_log_idx {}, object id {}, is_last {}", s.get_last_log_idx(), obj_id, false);
         return 0;
     }
 
     // Object ID > 0: second object, put actual value.
-    snap_mgr->loadSnapshotObject(s, obj_id, data_out);
-    is_last_obj = !(snap_mgr->existSnapshotObject(s, obj_id + 1));
+    if (snap_mgr->getTransferChunkSize())
+    {
+        /// Object ID is a transfer id of a chunk of object
+        is_last_obj = snap_mgr->loadSnapshotChunk(s, obj_id, data_out);
+    }
+    else
+    {
+        snap_mgr->loadSnapshotObject(s, obj_id, data_out);
+        is_last_obj = !(snap_mgr->existSnapshotObject(s, obj_id + 1));
+    }
 
     LOG_INFO(log, "Read snapshot object, last_log_idx {}, object id {}, is_last {}", s.get_last_log_idx(), obj_id, is_last_obj);
     user_snp_ctx = nullptr;
@@ -294,19 +394,26 @@ int NuRaftStateMachine::read_logical_snp_obj(snapshot & s, void *& user_snp_ctx,
 
 void NuRaftStateMachine::save_logical_snp_obj(snapshot & s, ulong & obj_id, buffer & data, bool is_first_obj, bool is_last_obj)
 {
+    LOG_INFO(log, "Save logical snapshot , object id {}, is_first_obj {}, is_last_obj {}", obj_id, is_first_obj, is_last_obj);
     if (obj_id == 0)
     {
-        // Object ID == 0: it contains dummy value, create snapshot context.
-        snap_mgr->receiveSnapshotMeta(s);
+        // Object ID == 0: it contains dummy value or snapshot chain, create snapshot context.
+        snap_mgr->receiveSnapshotMeta(s, &data);
+        obj_id = snap_mgr->getNextTransferId(s);
+    }
+    else if (snap_mgr->isReceivingInChunks())
+    {
+        // Object ID > 0: transfer id of a chunk of object, save to local disk and request the next chunk.
+        // snapshot_mutex is taken inside, it is not held while writing the chunk and verifying the object.
+        obj_id = snap_mgr->saveSnapshotChunk(s, obj_id, data, is_last_obj, snapshot_mutex);
     }
     else
     {
         std::lock_guard<std::mutex> lock(snapshot_mutex);
         // Object ID > 0: actual snapshot value, save to local disk
         snap_mgr->saveSnapshotObject(s, obj_id, data);
+        obj_id++;
     }
-    LOG_INFO(log, "Save logical snapshot , object id {}, is_first_obj {}, is_last_obj {}", obj_id, is_first_obj, is_last_obj);
-    obj_id++;
 }
 
 bool NuRaftStateMachine::existSnapshotObject(snapshot & s, ulong obj_id) const
@@ -331,6 +438,8 @@ bool NuRaftStateMachine::applySnapshotImpl(snapshot & s)
     if (succeed)
     {
         last_committed_idx = s.get_last_log_idx();
+        /// Track changes since the snapshot for the next delta snapshot
+        store.takeDirtyPaths(s.get_last_log_term(), s.get_last_log_idx());
         LOG_INFO(log, "Applied snapshot, now the last log index is {}", last_committed_idx.load());
     }
     return succeed;
@@ -370,76 +479,129 @@ void NuRaftStateMachine::replayLogs(ptr<log_store> log_store_, uint64_t from, ui
         last_index_in_store = to;
     }
 
-    /// [ batch_start_index, batch_end_index )
-    std::atomic<ulong> batch_start_index = from;
-    std::atomic<ulong> batch_end_index = 0;
-
-    ThreadSafeQueue<ReplayLogBatch> log_queue;
-
-    /// Loading and applying asynchronously
-    auto load_thread = ThreadFromGlobalPool(
-        [last_index_in_store, &log_queue, &batch_start_index, &batch_end_index, &log_store_]
+    const UInt64 replay_start_time = getCurrentTimeMilliseconds();
+    const ulong entries_count = last_index_in_store - from + 1;
+    const ulong batch_count = (entries_count + REPLAY_LOG_BATCH_SIZE - 1) / REPLAY_LOG_BATCH_SIZE;
+
+    /// Batches are loaded and decoded by several threads ahead of the apply
+    /// thread, which consumes them strictly in log index order.
+    std::mutex batches_mutex;
+    std::condition_variable batches_cv;
+    std::map<ulong, ReplayLogBatch> loaded_batches;
+    ulong next_batch_to_load = 0;
+    ulong next_batch_to_apply = 0;
+    bool stop_loading = false;
+    std::exception_ptr load_exception;
+
+    auto load_batches = [&](size_t thread_id)
+    {
+        Poco::Logger * thread_log = &(Poco::Logger::get("LoadLogThread#" + std::to_string(thread_id)));
+        while (true)
         {
-            Poco::Logger * thread_log = &(Poco::Logger::get("LoadLogThread"));
-            while (batch_start_index < last_index_in_store)
+            ulong batch_id;
             {
-                while (log_queue.size() > 10)
+                std::unique_lock lock(batches_mutex);
+                /// Bound the number of batches held in memory.
+                batches_cv.wait(lock, [&]
                 {
-                    LOG_DEBUG(thread_log, "Sleep 100ms to wait for applying log");
-                    usleep(100000);
-                }
-
-                /// 0.3 * 10000 = 3M
-                batch_end_index = batch_start_index + 10000;
-                if (batch_end_index > last_index_in_store + 1)
-                    batch_end_index = last_index_in_store + 1;
+                    return stop_loading || next_batch_to_load >= batch_count
+                        || next_batch_to_load < next_batch_to_apply + MAX_PENDING_REPLAY_LOG_BATCHES;
+                });
+                if (stop_loading || next_batch_to_load >= batch_count)
+                    return;
+                batch_id = next_batch_to_load++;
+            }
 
-                LOG_INFO(thread_log, "Begin to load batch [{} , {})", batch_start_index.load(), batch_end_index.load());
+            ReplayLogBatch batch;
+            batch.batch_start_index = from + batch_id * REPLAY_LOG_BATCH_SIZE;
+            batch.batch_end_index = std::min(batch.batch_start_index + REPLAY_LOG_BATCH_SIZE, last_index_in_store + 1);
 
-                ReplayLogBatch batch;
-                batch.log_entries
-                    = dynamic_cast<NuRaftFileLogStore *>(log_store_.get())->log_entries_version_ext(batch_start_index, batch_end_index, 0);
+            try
+            {
+                LOG_DEBUG(thread_log, "Begin to load batch [{} , {})", batch.batch_start_index, batch.batch_end_index);
 
-                batch.batch_start_index = batch_start_index;
-                batch.batch_end_index = batch_end_index;
-                batch.requests = cs_new<std::vector<ptr<RequestForSession>>>();
+                batch.log_entries = dynamic_cast<NuRaftFileLogStore *>(log_store_.get())
+                                        ->log_entries_version_ext(batch.batch_start_index, batch.batch_end_index, 0);
 
-                for (auto & entry_with_version : *batch.log_entries)
+                /// Replaying stops at a missing batch, as the apply thread finds it.
+                if (batch.log_entries)
                 {
-                    if (entry_with_version.entry->get_val_type() != nuraft::log_val_type::app_log)
-                    {
-                        LOG_DEBUG(thread_log, "Found non app nuraft log(type {}), ignore it", toString(entry_with_version.entry->get_val_type()));
-                        batch.requests->push_back(nullptr);
-                    }
-                    else
+                    batch.requests = cs_new<std::vector<std::vector<ptr<RequestForSession>>>>();
+                    batch.requests->reserve(batch.log_entries->size());
+
+                    for (auto & entry_with_version : *batch.log_entries)
                     {
-                        /// user requests
-                        auto request = deserializeKeeperRequest(entry_with_version.entry->get_buf());
-                        batch.requests->push_back(request);
+                        if (entry_with_version.entry->get_val_type() != nuraft::log_val_type::app_log)
+                        {
+                            LOG_DEBUG(
+                                thread_log, "Found non app nuraft log(type {}), ignore it", toString(entry_with_version.entry->get_val_type()));
+                            batch.requests->emplace_back();
+                        }
+                        else
+                        {
+                            /// user requests
+                            batch.requests->push_back(deserializeKeeperRequests(entry_with_version.entry->get_buf()));
+                        }
                     }
                 }
 
-                LOG_INFO(thread_log, "Finish to load batch [{}, {})", batch_start_index.load(), batch_end_index.load());
-                log_queue.push(batch);
-                batch_start_index.store(batch_end_index);
+                LOG_DEBUG(thread_log, "Finish to load batch [{}, {})", batch.batch_start_index, batch.batch_end_index);
+            }
+            catch (...)
+            {
+                std::lock_guard lock(batches_mutex);
+                if (!load_exception)
+                    load_exception = std::current_exception();
+                stop_loading = true;
+                batches_cv.notify_all();
+                return;
             }
-        });
 
-    /// Apply loaded logs
-    while (!log_queue.empty() || batch_start_index < last_index_in_store)
-    {
-        while (log_queue.empty() && batch_start_index != last_index_in_store)
+            {
+                std::lock_guard lock(batches_mutex);
+                loaded_batches.emplace(batch_id, std::move(batch));
+            }
+            batches_cv.notify_all();
+        }
+    };
+
+    size_t thread_num = std::min<size_t>(batch_count, REPLAY_LOG_THREAD_NUM);
+    ThreadPool load_thread_pool(thread_num);
+
+    SCOPE_EXIT({
         {
-            LOG_DEBUG(log, "Sleep 100ms to wait for log loading");
-            usleep(100000);
+            std::lock_guard lock(batches_mutex);
+            stop_loading = true;
         }
+        batches_cv.notify_all();
+        load_thread_pool.wait();
+    });
 
+    for (size_t thread_id = 0; thread_id < thread_num; thread_id++)
+        load_thread_pool.scheduleOrThrowOnError([&load_batches, thread_id] { load_batches(thread_id); });
+
+    /// Apply loaded logs
+    ulong replayed_count = 0;
+    for (ulong batch_id = 0; batch_id < batch_count; batch_id++)
+    {
         ReplayLogBatch batch;
-        log_queue.peek(batch);
+        {
+            std::unique_lock lock(batches_mutex);
+            batches_cv.wait(lock, [&] { return load_exception || loaded_batches.contains(batch_id); });
+
+            if (load_exception)
+                std::rethrow_exception(load_exception);
+
+            auto it = loaded_batches.find(batch_id);
+            batch = std::move(it->second);
+            loaded_batches.erase(it);
+            next_batch_to_apply = batch_id + 1;
+        }
+        batches_cv.notify_all();
 
         if (batch.log_entries == nullptr)
         {
-            LOG_DEBUG(log, "log vector is null");
+            LOG_WARNING(log, "Log batch [{}, {}) is null, stop replaying logs", batch.batch_start_index, batch.batch_end_index);
             break;
         }
 
@@ -451,29 +613,34 @@ void NuRaftStateMachine::replayLogs(ptr<log_store> log_store_, uint64_t from, ui
             if (entry_with_version.entry->get_val_type() != nuraft::log_val_type::app_log)
                 continue;
 
-            auto & request = (*batch.requests)[i];
-            LOG_TRACE(log, "Replaying log {}, request {}", log_index, request->toString());
+            for (const auto & request : (*batch.requests)[i])
+            {
+                LOG_TRACE(log, "Replaying log {}, request {}", log_index, request->toString());
 
-            store.processRequest(responses_queue, *request, {}, true, true);
+                store.processRequest(responses_queue, *request, {}, true, true);
 
-            if (!isNewSessionRequest(request->request->getOpNum()) && request->session_id > store.getSessionIDCounter())
-            {
-                /// We may receive an error session id from client, and we just ignore it.
-                LOG_WARNING(
-                    log,
-                    "Storage's session_id_counter {} must bigger than the session id {} of log.",
-                    toHexString(store.getSessionIDCounter()),
-                    toHexString(request->session_id));
+                if (!isNewSessionRequest(request->request->getOpNum()) && request->session_id > store.getSessionIDCounter())
+                {
+                    /// We may receive an error session id from client, and we just ignore it.
+                    LOG_WARNING(
+                        log,
+                        "Storage's session_id_counter {} must bigger than the session id {} of log.",
+                        toHexString(store.getSessionIDCounter()),
+                        toHexString(request->session_id));
+                }
             }
         }
 
-        log_queue.pop();
         last_committed_idx = batch.batch_end_index - 1;
+        replayed_count += batch.log_entries->size();
 
         LOG_INFO(log, "Replayed log batch [{}, {})", batch.batch_start_index, batch.batch_end_index);
     }
 
-    load_thread.join();
+    UInt64 elapsed_ms = std::max<UInt64>(getCurrentTimeMilliseconds() - replay_start_time, 1);
+    UInt64 entries_per_second = replayed_count * 1000 / elapsed_ms;
+    Metrics::getMetrics().replay_log_entries_per_second->add(entries_per_second);
+    LOG_INFO(log, "Replayed {} logs with {} threads in {} ms, {} entries/s", replayed_count, thread_num, elapsed_ms, entries_per_second);
 
     LOG_INFO(
         log,
@@ -591,6 +758,11 @@ uint64_t NuRaftStateMachine::getApproximateDataSize() const
     return store.getApproximateDataSize();
 }
 
+void NuRaftStateMachine::dumpMemoryUsageByPrefix(WriteBufferFromOwnString & buf) const
+{
+    store.dumpMemoryUsageByPrefix(buf);
+}
+
 bool NuRaftStateMachine::containsSession(int64_t session_id) const
 {
     return store.containsSession(session_id);
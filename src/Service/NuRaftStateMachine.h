@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <map>
 #include <mutex>
 #include <unordered_map>
 
@@ -43,10 +44,10 @@ public:
 
     ~NuRaftStateMachine() override = default;
 
-    /// do nothing
+    /// Bind requests registered by addLeaderRequests to the log index of the entry.
     ptr<buffer> pre_commit(const ulong log_idx, buffer & data) override; // NOLINT(readability-avoid-const-params-in-decls)
 
-    /// do nothing
+    /// Drop requests bound to the log index, as the entry is overwritten.
     void rollback(const ulong log_idx, buffer & data) override; // NOLINT(readability-avoid-const-params-in-decls)
 
     /**
@@ -69,6 +70,16 @@ public:
     /// Just for unit test
     ptr<buffer> commit(const ulong log_idx, buffer & data, bool ignore_response); // NOLINT(readability-avoid-const-params-in-decls)
 
+    /**
+     * Register requests already parsed on leader for a log entry about to be appended,
+     * so that commit does not deserialize them again. The entry is identified by its
+     * buffer until pre_commit assigns it a log index.
+     */
+    void addLeaderRequests(const buffer & data, const RequestsForSessions & requests);
+
+    /// Remove requests of entries which are not pre-committed, invoked after appending entries.
+    void removePendingLeaderRequests(const std::vector<ptr<buffer>> & entries);
+
     /**
      * Decide to create snapshot or not.
      * Once the pre-defined condition is satisfied, Raft core will invoke
@@ -255,9 +266,10 @@ public:
     uint64_t getSessionWithEphemeralNodesCount() const;
     uint64_t getTotalEphemeralNodesCount() const;
 
-    /// get approximate data size
-    /// TODO need a more accurate value
+    /// Bytes used by data tree nodes and ACLs
     uint64_t getApproximateDataSize() const;
+    /// Dump memory usage of data tree by path prefixes
+    void dumpMemoryUsageByPrefix(WriteBufferFromOwnString & buf) const;
 
     /// Whether contains a session, note that leader contains all sessions in cluster.
     /// and follower only contains local session.
@@ -321,6 +333,11 @@ private:
     std::shared_ptr<SnapTask> snap_task;
     std::atomic<bool> shutdown_called{false};
 
+    /// Requests parsed on leader, keyed by entry buffer before pre_commit and by log index after it.
+    std::mutex leader_requests_mutex;
+    std::unordered_map<const buffer *, std::vector<ptr<RequestForSession>>> pending_leader_requests;
+    std::map<ulong, std::vector<ptr<RequestForSession>>> leader_requests;
+
     std::mutex & new_session_id_callback_mutex;
     std::unordered_map<int64_t, ptr<std::condition_variable>> & new_session_id_callback;
 
@@ -23,7 +23,10 @@ NuRaftStateManager::NuRaftStateManager(int32_t id_, const Poco::Util::AbstractCo
     curr_log_store = cs_new<NuRaftFileLogStore>(log_dir
         , false, settings->raft_settings->log_fsync_mode
         , settings->raft_settings->log_fsync_interval
-        , settings->raft_settings->max_log_segment_file_size);
+        , settings->raft_settings->max_log_segment_file_size
+        , settings->raft_settings->preallocate_log_segment
+        , settings->raft_settings->log_entry_cache_size
+        , settings->raft_settings->io_uring_log_write);
 
     srv_state_file = fs::path(log_dir) / "srv_state";
     cluster_config_file = fs::path(log_dir) / "cluster_config";
@@ -36,22 +36,22 @@ void RequestProcessor::run()
         {
             auto need_wait = [&]() -> bool
             {
-                /// We should not wait when pending queue is not empty, for function 'moveRequestToPendingQueue'
-                /// moves all pending requests to pending queue.
-                /// Suppose there is a sequence of write-read requests, 'moveRequestToPendingQueue' move all requests
-                /// to pending queue and then the first loop handle the write request, then If we do not check the
-                /// pending queue in our wait condition, it will result in meaningless waiting.
-                bool pending_requests_empty = true;
-                for (const auto & [_, runner_pending_requests] : pending_requests)
+                if (!error_request_ids.empty() || !requests_queue->empty() || !barrier_tasks.empty())
+                    return false;
+
+                /// Committed requests blocked by read requests are retried after reader threads process them.
+                if (!committed_queue.empty() && !committed_blocked)
+                    return false;
+
+                /// Suppose there is a sequence of write-read requests of a session, the read request is ready after
+                /// the write request is applied, we should not wait for new requests to schedule a reader thread.
+                for (const auto & runner : runners)
                 {
-                    for (const auto & [session_, session_pending_requests] : runner_pending_requests)
-                        if (!session_pending_requests.empty())
-                        {
-                            pending_requests_empty = false;
-                            break;
-                        }
+                    std::lock_guard runner_lock(runner->mutex);
+                    if (runner->has_reads && !runner->reading)
+                        return false;
                 }
-                return error_request_ids.empty() && requests_queue->empty() && committed_queue.empty() && pending_requests_empty;
+                return true;
             };
 
             {
@@ -76,22 +76,25 @@ void RequestProcessor::run()
                 error_request_size = error_request_ids.size();
             }
 
-            /// 1. process read request
-            watch.restart();
+            /// 1. move local requests to pending queue, a committed request is put into requests queue before
+            /// it is committed, so the ones counted above are in pending queue after this.
             for (RunnerId runner_id = 0; runner_id < parallel; runner_id++)
-            {
                 moveRequestToPendingQueue(runner_id);
-                processReadRequests(runner_id);
-            }
-            Metrics::getMetrics().apply_read_request_time_ms->add(watch.elapsedMilliseconds());
 
-            /// 2. process committed request, single thread
+            /// 2. process read requests in reader threads, runners are processed in parallel and
+            /// concurrently with committed requests. Data tree buckets are locked by every request.
+            scheduleReadRequests();
+
+            /// 3. process committed request, single thread
             watch.restart();
             processCommittedRequest(committed_request_size);
             Metrics::getMetrics().apply_write_request_time_ms->add(watch.elapsedMilliseconds());
 
-            /// 3. process error requests
+            /// 4. process error requests
             processErrorRequest(error_request_size);
+
+            /// 5. run barrier tasks, every committed request popped so far is fully applied
+            runBarrierTasks();
         }
         catch (...)
         {
@@ -100,13 +103,46 @@ void RequestProcessor::run()
     }
 }
 
+void RequestProcessor::runBarrierTasks()
+{
+    std::vector<std::packaged_task<void()>> tasks;
+    {
+        std::unique_lock lk(mutex);
+        tasks.swap(barrier_tasks);
+    }
+    for (auto & task : tasks)
+        task();
+}
+
+void RequestProcessor::runInProcessorThread(std::function<void()> task)
+{
+    std::packaged_task<void()> packaged_task(std::move(task));
+    auto future = packaged_task.get_future();
+    {
+        std::unique_lock lk(mutex);
+        if (shutdown_called)
+        {
+            /// Processor thread is gone or going, nobody else touches the store.
+            lk.unlock();
+            packaged_task();
+            future.get();
+            return;
+        }
+        barrier_tasks.emplace_back(std::move(packaged_task));
+        cv.notify_all();
+    }
+    future.get();
+}
+
 void RequestProcessor::moveRequestToPendingQueue(RunnerId runner_id)
 {
-    auto & thread_requests = pending_requests.find(runner_id)->second;
+    auto & runner = *runners[runner_id];
     size_t request_size = requests_queue->size(runner_id);
+    if (request_size == 0)
+        return;
 
-    if (request_size)
-        LOG_TRACE(log, "Prepare to move {} requests to pending queue of runner {}", request_size, runner_id);
+    std::lock_guard runner_lock(runner.mutex);
+    LOG_TRACE(log, "Prepare to move {} requests to pending queue of runner {}", request_size, runner_id);
 
     for (size_t i = 0; i < request_size; ++i)
     {
@@ -117,7 +153,8 @@ void RequestProcessor::moveRequestToPendingQueue(RunnerId runner_id)
             if (op_num != Coordination::OpNum::Auth)
             {
                 LOG_TRACE(log, "Move {} to pending queue", request.toSimpleString());
-                thread_requests[request.session_id].push_back(request);
+                runner.has_reads |= request.request->isReadRequest();
+                runner.pending_requests[request.session_id].push_back(request);
             }
         }
     }
@@ -128,11 +165,6 @@ bool RequestProcessor::shouldProcessCommittedRequest(const RequestForSession & c
     bool has_read_request = false;
     bool found_error = false;
 
-    auto runner_id = getRunnerId(committed_request.session_id);
-    auto & my_pending_requests = pending_requests.find(runner_id)->second;
-
-    auto & pending_requests_for_session = my_pending_requests[committed_request.session_id];
-
     auto process_not_in_pending_queue = [this, &found_in_pending_queue, &committed_request]()
     {
         found_in_pending_queue = false;
@@ -144,13 +176,26 @@ bool RequestProcessor::shouldProcessCommittedRequest(const RequestForSession & c
             committed_request.toSimpleString());
     };
 
-    if (pending_requests_for_session.empty())
+    /// Only the first request is copied, reader threads remove read requests concurrently. A write request
+    /// is removed only by this thread, so it is still the first one after the lock is released.
+    RequestForSession first_pending_request;
     {
-        process_not_in_pending_queue();
-        return true;
+        auto & runner = *runners[getRunnerId(committed_request.session_id)];
+        std::lock_guard runner_lock(runner.mutex);
+
+        auto & pending_requests_for_session = runner.pending_requests[committed_request.session_id];
+        if (pending_requests_for_session.empty())
+        {
+            process_not_in_pending_queue();
+            return true;
+        }
+
+        first_pending_request = pending_requests_for_session.front();
+        /// Set with the runner locked, so a reader thread removing the request sees it and wakes us up.
+        if (first_pending_request.request->xid != committed_request.request->xid && first_pending_request.request->isReadRequest())
+            committed_blocked = true;
     }
 
-    auto & first_pending_request = pending_requests_for_session.front();
     LOG_DEBUG(
         log,
         "First pending request of session {} is {}",
@@ -196,6 +241,8 @@ bool RequestProcessor::shouldProcessCommittedRequest(const RequestForSession & c
 
 void RequestProcessor::processCommittedRequest(size_t count)
 {
+    committed_blocked = false;
+
     RequestForSession committed_request;
     for (size_t i = 0; i < count; ++i)
     {
@@ -204,8 +251,7 @@ void RequestProcessor::processCommittedRequest(size_t count)
 
         LOG_DEBUG(log, "Process committed(write) request {}", committed_request.toSimpleString());
 
-        auto runner_id = getRunnerId(committed_request.session_id);
-        auto & my_pending_requests = pending_requests.find(runner_id)->second;
+        auto & runner = *runners[getRunnerId(committed_request.session_id)];
 
         /// New session and update session requests are not put into pending queue
         if (unlikely(isSessionRequest(committed_request.request)))
@@ -216,14 +262,17 @@ void RequestProcessor::processCommittedRequest(size_t count)
         /// Remote requests
         else if (!keeper_dispatcher->isLocalSession(committed_request.session_id))
         {
-            if (my_pending_requests.contains(committed_request.session_id))
             {
-                LOG_WARNING(
-                    log,
-                    "Found session {} in pending_queue while it is not local, maybe because of connection disconnected. "
-                    "Just delete from pending queue.",
-                    toHexString(committed_request.session_id));
-                my_pending_requests.erase(committed_request.session_id);
+                std::lock_guard runner_lock(runner.mutex);
+                if (runner.pending_requests.contains(committed_request.session_id))
+                {
+                    LOG_WARNING(
+                        log,
+                        "Found session {} in pending_queue while it is not local, maybe because of connection disconnected. "
+                        "Just delete from pending queue.",
+                        toHexString(committed_request.session_id));
+                    runner.pending_requests.erase(committed_request.session_id);
+                }
             }
 
             applyRequest(committed_request);
@@ -244,19 +293,27 @@ void RequestProcessor::processCommittedRequest(size_t count)
                 if (!shouldProcessCommittedRequest(committed_request, found_in_pending_queue))
                     break;
 
-                /// apply request
+                /// apply request, the runner is not locked so that reader threads are not blocked. Only
+                /// the main thread removes write requests, so the request is still the first one after it.
                 applyRequest(committed_request);
                 committed_queue.pop();
                 auto current_time = getCurrentTimeMilliseconds();
                 Metrics::getMetrics().update_latency->add(current_time - committed_request.create_time);
 
                 /// remove request from pending queue
-                auto & pending_requests_for_session = my_pending_requests[committed_request.session_id];
+                std::lock_guard runner_lock(runner.mutex);
+                auto session_it = runner.pending_requests.find(committed_request.session_id);
+                if (session_it == runner.pending_requests.end())
+                    continue;
+
+                auto & pending_requests_for_session = session_it->second;
                 if (found_in_pending_queue)
                     pending_requests_for_session.erase(pending_requests_for_session.begin());
 
                 if (pending_requests_for_session.empty())
-                    my_pending_requests.erase(committed_request.session_id);
+                    runner.pending_requests.erase(session_it);
+                else if (pending_requests_for_session.front().request->isReadRequest())
+                    runner.has_reads = true;
             }
         }
     }
@@ -277,7 +334,7 @@ void RequestProcessor::processErrorRequest(size_t count)
         auto & error_request = error_requests.front();
         auto [session_id, xid] = error_request.getRequestId();
 
-        auto & my_pending_requests = pending_requests.find(getRunnerId(session_id))->second;
+        auto & runner = *runners[getRunnerId(session_id)];
 
         if (unlikely(isSessionRequest(error_request.opnum)))
         {
@@ -312,14 +369,17 @@ void RequestProcessor::processErrorRequest(size_t count)
         /// Remote request
         else if (!keeper_dispatcher->isLocalSession(session_id))
         {
-            if (my_pending_requests.contains(session_id))
             {
-                LOG_WARNING(
-                    log,
-                    "Found session {} in pending_queue while it is not local, maybe because of connection disconnected. "
-                    "Just delete from pending queue.",
-                    toHexString(session_id));
-                my_pending_requests.erase(session_id);
+                std::lock_guard runner_lock(runner.mutex);
+                if (runner.pending_requests.contains(session_id))
+                {
+                    LOG_WARNING(
+                        log,
+                        "Found session {} in pending_queue while it is not local, maybe because of connection disconnected. "
+                        "Just delete from pending queue.",
+                        toHexString(session_id));
+                    runner.pending_requests.erase(session_id);
+                }
             }
 
             LOG_WARNING(log, "Error request {} is not local", error_request.toString());
@@ -388,10 +448,11 @@ std::optional<RequestForSession> RequestProcessor::findErrorRequest(const ErrorR
 
     std::optional<RequestForSession> request;
 
-    auto & my_pending_requests = pending_requests.find(getRunnerId(session_id))->second;
-    auto session_requests = my_pending_requests.find(session_id);
+    auto & runner = *runners[getRunnerId(session_id)];
+    std::lock_guard runner_lock(runner.mutex);
+    auto session_requests = runner.pending_requests.find(session_id);
 
-    if (session_requests != my_pending_requests.end())
+    if (session_requests != runner.pending_requests.end())
     {
         auto & requests = session_requests->second;
         for (auto request_it = requests.begin(); request_it != requests.end();)
@@ -404,6 +465,8 @@ std::optional<RequestForSession> RequestProcessor::findErrorRequest(const ErrorR
                 LOG_WARNING(log, "Matched error request {} in pending queue", request_it->toSimpleString());
                 request = *request_it;
                 requests.erase(request_it);
+                if (!requests.empty() && requests.front().request->isReadRequest())
+                    runner.has_reads = true;
                 break;
             }
             else
@@ -416,35 +479,95 @@ std::optional<RequestForSession> RequestProcessor::findErrorRequest(const ErrorR
     return request;
 }
 
+void RequestProcessor::scheduleReadRequests()
+{
+    for (RunnerId runner_id = 0; runner_id < parallel; runner_id++)
+    {
+        auto & runner = *runners[runner_id];
+        {
+            std::lock_guard runner_lock(runner.mutex);
+            if (runner.reading || !runner.has_reads)
+                continue;
+            runner.reading = true;
+        }
+
+        /// The pool has a thread for every runner, so it never blocks.
+        read_thread_pool->scheduleOrThrowOnError([this, runner_id] { processReadRequests(runner_id); });
+    }
+}
+
 void RequestProcessor::processReadRequests(RunnerId runner_id)
 {
-    auto & thread_requests = pending_requests.find(runner_id)->second;
+    auto & runner = *runners[runner_id];
+    RequestForSessions read_requests;
+    Stopwatch watch;
 
-    /// process every session, until encountered write request
-    for (auto it = thread_requests.begin(); it != thread_requests.end();)
+    while (true)
     {
-        auto & session_requests = it->second;
-        for (auto session_request = session_requests.begin(); session_request != session_requests.end();)
         {
-            /// read request
-            if (session_request->request->isReadRequest())
+            std::lock_guard runner_lock(runner.mutex);
+
+            /// Remove processed requests, they are still in the front of their sessions unless the session is removed.
+            for (const auto & request : read_requests)
             {
-                applyRequest(*session_request);
-                auto current_time = getCurrentTimeMilliseconds();
-                Metrics::getMetrics().read_latency->add(current_time - session_request->create_time);
-                session_request = session_requests.erase(session_request);
+                auto session_it = runner.pending_requests.find(request.session_id);
+                if (session_it == runner.pending_requests.end())
+                    continue;
+
+                auto & session_requests = session_it->second;
+                if (!session_requests.empty() && session_requests.front().request->xid == request.request->xid)
+                    session_requests.erase(session_requests.begin());
             }
-            else
+            read_requests.clear();
+
+            /// Collect read requests of every session until encountered write request. They are kept in pending
+            /// queue while being processed, so that committed requests of the session wait for them.
+            for (auto it = runner.pending_requests.begin(); it != runner.pending_requests.end();)
             {
+                auto & session_requests = it->second;
+                for (const auto & session_request : session_requests)
+                {
+                    if (!session_request.request->isReadRequest())
+                        break;
+                    read_requests.push_back(session_request);
+                }
+
+                if (session_requests.empty())
+                    it = runner.pending_requests.erase(it);
+                else
+                    ++it;
+            }
+
+            runner.has_reads = false;
+            if (read_requests.empty())
+            {
+                runner.reading = false;
                 break;
             }
         }
 
-        if (session_requests.empty())
-            it = thread_requests.erase(it);
-        else
-            ++it;
+        /// Committed requests may wait for the removed read requests.
+        if (committed_blocked)
+        {
+            std::unique_lock lk(mutex);
+            committed_blocked = false;
+            cv.notify_all();
+        }
+
+        watch.restart();
+        for (const auto & request : read_requests)
+        {
+            applyRequest(request);
+            auto current_time = getCurrentTimeMilliseconds();
+            Metrics::getMetrics().read_latency->add(current_time - request.create_time);
+        }
+        Metrics::getMetrics().apply_read_request_time_ms->add(watch.elapsedMilliseconds());
     }
+
+    /// Wake up the main thread, which may wait for the last read requests.
+    std::unique_lock lk(mutex);
+    committed_blocked = false;
+    cv.notify_all();
 }
 
 void RequestProcessor::applyRequest(const RequestForSession & request) const
@@ -494,16 +617,21 @@ void RequestProcessor::shutdown()
         return;
 
     LOG_INFO(log, "Shutting down request processor!");
-    shutdown_called = true;
-
     {
         std::unique_lock lk(mutex);
+        shutdown_called = true;
         cv.notify_all();
     }
 
     if (main_thread.joinable())
         main_thread.join();
 
+    /// Barrier tasks posted before shutdown and not picked up by the main thread
+    runBarrierTasks();
+
+    if (read_thread_pool)
+        read_thread_pool->wait();
+
     RequestForSession request_for_session;
     while (requests_queue->tryPopAny(request_for_session))
     {
@@ -560,7 +688,8 @@ void RequestProcessor::initialize(
     keeper_dispatcher = keeper_dispatcher_;
     requests_queue = std::make_shared<RequestsQueue>(parallel, 20000);
     for (size_t runner_id = 0; runner_id < parallel; runner_id++)
-        pending_requests.emplace(runner_id, std::unordered_map<int64_t, std::vector<RequestForSession>>());
+        runners.emplace_back(std::make_unique<Runner>());
+    read_thread_pool = std::make_shared<ThreadPool>(parallel);
     main_thread = ThreadFromGlobalPool([this] { run(); });
 }
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <future>
+
 #include <Service/KeeperCommon.h>
 #include <Service/KeeperServer.h>
 #include <Service/RequestsQueue.h>
@@ -37,6 +39,12 @@ public:
 
     size_t commitQueueSize() const { return committed_queue.size(); }
 
+    /// Run task on the processor main thread between two rounds of request processing and wait
+    /// for it to finish. No write request is being applied while the task runs, but read requests
+    /// may be, and every committed request popped before it is fully applied. Exceptions of the
+    /// task are rethrown here.
+    void runInProcessorThread(std::function<void()> task);
+
 private:
     void run();
     /// Exist system for fatal error.
@@ -44,9 +52,12 @@ private:
 
     void moveRequestToPendingQueue(RunnerId runner_id);
 
+    /// Schedule reader threads for runners which have read requests ready.
+    void scheduleReadRequests();
     void processReadRequests(RunnerId runner_id);
     void processErrorRequest(size_t count);
     void processCommittedRequest(size_t count);
+    void runBarrierTasks();
 
     /// Apply request to state machine
     void applyRequest(const RequestForSession & request) const;
@@ -64,6 +75,10 @@ private:
 
     ThreadFromGlobalPool main_thread;
 
+    /// Process read requests of runners in parallel while committed requests are being applied by the main thread.
+    /// Requests of a session are always in the same runner, so they are processed in order.
+    ThreadPoolPtr read_thread_pool;
+
     std::atomic<bool> shutdown_called{false};
 
     std::shared_ptr<KeeperServer> server;
@@ -73,9 +88,25 @@ private:
     /// Local requests
     ptr<RequestsQueue> requests_queue;
 
-    /// <runner_id, <session_id, requests>>
-    /// Requests from `requests_queue` grouped by session
-    std::unordered_map<size_t, std::unordered_map<int64_t, RequestForSessions>> pending_requests;
+    struct Runner
+    {
+        /// Lock order is 'RequestProcessor::mutex' before it.
+        std::mutex mutex;
+        /// <session_id, requests>
+        /// Requests from `requests_queue` grouped by session. Leading read requests of a session are processed
+        /// by a reader thread, and a committed request is applied by the main thread when it is the first one.
+        std::unordered_map<int64_t, RequestForSessions> pending_requests;
+        /// Some session may start with a read request, set when requests are added or a write request is removed.
+        bool has_reads = false;
+        /// A reader thread is processing read requests of the runner.
+        bool reading = false;
+    };
+
+    /// Indexed by runner id
+    std::vector<std::unique_ptr<Runner>> runners;
+
+    /// Committed requests are waiting for read requests of the same session ahead of them.
+    std::atomic<bool> committed_blocked{false};
 
     /// Raft committed write requests which can be local or from other nodes.
     ConcurrentBoundedQueue<RequestForSession> committed_queue{1000};
@@ -87,6 +118,9 @@ private:
     mutable std::mutex mutex;
     std::condition_variable cv;
 
+    /// Tasks posted by runInProcessorThread, guarded by mutex.
+    std::vector<std::packaged_task<void()>> barrier_tasks;
+
     /// Error requests when append entry or forward to leader.
     ErrorRequests error_requests;
     /// Used as index for error_requests
@@ -5,39 +5,110 @@
 namespace RK
 {
 
+SessionManager::SessionManager(int64_t dead_session_check_period_ms) : log(&Poco::Logger::get("SessionManager"))
+{
+    for (auto & shard : shards)
+        shard = std::make_unique<Shard>(dead_session_check_period_ms);
+}
+
 int64_t SessionManager::getSessionID(int64_t session_timeout_ms)
 {
-    std::lock_guard lock(session_mutex);
     auto new_id = session_id_counter++;
-    auto it = session_and_timeout.emplace(new_id, session_timeout_ms);
+    auto & shard = getShard(new_id);
+    std::lock_guard lock(shard.mutex);
+    auto it = shard.session_and_timeout.emplace(new_id, session_timeout_ms);
     if (!it.second)
     {
         LOG_DEBUG(log, "Session {} already exist, must applying a fuzzy log.", toHexString(new_id));
     }
     LOG_DEBUG(log, "New session {} created.", toHexString(new_id));
-    session_expiry_queue.addNewSessionOrUpdate(new_id, session_timeout_ms);
+    shard.session_expiry_queue.addNewSessionOrUpdate(new_id, session_timeout_ms);
     return new_id;
 }
 
 bool SessionManager::updateSessionTimeout(int64_t session_id, int64_t /*session_timeout_ms*/)
 {
-    std::lock_guard lock(session_mutex);
-    if (!session_and_timeout.contains(session_id))
+    if (!updateSessionExpirationTime(session_id))
     {
         LOG_WARNING(log, "Updating session timeout for {}, but it is already expired.", toHexString(session_id));
         return false;
     }
-    session_expiry_queue.addNewSessionOrUpdate(session_id, session_and_timeout[session_id]);
     LOG_INFO(log, "Updated session timeout for {}", toHexString(session_id));
     return true;
 }
 
+int64_t SessionManager::getSessionCount() const
+{
+    int64_t count = 0;
+    for (const auto & shard : shards)
+    {
+        std::lock_guard lock(shard->mutex);
+        count += shard->session_and_timeout.size();
+    }
+    return count;
+}
+
+SessionManager::SessionAndTimeout SessionManager::getSessionAndTimeOut() const
+{
+    SessionAndTimeout result;
+    for (const auto & shard : shards)
+    {
+        std::lock_guard lock(shard->mutex);
+        result.insert(shard->session_and_timeout.begin(), shard->session_and_timeout.end());
+    }
+    return result;
+}
+
+std::vector<int64_t> SessionManager::getDeadSessions() const
+{
+    std::vector<int64_t> result;
+    for (const auto & shard : shards)
+    {
+        std::lock_guard lock(shard->mutex);
+        auto expired = shard->session_expiry_queue.getExpiredSessions();
+        result.insert(result.end(), expired.begin(), expired.end());
+    }
+    return result;
+}
+
+std::unordered_map<int64_t, int64_t> SessionManager::sessionToExpirationTime() const
+{
+    std::unordered_map<int64_t, int64_t> result;
+    for (const auto & shard : shards)
+    {
+        std::lock_guard lock(shard->mutex);
+        const auto & session_to_expiration_time = shard->session_expiry_queue.sessionToExpirationTime();
+        result.insert(session_to_expiration_time.begin(), session_to_expiration_time.end());
+    }
+    return result;
+}
+
+void SessionManager::dumpSessionIDs(WriteBuffer & buf, const String & delimiter) const
+{
+    SessionIDs session_ids;
+    for (const auto & shard : shards)
+    {
+        std::lock_guard lock(shard->mutex);
+        for (const auto & [session_id, _] : shard->session_and_timeout)
+            session_ids.push_back(session_id);
+    }
+
+    buf << "Sessions dump (" << session_ids.size() << "):\n";
+    for (auto session_id : session_ids)
+    {
+        buf << toHexString(session_id) << delimiter;
+    }
+}
+
 void SessionManager::reset()
 {
-    std::lock_guard lock(session_mutex);
     session_id_counter = 1;
-    session_and_timeout.clear();
-    session_expiry_queue.clear();
+    for (auto & shard : shards)
+    {
+        std::lock_guard lock(shard->mutex);
+        shard->session_and_timeout.clear();
+        shard->session_expiry_queue.clear();
+    }
 }
 
 }
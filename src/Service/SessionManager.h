@@ -1,5 +1,9 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -21,10 +25,11 @@ public:
     using SessionAndTimeout = std::unordered_map<int64_t, int64_t>;
     using SessionIDs = std::vector<int64_t>;
 
-    explicit SessionManager(int64_t dead_session_check_period_ms)
-        : session_expiry_queue(dead_session_check_period_ms), log(&Poco::Logger::get("SessionManager"))
-    {
-    }
+    /// Sessions are sharded by id, so that requests of different sessions, which are processed by
+    /// several reader threads, seldom contend on the same mutex.
+    static constexpr size_t SHARD_NUM = 16;
+
+    explicit SessionManager(int64_t dead_session_check_period_ms);
 
     /// Allocate a new session id with initialized expiry timeout session_timeout_ms.
     /// Will increase session_id_counter and zxid.
@@ -33,102 +38,93 @@ public:
     /// Update session timeout for session_id, invoked when client reconnect to keeper.
     bool updateSessionTimeout(int64_t session_id, int64_t session_timeout_ms);
 
-    void updateSessionExpirationTime(int64_t session_id)
+    /// Update expiration time of a session for a request of it, return false if the session does not exist.
+    bool updateSessionExpirationTime(int64_t session_id)
     {
-        std::lock_guard lock(session_mutex);
-        if (session_and_timeout.contains(session_id))
-            session_expiry_queue.addNewSessionOrUpdate(session_id, session_and_timeout[session_id]);
+        auto & shard = getShard(session_id);
+        std::lock_guard lock(shard.mutex);
+        auto it = shard.session_and_timeout.find(session_id);
+        if (it == shard.session_and_timeout.end())
+            return false;
+        shard.session_expiry_queue.addNewSessionOrUpdate(session_id, it->second);
+        return true;
     }
 
     bool contains(int64_t session_id) const
     {
-        std::lock_guard lock(session_mutex);
-        return session_and_timeout.contains(session_id);
+        const auto & shard = getShard(session_id);
+        std::lock_guard lock(shard.mutex);
+        return shard.session_and_timeout.contains(session_id);
     }
 
     void expireSession(int64_t session_id)
     {
-        std::lock_guard lock(session_mutex);
-        session_expiry_queue.remove(session_id);
-        session_and_timeout.erase(session_id);
+        auto & shard = getShard(session_id);
+        std::lock_guard lock(shard.mutex);
+        shard.session_expiry_queue.remove(session_id);
+        shard.session_and_timeout.erase(session_id);
     }
 
     int64_t getSessionIDCounter() const
     {
-        std::lock_guard lock(session_mutex);
-        return session_id_counter;
+        return session_id_counter.load();
     }
 
     void setSessionIDCounter(int64_t counter)
     {
-        std::lock_guard lock(session_mutex);
-        session_id_counter = counter;
+        session_id_counter.store(counter);
     }
 
-    int64_t getSessionCount() const
-    {
-        std::lock_guard lock(session_mutex);
-        return session_and_timeout.size();
-    }
+    int64_t getSessionCount() const;
 
-    SessionAndTimeout getSessionAndTimeOut() const
-    {
-        std::lock_guard lock(session_mutex);
-        return session_and_timeout;
-    }
+    SessionAndTimeout getSessionAndTimeOut() const;
 
     /// Add session id. Used when restoring KeeperStore from snapshot.
     void addSessionID(int64_t session_id, int64_t session_timeout_ms)
     {
-        std::lock_guard lock(session_mutex);
-        session_and_timeout.emplace(session_id, session_timeout_ms);
-        session_expiry_queue.addNewSessionOrUpdate(session_id, session_timeout_ms);
+        auto & shard = getShard(session_id);
+        std::lock_guard lock(shard.mutex);
+        shard.session_and_timeout.emplace(session_id, session_timeout_ms);
+        shard.session_expiry_queue.addNewSessionOrUpdate(session_id, session_timeout_ms);
     }
 
-    std::vector<int64_t> getDeadSessions() const
-    {
-        std::lock_guard lock(session_mutex);
-        auto ret = session_expiry_queue.getExpiredSessions();
-        return ret;
-    }
+    std::vector<int64_t> getDeadSessions() const;
 
-    std::unordered_map<int64_t, int64_t> sessionToExpirationTime() const
-    {
-        std::lock_guard lock(session_mutex);
-        const auto & ret = session_expiry_queue.sessionToExpirationTime();
-        return ret;
-    }
+    std::unordered_map<int64_t, int64_t> sessionToExpirationTime() const;
 
     void handleRemoteSession(int64_t session_id, int64_t expiration_time)
     {
-        std::lock_guard lock(session_mutex);
-        session_expiry_queue.setSessionExpirationTime(session_id, expiration_time);
+        auto & shard = getShard(session_id);
+        std::lock_guard lock(shard.mutex);
+        shard.session_expiry_queue.setSessionExpirationTime(session_id, expiration_time);
     }
 
-    void dumpSessionIDs(WriteBuffer & buf, const String & delimiter = "\n") const
-    {
-        std::lock_guard lock(session_mutex);
-        buf << "Sessions dump (" << session_and_timeout.size() << "):\n";
-        for (const auto & [session_id, _] : session_and_timeout)
-        {
-            buf << toHexString(session_id) << delimiter;
-        }
-    }
+    void dumpSessionIDs(WriteBuffer & buf, const String & delimiter = "\n") const;
 
     void reset();
 
 private:
-    /// Hold session and initialized expiry timeout, only local sessions.
-    SessionAndTimeout session_and_timeout;
+    struct Shard
+    {
+        explicit Shard(int64_t dead_session_check_period_ms) : session_expiry_queue(dead_session_check_period_ms) { }
+
+        /// Hold session and initialized expiry timeout, only local sessions.
+        SessionAndTimeout session_and_timeout;
+
+        /// Hold session and expiry time
+        /// For leader, holds all sessions in cluster.
+        /// For follower/leaner, holds only local sessions
+        SessionExpiryQueue session_expiry_queue;
+
+        mutable std::mutex mutex;
+    };
 
-    /// Hold session and expiry time
-    /// For leader, holds all sessions in cluster.
-    /// For follower/leaner, holds only local sessions
-    SessionExpiryQueue session_expiry_queue;
+    Shard & getShard(int64_t session_id) { return *shards[static_cast<UInt64>(session_id) % SHARD_NUM]; }
+    const Shard & getShard(int64_t session_id) const { return *shards[static_cast<UInt64>(session_id) % SHARD_NUM]; }
 
-    mutable std::mutex session_mutex;
+    std::array<std::unique_ptr<Shard>, SHARD_NUM> shards;
 
-    int64_t session_id_counter{1};
+    std::atomic<int64_t> session_id_counter{1};
 
     Poco::Logger * log;
 
@@ -1,5 +1,6 @@
 #include <filesystem>
 #include <Service/Settings.h>
+#include <Service/SnapshotCommon.h>
 #include <Common/IO/WriteHelpers.h>
 #include <Common/getNumberOfPhysicalCPUCores.h>
 #include <ZooKeeper/ZooKeeperConstants.h>
@@ -86,10 +87,38 @@ void RaftSettings::loadFromConfig(const String & config_elem, const Poco::Util::
         fresh_log_gap = config.getUInt(get_key("fresh_log_gap"), 200);
         configuration_change_tries_count = config.getUInt(get_key("configuration_change_tries_count"), 30);
         max_batch_size = config.getUInt(get_key("max_batch_size"), 1000);
+        batch_requests_in_log_entry = config.getBool(get_key("batch_requests_in_log_entry"), false);
         log_fsync_mode = FsyncModeNS::parseFsyncMode(config.getString(get_key("log_fsync_mode"), "fsync_parallel"));
         log_fsync_interval = config.getUInt(get_key("log_fsync_interval"), 1000);
         max_log_segment_file_size = config.getUInt(get_key("max_log_segment_file_size"), 1073741824);
+        preallocate_log_segment = config.getBool(get_key("preallocate_log_segment"), false);
+        io_uring_log_write = config.getBool(get_key("io_uring_log_write"), false);
+        log_entry_cache_size = config.getUInt64(get_key("log_entry_cache_size"), 134217728);
         async_snapshot = config.getBool(get_key("async_snapshot"), true);
+        UInt32 version_number = config.getUInt(get_key("snapshot_version"), static_cast<UInt32>(DEFAULT_SNAPSHOT_VERSION));
+        if (version_number < static_cast<UInt32>(SnapshotVersion::V2) || version_number > static_cast<UInt32>(CURRENT_SNAPSHOT_VERSION))
+            throw Exception(
+                ErrorCodes::ILLEGAL_SETTING_VALUE,
+                "Setting 'snapshot_version' must be in [{}, {}], got {}",
+                static_cast<UInt32>(SnapshotVersion::V2),
+                static_cast<UInt32>(CURRENT_SNAPSHOT_VERSION),
+                version_number);
+        snapshot_version = static_cast<SnapshotVersion>(version_number);
+        max_delta_snapshots = config.getUInt(get_key("max_delta_snapshots"), 0);
+        snapshot_compression_method = SnapshotCompressionMethodNS::parseSnapshotCompressionMethod(
+            config.getString(get_key("snapshot_compression_method"), "none"));
+        if (snapshot_compression_method != SnapshotCompressionMethod::NONE && snapshot_version < SnapshotVersion::V4)
+            throw Exception(
+                ErrorCodes::ILLEGAL_SETTING_VALUE,
+                "Setting 'snapshot_compression_method' requires 'snapshot_version' {} at least",
+                static_cast<UInt32>(SnapshotVersion::V4));
+        snapshot_compression_level = config.getInt(get_key("snapshot_compression_level"), DEFAULT_SNAPSHOT_COMPRESSION_LEVEL);
+        if (snapshot_compression_level < 1 || snapshot_compression_level > 9)
+            throw Exception(
+                ErrorCodes::ILLEGAL_SETTING_VALUE, "Setting 'snapshot_compression_level' must be in [1, 9], got {}", snapshot_compression_level);
+        snapshot_transfer_chunk_size = config.getUInt64(get_key("snapshot_transfer_chunk_size"), 0);
+        memory_usage_prefix_depth = config.getUInt(get_key("memory_usage_prefix_depth"), 2);
+        max_remove_recursive_nodes = config.getUInt(get_key("max_remove_recursive_nodes"), 100000);
     }
     catch (Exception & e)
     {
@@ -121,10 +150,21 @@ RaftSettingsPtr RaftSettings::getDefault()
     settings->fresh_log_gap = 200;
     settings->configuration_change_tries_count = 30;
     settings->max_batch_size = 1000;
+    settings->batch_requests_in_log_entry = false;
     settings->log_fsync_interval = 1000;
     settings->max_log_segment_file_size = 1073741824;
+    settings->preallocate_log_segment = false;
+    settings->io_uring_log_write = false;
+    settings->log_entry_cache_size = 134217728;
     settings->log_fsync_mode = FsyncMode::FSYNC_PARALLEL;
     settings->async_snapshot = true;
+    settings->snapshot_version = DEFAULT_SNAPSHOT_VERSION;
+    settings->max_delta_snapshots = 0;
+    settings->snapshot_compression_method = SnapshotCompressionMethod::NONE;
+    settings->snapshot_compression_level = DEFAULT_SNAPSHOT_COMPRESSION_LEVEL;
+    settings->snapshot_transfer_chunk_size = 0;
+    settings->memory_usage_prefix_depth = 2;
+    settings->max_remove_recursive_nodes = 100000;
 
     return settings;
 }
@@ -209,6 +249,17 @@ void Settings::dump(WriteBufferFromOwnString & buf) const
     write_int(raft_settings->async_snapshot);
     writeText("max_stored_snapshots=", buf);
     write_int(raft_settings->max_stored_snapshots);
+    writeText("snapshot_version=", buf);
+    write_int(static_cast<UInt32>(raft_settings->snapshot_version));
+    writeText("max_delta_snapshots=", buf);
+    write_int(raft_settings->max_delta_snapshots);
+    writeText("snapshot_compression_method=", buf);
+    writeText(SnapshotCompressionMethodNS::toString(raft_settings->snapshot_compression_method), buf);
+    buf.write('\n');
+    writeText("snapshot_compression_level=", buf);
+    write_int(raft_settings->snapshot_compression_level);
+    writeText("snapshot_transfer_chunk_size=", buf);
+    write_int(raft_settings->snapshot_transfer_chunk_size);
 
     writeText("shutdown_timeout=", buf);
     write_int(raft_settings->shutdown_timeout);
@@ -227,11 +278,23 @@ void Settings::dump(WriteBufferFromOwnString & buf) const
     buf.write('\n');
     writeText("max_log_segment_file_size=", buf);
     write_int(raft_settings->max_log_segment_file_size);
+    writeText("preallocate_log_segment=", buf);
+    write_int(raft_settings->preallocate_log_segment);
+    writeText("io_uring_log_write=", buf);
+    write_int(raft_settings->io_uring_log_write);
+    writeText("log_entry_cache_size=", buf);
+    write_int(raft_settings->log_entry_cache_size);
 
     writeText("nuraft_thread_size=", buf);
     write_int(raft_settings->nuraft_thread_size);
     writeText("fresh_log_gap=", buf);
     write_int(raft_settings->fresh_log_gap);
+    writeText("memory_usage_prefix_depth=", buf);
+    write_int(raft_settings->memory_usage_prefix_depth);
+    writeText("max_remove_recursive_nodes=", buf);
+    write_int(raft_settings->max_remove_recursive_nodes);
+    writeText("batch_requests_in_log_entry=", buf);
+    write_int(raft_settings->batch_requests_in_log_entry);
 }
 
 SettingsPtr Settings::loadFromConfig(const Poco::Util::AbstractConfiguration & config, bool standalone_keeper_)
@@ -28,6 +28,10 @@ namespace FsyncModeNS
     String toString(FsyncMode mode);
 }
 
+/// Defined in SnapshotCommon.h
+enum class SnapshotCompressionMethod : uint8_t;
+enum class SnapshotVersion : uint8_t;
+
 struct RaftSettings;
 using RaftSettingsPtr = std::shared_ptr<RaftSettings>;
 
@@ -106,14 +110,36 @@ struct RaftSettings
     UInt64 configuration_change_tries_count;
     /// Max batch size for append_entries
     UInt64 max_batch_size;
+    /// Whether to pack a batch of requests into one log entry, all servers must support the format before enabling it.
+    bool batch_requests_in_log_entry;
     /// Raft log fsync mode
     FsyncMode log_fsync_mode;
     /// How many logs do once fsync when async_fsync is false
     UInt64 log_fsync_interval;
     /// We store logs in multiple file, this setting represent the max single log segment file size in bytes.
     UInt64 max_log_segment_file_size;
+    /// Whether to preallocate max_log_segment_file_size bytes for open log segment and prepare the next one in background.
+    bool preallocate_log_segment;
+    /// Whether to write raft log by io_uring on Linux 5.5 and later, log is written by pwritev if io_uring is not available.
+    bool io_uring_log_write;
+    /// Max bytes of recent logs cached in memory, reads of them by replication skip log segments.
+    UInt64 log_entry_cache_size;
     /// Whether async snapshot
     bool async_snapshot;
+    /// Format version of created snapshots, which are sent to other servers as they are.
+    SnapshotVersion snapshot_version;
+    /// Max count of delta snapshots between two full snapshots, 0 means all snapshots are full ones.
+    UInt32 max_delta_snapshots;
+    /// Codec compressing data batches of snapshot objects, valid values: 'none', 'zlib'.
+    SnapshotCompressionMethod snapshot_compression_method;
+    /// Compression level of zlib, from 1 (fastest) to 9 (best compression).
+    Int32 snapshot_compression_level;
+    /// Max bytes of a snapshot object sent to another server in one message, 0 means an object is sent whole.
+    UInt64 snapshot_transfer_chunk_size;
+    /// Max depth of path prefixes data tree memory usage is aggregated by, 0 means disabled.
+    UInt64 memory_usage_prefix_depth;
+    /// Max count of nodes a removeRecursive request can remove, a larger subtree is not removed.
+    UInt64 max_remove_recursive_nodes;
 
     Poco::Logger * log = &Poco::Logger::get("RaftSettings");
 
@@ -1,10 +1,16 @@
+#include <algorithm>
+
 #include <Poco/File.h>
+#include <zlib.h>
 
 #include <Common/Exception.h>
+#include <Common/IO/VarInt.h>
 #include <Common/IO/WriteHelpers.h>
+#include <Common/Stopwatch.h>
 
 #include <Service/Crc32.h>
 #include <Service/KeeperUtils.h>
+#include <Service/Metrics.h>
 #include <Service/ReadBufferFromNuRaftBuffer.h>
 #include <Service/SnapshotCommon.h>
 #include <Service/WriteBufferFromNuraftBuffer.h>
@@ -16,10 +22,35 @@ namespace RK
 namespace ErrorCodes
 {
     extern const int CORRUPTED_SNAPSHOT;
+    extern const int BAD_ARGUMENTS;
+    extern const int UNKNOWN_SETTING;
 }
 
 using nuraft::cs_new;
 
+namespace SnapshotCompressionMethodNS
+{
+    SnapshotCompressionMethod parseSnapshotCompressionMethod(const String & in)
+    {
+        if (in == "none")
+            return SnapshotCompressionMethod::NONE;
+        else if (in == "zlib")
+            return SnapshotCompressionMethod::ZLIB;
+        else
+            throw Exception("Unknown config 'snapshot_compression_method'.", ErrorCodes::UNKNOWN_SETTING);
+    }
+
+    String toString(SnapshotCompressionMethod method)
+    {
+        if (method == SnapshotCompressionMethod::NONE)
+            return "none";
+        else if (method == SnapshotCompressionMethod::ZLIB)
+            return "zlib";
+        else
+            throw Exception("Unknown config 'snapshot_compression_method'.", ErrorCodes::UNKNOWN_SETTING);
+    }
+}
+
 String toString(SnapshotVersion version)
 {
     switch (version)
@@ -30,6 +61,10 @@ String toString(SnapshotVersion version)
             return "v1";
         case SnapshotVersion::V2:
             return "v2";
+        case SnapshotVersion::V3:
+            return "v3";
+        case SnapshotVersion::V4:
+            return "v4";
         case SnapshotVersion::UNKNOWN:
             return "unknown";
     }
@@ -100,7 +135,117 @@ UInt32 updateCheckSum(UInt32 checksum, UInt32 data_crc)
     return RK::getCRC32(reinterpret_cast<const char *>(&data), 8);
 }
 
-String serializeKeeperNode(const String & path, const ptr<KeeperNode> & node, SnapshotVersion version)
+UInt32 getBatchChecksum(const char * data, size_t length, SnapshotVersion version)
+{
+    return version >= SnapshotVersion::V3 ? RK::getCRC32C(data, length) : RK::getCRC32(data, length);
+}
+
+static constexpr size_t COMPRESSED_BATCH_HEADER_SIZE = sizeof(Int32) + sizeof(UInt8) + sizeof(UInt32);
+
+/// Deflate can not compress data better than about 1032:1, a larger uncompressed size is corrupted.
+static constexpr size_t MAX_ZLIB_COMPRESSION_RATIO = 1032;
+
+String compressSnapshotBatch(std::string_view data, SnapshotCompressionMethod method, Int32 level)
+{
+    if (method != SnapshotCompressionMethod::ZLIB)
+        throw Exception(ErrorCodes::BAD_ARGUMENTS, "Unsupported snapshot compression method {}", static_cast<int>(method));
+
+    Stopwatch watch;
+
+    String compressed;
+    uLongf compressed_size = compressBound(data.size());
+    compressed.resize(COMPRESSED_BATCH_HEADER_SIZE + compressed_size);
+
+    char * pos = compressed.data();
+    Int32 type = static_cast<Int32>(SnapshotBatchType::SNAPSHOT_TYPE_COMPRESSED);
+    UInt32 uncompressed_size = data.size();
+    memcpy(pos, &type, sizeof(type));
+    pos[sizeof(type)] = static_cast<char>(method);
+    memcpy(pos + sizeof(type) + sizeof(UInt8), &uncompressed_size, sizeof(uncompressed_size));
+
+    int res = compress2(
+        reinterpret_cast<Bytef *>(pos + COMPRESSED_BATCH_HEADER_SIZE),
+        &compressed_size,
+        reinterpret_cast<const Bytef *>(data.data()),
+        data.size(),
+        level);
+    if (res != Z_OK)
+        throw Exception(ErrorCodes::BAD_ARGUMENTS, "Can't compress snapshot batch, zlib error {}", res);
+    compressed.resize(COMPRESSED_BATCH_HEADER_SIZE + compressed_size);
+
+    Metrics::getMetrics().snap_uncompressed_bytes->add(data.size());
+    Metrics::getMetrics().snap_compressed_bytes->add(compressed.size());
+    Metrics::getMetrics().snap_compression_time_us->add(watch.elapsedMicroseconds());
+    return compressed;
+}
+
+bool isCompressedSnapshotBatch(std::string_view data)
+{
+    if (data.size() < sizeof(Int32))
+        return false;
+    Int32 type;
+    memcpy(&type, data.data(), sizeof(type));
+    return type == static_cast<Int32>(SnapshotBatchType::SNAPSHOT_TYPE_COMPRESSED);
+}
+
+String decompressSnapshotBatch(std::string_view data)
+{
+    if (data.size() < COMPRESSED_BATCH_HEADER_SIZE)
+        throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Snapshot is corrupted, compressed batch is too short");
+
+    Stopwatch watch;
+
+    auto method = static_cast<SnapshotCompressionMethod>(data[sizeof(Int32)]);
+    UInt32 uncompressed_size;
+    memcpy(&uncompressed_size, data.data() + sizeof(Int32) + sizeof(UInt8), sizeof(uncompressed_size));
+
+    if (method != SnapshotCompressionMethod::ZLIB)
+        throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Unknown snapshot compression method {}", static_cast<int>(method));
+
+    std::string_view compressed = data.substr(COMPRESSED_BATCH_HEADER_SIZE);
+    /// Do not trust the size before allocating memory for it.
+    if (uncompressed_size > compressed.size() * MAX_ZLIB_COMPRESSION_RATIO)
+        throw Exception(
+            ErrorCodes::CORRUPTED_SNAPSHOT,
+            "Snapshot is corrupted, uncompressed size {} of batch is impossible for {} compressed bytes",
+            uncompressed_size,
+            compressed.size());
+
+    String res;
+    res.resize(uncompressed_size);
+
+    /// Inflate in one call, the whole stream must be consumed and fill the result exactly.
+    z_stream stream{};
+    if (inflateInit(&stream) != Z_OK)
+        throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Can't init zlib to decompress snapshot batch: {}", stream.msg ? stream.msg : "");
+
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(compressed.data()));
+    stream.avail_in = static_cast<uInt>(compressed.size());
+    stream.next_out = reinterpret_cast<Bytef *>(res.data());
+    stream.avail_out = uncompressed_size;
+
+    int ret = inflate(&stream, Z_FINISH);
+    String error = stream.msg ? stream.msg : "";
+    size_t decompressed_size = stream.total_out;
+    size_t unconsumed = stream.avail_in;
+    inflateEnd(&stream);
+
+    if (ret != Z_STREAM_END)
+        throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Snapshot is corrupted, can't decompress batch, zlib error {} {}", ret, error);
+    if (decompressed_size != uncompressed_size)
+        throw Exception(
+            ErrorCodes::CORRUPTED_SNAPSHOT,
+            "Snapshot is corrupted, batch is decompressed to {} bytes, expected {}",
+            decompressed_size,
+            uncompressed_size);
+    if (unconsumed != 0)
+        throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Snapshot is corrupted, {} bytes trailing compressed batch", unconsumed);
+
+    Metrics::getMetrics().snap_decompression_time_us->add(watch.elapsedMicroseconds());
+    return res;
+}
+
+String serializeKeeperNode(const String & path, const KeeperNodePtr & node, SnapshotVersion version)
 {
     WriteBufferFromOwnString buf;
 
@@ -123,13 +268,13 @@ String serializeKeeperNode(const String & path, const ptr<KeeperNode> & node, Sn
     return std::move(buf.str());
 }
 
-ptr<KeeperNodeWithPath>parseKeeperNode(const String & buf, SnapshotVersion version)
+ptr<KeeperNodeWithPath>parseKeeperNode(std::string_view buf, SnapshotVersion version)
 {
     ReadBufferFromMemory in(buf.data(), buf.size());
 
     ptr<KeeperNodeWithPath> node_with_path = cs_new<KeeperNodeWithPath>();
     auto & node = node_with_path->node;
-    node = std::make_shared<KeeperNode>();
+    node = KeeperNode::create();
 
     Coordination::read(node_with_path->path, in);
     Coordination::read(node->data, in);
@@ -153,16 +298,123 @@ ptr<KeeperNodeWithPath>parseKeeperNode(const String & buf, SnapshotVersion versi
 }
 
 
-std::pair<size_t, UInt32> saveBatchV2(ptr<WriteBufferFromFile> & out, ptr<SnapshotBatchBody> & batch)
+String serializeKeeperNodesCompact(std::vector<std::pair<String, KeeperNodePtr>> & nodes)
+{
+    std::sort(nodes.begin(), nodes.end(), [](const auto & lhs, const auto & rhs) { return lhs.first < rhs.first; });
+
+    WriteBufferFromOwnString buf;
+    std::string_view prev_path;
+    for (const auto & [path, node] : nodes)
+    {
+        size_t shared = 0;
+        size_t max_shared = std::min(prev_path.size(), path.size());
+        while (shared < max_shared && prev_path[shared] == path[shared])
+            shared++;
+
+        writeVarUInt(shared, buf);
+        writeVarUInt(path.size() - shared, buf);
+        buf.write(path.data() + shared, path.size() - shared);
+        prev_path = path;
+
+        writeVarUInt(node->data.size(), buf);
+        buf.write(node->data.data(), node->data.size());
+        writeVarUInt(node->acl_id, buf);
+        writeIntBinary(static_cast<UInt8>(node->is_ephemeral | node->is_sequential << 1), buf);
+
+        const auto & stat = node->stat;
+        writeVarInt(stat.czxid, buf);
+        writeVarInt(stat.mzxid - stat.czxid, buf);
+        writeVarInt(stat.pzxid - stat.czxid, buf);
+        writeVarInt(stat.ctime, buf);
+        writeVarInt(stat.mtime - stat.ctime, buf);
+        writeVarInt(stat.version, buf);
+        writeVarInt(stat.cversion, buf);
+        writeVarInt(stat.aversion, buf);
+        writeVarInt(stat.ephemeralOwner, buf);
+        writeVarInt(stat.dataLength, buf);
+        writeVarInt(stat.numChildren, buf);
+    }
+    return std::move(buf.str());
+}
+
+void parseKeeperNodesCompact(std::string_view buf, const std::function<void(String &&, KeeperNodePtr &&)> & on_node)
+{
+    ReadBufferFromMemory in(buf.data(), buf.size());
+    String prev_path;
+    while (!in.eof())
+    {
+        UInt64 shared;
+        UInt64 suffix_size;
+        readVarUInt(shared, in);
+        readVarUInt(suffix_size, in);
+        if (shared > prev_path.size())
+            throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Snapshot is corrupted, shared prefix of path is longer than previous path");
+
+        String path;
+        path.reserve(shared + suffix_size);
+        path.append(prev_path, 0, shared);
+        path.resize(shared + suffix_size);
+        in.readStrict(path.data() + shared, suffix_size);
+        prev_path = path;
+
+        auto node = KeeperNode::create();
+        UInt64 data_size;
+        readVarUInt(data_size, in);
+        node->data.resize(data_size);
+        in.readStrict(node->data.data(), data_size);
+        readVarUInt(node->acl_id, in);
+
+        UInt8 flags;
+        readIntBinary(flags, in);
+        node->is_ephemeral = flags & 1;
+        node->is_sequential = flags & 2;
+
+        auto & stat = node->stat;
+        Int64 value;
+        readVarInt(stat.czxid, in);
+        readVarInt(value, in);
+        stat.mzxid = stat.czxid + value;
+        readVarInt(value, in);
+        stat.pzxid = stat.czxid + value;
+        readVarInt(stat.ctime, in);
+        readVarInt(value, in);
+        stat.mtime = stat.ctime + value;
+        readVarInt(stat.version, in);
+        readVarInt(stat.cversion, in);
+        readVarInt(stat.aversion, in);
+        readVarInt(stat.ephemeralOwner, in);
+        readVarInt(stat.dataLength, in);
+        readVarInt(stat.numChildren, in);
+
+        node->children.reserve(stat.numChildren);
+        on_node(std::move(path), std::move(node));
+    }
+}
+
+std::pair<size_t, UInt32> saveBatchV2(
+    ptr<WriteBufferFromFile> & out,
+    ptr<SnapshotBatchBody> & batch,
+    SnapshotVersion version,
+    SnapshotCompressionMethod compression_method,
+    Int32 compression_level)
 {
     if (!batch)
         batch = cs_new<SnapshotBatchBody>();
 
+    if (!batch->nodes.empty())
+    {
+        batch->type = SnapshotBatchType::SNAPSHOT_TYPE_DATA_COMPACT;
+        batch->add(serializeKeeperNodesCompact(batch->nodes));
+        batch->nodes.clear();
+    }
+
     String str_buf = SnapshotBatchBody::serialize(*batch);
+    if (compression_method != SnapshotCompressionMethod::NONE && version >= SnapshotVersion::V4)
+        str_buf = compressSnapshotBatch(str_buf, compression_method, compression_level);
 
     SnapshotBatchHeader header;
     header.data_length = str_buf.size();
-    header.data_crc = RK::getCRC32(str_buf.c_str(), str_buf.size());
+    header.data_crc = getBatchChecksum(str_buf.c_str(), str_buf.size(), version);
 
     writeIntBinary(header.data_length, *out);
     writeIntBinary(header.data_crc, *out);
@@ -173,10 +425,15 @@ std::pair<size_t, UInt32> saveBatchV2(ptr<WriteBufferFromFile> & out, ptr<Snapsh
     return {SnapshotBatchHeader::HEADER_SIZE + header.data_length, header.data_crc};
 }
 
-std::pair<size_t, UInt32>
-saveBatchAndUpdateCheckSumV2(ptr<WriteBufferFromFile> & out, ptr<SnapshotBatchBody> & batch, UInt32 checksum)
+std::pair<size_t, UInt32> saveBatchAndUpdateCheckSumV2(
+    ptr<WriteBufferFromFile> & out,
+    ptr<SnapshotBatchBody> & batch,
+    UInt32 checksum,
+    SnapshotVersion version,
+    SnapshotCompressionMethod compression_method,
+    Int32 compression_level)
 {
-    auto [save_size, data_crc] = saveBatchV2(out, batch);
+    auto [save_size, data_crc] = saveBatchV2(out, batch, version, compression_method, compression_level);
     /// rebuild batch
     batch = cs_new<SnapshotBatchBody>();
     return {save_size, updateCheckSum(checksum, data_crc)};
@@ -203,7 +460,7 @@ void serializeAclsV2(const NumToACLMap & acl_map, String path, UInt32 save_batch
             if (index != 0)
             {
                 /// write data in batch to file
-                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version);
                 checksum = new_checksum;
             }
             batch = cs_new<SnapshotBatchBody>();
@@ -223,7 +480,7 @@ void serializeAclsV2(const NumToACLMap & acl_map, String path, UInt32 save_batch
     }
 
     /// flush the last acl batch
-    auto [_, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+    auto [_, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version);
     checksum = new_checksum;
 
     writeTailAndClose(out, checksum);
@@ -251,7 +508,7 @@ void serializeSessionsV2(SessionAndTimeout & session_and_timeout, SessionAndAuth
             if (index != 0)
             {
                 /// write data in batch to file
-                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version);
                 checksum = new_checksum;
             }
             batch = cs_new<SnapshotBatchBody>();
@@ -276,7 +533,7 @@ void serializeSessionsV2(SessionAndTimeout & session_and_timeout, SessionAndAuth
     }
 
     /// flush the last batch
-    auto [_, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+    auto [_, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version);
     checksum = new_checksum;
     writeTailAndClose(out, checksum);
 }
@@ -302,7 +559,7 @@ void serializeMapV2(T & snap_map, UInt32 save_batch_size, SnapshotVersion versio
             if (index != 0)
             {
                 /// write data in batch to file
-                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version);
                 checksum = new_checksum;
             }
 
@@ -328,7 +585,7 @@ void serializeMapV2(T & snap_map, UInt32 save_batch_size, SnapshotVersion versio
     }
 
     /// flush the last batch
-    auto [_, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+    auto [_, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version);
     checksum = new_checksum;
     writeTailAndClose(out, checksum);
 }
@@ -386,14 +643,71 @@ ptr<SnapshotBatchBody> SnapshotBatchBody::parse(const String & data)
     return batch_body;
 }
 
-void parseBatchDataV2(KeeperStore & store, SnapshotBatchBody & batch, BucketEdges & buckets_edges, BucketNodes & bucket_nodes, SnapshotVersion version)
+SnapshotBatchBodyView SnapshotBatchBodyView::parse(std::string_view data)
+{
+    SnapshotBatchBodyView batch_body;
+    ReadBufferFromMemory in(data.data(), data.size());
+    int32_t type;
+    readIntBinary(type, in);
+    batch_body.type = static_cast<SnapshotBatchType>(type);
+    int32_t element_count;
+    readIntBinary(element_count, in);
+    batch_body.elements.reserve(element_count);
+    for (int i = 0; i < element_count; i++)
+    {
+        int32_t element_size;
+        readIntBinary(element_size, in);
+        if (element_size < 0 || static_cast<size_t>(element_size) > in.available())
+            throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Snapshot is corrupted, the {}th element in batch exceeds the batch", i + 1);
+        batch_body.elements.emplace_back(in.position(), element_size);
+        in.ignore(element_size);
+    }
+    return batch_body;
+}
+
+namespace
+{
+
+/// Collect a node loaded from snapshot to the buckets, they will be filled into data tree.
+void collectNode(KeeperStore & store, String && path, KeeperNodePtr && node, BucketEdges & buckets_edges, BucketNodes & bucket_nodes)
+{
+    /// Some strange ACLID during deserialization from ZooKeeper
+    if (node->acl_id == std::numeric_limits<uint64_t>::max())
+        node->acl_id = 0;
+
+    store.acl_map.addUsage(node->acl_id);
+
+    auto ephemeral_owner = node->stat.ephemeralOwner;
+    if (ephemeral_owner != 0)
+        store.addEphemeralNode(ephemeral_owner, path);
+
+    if (likely(path != "/"))
+    {
+        auto rslash_pos = path.rfind('/');
+
+        if (unlikely(rslash_pos < 0))
+            throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Can't find parent path for path {}", path);
+
+        auto parent_path = rslash_pos == 0 ? "/" : path.substr(0, rslash_pos);
+
+        // Storage edges in different bucket, according to the bucket index of parent node.
+        // Which allow us to insert child paths for all nodes in parallel.
+        buckets_edges[store.getBucketIndex(parent_path)].emplace_back(std::move(parent_path), path.substr(rslash_pos + 1));
+    }
+
+    bucket_nodes[store.getBucketIndex(path)].emplace_back(std::move(path), std::move(node));
+}
+
+}
+
+void parseBatchDataV2(KeeperStore & store, const SnapshotBatchBodyView & batch, BucketEdges & buckets_edges, BucketNodes & bucket_nodes, SnapshotVersion version)
 {
     for (size_t i = 0; i < batch.size(); i++)
     {
-        const auto & data = batch[i];
+        auto data = batch[i];
 
         String path;
-        ptr<KeeperNode> node;
+        KeeperNodePtr node;
 
         try
         {
@@ -410,39 +724,35 @@ void parseBatchDataV2(KeeperStore & store, SnapshotBatchBody & batch, BucketEdge
         if (version == SnapshotVersion::V0)
             node->acl_id = 0;
 
-        /// Some strange ACLID during deserialization from ZooKeeper
-        if (node->acl_id == std::numeric_limits<uint64_t>::max())
-            node->acl_id = 0;
-
-        store.acl_map.addUsage(node->acl_id);
-
-        auto ephemeral_owner = node->stat.ephemeralOwner;
-        if (ephemeral_owner != 0)
-            store.addEphemeralNode(ephemeral_owner, path);
+        collectNode(store, std::move(path), std::move(node), buckets_edges, bucket_nodes);
+    }
+}
 
-        if (likely(path != "/"))
+void parseBatchCompactData(KeeperStore & store, const SnapshotBatchBodyView & batch, BucketEdges & buckets_edges, BucketNodes & bucket_nodes)
+{
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        try
         {
-            auto rslash_pos = path.rfind('/');
-
-            if (unlikely(rslash_pos < 0))
-                throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Can't find parent path for path {}", path);
-
-            auto parent_path = rslash_pos == 0 ? "/" : path.substr(0, rslash_pos);
-
-            // Storage edges in different bucket, according to the bucket index of parent node.
-            // Which allow us to insert child paths for all nodes in parallel.
-            buckets_edges[store.getBucketIndex(parent_path)].emplace_back(std::move(parent_path), path.substr(rslash_pos + 1));
+            parseKeeperNodesCompact(
+                batch[i],
+                [&](String && path, KeeperNodePtr && node)
+                { collectNode(store, std::move(path), std::move(node), buckets_edges, bucket_nodes); });
+        }
+        catch (const Exception & e)
+        {
+            if (e.code() == ErrorCodes::CORRUPTED_SNAPSHOT)
+                throw;
+            throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Snapshot is corrupted, can't parse compact nodes in batch: {}", e.message());
         }
-
-        bucket_nodes[store.getBucketIndex(path)].emplace_back(std::move(path), std::move(node));
     }
 }
 
-void parseBatchSessionV2(KeeperStore & store, SnapshotBatchBody & batch, SnapshotVersion version)
+void parseBatchSessionV2(KeeperStore & store, const SnapshotBatchBodyView & batch, SnapshotVersion version)
 {
     for (size_t i = 0; i < batch.size(); i++)
     {
-        const String & data = batch[i];
+        auto data = batch[i];
         ReadBufferFromMemory in(data.data(), data.size());
 
         int64_t session_id;
@@ -469,13 +779,13 @@ void parseBatchSessionV2(KeeperStore & store, SnapshotBatchBody & batch, Snapsho
     }
 }
 
-void parseBatchAclMapV2(KeeperStore & store, SnapshotBatchBody & batch, SnapshotVersion version)
+void parseBatchAclMapV2(KeeperStore & store, const SnapshotBatchBodyView & batch, SnapshotVersion version)
 {
     if (version >= SnapshotVersion::V1)
     {
         for (size_t i = 0; i < batch.size(); i++)
         {
-            const String & data = batch[i];
+            auto data = batch[i];
             ReadBufferFromMemory in(data.data(), data.size());
 
             uint64_t acl_id;
@@ -496,12 +806,12 @@ void parseBatchAclMapV2(KeeperStore & store, SnapshotBatchBody & batch, Snapshot
     }
 }
 
-void parseBatchIntMapV2(KeeperStore & store, std::optional<UInt32> & object_count, SnapshotBatchBody & batch, SnapshotVersion /*version*/)
+void parseBatchIntMapV2(KeeperStore & store, std::optional<UInt32> & object_count, const SnapshotBatchBodyView & batch, SnapshotVersion /*version*/)
 {
     IntMap int_map;
     for (size_t i = 0; i < batch.size(); i++)
     {
-        const String & data = batch[i];
+        auto data = batch[i];
         ReadBufferFromMemory in(data.data(), data.size());
 
         String key;
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <functional>
 #include <string>
+#include <string_view>
 
 #include <Common/IO/WriteBufferFromFile.h>
 
@@ -36,21 +38,42 @@ enum class SnapshotVersion : uint8_t
     V0 = 0,
     V1 = 1, /// Add ACL map
     V2 = 2, /// Replace protobuf
+    V3 = 3, /// Checksum of batch is CRC32C instead of CRC32
+    V4 = 4, /// Nodes of a data batch are encoded together in compact format, see serializeKeeperNodesCompact
 
     UNKNOWN = 255,
 };
 
 String toString(SnapshotVersion version);
 
+/// Codec compressing batches of snapshot objects.
+enum class SnapshotCompressionMethod : uint8_t
+{
+    NONE = 0,
+    ZLIB = 1
+};
+
+namespace SnapshotCompressionMethodNS
+{
+    SnapshotCompressionMethod parseSnapshotCompressionMethod(const String & in);
+    String toString(SnapshotCompressionMethod method);
+}
+
+/// Z_BEST_SPEED, snapshot batches are compressed when creating snapshot, speed matters more than ratio.
+static constexpr Int32 DEFAULT_SNAPSHOT_COMPRESSION_LEVEL = 1;
 
-static constexpr auto CURRENT_SNAPSHOT_VERSION = SnapshotVersion::V2;
+
+/// Latest version which can be read and written.
+static constexpr auto CURRENT_SNAPSHOT_VERSION = SnapshotVersion::V4;
+/// Version of created snapshots by default, which servers of former releases can read.
+static constexpr auto DEFAULT_SNAPSHOT_VERSION = SnapshotVersion::V2;
 
 /// Batch data header in a snapshot object file.
 struct SnapshotBatchHeader
 {
     /// The length of the batch data (uncompressed)
     UInt32 data_length;
-    /// The CRC32C of the batch data.
+    /// The CRC32C of the batch data, CRC32 for snapshot before V3.
     /// If compression is enabled, this is the checksum of the compressed data.
     UInt32 data_crc;
     void reset()
@@ -71,7 +94,13 @@ enum class SnapshotBatchType : int
     SNAPSHOT_TYPE_SESSION = 4,
     SNAPSHOT_TYPE_STRINGMAP = 5,
     SNAPSHOT_TYPE_UINTMAP = 6,
-    SNAPSHOT_TYPE_ACLMAP = 7
+    SNAPSHOT_TYPE_ACLMAP = 7,
+    /// Paths of nodes removed since the parent snapshot, only in delta snapshot
+    SNAPSHOT_TYPE_DATA_REMOVED = 8,
+    /// Nodes in compact format, since snapshot V4
+    SNAPSHOT_TYPE_DATA_COMPACT = 9,
+    /// A compressed batch, see compressSnapshotBatch, since snapshot V4
+    SNAPSHOT_TYPE_COMPRESSED = 10
 };
 
 struct SnapshotBatchBody
@@ -79,14 +108,30 @@ struct SnapshotBatchBody
     SnapshotBatchType type;
     std::vector<String> elements;
 
+    /// Nodes of a data batch since snapshot V4, they are encoded as one element when the batch is saved.
+    std::vector<std::pair<String, KeeperNodePtr>> nodes;
+
     void add(const String & element);
     size_t size() const;
+    bool empty() const { return elements.empty() && nodes.empty(); }
     String & operator[](size_t n);
 
     static String serialize(const SnapshotBatchBody & batch_body);
     static ptr<SnapshotBatchBody> parse(const String & data);
 };
 
+/// Batch body parsed in place, elements refer to the data it is parsed from.
+struct SnapshotBatchBodyView
+{
+    SnapshotBatchType type;
+    std::vector<std::string_view> elements;
+
+    size_t size() const { return elements.size(); }
+    std::string_view operator[](size_t n) const { return elements[n]; }
+
+    static SnapshotBatchBodyView parse(std::string_view data);
+};
+
 int openFileForWrite(const String & path);
 int openFileForRead(const String & path);
 
@@ -101,15 +146,40 @@ void writeTailAndClose(ptr<WriteBufferFromFile> & out, UInt32 checksum);
 
 UInt32 updateCheckSum(UInt32 checksum, UInt32 data_crc);
 
-/// Serialize and parse keeper node. Please note that children is ignored for we build parent relationship after load all data.
-String serializeKeeperNode(const String & path, const ptr<KeeperNode> & node, SnapshotVersion version);
-ptr<KeeperNodeWithPath> parseKeeperNode(const String & buf, SnapshotVersion version);
+/// Checksum of batch data in snapshot of the version.
+UInt32 getBatchChecksum(const char * data, size_t length, SnapshotVersion version);
 
+/// Compress a serialized batch, the result is a batch of type SNAPSHOT_TYPE_COMPRESSED:
+/// type (Int32) + compression method (UInt8) + uncompressed size (UInt32) + compressed data.
+String compressSnapshotBatch(std::string_view data, SnapshotCompressionMethod method, Int32 level = DEFAULT_SNAPSHOT_COMPRESSION_LEVEL);
+bool isCompressedSnapshotBatch(std::string_view data);
+String decompressSnapshotBatch(std::string_view data);
 
-/// save batch data in snapshot object
-std::pair<size_t, UInt32> saveBatchV2(ptr<WriteBufferFromFile> & out, ptr<SnapshotBatchBody> & batch);
-std::pair<size_t, UInt32>
-saveBatchAndUpdateCheckSumV2(ptr<WriteBufferFromFile> & out, ptr<SnapshotBatchBody> & batch, UInt32 checksum);
+/// Serialize and parse keeper node. Please note that children is ignored for we build parent relationship after load all data.
+String serializeKeeperNode(const String & path, const KeeperNodePtr & node, SnapshotVersion version);
+ptr<KeeperNodeWithPath> parseKeeperNode(std::string_view buf, SnapshotVersion version);
+
+/// Encode nodes in compact format: nodes are sorted by path, a path is encoded as the length of the prefix it
+/// shares with the previous path and the rest of it, integers are varint encoded and some stats are encoded as
+/// delta to czxid or ctime. There is no framing for every node.
+String serializeKeeperNodesCompact(std::vector<std::pair<String, KeeperNodePtr>> & nodes);
+void parseKeeperNodesCompact(std::string_view buf, const std::function<void(String &&, KeeperNodePtr &&)> & on_node);
+
+
+/// save batch data in snapshot object, the batch is compressed if compression method is not NONE and version >= V4.
+std::pair<size_t, UInt32> saveBatchV2(
+    ptr<WriteBufferFromFile> & out,
+    ptr<SnapshotBatchBody> & batch,
+    SnapshotVersion version,
+    SnapshotCompressionMethod compression_method = SnapshotCompressionMethod::NONE,
+    Int32 compression_level = DEFAULT_SNAPSHOT_COMPRESSION_LEVEL);
+std::pair<size_t, UInt32> saveBatchAndUpdateCheckSumV2(
+    ptr<WriteBufferFromFile> & out,
+    ptr<SnapshotBatchBody> & batch,
+    UInt32 checksum,
+    SnapshotVersion version,
+    SnapshotCompressionMethod compression_method = SnapshotCompressionMethod::NONE,
+    Int32 compression_level = DEFAULT_SNAPSHOT_COMPRESSION_LEVEL);
 
 void serializeAclsV2(const NumToACLMap & acls, String path, UInt32 save_batch_size, SnapshotVersion version);
 
@@ -121,9 +191,10 @@ template <typename T>
 void serializeMapV2(T & snap_map, UInt32 save_batch_size, SnapshotVersion version, String & path);
 
 /// parse snapshot batch
-void parseBatchDataV2(KeeperStore & store, SnapshotBatchBody & batch, BucketEdges & buckets_edges, BucketNodes & bucket_nodes, SnapshotVersion version);
-void parseBatchSessionV2(KeeperStore & store, SnapshotBatchBody & batch, SnapshotVersion version);
-void parseBatchAclMapV2(KeeperStore & store, SnapshotBatchBody & batch, SnapshotVersion version);
-void parseBatchIntMapV2(KeeperStore & store, std::optional<UInt32> & object_count, SnapshotBatchBody & batch, SnapshotVersion version);
+void parseBatchDataV2(KeeperStore & store, const SnapshotBatchBodyView & batch, BucketEdges & buckets_edges, BucketNodes & bucket_nodes, SnapshotVersion version);
+void parseBatchCompactData(KeeperStore & store, const SnapshotBatchBodyView & batch, BucketEdges & buckets_edges, BucketNodes & bucket_nodes);
+void parseBatchSessionV2(KeeperStore & store, const SnapshotBatchBodyView & batch, SnapshotVersion version);
+void parseBatchAclMapV2(KeeperStore & store, const SnapshotBatchBodyView & batch, SnapshotVersion version);
+void parseBatchIntMapV2(KeeperStore & store, std::optional<UInt32> & object_count, const SnapshotBatchBodyView & batch, SnapshotVersion version);
 
 }
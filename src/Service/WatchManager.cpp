@@ -1,3 +1,5 @@
+#include <functional>
+
 #include <Common/IO/Operators.h>
 #include <Common/IO/WriteBufferFromString.h>
 #include <common/logger_useful.h>
@@ -45,23 +47,138 @@ ResponsesForSessions WatchManager::processWatches(const String & path, Coordinat
     }
 }
 
+void WatchManager::registerPersistentWatch(const String & path, int64_t session_id, Coordination::AddWatchMode mode)
+{
+    std::lock_guard lock(watch_mutex);
+    registerPersistentWatchNoLock(path, session_id, mode);
+}
+
+void WatchManager::registerPersistentWatchNoLock(const String & path, int64_t session_id, Coordination::AddWatchMode mode)
+{
+    auto & watch_types = sessions_and_watchers[session_id][path];
+
+    if (mode == Coordination::AddWatchMode::PersistentRecursive)
+    {
+        if (!(watch_types & static_cast<UInt8>(WatchType::PersistentRecursive)))
+            addRecursiveWatch(path, session_id);
+        watch_types |= static_cast<UInt8>(WatchType::PersistentRecursive);
+    }
+    else
+    {
+        persistent_watches[path].emplace(session_id);
+        watch_types |= static_cast<UInt8>(WatchType::Persistent);
+    }
+
+    LOG_TRACE(log, "Register persistent watch path={}, session_id={}, data={}", path, toHexString(session_id), toString(watch_types));
+}
+
+void WatchManager::addRecursiveWatch(const String & path, int64_t session_id)
+{
+    RecursiveWatchNode * node = &recursive_watches;
+    forEachPathComponent(path, [&node](std::string_view component)
+    {
+        auto it = node->children.find(component);
+        if (it == node->children.end())
+            it = node->children.emplace(String(component), std::make_unique<RecursiveWatchNode>()).first;
+        node = it->second.get();
+        return true;
+    });
+
+    if (node->sessions.empty())
+        ++recursive_watch_paths;
+    if (node->sessions.emplace(session_id).second)
+        ++recursive_watches_count;
+}
+
+void WatchManager::removeRecursiveWatch(const String & path, int64_t session_id)
+{
+    std::vector<std::pair<RecursiveWatchNode *, std::string_view>> nodes_path;
+    RecursiveWatchNode * node = &recursive_watches;
+    bool found = forEachPathComponent(path, [&](std::string_view component)
+    {
+        auto it = node->children.find(component);
+        if (it == node->children.end())
+            return false;
+        nodes_path.emplace_back(node, it->first);
+        node = it->second.get();
+        return true;
+    });
+
+    if (!found || !node->sessions.erase(session_id))
+        return;
+
+    --recursive_watches_count;
+    if (node->sessions.empty())
+        --recursive_watch_paths;
+
+    /// Remove trie nodes which neither hold watches nor lead to any watch.
+    for (auto it = nodes_path.rbegin(); it != nodes_path.rend(); ++it)
+    {
+        auto & [parent, name] = *it;
+        auto child = parent->children.find(name);
+        if (!child->second->sessions.empty() || !child->second->children.empty())
+            break;
+        parent->children.erase(child);
+    }
+}
+
+void WatchManager::collectPersistentWatches(const String & path, Coordination::Event event_type, std::unordered_set<int64_t> & sessions) const
+{
+    auto collect = [&sessions](const std::unordered_set<int64_t> & watchers) { sessions.insert(watchers.begin(), watchers.end()); };
+
+    if (auto it = persistent_watches.find(path); it != persistent_watches.end())
+        collect(it->second);
+
+    /// Recursive watches are not notified of children changes, they are notified of the changed child itself.
+    if (event_type == Coordination::Event::CHILD)
+        return;
+
+    const RecursiveWatchNode * node = &recursive_watches;
+    collect(node->sessions);
+    forEachPathComponent(path, [&](std::string_view component)
+    {
+        auto it = node->children.find(component);
+        if (it == node->children.end())
+            return false;
+        node = it->second.get();
+        collect(node->sessions);
+        return true;
+    });
+}
+
 ResponsesForSessions WatchManager::processWatches(const String & path, Coordination::Event event_type)
 {
     std::lock_guard lock(watch_mutex);
+    return processWatchesNoLock(path, event_type, true);
+}
 
-    ResponsesForSessions result;
-    auto it = watches.find(path);
-    if (it != watches.end())
+ResponsesForSessions WatchManager::processWatchesNoLock(const String & path, Coordination::Event event_type, bool trigger_persistent)
+{
+    auto make_watch_response = [](const String & watch_path, Coordination::Event type)
     {
         std::shared_ptr<Coordination::ZooKeeperWatchResponse> watch_response = std::make_shared<Coordination::ZooKeeperWatchResponse>();
-        watch_response->path = path;
+        watch_response->path = watch_path;
         watch_response->xid = Coordination::WATCH_XID;
         watch_response->zxid = -1;
-        watch_response->type = event_type;
+        watch_response->type = type;
         watch_response->state = Coordination::State::CONNECTED;
+        return watch_response;
+    };
+
+    /// A session is notified only once of an event even if it has both one-shot and persistent watches.
+    std::unordered_set<int64_t> persistent_sessions;
+    if (trigger_persistent && event_type != Coordination::Event::CHILD)
+        collectPersistentWatches(path, event_type, persistent_sessions);
+
+    ResponsesForSessions result;
+    auto it = watches.find(path);
+    if (it != watches.end())
+    {
+        auto watch_response = make_watch_response(path, event_type);
         for (auto watcher_session : it->second)
         {
             result.push_back(ResponseForSession{watcher_session, watch_response});
+            persistent_sessions.erase(watcher_session);
             LOG_TRACE(log, "Unregister watch for path={}, session_id={}, data={}", path, toHexString(watcher_session), toString(sessions_and_watchers[watcher_session][path]));
             if ((sessions_and_watchers[watcher_session][path] ^= static_cast<uint8_t>(WatchType::Data)) == 0)
             {
@@ -73,6 +190,13 @@ ResponsesForSessions WatchManager::processWatches(const String & path, Coordinat
 
     }
 
+    if (!persistent_sessions.empty())
+    {
+        auto watch_response = make_watch_response(path, event_type);
+        for (auto watcher_session : persistent_sessions)
+            result.push_back(ResponseForSession{watcher_session, watch_response});
+    }
+
     auto parent_path = getParentPath(path);
 
     Strings paths_to_check_for_list_watches;
@@ -87,25 +211,24 @@ ResponsesForSessions WatchManager::processWatches(const String & path, Coordinat
     }
     /// CHANGED event never trigger list wathes
 
+    /// Persistent watches of parent are notified of children changes.
+    std::unordered_set<int64_t> persistent_parent_sessions;
+    if (trigger_persistent && !paths_to_check_for_list_watches.empty())
+        collectPersistentWatches(parent_path, Coordination::Event::CHILD, persistent_parent_sessions);
+
     for (const auto & path_to_check : paths_to_check_for_list_watches)
     {
         it = list_watches.find(path_to_check);
         if (it != list_watches.end())
         {
-            std::shared_ptr<Coordination::ZooKeeperWatchResponse> watch_list_response
-                = std::make_shared<Coordination::ZooKeeperWatchResponse>();
-            watch_list_response->path = path_to_check;
-            watch_list_response->xid = Coordination::WATCH_XID;
-            watch_list_response->zxid = -1;
-            if (path_to_check == parent_path)
-                watch_list_response->type = Coordination::Event::CHILD;
-            else
-                watch_list_response->type = Coordination::Event::DELETED;
-
-            watch_list_response->state = Coordination::State::CONNECTED;
+            auto watch_list_response = make_watch_response(
+                path_to_check, path_to_check == parent_path ? Coordination::Event::CHILD : Coordination::Event::DELETED);
+
             for (auto watcher_session : it->second)
             {
                 result.push_back(ResponseForSession{watcher_session, watch_list_response});
+                if (path_to_check == parent_path)
+                    persistent_parent_sessions.erase(watcher_session);
                 LOG_TRACE(log, "Unregister watch forlistwatch path={}, session_id={}, data={}", path_to_check, toHexString(watcher_session), toString(sessions_and_watchers[watcher_session][path_to_check]));
                 if ((sessions_and_watchers[watcher_session][path_to_check] ^= static_cast<uint8_t>(WatchType::List)) == 0)
                 {
@@ -117,6 +240,14 @@ ResponsesForSessions WatchManager::processWatches(const String & path, Coordinat
             list_watches.erase(it);
         }
     }
+
+    if (!persistent_parent_sessions.empty())
+    {
+        auto watch_response = make_watch_response(parent_path, Coordination::Event::CHILD);
+        for (auto watcher_session : persistent_parent_sessions)
+            result.push_back(ResponseForSession{watcher_session, watch_response});
+    }
+
     return result;
 }
 
@@ -142,14 +273,14 @@ ResponsesForSessions WatchManager::processRequestSetWatch(
         {
             LOG_TRACE(
                 log, "Trigger data_watches when processing SetWatch operation for session {}, path {}", toHexString(session_id), path);
-            auto watch_responses = processWatches(path, Coordination::Event::DELETED);
+            auto watch_responses = processWatchesNoLock(path, Coordination::Event::DELETED, false);
             responses.insert(responses.end(), watch_responses.begin(), watch_responses.end());
         }
         else if (watch_nodes_info[path].first > request->relative_zxid)
         {
             LOG_TRACE(
                 log, "Trigger data_watches when processing SetWatch operation for session {}, path {}", toHexString(session_id), path);
-            auto watch_responses = processWatches(path, Coordination::Event::CHANGED);
+            auto watch_responses = processWatchesNoLock(path, Coordination::Event::CHANGED, false);
             responses.insert(responses.end(), watch_responses.begin(), watch_responses.end());
         }
     }
@@ -166,7 +297,7 @@ ResponsesForSessions WatchManager::processRequestSetWatch(
         {
             LOG_TRACE(
                 log, "Trigger exist_watches when processing SetWatch operation for session {}, path {}", toHexString(session_id), path);
-            auto watch_responses = processWatches(path, Coordination::Event::CREATED);
+            auto watch_responses = processWatchesNoLock(path, Coordination::Event::CREATED, false);
             responses.insert(responses.end(), watch_responses.begin(), watch_responses.end());
         }
     }
@@ -183,18 +314,24 @@ ResponsesForSessions WatchManager::processRequestSetWatch(
         {
             LOG_TRACE(
                 log, "Trigger list_watches when processing SetWatch operation for session {}, path {}", toHexString(session_id), path);
-            auto watch_responses = processWatches(path, Coordination::Event::DELETED);
+            auto watch_responses = processWatchesNoLock(path, Coordination::Event::DELETED, false);
             responses.insert(responses.end(), watch_responses.begin(), watch_responses.end());
         }
         else if (watch_nodes_info[path].second > request->relative_zxid)
         {
             LOG_TRACE(
                 log, "Trigger list_watches when processing SetWatch operation for session {}, path {}", toHexString(session_id), path);
-            auto watch_responses = processWatches(path, Coordination::Event::CHILD);
+            auto watch_responses = processWatchesNoLock(path, Coordination::Event::CHILD, false);
             responses.insert(responses.end(), watch_responses.begin(), watch_responses.end());
         }
     }
 
+    /// SetWatches2, persistent watches are re-registered but not triggered, the same as ZooKeeper.
+    for (const String & path : request->persistent_watches)
+        registerPersistentWatchNoLock(path, session_id, Coordination::AddWatchMode::Persistent);
+    for (const String & path : request->persistent_recursive_watches)
+        registerPersistentWatchNoLock(path, session_id, Coordination::AddWatchMode::PersistentRecursive);
+
     return responses;
 }
 
@@ -207,8 +344,22 @@ void WatchManager::cleanDeadWatches(int64_t session_id)
 
     if (watches_it != sessions_and_watchers.end())
     {
-        for (const auto & [watch_path, _] : watches_it->second)
+        for (const auto & [watch_path, watch_types] : watches_it->second)
         {
+            if (watch_types & static_cast<UInt8>(WatchType::Persistent))
+            {
+                auto persistent_watch = persistent_watches.find(watch_path);
+                if (persistent_watch != persistent_watches.end())
+                {
+                    persistent_watch->second.erase(session_id);
+                    if (persistent_watch->second.empty())
+                        persistent_watches.erase(persistent_watch);
+                }
+            }
+
+            if (watch_types & static_cast<UInt8>(WatchType::PersistentRecursive))
+                removeRecursiveWatch(watch_path, session_id);
+
             auto watch = watches.find(watch_path);
             if (watch != watches.end())
             {
@@ -253,7 +404,10 @@ uint64_t WatchManager::getTotalWatchesCount() const
     for (const auto & [path, subscribed_sessions] : list_watches)
         ret += subscribed_sessions.size();
 
-    return ret;
+    for (const auto & [path, subscribed_sessions] : persistent_watches)
+        ret += subscribed_sessions.size();
+
+    return ret + recursive_watches_count;
 }
 
 uint64_t WatchManager::getSessionsWithWatchesCount() const
@@ -266,6 +420,17 @@ uint64_t WatchManager::getSessionsWithWatchesCount() const
     for (const auto & [path, subscribed_sessions] : list_watches)
         counter.insert(subscribed_sessions.begin(), subscribed_sessions.end());
 
+    for (const auto & [path, subscribed_sessions] : persistent_watches)
+        counter.insert(subscribed_sessions.begin(), subscribed_sessions.end());
+
+    if (recursive_watches_count)
+    {
+        for (const auto & [session_id, watches_paths] : sessions_and_watchers)
+            for (const auto & [path, watch_types] : watches_paths)
+                if (watch_types & static_cast<UInt8>(WatchType::PersistentRecursive))
+                    counter.insert(session_id);
+    }
+
     return counter.size();
 }
 
@@ -302,6 +467,31 @@ void WatchManager::dumpWatchesByPath(WriteBufferFromOwnString & buf) const
         buf << watch_path << "\n";
         write_int_vec(sessions);
     }
+
+    for (const auto & [watch_path, sessions] : persistent_watches)
+    {
+        buf << watch_path << "\n";
+        write_int_vec(sessions);
+    }
+
+    String watch_path;
+    std::function<void(const RecursiveWatchNode &)> dump_recursive_watches = [&](const RecursiveWatchNode & node)
+    {
+        if (!node.sessions.empty())
+        {
+            buf << (watch_path.empty() ? "/" : watch_path) << "\n";
+            write_int_vec(node.sessions);
+        }
+
+        for (const auto & [name, child] : node.children)
+        {
+            size_t size = watch_path.size();
+            watch_path.append("/").append(name);
+            dump_recursive_watches(*child);
+            watch_path.resize(size);
+        }
+    };
+    dump_recursive_watches(recursive_watches);
 }
 
 void WatchManager::reset()
@@ -309,6 +499,11 @@ void WatchManager::reset()
     std::lock_guard lock(watch_mutex);
     watches.clear();
     list_watches.clear();
+    persistent_watches.clear();
+    recursive_watches.children.clear();
+    recursive_watches.sessions.clear();
+    recursive_watch_paths = 0;
+    recursive_watches_count = 0;
     sessions_and_watchers.clear();
 }
 
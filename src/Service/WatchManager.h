@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -18,6 +19,8 @@ enum class WatchType : UInt8
 {
     List = 1,
     Data = 2,
+    Persistent = 4,
+    PersistentRecursive = 8,
 };
 
 class WatchManager
@@ -29,11 +32,13 @@ public:
     explicit WatchManager() : log(&Poco::Logger::get("WatchManager")) { }
 
     void registerWatches(const String & path, int64_t session_id, Coordination::OpNum opnum);
+    /// Register watch of AddWatch request, it is not removed after triggered.
+    void registerPersistentWatch(const String & path, int64_t session_id, Coordination::AddWatchMode mode);
 
     ResponsesForSessions processWatches(const String & path, Coordination::OpNum opnum);
     ResponsesForSessions processWatches(const String & path, Coordination::Event event_type);
 
-    /// Process request SetWatch from client
+    /// Process request SetWatch and SetWatches2 from client
     ResponsesForSessions processRequestSetWatch(
         const RequestForSession & request_for_session, std::unordered_map<String, std::pair<int64_t, int64_t>> & watch_nodes_info);
 
@@ -42,7 +47,7 @@ public:
     uint64_t getWatchedPathsCount() const
     {
         std::lock_guard lock(watch_mutex);
-        return watches.size() + list_watches.size();
+        return watches.size() + list_watches.size() + persistent_watches.size() + recursive_watch_paths;
     }
 
     uint64_t getTotalWatchesCount() const;
@@ -54,12 +59,43 @@ public:
     void reset();
 
 private:
+    /// Sessions of persistent recursive watches organized by path components, so that finding the watches
+    /// of a path and all its ancestors is O(path depth) rather than O(watches count).
+    struct ComponentHash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view component) const { return std::hash<std::string_view>{}(component); }
+    };
+
+    struct RecursiveWatchNode
+    {
+        std::unordered_set<int64_t> sessions;
+        /// Looked up by std::string_view of path components without building strings.
+        std::unordered_map<String, std::unique_ptr<RecursiveWatchNode>, ComponentHash, std::equal_to<>> children;
+    };
+
+    void registerPersistentWatchNoLock(const String & path, int64_t session_id, Coordination::AddWatchMode mode);
+
+    ResponsesForSessions processWatchesNoLock(const String & path, Coordination::Event event_type, bool trigger_persistent);
+
+    /// Append sessions of persistent watches which should be notified of the event to 'sessions'.
+    void collectPersistentWatches(const String & path, Coordination::Event event_type, std::unordered_set<int64_t> & sessions) const;
+
+    void addRecursiveWatch(const String & path, int64_t session_id);
+    void removeRecursiveWatch(const String & path, int64_t session_id);
+
     /// Session id -> node path
     SessionAndWatcher sessions_and_watchers;
     /// Node path -> session id. Watches for 'get' and 'exist' requests
     Watches watches;
     /// Node path -> session id. Watches for 'list' request (watches on children).
     Watches list_watches;
+    /// Node path -> session id. Persistent watches of AddWatch request.
+    Watches persistent_watches;
+    /// Persistent recursive watches of AddWatch request.
+    RecursiveWatchNode recursive_watches;
+    size_t recursive_watch_paths = 0;
+    size_t recursive_watches_count = 0;
 
     mutable std::mutex watch_mutex;
 
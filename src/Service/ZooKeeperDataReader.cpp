@@ -105,7 +105,7 @@ int64_t deserializeStorageData(KeeperStore & store, ReadBuffer & in, Poco::Logge
 
     while (path != "/")
     {
-        std::shared_ptr<KeeperNode> node = std::make_shared<KeeperNode>();
+        KeeperNodePtr node = KeeperNode::create();
         Coordination::read(node->data, in);
 
         size_t acl_id;
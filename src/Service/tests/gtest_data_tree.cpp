@@ -0,0 +1,595 @@
+#include <algorithm>
+#include <map>
+#include <set>
+#include <thread>
+
+#include <fmt/format.h>
+
+#include <Common/IO/ReadBufferFromString.h>
+#include <gtest/gtest.h>
+
+#include <Service/KeeperNodeChildren.h>
+#include <Service/KeeperNodeTrie.h>
+#include <Service/KeeperStore.h>
+#include <Service/tests/raft_test_common.h>
+#include <ZooKeeper/ZooKeeperIO.h>
+
+using namespace RK;
+
+namespace
+{
+
+using NodeMap = KeeperNodeMap<KeeperNode, KeeperStore::DATA_TREE_BUCKET_NUM>;
+using NodeTrie = KeeperNodeTrie<KeeperNode, KeeperStore::DATA_TREE_BUCKET_NUM>;
+
+}
+
+TEST(DataTree, trieBasicOperations)
+{
+    NodeTrie trie;
+
+    ASSERT_TRUE(trie.emplace("/", KeeperNode::create()));
+    ASSERT_TRUE(trie.emplace("/a", KeeperNode::create()));
+    ASSERT_TRUE(trie.emplace("/a/b", KeeperNode::create()));
+    ASSERT_TRUE(trie.emplace("/a/b/c", KeeperNode::create()));
+    ASSERT_TRUE(trie.emplace("/b/b/b", KeeperNode::create()));
+    ASSERT_EQ(trie.size(), 5);
+
+    /// emplace an existing path assigns value
+    auto node = KeeperNode::create();
+    node->data = "data";
+    ASSERT_FALSE(trie.emplace("/a/b", node));
+    ASSERT_EQ(trie.size(), 5);
+    ASSERT_EQ(trie.get("/a/b")->data, "data");
+
+    /// intermediate components are not nodes
+    ASSERT_EQ(trie.count("/b"), 0);
+    ASSERT_EQ(trie.count("/b/b"), 0);
+    ASSERT_EQ(trie.count("/b/b/b"), 1);
+    ASSERT_EQ(trie.count("/a/b/c/d"), 0);
+    ASSERT_EQ(trie.count("a/b"), 0);
+    ASSERT_EQ(trie.count(""), 0);
+
+    ASSERT_FALSE(trie.erase("/b/b"));
+    ASSERT_TRUE(trie.erase("/a/b"));
+    ASSERT_FALSE(trie.erase("/a/b"));
+    ASSERT_EQ(trie.size(), 4);
+    ASSERT_EQ(trie.count("/a/b/c"), 1);
+
+    ASSERT_TRUE(trie.erase("/b/b/b"));
+    ASSERT_TRUE(trie.emplace("/b/b", KeeperNode::create()));
+    ASSERT_EQ(trie.count("/b/b/b"), 0);
+    ASSERT_EQ(trie.size(), 4);
+
+    trie.clear();
+    ASSERT_EQ(trie.size(), 0);
+    ASSERT_EQ(trie.count("/a"), 0);
+}
+
+TEST(DataTree, trieSameAsMap)
+{
+    auto paths = generateClickHousePaths(100000);
+
+    NodeMap map;
+    NodeTrie trie;
+    fillDataTree(map, paths);
+    fillDataTree(trie, paths);
+    ASSERT_EQ(trie.size(), map.size());
+
+    /// Fill buckets in parallel just like loading snapshot.
+    NodeTrie parallel_trie;
+    {
+        std::vector<Strings> bucket_paths(parallel_trie.getBucketNum());
+        for (const auto & path : paths)
+            bucket_paths[parallel_trie.getBucketIndex(path)].push_back(path);
+
+        const UInt32 threads_count = 4;
+        std::vector<std::thread> threads;
+        for (UInt32 thread_id = 0; thread_id < threads_count; thread_id++)
+            threads.emplace_back(
+                [&, thread_id]
+                {
+                    for (UInt32 bucket_id = thread_id; bucket_id < parallel_trie.getBucketNum(); bucket_id += threads_count)
+                        for (const auto & path : bucket_paths[bucket_id])
+                            parallel_trie.emplace(path, KeeperNode::create(), bucket_id);
+                });
+        for (auto & thread : threads)
+            thread.join();
+    }
+    ASSERT_EQ(parallel_trie.size(), trie.size());
+    for (UInt32 i = 0; i < trie.getBucketNum(); i++)
+        ASSERT_EQ(parallel_trie.getMap(i).size(), trie.getMap(i).size());
+    for (const auto & path : paths)
+        ASSERT_EQ(parallel_trie.count(path), 1);
+
+    /// remove every third node
+    for (size_t i = 0; i < paths.size(); i += 3)
+    {
+        ASSERT_TRUE(map.erase(paths[i]));
+        ASSERT_TRUE(trie.erase(paths[i]));
+    }
+    ASSERT_EQ(trie.size(), map.size());
+
+    std::map<String, KeeperNodePtr> map_nodes;
+    std::map<String, KeeperNodePtr> trie_nodes;
+    for (UInt32 i = 0; i < map.getBucketNum(); i++)
+        map.getMap(i).forEach([&](const String & path, const KeeperNodePtr & value) { map_nodes.emplace(path, value); });
+
+    size_t nodes_in_buckets = 0;
+    for (UInt32 i = 0; i < trie.getBucketNum(); i++)
+    {
+        nodes_in_buckets += trie.getMap(i).size();
+        trie.getMap(i).forEach(
+            [&](const String & path, const KeeperNodePtr & value)
+            {
+                ASSERT_EQ(trie.getBucketIndex(path), i);
+                trie_nodes.emplace(path, value);
+            });
+    }
+
+    ASSERT_EQ(nodes_in_buckets, trie.size());
+    ASSERT_EQ(map_nodes.size(), trie_nodes.size());
+    for (const auto & [path, _] : map_nodes)
+    {
+        ASSERT_TRUE(trie_nodes.contains(path)) << path;
+        ASSERT_EQ(trie.count(path), 1);
+    }
+}
+
+TEST(DataTree, trieInternInnerNames)
+{
+    NodeTrie trie;
+    const auto & components = trie.getComponents();
+
+    ASSERT_TRUE(trie.emplace("/a/replicas/r1", KeeperNode::create()));
+    ASSERT_TRUE(trie.emplace("/b/replicas/r2", KeeperNode::create()));
+    /// 'a', 'b' and 'replicas' are interned, leaves are not.
+    ASSERT_EQ(components.size(), 3);
+
+    /// A leaf is interned when it becomes an inner node and vice versa.
+    ASSERT_TRUE(trie.emplace("/a/replicas/r1/queue", KeeperNode::create()));
+    ASSERT_EQ(components.size(), 4);
+    ASSERT_TRUE(trie.erase("/a/replicas/r1/queue"));
+    ASSERT_EQ(components.size(), 3);
+    ASSERT_EQ(trie.count("/a/replicas/r1"), 1);
+
+    /// Long leaf name is stored out of trie node.
+    String long_path = "/a/replicas/" + String(100, 'x');
+    ASSERT_TRUE(trie.emplace(long_path, KeeperNode::create()));
+    ASSERT_EQ(trie.count(long_path), 1);
+    ASSERT_EQ(components.size(), 3);
+
+    ASSERT_TRUE(trie.erase(long_path));
+    ASSERT_TRUE(trie.erase("/a/replicas/r1"));
+    ASSERT_EQ(components.size(), 2);
+    ASSERT_TRUE(trie.erase("/b/replicas/r2"));
+    ASSERT_EQ(components.size(), 0);
+    ASSERT_EQ(trie.size(), 0);
+}
+
+TEST(DataTree, trieChildTable)
+{
+    NodeTrie trie;
+    std::set<String> expected;
+
+    /// Grow from a dense array to a hash table, then shrink while erasing.
+    const size_t children_count = 1000;
+    for (size_t i = 0; i < children_count; i++)
+    {
+        String path = fmt::format("/p/child-{}", i);
+        ASSERT_TRUE(trie.emplace(path, KeeperNode::create()));
+        expected.insert(path);
+    }
+
+    for (size_t step : {7, 3, 2, 1})
+    {
+        for (size_t i = 0; i < children_count; i += step)
+        {
+            String path = fmt::format("/p/child-{}", i);
+            ASSERT_EQ(trie.erase(path), expected.erase(path) == 1);
+        }
+        ASSERT_EQ(trie.size(), expected.size());
+        for (size_t i = 0; i < children_count; i++)
+        {
+            String path = fmt::format("/p/child-{}", i);
+            ASSERT_EQ(trie.count(path), expected.count(path)) << path;
+        }
+    }
+
+    ASSERT_EQ(trie.size(), 0);
+    for (UInt32 i = 0; i < trie.getBucketNum(); i++)
+        trie.getMap(i).forEach([](const String & path, const KeeperNodePtr &) { FAIL() << path; });
+}
+
+TEST(DataTree, incrementalRehash)
+{
+    KeeperNodeMap<KeeperNode, 1> map;
+    std::map<String, KeeperNodePtr> expected;
+
+    /// Mixed operations across several rounds of rehashing.
+    for (size_t i = 0; i < 200000; i++)
+    {
+        String path = "/node/" + std::to_string(i % 50000);
+        if (i % 5 == 4)
+        {
+            ASSERT_EQ(map.erase(path), expected.erase(path) == 1);
+        }
+        else
+        {
+            auto node = KeeperNode::create();
+            ASSERT_EQ(map.emplace(path, node), expected.insert_or_assign(path, node).second);
+        }
+        ASSERT_EQ(map.size(), expected.size());
+    }
+
+    for (size_t i = 0; i < 100000; i++)
+    {
+        String path = "/grow/" + std::to_string(i);
+        auto node = KeeperNode::create();
+        ASSERT_TRUE(map.emplace(path, node));
+        expected.emplace(path, node);
+        if (i % 1000 == 0)
+        {
+            ASSERT_EQ(map.get(path), node);
+        }
+    }
+
+    ASSERT_EQ(map.size(), expected.size());
+    for (const auto & [path, node] : expected)
+        ASSERT_EQ(map.get(path), node);
+
+    size_t visited = 0;
+    map.getMap(0).forEach(
+        [&](const String & path, const KeeperNodePtr & node)
+        {
+            ASSERT_EQ(expected.at(path), node);
+            visited++;
+        });
+    ASSERT_EQ(visited, expected.size());
+}
+
+TEST(DataTree, nodeChildren)
+{
+    KeeperNodeChildren children;
+    std::set<String> expected;
+
+    ASSERT_TRUE(children.empty());
+    ASSERT_EQ(children.allocatedBytes(), 0);
+
+    /// Random insert and erase, some names are compacted.
+    for (size_t i = 0; i < 100000; i++)
+    {
+        String name = "child-" + std::to_string((i * 7919) % 10000);
+        if (i % 3 == 2)
+            ASSERT_EQ(children.erase(name), expected.erase(name));
+        else
+            ASSERT_EQ(children.insert(name), expected.insert(name).second);
+        ASSERT_EQ(children.size(), expected.size());
+    }
+
+    /// Names are sorted
+    ASSERT_TRUE(std::equal(children.begin(), children.end(), expected.begin(), expected.end()));
+    for (const auto & name : expected)
+        ASSERT_TRUE(children.contains(name));
+    ASSERT_FALSE(children.contains("child-"));
+
+    /// Bulk loading
+    KeeperNodeChildren appended;
+    for (auto it = expected.rbegin(); it != expected.rend(); ++it)
+        appended.append(*it);
+    appended.append(*expected.begin());
+    ASSERT_FALSE(appended.isIndexed());
+    appended.buildIndex();
+    ASSERT_EQ(appended, children);
+
+    auto copied = children;
+    ASSERT_EQ(copied, children);
+    copied.erase(*expected.begin());
+    ASSERT_NE(copied, children);
+}
+
+TEST(DataTree, nodeChildrenSerialized)
+{
+    KeeperNodeChildren children;
+
+    auto parse = [](const std::shared_ptr<const String> & serialized)
+    {
+        ReadBufferFromString in(*serialized);
+        Strings names;
+        Coordination::read(names, in);
+        return names;
+    };
+
+    ASSERT_TRUE(parse(children.getSerialized()).empty());
+
+    for (size_t i = 0; i < 1000; i++)
+        children.insert("node-" + std::to_string(i));
+
+    /// cached until children are modified
+    auto serialized = children.getSerialized();
+    ASSERT_EQ(serialized, children.getSerialized());
+    ASSERT_EQ(parse(serialized), Strings(children.begin(), children.end()));
+
+    children.erase("node-0");
+    ASSERT_NE(serialized, children.getSerialized());
+    ASSERT_EQ(parse(children.getSerialized()).size(), 999);
+
+    serialized = children.getSerialized();
+    children.insert("node-0");
+    ASSERT_NE(serialized, children.getSerialized());
+    ASSERT_EQ(parse(children.getSerialized()), Strings(children.begin(), children.end()));
+}
+
+TEST(DataTree, nodeChildrenShared)
+{
+    /// Base is owned by a node like in data tree.
+    KeeperNodeChildren base_children;
+    auto base = std::shared_ptr<KeeperNodeChildren>(&base_children, [](KeeperNodeChildren *) {});
+    std::set<String> expected;
+    for (size_t i = 0; i < 1000; i++)
+    {
+        base->insert("node-" + std::to_string(i));
+        expected.insert("node-" + std::to_string(i));
+    }
+    KeeperNodeChildren base_copy = *base;
+
+    KeeperNodeChildren children;
+    children.share(base);
+    ASSERT_TRUE(children.isShared());
+    ASSERT_EQ(children, *base);
+
+    /// Erase names of base, insert new names and insert some erased names again.
+    for (size_t i = 0; i < 2000; i += 3)
+    {
+        String name = "node-" + std::to_string(i);
+        ASSERT_EQ(children.erase(name), expected.erase(name));
+    }
+    for (size_t i = 0; i < 2000; i += 2)
+    {
+        String name = "node-" + std::to_string(i);
+        ASSERT_EQ(children.insert(name), expected.insert(name).second);
+    }
+    ASSERT_EQ(children.erase("node-1"), 1);
+    ASSERT_EQ(children.erase("node-1"), 0);
+    expected.erase("node-1");
+
+    ASSERT_EQ(children.size(), expected.size());
+    ASSERT_TRUE(std::equal(children.begin(), children.end(), expected.begin(), expected.end()));
+    for (size_t i = 0; i < 2000; i++)
+    {
+        String name = "node-" + std::to_string(i);
+        ASSERT_EQ(children.contains(name), expected.count(name) == 1);
+    }
+    ASSERT_EQ(*children.getSerialized(), *KeeperNodeChildren(children).getSerialized());
+
+    /// Base is not modified
+    ASSERT_EQ(*base, base_copy);
+
+    /// Copied as base is shared by another copy.
+    auto copied = children;
+    children.unshare();
+    ASSERT_FALSE(children.isShared());
+    ASSERT_EQ(*base, base_copy);
+    ASSERT_TRUE(std::equal(children.begin(), children.end(), expected.begin(), expected.end()));
+
+    /// Moved as nothing else shares base.
+    base.reset();
+    copied.unshare();
+    ASSERT_TRUE(base_children.empty());
+    ASSERT_EQ(copied, children);
+}
+
+TEST(DataTree, memoryUsage)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms, "", 2);
+    KeeperStore::KeeperResponsesQueue responses_queue;
+
+    auto process = [&](const Coordination::ZooKeeperRequestPtr & request)
+    {
+        store.processRequest(responses_queue, {request, 1, 0}, {}, /* check_acl = */ true, /*ignore_response*/ true);
+    };
+
+    setNode(store, "a", "12345");
+    setNode(store, "a/bb", "");
+    setNode(store, "a/bb/ccc", "1234567890");
+    setNode(store, "d", "");
+
+    auto set_request = std::make_shared<Coordination::ZooKeeperSetRequest>();
+    set_request->path = "/a/bb";
+    set_request->data = "123";
+    set_request->version = -1;
+    process(set_request);
+
+    auto remove_request = std::make_shared<Coordination::ZooKeeperRemoveRequest>();
+    remove_request->path = "/d";
+    remove_request->version = -1;
+    process(remove_request);
+
+    const Int64 overhead = KeeperNodeChildren::ENTRY_OVERHEAD_BYTES;
+
+    /// "/", "/a", "/a/bb" and "/a/bb/ccc"
+    auto usage = store.getMemoryUsage();
+    ASSERT_EQ(usage.nodes, 4);
+    ASSERT_EQ(usage.path_bytes, 1 + 2 + 5 + 9);
+    ASSERT_EQ(usage.data_bytes, 5 + 3 + 10);
+    ASSERT_EQ(usage.children_bytes, 1 + 2 + 3 + 3 * overhead);
+    /// Plus hash table of data tree
+    ASSERT_GT(store.getApproximateDataSize(), usage.totalBytes() + store.getACLMap().getACLsBytes());
+
+    auto usage_by_prefix = store.getMemoryUsageByPrefix();
+    ASSERT_EQ(usage_by_prefix.size(), 2);
+    ASSERT_EQ(usage_by_prefix["/a"].nodes, 3);
+    ASSERT_EQ(usage_by_prefix["/a"].data_bytes, 5 + 3 + 10);
+    ASSERT_EQ(usage_by_prefix["/a/bb"].nodes, 2);
+    ASSERT_EQ(usage_by_prefix["/a/bb"].path_bytes, 5 + 9);
+    ASSERT_EQ(usage_by_prefix["/a/bb"].children_bytes, 2 + 3 + 2 * overhead);
+
+    /// Incremental accounting is the same as recalculating.
+    store.rebuildMemoryUsage();
+    auto rebuilt = store.getMemoryUsage();
+    ASSERT_EQ(rebuilt.nodes, usage.nodes);
+    ASSERT_EQ(rebuilt.path_bytes, usage.path_bytes);
+    ASSERT_EQ(rebuilt.data_bytes, usage.data_bytes);
+    ASSERT_EQ(rebuilt.children_bytes, usage.children_bytes);
+
+    auto rebuilt_by_prefix = store.getMemoryUsageByPrefix();
+    ASSERT_EQ(rebuilt_by_prefix.size(), usage_by_prefix.size());
+    for (const auto & [prefix, prefix_usage] : usage_by_prefix)
+        ASSERT_EQ(rebuilt_by_prefix[prefix].totalBytes(), prefix_usage.totalBytes());
+}
+
+TEST(DataTree, removeRecursive)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    KeeperStore::KeeperResponsesQueue responses_queue;
+
+    setNode(store, "t", "");
+    setNode(store, "t/a", "");
+    setNode(store, "t/a/x", "");
+    setNode(store, "t/b", "");
+    auto nodes_count = store.getNodesCount();
+
+    auto exists_request = std::make_shared<Coordination::ZooKeeperExistsRequest>();
+    exists_request->path = "/t/a/x";
+    exists_request->has_watch = true;
+    store.processRequest(responses_queue, {exists_request, 1, 0}, {}, /* check_acl = */ true, /*ignore_response*/ true);
+    ASSERT_EQ(store.getTotalWatchesCount(), 1);
+
+    auto remove_recursive = [&](UInt32 limit, const String & path = "/t")
+    {
+        auto request = std::make_shared<Coordination::ZooKeeperRemoveRecursiveRequest>();
+        request->path = path;
+        request->remove_nodes_limit = limit;
+        store.processRequest(responses_queue, {request, 1, 0}, {}, /* check_acl = */ true, /*ignore_response*/ false);
+
+        std::vector<ResponseForSession> responses;
+        ResponseForSession response;
+        while (responses_queue.tryPop(response))
+            responses.push_back(response);
+        return responses;
+    };
+
+    /// Root can not be removed.
+    auto responses = remove_recursive(1000, "/");
+    ASSERT_EQ(responses.size(), 1);
+    ASSERT_EQ(responses[0].response->error, Coordination::Error::ZBADARGUMENTS);
+
+    /// Subtree is larger than limit, nothing is removed.
+    responses = remove_recursive(1);
+    ASSERT_EQ(responses.size(), 1);
+    ASSERT_EQ(responses[0].response->error, Coordination::Error::ZNOTEMPTY);
+
+    responses = remove_recursive(3);
+    ASSERT_EQ(responses.size(), 1);
+    ASSERT_EQ(responses[0].response->error, Coordination::Error::ZNOTEMPTY);
+    ASSERT_EQ(store.getNodesCount(), nodes_count);
+
+    responses = remove_recursive(4);
+    ASSERT_EQ(responses.size(), 2);
+    auto watch_response = std::dynamic_pointer_cast<Coordination::ZooKeeperWatchResponse>(responses[0].response);
+    ASSERT_TRUE(watch_response);
+    ASSERT_EQ(watch_response->path, "/t/a/x");
+    ASSERT_EQ(watch_response->type, Coordination::Event::DELETED);
+    ASSERT_EQ(responses[1].response->error, Coordination::Error::ZOK);
+
+    ASSERT_EQ(store.getNodesCount(), nodes_count - 4);
+    ASSERT_FALSE(store.exists("/t"));
+    ASSERT_FALSE(store.exists("/t/a/x"));
+    ASSERT_FALSE(store.getNode("/")->children.contains("t"));
+    ASSERT_EQ(store.getTotalWatchesCount(), 0);
+
+    responses = remove_recursive(4);
+    ASSERT_EQ(responses[0].response->error, Coordination::Error::ZNONODE);
+}
+
+/// Multi requests of 100 operations, failed ones are rolled back by the last operation.
+TEST(DataTree, multiRollback)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    KeeperStore::KeeperResponsesQueue responses_queue;
+
+    setNode(store, "m", "v");
+    setNode(store, "m/existing", "");
+    auto nodes_count = store.getNodesCount();
+    auto memory_usage = store.getMemoryUsage().totalBytes();
+    auto stat = store.getNode("/m")->stat;
+
+    auto make_multi = [](bool fail)
+    {
+        Coordination::Requests requests;
+        for (size_t i = 0; i < 33; ++i)
+        {
+            auto create = std::make_shared<Coordination::CreateRequest>();
+            create->path = fmt::format("/m/node-{}", i);
+            requests.push_back(create);
+
+            auto set = std::make_shared<Coordination::SetRequest>();
+            set->path = "/m";
+            set->data = fmt::format("data-{}", i);
+            requests.push_back(set);
+        }
+        auto remove = std::make_shared<Coordination::RemoveRequest>();
+        remove->path = "/m/existing";
+        requests.push_back(remove);
+
+        auto create = std::make_shared<Coordination::CreateRequest>();
+        create->path = fail ? "/m" : "/m/last";
+        requests.push_back(create);
+
+        return std::make_shared<Coordination::ZooKeeperMultiRequest>(requests, Coordination::ACLs{});
+    };
+
+    auto process = [&](const Coordination::ZooKeeperRequestPtr & request)
+    {
+        store.processRequest(responses_queue, {request, 1, 0}, {}, /* check_acl = */ true, /*ignore_response*/ false);
+        ResponseForSession response;
+        EXPECT_TRUE(responses_queue.tryPop(response));
+        /// Error of the last operation
+        return dynamic_cast<const Coordination::ZooKeeperMultiResponse &>(*response.response).responses.back()->error;
+    };
+
+    const size_t multi_count = 100;
+
+    for (size_t i = 0; i < multi_count; ++i)
+        ASSERT_EQ(process(make_multi(true)), Coordination::Error::ZNODEEXISTS);
+
+    auto node = store.getNode("/m");
+    ASSERT_EQ(node->data, "v");
+    ASSERT_EQ(node->stat, stat);
+    ASSERT_EQ(node->children.size(), 1);
+    ASSERT_TRUE(store.exists("/m/existing"));
+    ASSERT_EQ(store.getNodesCount(), nodes_count);
+    ASSERT_EQ(store.getMemoryUsage().totalBytes(), memory_usage);
+
+    ASSERT_EQ(process(make_multi(false)), Coordination::Error::ZOK);
+    ASSERT_EQ(store.getNode("/m")->data, "data-32");
+    ASSERT_EQ(store.getNodesCount(), nodes_count + 33);
+    ASSERT_FALSE(store.exists("/m/existing"));
+
+    /// Removed node is restored when data tree is pinned, it must not be modified in place afterwards.
+    {
+        auto view = store.pinDataTree();
+
+        auto remove = std::make_shared<Coordination::RemoveRequest>();
+        remove->path = "/m/node-0";
+        auto create = std::make_shared<Coordination::CreateRequest>();
+        create->path = "/m";
+        ASSERT_EQ(
+            process(std::make_shared<Coordination::ZooKeeperMultiRequest>(Coordination::Requests{remove, create}, Coordination::ACLs{})),
+            Coordination::Error::ZNODEEXISTS);
+
+        auto set = std::make_shared<Coordination::ZooKeeperSetRequest>();
+        set->path = "/m/node-0";
+        set->data = "new";
+        store.processRequest(responses_queue, {set, 1, 0}, {}, /* check_acl = */ true, /*ignore_response*/ false);
+        ResponseForSession response;
+        ASSERT_TRUE(responses_queue.tryPop(response));
+        ASSERT_EQ(response.response->error, Coordination::Error::ZOK);
+
+        ASSERT_EQ(store.getNode("/m/node-0")->data, "new");
+        ASSERT_EQ(view->getDataTree().get("/m/node-0")->data, "");
+    }
+}
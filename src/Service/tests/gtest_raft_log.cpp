@@ -1,8 +1,16 @@
+#include <algorithm>
+#include <thread>
+
+#include <Poco/DirectoryIterator.h>
 #include <Poco/File.h>
 
+#include <Common/IO/WriteBufferFromFile.h>
+#include <Common/Stopwatch.h>
+#include <common/logger_useful.h>
 #include <gtest/gtest.h>
 #include <libnuraft/nuraft.hxx>
 
+#include <Service/Crc32.h>
 #include <Service/KeeperUtils.h>
 #include <Service/LogEntry.h>
 #include <Service/NuRaftFileLogStore.h>
@@ -36,6 +44,21 @@ TEST(RaftLog, writeAndReadUInt32)
     ASSERT_EQ(x2, y2);
 }
 
+TEST(RaftLog, crc32c)
+{
+    ASSERT_EQ(getCRC32C("123456789", 9), 0xe3069283);
+    ASSERT_EQ(getCRC32CSoftware("123456789", 9), 0xe3069283);
+
+    String data(100000, '\0');
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<char>(i * 31 + i / 7);
+
+    /// Cover every code path of hardware implementation, also unaligned data.
+    for (size_t length : {0, 1, 7, 8, 9, 100, 767, 768, 769, 24575, 24576, 24577, 99990})
+        for (size_t offset : {0, 1, 5})
+            ASSERT_EQ(getCRC32C(data.data() + offset, length), getCRC32CSoftware(data.data() + offset, length));
+}
+
 TEST(RaftLog, serializeStr)
 {
     String str("a string buffer");
@@ -199,6 +222,54 @@ TEST(RaftLog, removeSegment)
     cleanDirectory(log_dir);
 }
 
+TEST(RaftLog, removeSegmentInBackground)
+{
+    String log_dir(LOG_DIR + "/16");
+    cleanDirectory(log_dir);
+    auto log_store = LogSegmentStore::getInstance(log_dir, true, 200);
+    ASSERT_NO_THROW(log_store->init());
+    for (int i = 0; i < 10; i++)
+    {
+        UInt64 term = 1;
+        String key("/ck/table/table1");
+        String data("CREATE TABLE table1;");
+        ASSERT_EQ(appendEntry(log_store, term, key, data), i + 1);
+    }
+
+    auto segments = log_store->getClosedSegments();
+    ASSERT_EQ(segments.size(), 4);
+
+    /// Segments are detached at once, files are deleted in background.
+    ASSERT_EQ(log_store->removeSegment(5), 2);
+    ASSERT_EQ(log_store->firstLogIndex(), 5);
+    ASSERT_FALSE(Poco::File(log_dir + "/" + segments[0]->getFileName()).exists());
+    ASSERT_FALSE(Poco::File(log_dir + "/" + segments[1]->getFileName()).exists());
+
+    log_store->waitBackgroundTasks();
+    ASSERT_EQ(log_store->removingSegmentsCount(), 0);
+    ASSERT_EQ(log_store->removingSegmentsBytes(), 0);
+    ASSERT_FALSE(Poco::File(log_dir + "/" + LogSegmentStore::REMOVED_SEGMENT_FILE_PREFIX + segments[0]->getFileName()).exists());
+    ASSERT_FALSE(Poco::File(log_dir + "/" + LogSegmentStore::REMOVED_SEGMENT_FILE_PREFIX + segments[1]->getFileName()).exists());
+
+    /// Removed file left by last run is deleted when initializing, and is not loaded as segment.
+    String left_file = log_dir + "/" + LogSegmentStore::REMOVED_SEGMENT_FILE_PREFIX + segments[0]->getFileName();
+    {
+        std::ofstream out(left_file);
+        out << String(1024, 'x');
+    }
+    ASSERT_NO_THROW(log_store->close());
+    ASSERT_NO_THROW(log_store->init());
+    ASSERT_EQ(log_store->firstLogIndex(), 5);
+    ASSERT_EQ(log_store->lastLogIndex(), 10);
+
+    log_store->waitBackgroundTasks();
+    ASSERT_FALSE(Poco::File(left_file).exists());
+    ASSERT_EQ(log_store->removingSegmentsCount(), 0);
+
+    ASSERT_NO_THROW(log_store->close());
+    cleanDirectory(log_dir);
+}
+
 TEST(RaftLog, truncateLog)
 {
     String log_dir(LOG_DIR + "/6");
@@ -420,6 +491,462 @@ TEST(RaftLog, getEntries)
     cleanDirectory(log_dir);
 }
 
+TEST(RaftLog, getEntriesInRange)
+{
+    String log_dir(LOG_DIR + "/12");
+    cleanDirectory(log_dir);
+    auto log_store = LogSegmentStore::getInstance(log_dir, true, 1024);
+    ASSERT_NO_THROW(log_store->init());
+
+    String key("/ck/table/table1");
+    for (int i = 0; i < 100; i++)
+    {
+        String data = "CREATE TABLE table" + std::to_string(i + 1) + ";";
+        ASSERT_EQ(appendEntry(log_store, 1, key, data), i + 1);
+    }
+    ASSERT_GT(log_store->getClosedSegments().size(), 2);
+
+    /// Across closed segments, which are mapped, and the open segment.
+    auto entries = log_store->getEntries(3, 100);
+    ASSERT_EQ(entries.size(), 98);
+    for (UInt64 index = 3; index <= 100; index++)
+    {
+        ASSERT_EQ(getZookeeperCreateRequest(entries[index - 3])->data, "CREATE TABLE table" + std::to_string(index) + ";");
+        ASSERT_EQ(entries[index - 3]->get_term(), 1);
+        ASSERT_EQ(log_store->getEntry(index)->get_buf().size(), entries[index - 3]->get_buf().size());
+    }
+
+    /// Limited by bytes, size of an entry is its data length plus term.
+    UInt64 entry_size = entries[0]->get_buf().size() + sizeof(ulong) + sizeof(char);
+    ASSERT_EQ(log_store->getEntries(3, 100, entry_size * 10).size(), 10);
+    ASSERT_EQ(log_store->getEntries(3, 100, entry_size * 10 - 1).size(), 9);
+
+    /// Out of range
+    entries = log_store->getEntries(99, 101);
+    ASSERT_EQ(entries.size(), 3);
+    ASSERT_TRUE(entries[2] == nullptr);
+
+    /// Truncate a mapped closed segment, it is unmapped and reopened.
+    ASSERT_TRUE(log_store->truncateLog(5));
+    ASSERT_EQ(log_store->getEntries(1, 5).size(), 5);
+    String data("CREATE TABLE table6;");
+    ASSERT_EQ(appendEntry(log_store, 2, key, data), 6);
+    ASSERT_EQ(log_store->getEntries(6, 6)[0]->get_term(), 2);
+
+    log_store->close();
+    cleanDirectory(log_dir);
+}
+
+TEST(RaftLog, segmentIndex)
+{
+    String log_dir(LOG_DIR + "/14");
+    cleanDirectory(log_dir);
+    auto log_store = LogSegmentStore::getInstance(log_dir, true, 1024);
+    ASSERT_NO_THROW(log_store->init());
+
+    String key("/ck/table/table1");
+    String data("CREATE TABLE table1;");
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(appendEntry(log_store, 1, key, data), i + 1);
+
+    /// Indexes are written in background after rolling over.
+    log_store->waitBackgroundTasks();
+    auto segments = log_store->getClosedSegments();
+    ASSERT_GT(segments.size(), 3);
+    for (const auto & segment : segments)
+        ASSERT_TRUE(Poco::File(log_dir + "/" + segment->getFileName() + NuRaftLogSegment::INDEX_FILE_SUFFIX).exists());
+
+    /// Break an index file and remove another one, they are loaded by scanning and written again.
+    String broken_index = log_dir + "/" + segments[1]->getFileName() + NuRaftLogSegment::INDEX_FILE_SUFFIX;
+    {
+        std::fstream index_file(broken_index, std::ios::in | std::ios::out | std::ios::binary);
+        index_file.seekp(20);
+        index_file.put('\x7f');
+    }
+    Poco::File(log_dir + "/" + segments[2]->getFileName() + NuRaftLogSegment::INDEX_FILE_SUFFIX).remove();
+
+    ASSERT_NO_THROW(log_store->close());
+    ASSERT_NO_THROW(log_store->init());
+    ASSERT_EQ(log_store->lastLogIndex(), 100);
+    for (UInt64 index = 1; index <= 100; index++)
+        ASSERT_EQ(getZookeeperCreateRequest(log_store->getEntry(index))->data, data);
+    ASSERT_TRUE(Poco::File(log_dir + "/" + segments[2]->getFileName() + NuRaftLogSegment::INDEX_FILE_SUFFIX).exists());
+
+    /// Index is removed with its segment, and when the segment is reopened by truncating.
+    ASSERT_EQ(log_store->removeSegment(segments[1]->firstIndex()), 1);
+    ASSERT_FALSE(Poco::File(log_dir + "/" + segments[0]->getFileName() + NuRaftLogSegment::INDEX_FILE_SUFFIX).exists());
+
+    String closed_index = log_dir + "/" + segments.back()->getFileName() + NuRaftLogSegment::INDEX_FILE_SUFFIX;
+    UInt64 last_index_kept = segments.back()->lastIndex() - 1;
+    ASSERT_TRUE(log_store->truncateLog(last_index_kept));
+    ASSERT_FALSE(Poco::File(closed_index).exists());
+
+    ASSERT_NO_THROW(log_store->close());
+    ASSERT_NO_THROW(log_store->init());
+    ASSERT_EQ(log_store->lastLogIndex(), last_index_kept);
+
+    log_store->close();
+    cleanDirectory(log_dir);
+}
+
+namespace
+{
+
+ptr<log_entry> makeCacheEntry(UInt64 index, size_t size)
+{
+    auto data = buffer::alloc(size);
+    memset(data->data_begin(), static_cast<int>(index % 251), size);
+    return cs_new<log_entry>(index * 10, data, log_val_type::app_log, index * 3, true, static_cast<UInt32>(index * 5), false);
+}
+
+bool isCacheEntry(const ptr<log_entry> & entry, UInt64 index, size_t size)
+{
+    if (!entry || entry->get_term() != index * 10 || entry->get_buf().size() != size)
+        return false;
+    const auto * data = entry->get_buf().data_begin();
+    return std::all_of(data, data + size, [&](auto c) { return c == static_cast<nuraft::byte>(index % 251); });
+}
+
+}
+
+TEST(RaftLog, logEntryCache)
+{
+    /// 1024 slots at least
+    LogEntryCache cache(10000);
+
+    for (UInt64 index = 1; index <= 100; index++)
+        cache.putEntry(index, makeCacheEntry(index, 296));
+
+    /// Bounded by bytes, 10000 / 296 = 33 logs
+    for (UInt64 index = 1; index <= 100; index++)
+        ASSERT_EQ(cache.getEntry(index) != nullptr, index > 67) << index;
+    for (UInt64 index = 68; index <= 100; index++)
+        ASSERT_TRUE(isCacheEntry(cache.getEntry(index), index, 296));
+    ASSERT_EQ(cache.getHits(), 66);
+    ASSERT_EQ(cache.getMisses(), 67);
+
+    /// Timestamp and crc32 are kept
+    auto entry = cache.getEntry(90);
+    ASSERT_EQ(entry->get_timestamp(), 90 * 3);
+    ASSERT_TRUE(entry->has_crc32());
+    ASSERT_EQ(entry->get_crc32(), 90 * 5);
+
+    /// Bounded by slots
+    for (UInt64 index = 101; index <= 3000; index++)
+        cache.putEntry(index, makeCacheEntry(index, 1));
+    ASSERT_TRUE(cache.getEntry(3000 - 1024) == nullptr);
+    ASSERT_TRUE(isCacheEntry(cache.getEntry(3000 - 1023), 3000 - 1023, 1));
+
+    /// Overwrite logs after truncating
+    cache.putEntry(2990, makeCacheEntry(2990 * 7, 20));
+    ASSERT_TRUE(isCacheEntry(cache.getEntry(2990), 2990 * 7, 20));
+    ASSERT_TRUE(cache.getEntry(2989) == nullptr);
+    ASSERT_TRUE(cache.getEntry(2991) == nullptr);
+
+    /// Too large to cache
+    cache.putEntry(2991, makeCacheEntry(2991, 20000));
+    ASSERT_TRUE(cache.getEntry(2990) == nullptr);
+    ASSERT_TRUE(cache.getEntry(2991) == nullptr);
+    cache.putEntry(2992, makeCacheEntry(2992, 5000));
+    cache.putEntry(2993, makeCacheEntry(2993, 4000));
+    cache.putEntry(2994, makeCacheEntry(2994, 3000));
+    ASSERT_TRUE(cache.getEntry(2992) == nullptr);
+    ASSERT_TRUE(isCacheEntry(cache.getEntry(2993), 2993, 4000));
+    ASSERT_TRUE(isCacheEntry(cache.getEntry(2994), 2994, 3000));
+
+    cache.clear();
+    ASSERT_TRUE(cache.getEntry(2994) == nullptr);
+}
+
+/// Readers never get a broken log while the writer keeps overwriting the arena.
+TEST(RaftLog, logEntryCacheConcurrentRead)
+{
+    Poco::Logger * log = &(Poco::Logger::get("RaftLog"));
+
+    LogEntryCache cache(1024 * 1024);
+    const UInt64 count = 1000000;
+    std::atomic<UInt64> last_index = 0;
+    std::atomic<bool> broken = false;
+    std::atomic<UInt64> reads = 0;
+
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < 4; i++)
+        readers.emplace_back(
+            [&]
+            {
+                UInt64 local_reads = 0;
+                while (last_index < count)
+                {
+                    UInt64 index = last_index.load();
+                    for (UInt64 j = index > 1000 ? index - 1000 : 1; j <= index; j += 7)
+                    {
+                        if (auto entry = cache.getEntry(j); entry && !isCacheEntry(entry, j, 64 + j % 512))
+                            broken = true;
+                        local_reads++;
+                    }
+                }
+                reads += local_reads;
+            });
+
+    Stopwatch watch;
+    for (UInt64 index = 1; index <= count; index++)
+    {
+        cache.putEntry(index, makeCacheEntry(index, 64 + index % 512));
+        last_index = index;
+    }
+    UInt64 put_ms = watch.elapsedMilliseconds();
+    for (auto & reader : readers)
+        reader.join();
+
+    ASSERT_FALSE(broken);
+    LOG_INFO(
+        log,
+        "Put {} logs costs {}ms while 4 threads reading {} times, hits {}, misses {}",
+        count,
+        put_ms,
+        reads.load(),
+        cache.getHits(),
+        cache.getMisses());
+}
+
+namespace
+{
+
+/// Size on disk of the open segment file, 0 if not found.
+UInt64 getOpenSegmentFileSize(const String & log_dir)
+{
+    for (Poco::DirectoryIterator it(log_dir), end; it != end; ++it)
+        if (it.name().find("_open_") != String::npos)
+            return it->getSize();
+    return 0;
+}
+
+}
+
+TEST(RaftLog, preallocateSegment)
+{
+    String log_dir(LOG_DIR + "/9");
+    cleanDirectory(log_dir);
+    const UInt32 max_segment_size = 1024;
+    auto log_store = LogSegmentStore::getInstance(log_dir, true, max_segment_size, true);
+    ASSERT_NO_THROW(log_store->init());
+
+    String key("/ck/table/table1");
+    String data("CREATE TABLE table1;");
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(appendEntry(log_store, 1, key, data), i + 1);
+    ASSERT_GT(log_store->getClosedSegments().size(), 1);
+
+    /// Preallocated space of closed segments is released.
+    for (const auto & segment : log_store->getClosedSegments())
+        ASSERT_EQ(Poco::File(log_dir + "/" + segment->getFileName()).getSize(), segment->getFileSize());
+#if defined(OS_LINUX)
+    ASSERT_EQ(getOpenSegmentFileSize(log_dir), max_segment_size);
+#endif
+
+    /// Entries of open segment end before the zeros.
+    ASSERT_NO_THROW(log_store->close());
+    log_store = LogSegmentStore::getInstance(log_dir, true, max_segment_size, true);
+    ASSERT_NO_THROW(log_store->init());
+    ASSERT_EQ(log_store->lastLogIndex(), 100);
+
+    ASSERT_TRUE(log_store->truncateLog(98));
+    ASSERT_EQ(log_store->lastLogIndex(), 98);
+    for (int i = 0; i < 50; i++)
+        ASSERT_EQ(appendEntry(log_store, 1, key, data), i + 99);
+
+    ASSERT_NO_THROW(log_store->close());
+    ASSERT_NO_THROW(log_store->init());
+    ASSERT_EQ(log_store->lastLogIndex(), 148);
+    for (UInt64 index = 1; index <= 148; index++)
+    {
+        auto entry = log_store->getEntry(index);
+        ASSERT_TRUE(entry != nullptr);
+        ASSERT_EQ(getZookeeperCreateRequest(entry)->data, data);
+    }
+
+    log_store->close();
+    cleanDirectory(log_dir);
+}
+
+/// Flushing runs concurrently with appending and rolling over, flushed index never goes back.
+TEST(RaftLog, appendWhileFlushing)
+{
+    Poco::Logger * log = &(Poco::Logger::get("RaftLog"));
+
+    String log_dir(LOG_DIR + "/11");
+    cleanDirectory(log_dir);
+    auto log_store = LogSegmentStore::getInstance(log_dir, true, 64 * 1024);
+    ASSERT_NO_THROW(log_store->init());
+
+    const size_t count = 20000;
+    std::atomic<bool> finished = false;
+    size_t flush_times = 0;
+    UInt64 last_flushed_index = 0;
+
+    std::thread flush_thread(
+        [&]
+        {
+            while (!finished)
+            {
+                UInt64 flushed_index = log_store->flush();
+                ASSERT_GE(flushed_index, last_flushed_index);
+                last_flushed_index = flushed_index;
+                flush_times++;
+            }
+        });
+
+    String key("/ck/table/table1");
+    String data(200, 'a');
+    Stopwatch watch;
+    for (size_t i = 0; i < count; i++)
+        ASSERT_EQ(appendEntry(log_store, 1, key, data), i + 1);
+    UInt64 elapsed_ms = watch.elapsedMilliseconds();
+
+    finished = true;
+    flush_thread.join();
+    ASSERT_EQ(log_store->flush(), count);
+
+    LOG_INFO(log, "Append {} entries costs {}ms while flushing {} times concurrently", count, elapsed_ms, flush_times);
+
+    log_store->close();
+    cleanDirectory(log_dir);
+}
+
+/// Entries written by io_uring, it falls back to pwritev if io_uring is not available, either way the log is the same.
+TEST(RaftLog, ioUringWrite)
+{
+    String log_dir(LOG_DIR + "/18");
+    cleanDirectory(log_dir);
+    auto log_store = LogSegmentStore::getInstance(log_dir, true, 64 * 1024, false, /* io_uring_log_write */ true);
+    ASSERT_NO_THROW(log_store->init());
+
+    const size_t count = 5000;
+    std::atomic<bool> finished = false;
+    UInt64 last_flushed_index = 0;
+
+    std::thread flush_thread(
+        [&]
+        {
+            while (!finished)
+            {
+                UInt64 flushed_index = log_store->flush();
+                ASSERT_GE(flushed_index, last_flushed_index);
+                last_flushed_index = flushed_index;
+            }
+        });
+
+    String key("/ck/table/table1");
+    for (size_t i = 0; i < count; i++)
+    {
+        String data = "CREATE TABLE table" + std::to_string(i + 1) + ";";
+        ASSERT_EQ(appendEntry(log_store, 1, key, data), i + 1);
+        if (i % 10 == 9)
+            log_store->submitWrites();
+
+        /// Read an entry which may not be written yet.
+        if (i % 100 == 99)
+            ASSERT_EQ(getZookeeperCreateRequest(log_store->getEntry(i + 1))->data, data);
+    }
+
+    finished = true;
+    flush_thread.join();
+    ASSERT_EQ(log_store->flush(), count);
+
+    auto entries = log_store->getEntries(1, count);
+    ASSERT_EQ(entries.size(), count);
+    for (size_t i = 0; i < count; i++)
+        ASSERT_EQ(getZookeeperCreateRequest(entries[i])->data, "CREATE TABLE table" + std::to_string(i + 1) + ";");
+
+    /// Truncated entries are overwritten by the ones appended after.
+    ASSERT_TRUE(log_store->truncateLog(count - 10));
+    for (size_t i = count - 10; i < count; i++)
+    {
+        String data("ALTER TABLE table1;");
+        ASSERT_EQ(appendEntry(log_store, 2, key, data), i + 1);
+    }
+    ASSERT_EQ(log_store->flush(), count);
+    log_store->close();
+
+    log_store = LogSegmentStore::getInstance(log_dir, true, 64 * 1024, false, true);
+    ASSERT_NO_THROW(log_store->init());
+    ASSERT_EQ(log_store->lastLogIndex(), count);
+    for (size_t i = 1; i <= count; i++)
+    {
+        auto entry = log_store->getEntry(i);
+        ASSERT_EQ(entry->get_term(), i > count - 10 ? 2 : 1);
+        ASSERT_EQ(
+            getZookeeperCreateRequest(entry)->data, i > count - 10 ? "ALTER TABLE table1;" : "CREATE TABLE table" + std::to_string(i) + ";");
+    }
+
+    log_store->close();
+    cleanDirectory(log_dir);
+}
+
+/// Segments written before V2 are checksummed with CRC32, they are still readable after upgrading.
+TEST(RaftLog, readV1Segment)
+{
+    String log_dir(LOG_DIR + "/17");
+    cleanDirectory(log_dir);
+    Poco::File(log_dir).createDirectories();
+
+    String key("/ck/table/table1");
+    String data("CREATE TABLE table1;");
+    const UInt64 count = 3;
+
+    {
+        WriteBufferFromFile out(log_dir + "/log_1_open_20240101000000");
+        const char magic[8] = {0, 'R', 'a', 'f', 't', 'L', 'o', 'g'};
+        out.write(magic, 8);
+        out.write(static_cast<char>(LogVersion::V1));
+
+        for (UInt64 i = 0; i < count; i++)
+        {
+            auto entry_buf = LogEntryBody::serialize(createLogEntry(1, key, data));
+            const char * entry_data = reinterpret_cast<const char *>(entry_buf->data_begin());
+
+            LogEntryHeader header;
+            header.term = 1;
+            header.index = i + 1;
+            header.data_length = entry_buf->size();
+            header.data_crc = getCRC32(entry_data, header.data_length);
+
+            out.write(reinterpret_cast<const char *>(&header), LogEntryHeader::HEADER_SIZE);
+            out.write(entry_data, header.data_length);
+        }
+        out.sync();
+    }
+
+    auto check_entries = [&](ptr<LogSegmentStore> store)
+    {
+        for (UInt64 i = 0; i < count; i++)
+        {
+            auto entry = store->getEntry(i + 1);
+            ASSERT_TRUE(entry != nullptr);
+            ASSERT_EQ(entry->get_term(), 1);
+            ASSERT_EQ(getZookeeperCreateRequest(entry)->path, key);
+            ASSERT_EQ(getZookeeperCreateRequest(entry)->data, data);
+        }
+    };
+
+    /// Loaded as the open segment, then closed as new entries are appended to a segment of current version.
+    auto log_store = LogSegmentStore::getInstance(log_dir, true);
+    ASSERT_NO_THROW(log_store->init());
+    ASSERT_EQ(log_store->lastLogIndex(), count);
+    check_entries(log_store);
+
+    ASSERT_EQ(appendEntry(log_store, 1, key, data), count + 1);
+    ASSERT_NO_THROW(log_store->close());
+
+    /// Loaded as a closed segment from its index file
+    ASSERT_NO_THROW(log_store->init());
+    ASSERT_EQ(log_store->lastLogIndex(), count + 1);
+    check_entries(log_store);
+
+    log_store->close();
+    cleanDirectory(log_dir);
+}
+
 int main(int argc, char ** argv)
 {
     RK::TestServer app;
@@ -1,13 +1,25 @@
+#include <algorithm>
+#include <numeric>
+
 #include <Poco/File.h>
+#include <fmt/format.h>
 
+#include <Common/MemoryStatisticsOS.h>
 #include <Common/Stopwatch.h>
+#include <Common/ThreadPool.h>
+#include <Common/getNumberOfPhysicalCPUCores.h>
 #include <common/argsToConfig.h>
+#include <common/logger_useful.h>
 #include <gtest/gtest.h>
 #include <libnuraft/nuraft.hxx>
 
+#include <Service/Crc32.h>
+#include <Service/KeeperNodeTrie.h>
+#include <Service/KeeperStore.h>
 #include <Service/KeeperUtils.h>
 #include <Service/NuRaftFileLogStore.h>
 #include <Service/NuRaftStateMachine.h>
+#include <Service/WatchManager.h>
 #include <Service/tests/raft_test_common.h>
 
 using namespace nuraft;
@@ -15,6 +27,57 @@ using namespace RK;
 
 static const UInt32 LOG_COUNT = 10000;
 
+namespace
+{
+
+using NodeMap = KeeperNodeMap<KeeperNode, KeeperStore::DATA_TREE_BUCKET_NUM>;
+using NodeTrie = KeeperNodeTrie<KeeperNode, KeeperStore::DATA_TREE_BUCKET_NUM>;
+
+/// Insert nodes one by one, return latency of every insert in nanoseconds.
+template <typename Map>
+std::vector<UInt64> measureInsertLatency(Map & map, size_t count)
+{
+    std::vector<UInt64> latencies;
+    latencies.reserve(count);
+
+    auto value = KeeperNode::create();
+    for (size_t i = 0; i < count; i++)
+    {
+        String path = "/node/" + std::to_string(i);
+        Stopwatch watch;
+        map.emplace(path, value);
+        latencies.push_back(watch.elapsedNanoseconds());
+    }
+    return latencies;
+}
+
+UInt64 quantile(std::vector<UInt64> values, double level)
+{
+    std::sort(values.begin(), values.end());
+    return values[static_cast<size_t>((values.size() - 1) * level)];
+}
+
+#if defined(OS_LINUX)
+/// Resident memory grows after building the tree. The tree is kept alive when measuring.
+template <typename DataTree>
+Int64 measureResidentMemory(const Strings & paths, size_t & nodes_count, UInt64 & elapsed_ms)
+{
+    MemoryStatisticsOS memory_stat;
+    Int64 before = memory_stat.get().resident;
+
+    Stopwatch watch;
+    auto tree = std::make_unique<DataTree>();
+    fillDataTree(*tree, paths);
+    elapsed_ms = watch.elapsedMilliseconds();
+
+    Int64 after = memory_stat.get().resident;
+    nodes_count = tree->size();
+    return after - before;
+}
+#endif
+
+}
+
 TEST(RaftPerformance, appendLogPerformance)
 {
     Poco::Logger * log = &(Poco::Logger::get("RaftLog"));
@@ -216,3 +279,607 @@ TEST(RaftPerformance, machineCreate)
     cleanDirectory(snap_dir);
     cleanDirectory(log_dir);
 }
+
+/// Read requests are processed by several threads against the same store while write requests are
+/// being applied by another thread, read throughput should scale with the thread count.
+TEST(RaftPerformance, parallelRead)
+{
+    Poco::Logger * log = &(Poco::Logger::get("RaftStateMachine"));
+
+    RaftSettingsPtr setting_ptr = RaftSettings::getDefault();
+    KeeperStore store(setting_ptr->dead_session_check_period_ms);
+
+    const int node_count = 1000;
+    for (int i = 0; i < node_count; i++)
+        setNode(store, std::to_string(i), String(128, 'v'));
+
+    const size_t read_count = 400000;
+    size_t max_threads = std::max(4U, getNumberOfPhysicalCPUCores());
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        ThreadPool thread_pool(threads);
+        std::vector<size_t> processed(threads);
+        std::atomic<bool> reading{true};
+        size_t written = 0;
+        Stopwatch watch;
+
+        /// Write requests are applied by a single thread, just like the request processor.
+        ThreadFromGlobalPool writer(
+            [&]
+            {
+                KeeperStore::KeeperResponsesQueue responses_queue;
+                while (reading)
+                {
+                    auto set_request = cs_new<Coordination::ZooKeeperSetRequest>();
+                    set_request->path = "/" + std::to_string(written % node_count);
+                    set_request->data = String(128, 'w');
+                    store.processRequest(responses_queue, {set_request, 1, 0}, {}, /* check_acl = */ true, /*ignore_response*/ true);
+                    written++;
+                }
+            });
+
+        for (size_t thread = 0; thread < threads; thread++)
+        {
+            thread_pool.scheduleOrThrowOnError(
+                [&, thread]
+                {
+                    KeeperStore::KeeperResponsesQueue responses_queue;
+                    size_t count = 0;
+                    for (size_t i = thread; i < read_count; i += threads)
+                    {
+                        Coordination::ZooKeeperRequestPtr request;
+                        if (i % 2)
+                        {
+                            auto get_request = cs_new<Coordination::ZooKeeperGetRequest>();
+                            get_request->path = "/" + std::to_string(i % node_count);
+                            request = get_request;
+                        }
+                        else
+                        {
+                            auto list_request = cs_new<Coordination::ZooKeeperListRequest>();
+                            list_request->path = "/" + std::to_string(i % node_count);
+                            request = list_request;
+                        }
+                        store.processRequest(responses_queue, {request, 1, 0}, {}, /* check_acl = */ true, /*ignore_response*/ true);
+                        count++;
+                    }
+                    processed[thread] = count;
+                });
+        }
+        thread_pool.wait();
+
+        UInt64 elapsed_ms = std::max<UInt64>(watch.elapsedMilliseconds(), 1);
+        reading = false;
+        writer.join();
+
+        ASSERT_EQ(std::accumulate(processed.begin(), processed.end(), size_t(0)), read_count);
+        LOG_INFO(
+            log,
+            "Parallel read performance: threads {}, count {}, milli second {}, TPS {}, concurrent writes {}",
+            threads,
+            read_count,
+            elapsed_ms,
+            read_count * 1000 / elapsed_ms,
+            written);
+    }
+}
+
+/// Trigger watches of writes with 1M recursive watches registered, cost should not depend on watches count.
+TEST(RaftPerformance, recursiveWatchBenchmark)
+{
+    Poco::Logger * log = &(Poco::Logger::get("WatchManager"));
+
+    const size_t watches_count = 1000000;
+    const size_t writes_count = 100000;
+
+    WatchManager watch_manager;
+
+    Stopwatch watch;
+    for (size_t i = 0; i < watches_count; i++)
+        watch_manager.registerPersistentWatch(
+            fmt::format("/clickhouse/tables/{}/replicas/{}", i % 1000, i / 1000), static_cast<int64_t>(i), Coordination::AddWatchMode::PersistentRecursive);
+    LOG_INFO(log, "Register {} recursive watches costs {}ms", watches_count, watch.elapsedMilliseconds());
+
+    size_t notified_count = 0;
+    watch.restart();
+    for (size_t i = 0; i < writes_count; i++)
+    {
+        auto path = fmt::format("/clickhouse/tables/{}/replicas/{}/queue/queue-{:010}", i % 1000, i % 1000, i);
+        notified_count += watch_manager.processWatches(path, Coordination::OpNum::Set).size();
+    }
+    UInt64 elapsed_us = watch.elapsedMicroseconds();
+
+    ASSERT_EQ(notified_count, writes_count);
+    LOG_INFO(log, "Trigger watches for {} writes costs {}us, {}ns per write", writes_count, elapsed_us, elapsed_us * 1000 / writes_count);
+}
+
+/// Throughput of checksums for log entries and snapshot batches.
+TEST(RaftPerformance, crcBenchmark)
+{
+    Poco::Logger * log = &(Poco::Logger::get("RaftLog"));
+    const size_t rounds = 100;
+    String data(1 << 20, 'x');
+
+    auto measure = [&](const String & name, auto && checksum)
+    {
+        Stopwatch watch;
+        UInt32 result = 0;
+        for (size_t i = 0; i < rounds; ++i)
+            result ^= checksum(data.data(), data.size());
+        UInt64 elapsed_us = std::max<UInt64>(watch.elapsedMicroseconds(), 1);
+        LOG_INFO(log, "{} throughput {} MB/s, result {}", name, rounds * data.size() / elapsed_us, result);
+    };
+
+    measure("CRC32", getCRC32);
+    measure("CRC32C software", getCRC32CSoftware);
+    measure(isHardwareCRC32C() ? "CRC32C hardware" : "CRC32C", getCRC32C);
+}
+
+/// Reading entries of closed segments entry by entry and in range, like a lagging follower catching up.
+TEST(RaftPerformance, readEntriesBenchmark)
+{
+    Poco::Logger * log = &(Poco::Logger::get("RaftLog"));
+
+    String log_dir(LOG_DIR + "/13");
+    cleanDirectory(log_dir);
+    auto log_store = LogSegmentStore::getInstance(log_dir, true, 1024 * 1024);
+    ASSERT_NO_THROW(log_store->init());
+
+    const UInt64 count = 100000;
+    String key("/ck/table/table1");
+    String data(200, 'a');
+    for (UInt64 i = 0; i < count; i++)
+        appendEntry(log_store, 1, key, data);
+
+    Stopwatch watch;
+    for (UInt64 index = 1; index <= count; index++)
+        ASSERT_TRUE(log_store->getEntry(index) != nullptr);
+    UInt64 one_by_one_ms = watch.elapsedMilliseconds();
+
+    watch.restart();
+    const UInt64 batch = 1000;
+    for (UInt64 index = 1; index <= count; index += batch)
+        ASSERT_EQ(log_store->getEntries(index, index + batch - 1).size(), batch);
+    UInt64 in_range_ms = watch.elapsedMilliseconds();
+
+    LOG_INFO(log, "Read {} entries one by one costs {}ms, in range of {} costs {}ms", count, one_by_one_ms, batch, in_range_ms);
+
+    log_store->close();
+    cleanDirectory(log_dir);
+}
+
+/// Loading closed segments with index files and by scanning entries.
+TEST(RaftPerformance, loadSegmentsBenchmark)
+{
+    Poco::Logger * log = &(Poco::Logger::get("RaftLog"));
+
+    String log_dir(LOG_DIR + "/15");
+    cleanDirectory(log_dir);
+    auto log_store = LogSegmentStore::getInstance(log_dir, true, 4 * 1024 * 1024);
+    ASSERT_NO_THROW(log_store->init());
+
+    const UInt64 count = 200000;
+    String key("/ck/table/table1");
+    String data(100, 'a');
+    for (UInt64 i = 0; i < count; i++)
+        appendEntry(log_store, 1, key, data);
+    ASSERT_NO_THROW(log_store->close());
+
+    Stopwatch watch;
+    ASSERT_NO_THROW(log_store->init());
+    UInt64 with_index_ms = watch.elapsedMilliseconds();
+    ASSERT_EQ(log_store->lastLogIndex(), count);
+    ASSERT_NO_THROW(log_store->close());
+
+    std::vector<String> files;
+    Poco::File(log_dir).list(files);
+    for (const auto & file : files)
+        if (file.ends_with(NuRaftLogSegment::INDEX_FILE_SUFFIX))
+            Poco::File(log_dir + "/" + file).remove();
+
+    watch.restart();
+    ASSERT_NO_THROW(log_store->init());
+    UInt64 scanning_ms = watch.elapsedMilliseconds();
+    ASSERT_EQ(log_store->lastLogIndex(), count);
+
+    LOG_INFO(log, "Load {} entries with index files costs {}ms, by scanning costs {}ms", count, with_index_ms, scanning_ms);
+
+    log_store->close();
+    cleanDirectory(log_dir);
+}
+
+/// Latency of appending across many segment rollovers, with and without preparing the next segment.
+TEST(RaftPerformance, rolloverLatencyBenchmark)
+{
+    Poco::Logger * log = &(Poco::Logger::get("RaftLog"));
+
+    for (bool preallocate : {false, true})
+    {
+        String log_dir(LOG_DIR + "/10");
+        cleanDirectory(log_dir);
+        auto log_store = LogSegmentStore::getInstance(log_dir, true, 64 * 1024, preallocate);
+        ASSERT_NO_THROW(log_store->init());
+
+        String key("/ck/table/table1");
+        String data(200, 'a');
+        const size_t count = 20000;
+        std::vector<UInt64> latencies;
+        latencies.reserve(count);
+
+        Stopwatch watch;
+        for (size_t i = 0; i < count; i++)
+        {
+            Stopwatch append_watch;
+            appendEntry(log_store, 1, key, data);
+            log_store->flush();
+            latencies.push_back(append_watch.elapsedMicroseconds());
+        }
+        UInt64 elapsed_ms = watch.elapsedMilliseconds();
+
+        std::sort(latencies.begin(), latencies.end());
+        LOG_INFO(
+            log,
+            "Append {} entries across {} segments with preallocate {} costs {}ms, latency p50 {}us p99 {}us p999 {}us max {}us",
+            count,
+            log_store->getClosedSegments().size() + 1,
+            preallocate,
+            elapsed_ms,
+            latencies[count / 2],
+            latencies[count * 99 / 100],
+            latencies[count * 999 / 1000],
+            latencies.back());
+
+        log_store->close();
+        cleanDirectory(log_dir);
+    }
+}
+
+#if defined(OS_LINUX)
+TEST(RaftPerformance, memoryBenchmark)
+{
+    Poco::Logger * log = &(Poco::Logger::get("DataTree"));
+
+    const size_t nodes_count = 1000000;
+    auto paths = generateClickHousePaths(nodes_count);
+
+    size_t total_path_bytes = 0;
+    for (const auto & path : paths)
+        total_path_bytes += path.size();
+
+    /// Measure trie first, memory freed by it may be reused by the map which is in favor of the map.
+    size_t trie_nodes_count;
+    UInt64 trie_elapsed_ms;
+    Int64 trie_memory = measureResidentMemory<NodeTrie>(paths, trie_nodes_count, trie_elapsed_ms);
+
+    size_t map_nodes_count;
+    UInt64 map_elapsed_ms;
+    Int64 map_memory = measureResidentMemory<NodeMap>(paths, map_nodes_count, map_elapsed_ms);
+
+    ASSERT_EQ(trie_nodes_count, nodes_count);
+    ASSERT_EQ(map_nodes_count, nodes_count);
+
+    LOG_INFO(
+        log,
+        "Data tree memory benchmark, nodes {}, total path bytes {}, map resident memory {} bytes ({} bytes/node, {}ms), "
+        "trie resident memory {} bytes ({} bytes/node, {}ms)",
+        nodes_count,
+        total_path_bytes,
+        map_memory,
+        map_memory / static_cast<Int64>(nodes_count),
+        map_elapsed_ms,
+        trie_memory,
+        trie_memory / static_cast<Int64>(nodes_count),
+        trie_elapsed_ms);
+}
+#endif
+
+/// Grow a data tree from 0 and record latency of every insert, the tail latency of
+/// every window should be flat, no window should pay for rehashing a whole bucket.
+TEST(RaftPerformance, insertTailLatency)
+{
+    Poco::Logger * log = &(Poco::Logger::get("DataTree"));
+
+    const size_t nodes_count = 5000000;
+    const size_t window_size = 500000;
+
+    using PlainMap = std::unordered_map<String, KeeperNodePtr>;
+    auto measure = [&](auto & map, const String & name)
+    {
+        auto latencies = measureInsertLatency(map, nodes_count);
+        for (size_t begin = 0; begin < latencies.size(); begin += window_size)
+        {
+            std::vector<UInt64> window(latencies.begin() + begin, latencies.begin() + std::min(begin + window_size, latencies.size()));
+            LOG_INFO(
+                log,
+                "{} insert latency, nodes [{}, {}), p99 {}ns, p999 {}ns, max {}ns",
+                name,
+                begin,
+                begin + window.size(),
+                quantile(window, 0.99),
+                quantile(window, 0.999),
+                *std::max_element(window.begin(), window.end()));
+        }
+        return *std::max_element(latencies.begin(), latencies.end());
+    };
+
+    UInt64 max_latency;
+    {
+        KeeperNodeMap<KeeperNode, KeeperStore::DATA_TREE_BUCKET_NUM> map;
+        max_latency = measure(map, "KeeperNodeMap");
+        ASSERT_EQ(map.size(), nodes_count);
+    }
+
+    UInt64 plain_max_latency;
+    {
+        PlainMap map;
+        plain_max_latency = measure(map, "unordered_map");
+    }
+
+    LOG_INFO(log, "Max insert latency, KeeperNodeMap {}ns, unordered_map {}ns", max_latency, plain_max_latency);
+}
+
+/// Create and remove nodes just like a data tree under churn, with a small value for every node.
+/// Build with KEEPER_NODE_SLAB_ALLOCATOR to compare slab allocation with malloc.
+TEST(RaftPerformance, nodeAllocationBenchmark)
+{
+    Poco::Logger * log = &(Poco::Logger::get("DataTree"));
+
+    const size_t nodes_count = 1000000;
+    const size_t rounds = 5;
+    const String value(16, 'v');
+
+    Strings paths;
+    paths.reserve(nodes_count);
+    for (size_t i = 0; i < nodes_count; i++)
+        paths.emplace_back("/node/" + std::to_string(i));
+
+#if defined(OS_LINUX)
+    MemoryStatisticsOS memory_stat;
+    Int64 memory_before = memory_stat.get().resident;
+#endif
+
+    auto map = std::make_unique<NodeMap>();
+    Stopwatch watch;
+    for (const auto & path : paths)
+    {
+        auto node = KeeperNode::create();
+        node->data = value;
+        map->emplace(path, std::move(node));
+    }
+    UInt64 create_ns = watch.elapsedNanoseconds();
+
+#if defined(OS_LINUX)
+    Int64 memory_after = memory_stat.get().resident;
+    LOG_INFO(
+        log,
+        "Create {} nodes, {}ns/node, resident memory {} bytes/node",
+        nodes_count,
+        create_ns / nodes_count,
+        (memory_after - memory_before) / static_cast<Int64>(nodes_count));
+#else
+    LOG_INFO(log, "Create {} nodes, {}ns/node", nodes_count, create_ns / nodes_count);
+#endif
+
+    /// Remove and create every other node, freed memory is reused.
+    UInt64 remove_ns = 0;
+    create_ns = 0;
+    for (size_t round = 0; round < rounds; round++)
+    {
+        watch.restart();
+        for (size_t i = round % 2; i < nodes_count; i += 2)
+            ASSERT_TRUE(map->erase(paths[i]));
+        remove_ns += watch.elapsedNanoseconds();
+
+        watch.restart();
+        for (size_t i = round % 2; i < nodes_count; i += 2)
+        {
+            auto node = KeeperNode::create();
+            node->data = value;
+            map->emplace(paths[i], std::move(node));
+        }
+        create_ns += watch.elapsedNanoseconds();
+    }
+    ASSERT_EQ(map->size(), nodes_count);
+
+    size_t churn_count = rounds * nodes_count / 2;
+    LOG_INFO(log, "Churn {} nodes, remove {}ns/node, create {}ns/node", churn_count, remove_ns / churn_count, create_ns / churn_count);
+
+#if defined(OS_LINUX)
+    LOG_INFO(
+        log,
+        "After churn resident memory {} bytes/node",
+        (memory_stat.get().resident - memory_before) / static_cast<Int64>(nodes_count));
+#endif
+
+#ifdef KEEPER_NODE_SLAB_ALLOCATOR
+    auto [used_bytes, allocated_bytes] = KeeperNode::slabStatistics();
+    LOG_INFO(log, "Slab allocator used {} bytes, allocated {} bytes", used_bytes, allocated_bytes);
+    ASSERT_GE(used_bytes, nodes_count * sizeof(KeeperNode));
+#endif
+}
+
+/// List a parent with 100k children, the first list serializes children, the following ones hit the cache.
+TEST(RaftPerformance, listPerformance)
+{
+    Poco::Logger * log = &(Poco::Logger::get("DataTree"));
+
+    const size_t children_count = 100000;
+    const size_t list_count = 100;
+
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    setNode(store, "log", "");
+
+    auto parent = store.getNodeForUpdate("/log");
+    for (size_t i = 0; i < children_count; i++)
+        parent->children.insert(fmt::format("log-{:010}", i));
+
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    auto list = [&]()
+    {
+        auto request = std::make_shared<Coordination::ZooKeeperListRequest>();
+        request->path = "/log";
+        store.processRequest(responses_queue, {request, 1, 0}, {}, /* check_acl = */ true, /*ignore_response*/ false);
+
+        ResponseForSession response;
+        ASSERT_TRUE(responses_queue.tryPop(response));
+        ASSERT_EQ(response.response->error, Coordination::Error::ZOK);
+
+        WriteBufferFromOwnString out;
+        response.response->write(out);
+    };
+
+    Stopwatch watch;
+    list();
+    UInt64 first_us = watch.elapsedMicroseconds();
+
+    watch.restart();
+    for (size_t i = 0; i < list_count; i++)
+        list();
+    UInt64 cached_us = watch.elapsedMicroseconds() / list_count;
+
+    LOG_INFO(log, "List {} children, first list {}us, cached list {}us", children_count, first_us, cached_us);
+}
+
+/// Create a child under a parent with 1M children while data tree is pinned for snapshot, children of the
+/// parent are shared rather than copied to the copy-on-write node.
+TEST(RaftPerformance, createUnderPinnedParent)
+{
+    Poco::Logger * log = &(Poco::Logger::get("RaftPerformance"));
+
+    const size_t children_count = 1000000;
+
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    setNode(store, "log", "");
+
+    auto parent = store.getNodeForUpdate("/log");
+    for (size_t i = 0; i < children_count; i++)
+        parent->children.insert(fmt::format("log-{:010}", i));
+
+    Stopwatch watch;
+    auto parent_copy = parent->clone();
+    UInt64 copy_us = watch.elapsedMicroseconds();
+
+    auto view = store.pinDataTree();
+
+    watch.restart();
+    setNode(store, "log/new", "");
+    UInt64 create_us = watch.elapsedMicroseconds();
+
+    LOG_INFO(log, "Create under a pinned parent of {} children {}us, copying children {}us", children_count, create_us, copy_us);
+    ASSERT_LT(create_us, copy_us);
+
+    /// Pinned parent is not changed, store sees the new child.
+    ASSERT_EQ(parent->children.size(), children_count);
+    ASSERT_FALSE(parent->children.contains("new"));
+    ASSERT_EQ(store.getNode("/log")->children.size(), children_count + 1);
+    ASSERT_TRUE(store.getNode("/log")->children.contains("new"));
+    ASSERT_TRUE(store.exists("/log/new"));
+
+    /// Merged to data tree after unpinned.
+    view.reset();
+    parent.reset();
+    store.pinDataTree().reset();
+    auto merged = store.getNode("/log");
+    ASSERT_FALSE(merged->children.isShared());
+    ASSERT_EQ(merged->children.size(), children_count + 1);
+    parent_copy->children.insert("new");
+    ASSERT_EQ(merged->children, parent_copy->children);
+}
+
+/// Multi requests of 100 operations, failed ones are rolled back by the last operation.
+TEST(RaftPerformance, multiRollbackBenchmark)
+{
+    Poco::Logger * log = &(Poco::Logger::get("RaftPerformance"));
+
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    KeeperStore::KeeperResponsesQueue responses_queue;
+
+    setNode(store, "m", "v");
+    setNode(store, "m/existing", "");
+    auto nodes_count = store.getNodesCount();
+    auto memory_usage = store.getMemoryUsage().totalBytes();
+    auto stat = store.getNode("/m")->stat;
+
+    auto make_multi = [](bool fail, bool fail_first = false)
+    {
+        Coordination::Requests requests;
+        if (fail_first)
+        {
+            auto create = std::make_shared<Coordination::CreateRequest>();
+            create->path = "/m";
+            requests.push_back(create);
+        }
+        for (size_t i = 0; i < 33; ++i)
+        {
+            auto create = std::make_shared<Coordination::CreateRequest>();
+            create->path = fmt::format("/m/node-{}", i);
+            requests.push_back(create);
+
+            auto set = std::make_shared<Coordination::SetRequest>();
+            set->path = "/m";
+            set->data = fmt::format("data-{}", i);
+            requests.push_back(set);
+        }
+        auto remove = std::make_shared<Coordination::RemoveRequest>();
+        remove->path = "/m/existing";
+        requests.push_back(remove);
+
+        auto create = std::make_shared<Coordination::CreateRequest>();
+        create->path = fail ? "/m" : "/m/last";
+        requests.push_back(create);
+
+        return std::make_shared<Coordination::ZooKeeperMultiRequest>(requests, Coordination::ACLs{});
+    };
+
+    auto process = [&](const Coordination::ZooKeeperRequestPtr & request)
+    {
+        store.processRequest(responses_queue, {request, 1, 0}, {}, /* check_acl = */ true, /*ignore_response*/ false);
+        ResponseForSession response;
+        EXPECT_TRUE(responses_queue.tryPop(response));
+        /// Error of the last operation
+        return dynamic_cast<const Coordination::ZooKeeperMultiResponse &>(*response.response).responses.back()->error;
+    };
+
+    const size_t multi_count = 10000;
+
+    /// Requests are built out of timing and reused. The baseline fails at the first operation,
+    /// so nothing is applied or rolled back.
+    auto baseline_multi = make_multi(true, true);
+    auto failed_multi = make_multi(true);
+
+    Stopwatch watch;
+    for (size_t i = 0; i < multi_count; ++i)
+        ASSERT_EQ(process(baseline_multi), Coordination::Error::ZRUNTIMEINCONSISTENCY);
+    UInt64 baseline_ns = watch.elapsedNanoseconds();
+
+    watch.restart();
+    for (size_t i = 0; i < multi_count; ++i)
+        ASSERT_EQ(process(failed_multi), Coordination::Error::ZNODEEXISTS);
+    UInt64 failed_ns = watch.elapsedNanoseconds();
+
+    LOG_INFO(
+        log,
+        "Process {} multi requests, failed at the first operation {}ns/request, failed at the last operation {}ns/request, "
+        "applying and rolling back costs {}ns/request",
+        multi_count,
+        baseline_ns / multi_count,
+        failed_ns / multi_count,
+        (failed_ns - std::min(failed_ns, baseline_ns)) / multi_count);
+
+    auto node = store.getNode("/m");
+    ASSERT_EQ(node->data, "v");
+    ASSERT_EQ(node->stat, stat);
+    ASSERT_EQ(node->children.size(), 1);
+    ASSERT_TRUE(store.exists("/m/existing"));
+    ASSERT_EQ(store.getNodesCount(), nodes_count);
+    ASSERT_EQ(store.getMemoryUsage().totalBytes(), memory_usage);
+
+    ASSERT_EQ(process(make_multi(false)), Coordination::Error::ZOK);
+    ASSERT_EQ(store.getNode("/m")->data, "data-32");
+    ASSERT_EQ(store.getNodesCount(), nodes_count + 33);
+    ASSERT_FALSE(store.exists("/m/existing"));
+}
@@ -1,5 +1,11 @@
+#include <cstring>
+#include <limits>
+#include <map>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <Common/IO/ReadBufferFromFile.h>
+#include <Common/IO/ReadHelpers.h>
 #include <Service/ACLMap.h>
 #include <Service/KeeperStore.h>
 #include <Service/KeeperCommon.h>
@@ -320,7 +326,7 @@ void assertStateMachineEquals(KeeperStore & storage, KeeperStore & ano_storage)
 TEST(RaftSnapshot, parseAndSerializeKeeperNode)
 {
     String path = "/parseAndSerializeKeeperNode";
-    ptr<KeeperNode> node = cs_new<KeeperNode>();
+    KeeperNodePtr node = KeeperNode::create();
     node->data = "some_data";
     node->acl_id = 0;
     node->is_ephemeral = true;
@@ -351,6 +357,120 @@ TEST(RaftSnapshot, parseAndSerializeKeeperNode)
     test(SnapshotVersion::V0);
     test(SnapshotVersion::V1);
     test(SnapshotVersion::V2);
+    test(SnapshotVersion::V3);
+}
+
+TEST(RaftSnapshot, parseAndSerializeKeeperNodesCompact)
+{
+    std::vector<std::pair<String, KeeperNodePtr>> nodes;
+    for (const auto & path : {"/b/c", "/a", "/", "/b", "/a/b/c", "/ab"})
+    {
+        KeeperNodePtr node = KeeperNode::create();
+        node->data = String("data_of_") + path;
+        node->acl_id = nodes.size() % 2 ? std::numeric_limits<uint64_t>::max() - 1 : 0;
+        node->is_ephemeral = nodes.size() % 2;
+        node->is_sequential = nodes.size() % 3;
+        node->stat.czxid = 100 + nodes.size();
+        node->stat.mzxid = 1000;
+        node->stat.pzxid = 50; /// less than czxid
+        node->stat.ctime = 1700000000000;
+        node->stat.mtime = 1600000000000; /// less than ctime
+        node->stat.version = -1;
+        node->stat.cversion = 3;
+        node->stat.aversion = 4;
+        node->stat.ephemeralOwner = node->is_ephemeral ? 0x7fffffffffffffff : 0;
+        node->stat.dataLength = node->data.size();
+        node->stat.numChildren = 2;
+        nodes.emplace_back(path, node);
+    }
+
+    auto expected = nodes;
+    String buf = serializeKeeperNodesCompact(nodes);
+
+    std::map<String, KeeperNodePtr> parsed;
+    std::vector<String> parsed_paths;
+    parseKeeperNodesCompact(
+        buf,
+        [&](String && path, KeeperNodePtr && node)
+        {
+            parsed_paths.push_back(path);
+            parsed.emplace(std::move(path), std::move(node));
+        });
+
+    /// Nodes are sorted by path
+    ASSERT_TRUE(std::is_sorted(parsed_paths.begin(), parsed_paths.end()));
+    ASSERT_EQ(parsed.size(), expected.size());
+    for (const auto & [path, node] : expected)
+    {
+        ASSERT_TRUE(parsed.contains(path));
+        auto & parsed_node = parsed.at(path);
+        parsed_node->children = node->children;
+        ASSERT_EQ(*parsed_node, *node);
+        ASSERT_TRUE(parsed_node->stat == node->stat);
+    }
+
+    /// Truncated nodes
+    ASSERT_ANY_THROW(parseKeeperNodesCompact(std::string_view(buf.data(), buf.size() - 1), [](String &&, KeeperNodePtr &&) {}));
+}
+
+TEST(RaftSnapshot, parseBatchBodyView)
+{
+    SnapshotBatchBody batch;
+    batch.type = SnapshotBatchType::SNAPSHOT_TYPE_SESSION;
+    batch.add("element_1");
+    batch.add("");
+    batch.add(String(1000, 'x'));
+
+    String data = SnapshotBatchBody::serialize(batch);
+    auto view = SnapshotBatchBodyView::parse(data);
+    ASSERT_EQ(view.type, SnapshotBatchType::SNAPSHOT_TYPE_SESSION);
+    ASSERT_EQ(view.size(), 3);
+    for (size_t i = 0; i < view.size(); i++)
+        ASSERT_EQ(view[i], batch[i]);
+
+    /// Elements refer to the parsed data
+    ASSERT_EQ(view[2].data(), data.data() + data.size() - 1000);
+
+    /// Truncated batch
+    ASSERT_ANY_THROW(SnapshotBatchBodyView::parse(std::string_view(data.data(), data.size() - 1)));
+}
+
+TEST(RaftSnapshot, compressSnapshotBatch)
+{
+    SnapshotBatchBody batch;
+    batch.type = SnapshotBatchType::SNAPSHOT_TYPE_DATA;
+    for (int i = 0; i < 1000; i++)
+        batch.add("/clickhouse/tables/table_" + std::to_string(i));
+
+    String data = SnapshotBatchBody::serialize(batch);
+    ASSERT_FALSE(isCompressedSnapshotBatch(data));
+
+    String compressed = compressSnapshotBatch(data, SnapshotCompressionMethod::ZLIB);
+    ASSERT_TRUE(isCompressedSnapshotBatch(compressed));
+    ASSERT_LT(compressed.size(), data.size());
+    ASSERT_EQ(decompressSnapshotBatch(compressed), data);
+
+    /// Truncated compressed data
+    ASSERT_ANY_THROW(decompressSnapshotBatch(std::string_view(compressed.data(), compressed.size() / 2)));
+
+    /// Trailing bytes after compressed data
+    ASSERT_ANY_THROW(decompressSnapshotBatch(compressed + "trailing"));
+
+    /// Uncompressed size in header is impossible for the compressed data
+    String inflated_size = compressed;
+    UInt32 uncompressed_size = std::numeric_limits<UInt32>::max();
+    memcpy(inflated_size.data() + sizeof(Int32) + sizeof(UInt8), &uncompressed_size, sizeof(uncompressed_size));
+    ASSERT_ANY_THROW(decompressSnapshotBatch(inflated_size));
+
+    /// Uncompressed size in header is smaller than the real one
+    String shrunk_size = compressed;
+    uncompressed_size = static_cast<UInt32>(data.size() - 1);
+    memcpy(shrunk_size.data() + sizeof(Int32) + sizeof(UInt8), &uncompressed_size, sizeof(uncompressed_size));
+    ASSERT_ANY_THROW(decompressSnapshotBatch(shrunk_size));
+
+    /// Batch compressed with another level
+    String compressed_best = compressSnapshotBatch(data, SnapshotCompressionMethod::ZLIB, 9);
+    ASSERT_EQ(decompressSnapshotBatch(compressed_best), data);
 }
 
 TEST(RaftSnapshot, createSnapshot_1)
@@ -371,6 +491,47 @@ TEST(RaftSnapshot, createSnapshot_1)
     cleanDirectory(snap_dir);
 }
 
+TEST(RaftSnapshot, createSnapshotInConfiguredVersion)
+{
+    String snap_dir(SNAP_DIR + "/2");
+    cleanDirectory(snap_dir);
+
+    /// Servers of former releases can read snapshots created by default.
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    ASSERT_EQ(raft_settings->snapshot_version, SnapshotVersion::V2);
+
+    KeeperStore storage(raft_settings->dead_session_check_period_ms);
+    for (int i = 0; i < 10; i++)
+        setNode(storage, std::to_string(i), "table_" + std::to_string(i));
+
+    for (auto version : {SnapshotVersion::V2, SnapshotVersion::V3, SnapshotVersion::V4})
+    {
+        KeeperSnapshotManager snap_mgr(
+            snap_dir, 3, 10, 0, SnapshotCompressionMethod::NONE, 0, DEFAULT_SNAPSHOT_COMPRESSION_LEVEL, version);
+        ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+        snapshot meta(static_cast<UInt64>(version), 1, config);
+        snap_mgr.createSnapshot(meta, storage);
+
+        /// Every object starts with header magic and version.
+        auto snapshot_store = snap_mgr.getSnapshots().rbegin()->second;
+        for (const auto & [obj_id, obj_path] : snapshot_store->getObjectPaths())
+        {
+            ReadBufferFromFile in(obj_path);
+            String magic(MAGIC_SNAPSHOT_HEAD.size(), '\0');
+            in.readStrict(magic.data(), magic.size());
+            ASSERT_EQ(magic, MAGIC_SNAPSHOT_HEAD);
+            UInt8 object_version;
+            readIntBinary(object_version, in);
+            ASSERT_EQ(object_version, static_cast<UInt8>(version));
+        }
+
+        KeeperStore loaded(raft_settings->dead_session_check_period_ms);
+        ASSERT_TRUE(snap_mgr.parseSnapshot(meta, loaded));
+        ASSERT_EQ(loaded.getNodesCount(), storage.getNodesCount());
+    }
+    cleanDirectory(snap_dir);
+}
+
 TEST(RaftSnapshot, createSnapshot_2)
 {
     String snap_dir(SNAP_DIR + "/2");
@@ -395,6 +556,85 @@ TEST(RaftSnapshot, createSnapshot_2)
     cleanDirectory(snap_dir);
 }
 
+TEST(RaftSnapshot, pinDataTree)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+
+    /// system nodes
+    size_t base_nodes = store.getNodesCount();
+    size_t base_children = store.getNode("/")->children.size();
+
+    for (int i = 0; i < 100; i++)
+        setNode(store, std::to_string(i), "v" + std::to_string(i));
+
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    auto process = [&](const Coordination::ZooKeeperRequestPtr & request)
+    {
+        int64_t time = std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
+        store.processRequest(responses_queue, {request, 1, time}, {}, /* check_acl = */ true, /*ignore_response*/ true);
+    };
+
+    auto view = store.pinDataTree();
+    ASSERT_EQ(view->size(), base_nodes + 100);
+
+    /// modify data tree when it is pinned
+    for (int i = 0; i < 10; i++)
+    {
+        auto request = cs_new<Coordination::ZooKeeperSetRequest>();
+        request->path = "/" + std::to_string(i);
+        request->data = "new_v" + std::to_string(i);
+        process(request);
+    }
+    for (int i = 10; i < 20; i++)
+    {
+        auto request = cs_new<Coordination::ZooKeeperRemoveRequest>();
+        request->path = "/" + std::to_string(i);
+        process(request);
+    }
+    for (int i = 100; i < 130; i++)
+        setNode(store, std::to_string(i), "v" + std::to_string(i));
+
+    /// view is not changed
+    std::unordered_map<String, KeeperNodePtr> pinned_nodes;
+    for (UInt32 i = 0; i < view->getDataTree().getBucketNum(); i++)
+        view->getDataTree().getMap(i).forEach([&](const String & path, const KeeperNodePtr & node) { pinned_nodes.emplace(path, node); });
+
+    ASSERT_EQ(pinned_nodes.size(), base_nodes + 100);
+    ASSERT_EQ(pinned_nodes.at("/")->children.size(), base_children + 100);
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(pinned_nodes.at("/" + std::to_string(i))->data, "v" + std::to_string(i));
+
+    /// store sees the latest data
+    auto check_store = [&]()
+    {
+        ASSERT_EQ(store.getNodesCount(), base_nodes + 120);
+        ASSERT_EQ(store.getNode("/")->children.size(), base_children + 120);
+        for (int i = 0; i < 10; i++)
+            ASSERT_EQ(store.getNode("/" + std::to_string(i))->data, "new_v" + std::to_string(i));
+        for (int i = 10; i < 20; i++)
+            ASSERT_FALSE(store.exists("/" + std::to_string(i)));
+        for (int i = 20; i < 130; i++)
+            ASSERT_EQ(store.getNode("/" + std::to_string(i))->data, "v" + std::to_string(i));
+    };
+    check_store();
+
+    /// Unpin and merge copy-on-write nodes when processing requests.
+    view.reset();
+    for (int i = 0; i < 20; i++)
+    {
+        auto request = cs_new<Coordination::ZooKeeperGetRequest>();
+        request->path = "/" + std::to_string(i);
+        process(request);
+    }
+
+    check_store();
+    ASSERT_EQ(store.getDataTree().size(), base_nodes + 120);
+
+    view = store.pinDataTree();
+    ASSERT_EQ(view->size(), base_nodes + 120);
+}
+
 TEST(RaftSnapshot, readAndSaveSnapshot)
 {
     String snap_read_dir(SNAP_DIR + "/3");
@@ -453,21 +693,21 @@ void compareKeeperStore(KeeperStore & store, KeeperStore & new_store, bool compa
     for (UInt32 i = 0; i < store.getDataTreeBucketNum(); i++)
     {
         auto & inner_map = store.getDataTree().getMap(i);
-        for (auto it = inner_map.getMap().begin(); it != inner_map.getMap().end(); it++)
+        inner_map.forEach([&](const String & path, const KeeperNodePtr & node)
         {
-            auto new_node = new_store.getNode(it->first);
+            auto new_node = new_store.getNode(path);
             ASSERT_TRUE(new_node != nullptr);
-            ASSERT_EQ(new_node->data, it->second->data);
+            ASSERT_EQ(new_node->data, node->data);
             if (compare_acl)
             {
-                ASSERT_EQ(new_node->acl_id, it->second->acl_id);
+                ASSERT_EQ(new_node->acl_id, node->acl_id);
             }
 
-            ASSERT_EQ(new_node->is_ephemeral, it->second->is_ephemeral) << "Ephemeral not equals for path " << it->first;
-            ASSERT_EQ(new_node->is_sequential, it->second->is_sequential);
-            ASSERT_EQ(new_node->stat, it->second->stat);
-            ASSERT_EQ(new_node->children, it->second->children);
-        }
+            ASSERT_EQ(new_node->is_ephemeral, node->is_ephemeral) << "Ephemeral not equals for path " << path;
+            ASSERT_EQ(new_node->is_sequential, node->is_sequential);
+            ASSERT_EQ(new_node->stat, node->stat);
+            ASSERT_EQ(new_node->children, node->children);
+        });
     }
     ASSERT_EQ(new_store.getNode("/1020/test112")->data, "test211");
 
@@ -546,12 +786,156 @@ void compareKeeperStore(KeeperStore & store, KeeperStore & new_store, bool compa
     ASSERT_TRUE(true) << "compare ACLs.";
 }
 
-void parseSnapshot(const SnapshotVersion version1, const SnapshotVersion version2)
+TEST(RaftSnapshot, readAndSaveSnapshotInChunks)
+{
+    String snap_read_dir(SNAP_DIR + "/8");
+    String snap_save_dir(SNAP_DIR + "/9");
+    cleanDirectory(snap_read_dir);
+    cleanDirectory(snap_save_dir);
+
+    /// Objects are sent in chunks of 1000 bytes
+    KeeperSnapshotManager snap_mgr_read(snap_read_dir, 3, 100, 0, SnapshotCompressionMethod::NONE, 1000);
+    KeeperSnapshotManager snap_mgr_save(snap_save_dir, 3, 100);
+
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    for (int i = 0; i < 1024; i++)
+    {
+        String key = std::to_string(i + 1);
+        setNode(store, key, "table_" + key);
+    }
+
+    snapshot meta(1024, 1, config);
+    snap_mgr_read.createSnapshot(meta, store, store.getZxid(), store.getSessionIDCounter());
+
+    /// The first object tells the chunk size
+    ptr<buffer> chain_data = snap_mgr_read.serializeSnapshotChain(meta);
+    ASSERT_TRUE(chain_data);
+    snap_mgr_save.receiveSnapshotMeta(meta, chain_data.get());
+    ASSERT_TRUE(snap_mgr_save.isReceivingInChunks());
+
+    ulong transfer_id = snap_mgr_save.getNextTransferId(meta);
+    ASSERT_EQ(transfer_id, 1);
+
+    std::mutex snapshot_mutex;
+    size_t chunk_count = 0;
+    bool corrupted = false;
+    bool resumed = false;
+    while (true)
+    {
+        ptr<buffer> chunk;
+        bool is_last = snap_mgr_read.loadSnapshotChunk(meta, transfer_id, chunk);
+        ASSERT_LE(chunk->size(), 1000 + 1);
+        chunk_count++;
+
+        /// Corrupt a chunk of object 1 once, the object is received again
+        if (!corrupted && (transfer_id & 0xFFFFFFFF) == 1 && chunk->size() > 100)
+        {
+            corrupted = true;
+            chunk->data_begin()[100] ^= 0xFF;
+        }
+
+        ulong next_transfer_id = snap_mgr_save.saveSnapshotChunk(meta, transfer_id, *chunk, is_last, snapshot_mutex);
+        if (is_last)
+            break;
+
+        /// Receive the snapshot again, chunks received are skipped
+        if (!resumed && chunk_count == 20)
+        {
+            resumed = true;
+            snap_mgr_save.receiveSnapshotMeta(meta, chain_data.get());
+            ASSERT_EQ(snap_mgr_save.getNextTransferId(meta), next_transfer_id);
+        }
+        transfer_id = next_transfer_id;
+    }
+    ASSERT_TRUE(corrupted);
+    ASSERT_TRUE(resumed);
+
+    /// No partially received object is left
+    for (const auto & entry : std::filesystem::directory_iterator(snap_save_dir))
+        ASSERT_FALSE(entry.path().filename().string().starts_with(KeeperSnapshotStore::RECEIVING_OBJECT_PREFIX));
+
+    KeeperStore new_store(raft_settings->dead_session_check_period_ms);
+    ASSERT_TRUE(snap_mgr_save.parseSnapshot(meta, new_store));
+    ASSERT_EQ(new_store.getNodesCount(), store.getNodesCount());
+    for (int i = 0; i < 1024; i++)
+    {
+        String key = std::to_string(i + 1);
+        ASSERT_EQ(new_store.getNode("/" + key)->data, "table_" + key);
+    }
+
+    cleanDirectory(snap_read_dir);
+    cleanDirectory(snap_save_dir);
+}
+
+TEST(RaftSnapshot, saveCorruptedSnapshotChunks)
+{
+    String snap_read_dir(SNAP_DIR + "/8");
+    String snap_save_dir(SNAP_DIR + "/9");
+    cleanDirectory(snap_read_dir);
+    cleanDirectory(snap_save_dir);
+
+    KeeperSnapshotManager snap_mgr_read(snap_read_dir, 3, 100, 0, SnapshotCompressionMethod::NONE, 1000);
+    KeeperSnapshotManager snap_mgr_save(snap_save_dir, 3, 100);
+
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    for (int i = 0; i < 1024; i++)
+    {
+        String key = std::to_string(i + 1);
+        setNode(store, key, "table_" + key);
+    }
+
+    snapshot meta(1024, 1, config);
+    snap_mgr_read.createSnapshot(meta, store, store.getZxid(), store.getSessionIDCounter());
+
+    ptr<buffer> chain_data = snap_mgr_read.serializeSnapshotChain(meta);
+    snap_mgr_save.receiveSnapshotMeta(meta, chain_data.get());
+
+    /// Object 1 is always corrupted, it is received again until installing the snapshot is given up
+    std::mutex snapshot_mutex;
+    auto receive_corrupted_object = [&]
+    {
+        ulong transfer_id = KeeperSnapshotManager::getTransferId(1, 0);
+        while (true)
+        {
+            ptr<buffer> chunk;
+            bool is_last = snap_mgr_read.loadSnapshotChunk(meta, transfer_id, chunk);
+            if (transfer_id == KeeperSnapshotManager::getTransferId(1, 0))
+                chunk->data_begin()[chunk->size() - 1] ^= 0xFF;
+
+            ulong next_transfer_id = snap_mgr_save.saveSnapshotChunk(meta, transfer_id, *chunk, is_last, snapshot_mutex);
+            if (next_transfer_id == KeeperSnapshotManager::getTransferId(1, 0))
+                return;
+            ASSERT_EQ(next_transfer_id & 0xFFFFFFFF, 1);
+            transfer_id = next_transfer_id;
+        }
+    };
+
+    for (size_t i = 0; i < KeeperSnapshotManager::MAX_CORRUPTED_OBJECT_RETRIES; i++)
+        receive_corrupted_object();
+    ASSERT_THROW(receive_corrupted_object(), RK::Exception);
+    ASSERT_FALSE(snap_mgr_save.existSnapshotObject(meta, 1));
+
+    /// Retries are counted again when the snapshot is received again
+    snap_mgr_save.receiveSnapshotMeta(meta, chain_data.get());
+    receive_corrupted_object();
+
+    cleanDirectory(snap_read_dir);
+    cleanDirectory(snap_save_dir);
+}
+
+void parseSnapshot(
+    const SnapshotVersion version1,
+    const SnapshotVersion version2,
+    SnapshotCompressionMethod compression_method = SnapshotCompressionMethod::NONE)
 {
     String snap_dir(SNAP_DIR + "/5");
     cleanDirectory(snap_dir);
 
-    KeeperSnapshotManager snap_mgr(snap_dir, 3, 100);
+    KeeperSnapshotManager snap_mgr(snap_dir, 3, 100, 0, compression_method);
     ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
 
     RaftSettingsPtr raft_settings(RaftSettings::getDefault());
@@ -676,6 +1060,24 @@ TEST(RaftSnapshot, parseSnapshot)
 
     parseSnapshot(SnapshotVersion::V2, SnapshotVersion::V1);
     sleep(1);
+
+    parseSnapshot(SnapshotVersion::V2, SnapshotVersion::V3);
+    sleep(1);
+
+    parseSnapshot(SnapshotVersion::V3, SnapshotVersion::V2);
+    sleep(1);
+
+    parseSnapshot(SnapshotVersion::V3, SnapshotVersion::V4);
+    sleep(1);
+
+    parseSnapshot(SnapshotVersion::V4, SnapshotVersion::V3);
+    sleep(1);
+
+    parseSnapshot(SnapshotVersion::V3, SnapshotVersion::V4, SnapshotCompressionMethod::ZLIB);
+    sleep(1);
+
+    parseSnapshot(SnapshotVersion::V4, SnapshotVersion::V4, SnapshotCompressionMethod::ZLIB);
+    sleep(1);
 }
 
 TEST(RaftSnapshot, parseIncompleteSnapshot)
@@ -911,6 +1313,141 @@ void createSnapshotWithFuzzyLog(bool async_snapshot)
     cleanDirectory(log_dir);
 }
 
+TEST(RaftSnapshot, createAndParseDeltaSnapshot)
+{
+    String snap_dir(SNAP_DIR + "/7");
+    cleanDirectory(snap_dir);
+
+    KeeperSnapshotManager snap_mgr(snap_dir, 3, 100, /* max_delta_snapshots */ 2);
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    store.enableDirtyPathsTracking();
+
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    auto process = [&](const Coordination::ZooKeeperRequestPtr & request)
+    {
+        int64_t time = std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
+        store.processRequest(responses_queue, {request, 1, time}, {}, /* check_acl = */ true, /*ignore_response*/ true);
+    };
+    auto set_data = [&](const String & path, const String & data)
+    {
+        auto request = cs_new<Coordination::ZooKeeperSetRequest>();
+        request->path = path;
+        request->data = data;
+        process(request);
+    };
+    auto remove_node = [&](const String & path)
+    {
+        auto request = cs_new<Coordination::ZooKeeperRemoveRequest>();
+        request->path = path;
+        process(request);
+    };
+
+    /// Compare store loaded from snapshot chain with the store
+    auto check_snapshot = [&](const snapshot & meta)
+    {
+        KeeperStore new_store(raft_settings->dead_session_check_period_ms);
+        snap_mgr.parseSnapshot(meta, new_store);
+
+        ASSERT_EQ(new_store.getNodesCount(), store.getNodesCount());
+        ASSERT_EQ(new_store.getTotalEphemeralNodesCount(), store.getTotalEphemeralNodesCount());
+        ASSERT_EQ(new_store.getSessionCount(), store.getSessionCount());
+        ASSERT_EQ(new_store.getZxid(), store.getZxid());
+
+        for (UInt32 i = 0; i < store.getDataTree().getBucketNum(); i++)
+        {
+            store.getDataTree().getMap(i).forEach(
+                [&](const String & path, const KeeperNodePtr & node)
+                {
+                    auto new_node = new_store.getNode(path);
+                    ASSERT_TRUE(new_node) << path;
+                    ASSERT_EQ(new_node->data, node->data);
+                    ASSERT_EQ(new_node->stat.version, node->stat.version);
+                    ASSERT_EQ(new_node->stat.mzxid, node->stat.mzxid);
+                    ASSERT_EQ(new_node->stat.ephemeralOwner, node->stat.ephemeralOwner);
+                    ASSERT_EQ(new_node->children.size(), node->children.size());
+                });
+        }
+    };
+
+    for (int i = 0; i < 1024; i++)
+        setNode(store, std::to_string(i), "v" + std::to_string(i));
+    setNode(store, "0/child", "child");
+
+    /// 1. The first snapshot is a full one
+    snapshot meta_1(1, 1, config);
+    snap_mgr.createSnapshot(meta_1, store, store.getZxid(), store.getSessionIDCounter());
+    ASSERT_FALSE(snap_mgr.getSnapshots().at(getSnapshotStoreMapKey(meta_1))->isDelta());
+
+    /// 2. Delta snapshot with changed, removed and created nodes
+    for (int i = 1; i <= 10; i++)
+        set_data("/" + std::to_string(i), "new_v" + std::to_string(i));
+    for (int i = 20; i < 30; i++)
+        remove_node("/" + std::to_string(i));
+    remove_node("/0/child");
+    for (int i = 2000; i < 2250; i++)
+        setNode(store, std::to_string(i), "v" + std::to_string(i));
+    setNode(store, "ephemeral", "e", true, 2);
+
+    snapshot meta_2(2, 1, config);
+    snap_mgr.createSnapshot(meta_2, store, store.getZxid(), store.getSessionIDCounter());
+    ASSERT_TRUE(snap_mgr.getSnapshots().at(getSnapshotStoreMapKey(meta_2))->isDelta());
+    check_snapshot(meta_2);
+
+    /// 3. Delta snapshot on delta snapshot
+    remove_node("/0");
+    set_data("/500", "new_v500");
+
+    snapshot meta_3(3, 1, config);
+    snap_mgr.createSnapshot(meta_3, store, store.getZxid(), store.getSessionIDCounter());
+    ASSERT_TRUE(snap_mgr.getSnapshots().at(getSnapshotStoreMapKey(meta_3))->isDelta());
+    ASSERT_EQ(snap_mgr.getSnapshotChain(meta_3).size(), 3);
+    check_snapshot(meta_3);
+
+    /// 4. Full snapshot for there are max_delta_snapshots delta snapshots
+    snapshot meta_4(4, 1, config);
+    snap_mgr.createSnapshot(meta_4, store, store.getZxid(), store.getSessionIDCounter());
+    ASSERT_FALSE(snap_mgr.getSnapshots().at(getSnapshotStoreMapKey(meta_4))->isDelta());
+    check_snapshot(meta_4);
+
+    /// Snapshot chain is rebuilt from file names
+    KeeperSnapshotManager new_snap_mgr(snap_dir, 3, 100, 2);
+    ASSERT_EQ(new_snap_mgr.loadSnapshotMetas(), 4);
+    ASSERT_EQ(new_snap_mgr.getSnapshotChain(meta_3).size(), 3);
+
+    /// Snapshots which delta snapshots are based on are not removed
+    ASSERT_EQ(snap_mgr.removeSnapshots(), 3);
+    ASSERT_TRUE(snap_mgr.existSnapshot(meta_1));
+    ASSERT_TRUE(snap_mgr.existSnapshot(meta_2));
+    ASSERT_FALSE(snap_mgr.existSnapshot(meta_3));
+
+    cleanDirectory(snap_dir);
+}
+
+TEST(RaftSnapshot, dirtyPathsNotTrackedWithoutDeltaSnapshot)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+
+    store.takeDirtyPaths(1, 1);
+    setNode(store, "1", "v1");
+
+    auto dirty_paths = store.takeDirtyPaths(2, 1);
+    ASSERT_TRUE(dirty_paths.overflow);
+    ASSERT_TRUE(dirty_paths.paths.empty());
+
+    store.enableDirtyPathsTracking();
+    store.takeDirtyPaths(3, 1);
+    setNode(store, "2", "v2");
+
+    dirty_paths = store.takeDirtyPaths(4, 1);
+    ASSERT_FALSE(dirty_paths.overflow);
+    ASSERT_EQ(dirty_paths.base_log_term, 3);
+    ASSERT_TRUE(dirty_paths.paths.contains("/2"));
+}
+
 TEST(RaftSnapshot, createSnapshotWithFuzzyLog)
 {
     createSnapshotWithFuzzyLog(true);
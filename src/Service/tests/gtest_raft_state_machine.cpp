@@ -1,3 +1,6 @@
+#include <bit>
+#include <cstring>
+#include <limits>
 #include <Service/KeeperStore.h>
 #include <Service/NuRaftFileLogStore.h>
 #include <Service/NuRaftStateMachine.h>
@@ -121,6 +124,170 @@ TEST(RaftStateMachine, modifyEntry)
 }
 
 
+TEST(RaftStateMachine, commitBatchEntry)
+{
+    auto * log = &(Poco::Logger::get("Test_RaftStateMachine"));
+    String snap_dir(SNAP_DIR + "/batch");
+    String log_dir(LOG_DIR + "/batch");
+
+    cleanDirectory(snap_dir);
+    cleanDirectory(log_dir);
+
+    KeeperResponsesQueue queue;
+    RaftSettingsPtr setting_ptr = RaftSettings::getDefault();
+
+    std::mutex new_session_id_callback_mutex;
+    std::unordered_map<int64_t, ptr<std::condition_variable>> new_session_id_callback;
+
+    NuRaftStateMachine machine(queue, setting_ptr, snap_dir, log_dir, 10, 3, new_session_id_callback_mutex, new_session_id_callback);
+    int64_t session_id = machine.getStore().getSessionID(30000);
+
+    const size_t batch_size = 1000;
+    RequestsForSessions batch;
+    size_t single_entries_bytes = 0;
+    for (size_t i = 0; i < batch_size; i++)
+    {
+        auto request = cs_new<ZooKeeperCreateRequest>();
+        request->path = "/batch_" + std::to_string(i);
+        request->data = "data";
+        request->xid = static_cast<XID>(i);
+        batch.emplace_back(request, session_id, 1);
+        single_entries_bytes += serializeKeeperRequest(batch.back())->size();
+    }
+
+    /// Single request entry is still accepted.
+    ptr<buffer> single_buf = serializeKeeperRequest(batch[0]);
+    ASSERT_FALSE(isBatchEntry(*single_buf));
+    auto single = deserializeKeeperRequests(*single_buf);
+    ASSERT_EQ(single.size(), 1);
+    ASSERT_EQ(single[0]->request->xid, 0);
+
+    ptr<buffer> buf = serializeKeeperRequests(batch);
+    LOG_INFO(log, "{} requests take {} bytes in one entry, {} bytes in single entries", batch_size, buf->size(), single_entries_bytes);
+    ASSERT_TRUE(isBatchEntry(*buf));
+
+    /// Requests are deserialized as they are serialized and in order.
+    auto requests = deserializeKeeperRequests(*buf);
+    ASSERT_EQ(requests.size(), batch_size);
+    for (size_t i = 0; i < batch_size; i++)
+    {
+        ASSERT_EQ(requests[i]->session_id, session_id);
+        ASSERT_EQ(requests[i]->create_time, 1);
+        ASSERT_EQ(requests[i]->request->getOpNum(), OpNum::Create);
+        ASSERT_EQ(requests[i]->request->xid, static_cast<XID>(i));
+        const auto & create = dynamic_cast<const ZooKeeperCreateRequest &>(*requests[i]->request);
+        ASSERT_EQ(create.path, "/batch_" + std::to_string(i));
+        ASSERT_EQ(create.data, "data");
+    }
+
+    /// An empty batch is a batch entry too.
+    ptr<buffer> empty_buf = serializeKeeperRequests({});
+    ASSERT_TRUE(isBatchEntry(*empty_buf));
+    ASSERT_TRUE(deserializeKeeperRequests(*empty_buf).empty());
+
+    /// Corrupted requests count is rejected before reserving memory for it.
+    for (int32_t count : {-1, std::numeric_limits<int32_t>::max(), 2})
+    {
+        ptr<buffer> corrupted_buf = serializeKeeperRequests({batch[0]});
+        /// Requests count is in big endian after session id and length.
+        int32_t count_be = std::byteswap(count);
+        memcpy(corrupted_buf->data_begin() + sizeof(int64_t) + sizeof(int32_t), &count_be, sizeof(count_be));
+        ASSERT_THROW(deserializeKeeperRequests(*corrupted_buf), RK::Exception);
+    }
+
+    auto zxid = machine.getStore().getZxid();
+    machine.commit(machine.last_commit_index() + 1, *buf);
+
+    /// Requests are applied in order and every write request consumes a zxid.
+    ASSERT_EQ(machine.getStore().getZxid(), zxid + static_cast<int64_t>(batch_size));
+    for (size_t i = 0; i < batch_size; i++)
+    {
+        KeeperNode & node = machine.getNode("/batch_" + std::to_string(i));
+        ASSERT_EQ(node.data, "data");
+        ASSERT_EQ(node.stat.czxid, zxid + static_cast<int64_t>(i));
+    }
+
+    machine.shutdown();
+    cleanDirectory(snap_dir);
+    cleanDirectory(log_dir);
+}
+
+TEST(RaftStateMachine, commitLeaderRequests)
+{
+    String snap_dir(SNAP_DIR + "/leader");
+    String log_dir(LOG_DIR + "/leader");
+
+    cleanDirectory(snap_dir);
+    cleanDirectory(log_dir);
+
+    KeeperResponsesQueue queue;
+    RaftSettingsPtr setting_ptr = RaftSettings::getDefault();
+
+    std::mutex new_session_id_callback_mutex;
+    std::unordered_map<int64_t, ptr<std::condition_variable>> new_session_id_callback;
+
+    NuRaftStateMachine machine(queue, setting_ptr, snap_dir, log_dir, 10, 3, new_session_id_callback_mutex, new_session_id_callback);
+    int64_t session_id = machine.getStore().getSessionID(30000);
+
+    auto make_batch = [session_id](const String & prefix)
+    {
+        RequestsForSessions batch;
+        for (size_t i = 0; i < 10; i++)
+        {
+            auto request = cs_new<ZooKeeperCreateRequest>();
+            request->path = prefix + std::to_string(i);
+            request->data = "data";
+            request->xid = static_cast<XID>(i);
+            batch.emplace_back(request, session_id, 1);
+        }
+        return batch;
+    };
+
+    /// Requests registered on leader are committed without parsing the entry.
+    auto leader_batch = make_batch("/leader_");
+    ptr<buffer> leader_buf = serializeKeeperRequests(leader_batch);
+    machine.addLeaderRequests(*leader_buf, leader_batch);
+
+    ulong leader_idx = machine.last_commit_index() + 1;
+    machine.pre_commit(leader_idx, *leader_buf);
+    machine.removePendingLeaderRequests({leader_buf});
+
+    /// A different payload proves that registered requests are used.
+    ptr<buffer> other_buf = serializeKeeperRequests(make_batch("/other_"));
+    machine.commit(leader_idx, *other_buf);
+    ASSERT_TRUE(machine.getStore().getNode("/leader_0") != nullptr);
+    ASSERT_TRUE(machine.getStore().getNode("/other_0") == nullptr);
+
+    /// Rolled back entries fall back to deserialization.
+    auto rollback_batch = make_batch("/rollback_");
+    ptr<buffer> rollback_buf = serializeKeeperRequests(rollback_batch);
+    machine.addLeaderRequests(*rollback_buf, rollback_batch);
+
+    ulong rollback_idx = machine.last_commit_index() + 1;
+    machine.pre_commit(rollback_idx, *rollback_buf);
+    machine.removePendingLeaderRequests({rollback_buf});
+    machine.rollback(rollback_idx, *rollback_buf);
+
+    ptr<buffer> follower_buf = serializeKeeperRequests(make_batch("/follower_"));
+    machine.commit(rollback_idx, *follower_buf);
+    ASSERT_TRUE(machine.getStore().getNode("/rollback_0") == nullptr);
+    ASSERT_TRUE(machine.getStore().getNode("/follower_0") != nullptr);
+
+    /// Entries not pre-committed are not kept.
+    auto pending_batch = make_batch("/pending_");
+    ptr<buffer> pending_buf = serializeKeeperRequests(pending_batch);
+    machine.addLeaderRequests(*pending_buf, pending_batch);
+    machine.removePendingLeaderRequests({pending_buf});
+    machine.pre_commit(machine.last_commit_index() + 1, *pending_buf);
+
+    machine.commit(machine.last_commit_index() + 1, *pending_buf);
+    ASSERT_TRUE(machine.getStore().getNode("/pending_0") != nullptr);
+
+    machine.shutdown();
+    cleanDirectory(snap_dir);
+    cleanDirectory(log_dir);
+}
+
 TEST(RaftStateMachine, createSnapshot)
 {
     auto *log = &(Poco::Logger::get("Test_RaftStateMachine"));
@@ -299,3 +466,65 @@ TEST(RaftStateMachine, initStateMachine)
     cleanDirectory(snap_dir);
     cleanDirectory(log_dir);
 }
+
+TEST(RaftStateMachine, replayLogsInParallel)
+{
+    auto * log = &(Poco::Logger::get("Test_RaftStateMachine"));
+    String snap_dir(SNAP_DIR + "/7");
+    String log_dir(LOG_DIR + "/7");
+
+    cleanDirectory(snap_dir, true);
+    cleanDirectory(log_dir, true);
+
+    /// More than one replay batch, so logs are loaded by several threads.
+    UInt32 last_index = 35000;
+    UInt64 term = 1;
+
+    {
+        KeeperResponsesQueue queue;
+        RaftSettingsPtr setting_ptr = RaftSettings::getDefault();
+        ptr<NuRaftFileLogStore> log_store = cs_new<NuRaftFileLogStore>(log_dir);
+
+        std::mutex new_session_id_callback_mutex;
+        std::unordered_map<int64_t, ptr<std::condition_variable>> new_session_id_callback;
+
+        NuRaftStateMachine machine(
+            queue, setting_ptr, snap_dir, log_dir, 10, 3, new_session_id_callback_mutex, new_session_id_callback, log_store);
+
+        for (UInt32 i = 0; i < last_index; i++)
+        {
+            String key = "/" + std::to_string(i + 1);
+            createZNodeLog(machine, key, "table_" + key, log_store, term);
+        }
+        sleep(1);
+
+        ASSERT_EQ(machine.getStore().getNodesCount(), last_index + 3);
+        machine.shutdown();
+    }
+
+    {
+        KeeperResponsesQueue queue;
+        RaftSettingsPtr setting_ptr = RaftSettings::getDefault();
+        ptr<NuRaftFileLogStore> log_store = cs_new<NuRaftFileLogStore>(log_dir);
+
+        std::mutex new_session_id_callback_mutex;
+        std::unordered_map<int64_t, ptr<std::condition_variable>> new_session_id_callback;
+
+        NuRaftStateMachine machine(
+            queue, setting_ptr, snap_dir, log_dir, 10, 3, new_session_id_callback_mutex, new_session_id_callback, log_store);
+        LOG_INFO(log, "init last commit index {}", machine.last_commit_index());
+
+        ASSERT_EQ(machine.last_commit_index(), last_index);
+        ASSERT_EQ(machine.getStore().getNodesCount(), last_index + 3);
+
+        String last_key = "/" + std::to_string(last_index);
+        auto node = machine.getStore().getNode(last_key);
+        ASSERT_TRUE(node != nullptr);
+        ASSERT_EQ(node->data, "table_" + last_key);
+
+        machine.shutdown();
+    }
+
+    cleanDirectory(snap_dir);
+    cleanDirectory(log_dir);
+}
@@ -0,0 +1,113 @@
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include <Service/WatchManager.h>
+
+using namespace RK;
+
+namespace
+{
+
+/// Sessions notified and their events, sorted by session
+std::vector<std::pair<int64_t, Coordination::Event>> notified(const ResponsesForSessions & responses, const String & path)
+{
+    std::vector<std::pair<int64_t, Coordination::Event>> result;
+    for (const auto & response : responses)
+    {
+        auto watch_response = std::dynamic_pointer_cast<Coordination::ZooKeeperWatchResponse>(response.response);
+        if (watch_response && watch_response->path == path)
+            result.emplace_back(response.session_id, static_cast<Coordination::Event>(watch_response->type));
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+}
+
+TEST(WatchManager, persistentWatch)
+{
+    WatchManager watch_manager;
+    watch_manager.registerPersistentWatch("/a", 1, Coordination::AddWatchMode::Persistent);
+    watch_manager.registerWatches("/a", 2, Coordination::OpNum::Get);
+
+    /// Both persistent and one-shot watches are triggered.
+    auto responses = watch_manager.processWatches("/a", Coordination::OpNum::Set);
+    ASSERT_EQ(notified(responses, "/a").size(), 2);
+
+    /// Only persistent watch is left.
+    responses = watch_manager.processWatches("/a", Coordination::OpNum::Set);
+    ASSERT_EQ(notified(responses, "/a"), (std::vector<std::pair<int64_t, Coordination::Event>>{{1, Coordination::Event::CHANGED}}));
+
+    /// Children changes.
+    responses = watch_manager.processWatches("/a/b", Coordination::OpNum::Create);
+    ASSERT_EQ(notified(responses, "/a"), (std::vector<std::pair<int64_t, Coordination::Event>>{{1, Coordination::Event::CHILD}}));
+    ASSERT_TRUE(notified(responses, "/a/b").empty());
+
+    /// A session is notified once even if it has both kinds of watches.
+    watch_manager.registerWatches("/a", 1, Coordination::OpNum::Exists);
+    responses = watch_manager.processWatches("/a", Coordination::OpNum::Set);
+    ASSERT_EQ(notified(responses, "/a").size(), 1);
+
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 1);
+    watch_manager.cleanDeadWatches(1);
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 0);
+    ASSERT_TRUE(watch_manager.processWatches("/a", Coordination::OpNum::Set).empty());
+}
+
+TEST(WatchManager, persistentRecursiveWatch)
+{
+    WatchManager watch_manager;
+    watch_manager.registerPersistentWatch("/a", 1, Coordination::AddWatchMode::PersistentRecursive);
+    watch_manager.registerPersistentWatch("/a/b", 2, Coordination::AddWatchMode::PersistentRecursive);
+    watch_manager.registerPersistentWatch("/", 3, Coordination::AddWatchMode::PersistentRecursive);
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 3);
+    ASSERT_EQ(watch_manager.getWatchedPathsCount(), 3);
+
+    auto responses = watch_manager.processWatches("/a/b/c", Coordination::OpNum::Create);
+    ASSERT_EQ(
+        notified(responses, "/a/b/c"),
+        (std::vector<std::pair<int64_t, Coordination::Event>>{
+            {1, Coordination::Event::CREATED}, {2, Coordination::Event::CREATED}, {3, Coordination::Event::CREATED}}));
+    /// Recursive watches are not notified of children changes.
+    ASSERT_TRUE(notified(responses, "/a/b").empty());
+
+    responses = watch_manager.processWatches("/ab", Coordination::OpNum::Set);
+    ASSERT_EQ(notified(responses, "/ab"), (std::vector<std::pair<int64_t, Coordination::Event>>{{3, Coordination::Event::CHANGED}}));
+
+    watch_manager.cleanDeadWatches(2);
+    responses = watch_manager.processWatches("/a/b/c", Coordination::OpNum::Remove);
+    ASSERT_EQ(
+        notified(responses, "/a/b/c"),
+        (std::vector<std::pair<int64_t, Coordination::Event>>{{1, Coordination::Event::DELETED}, {3, Coordination::Event::DELETED}}));
+
+    watch_manager.cleanDeadWatches(1);
+    watch_manager.cleanDeadWatches(3);
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 0);
+    ASSERT_EQ(watch_manager.getWatchedPathsCount(), 0);
+}
+
+TEST(WatchManager, setWatches2)
+{
+    WatchManager watch_manager;
+
+    auto request = std::make_shared<Coordination::ZooKeeperSetWatchesRequest>();
+    request->op_num = Coordination::OpNum::SetWatches2;
+    request->relative_zxid = 0;
+    request->persistent_watches = {"/a"};
+    request->persistent_recursive_watches = {"/b"};
+
+    /// Persistent watches are re-registered without being triggered.
+    std::unordered_map<String, std::pair<int64_t, int64_t>> watch_nodes_info;
+    auto responses = watch_manager.processRequestSetWatch(RequestForSession{request, 1, 0}, watch_nodes_info);
+    ASSERT_TRUE(responses.empty());
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 2);
+
+    responses = watch_manager.processWatches("/a", Coordination::OpNum::Set);
+    ASSERT_EQ(notified(responses, "/a"), (std::vector<std::pair<int64_t, Coordination::Event>>{{1, Coordination::Event::CHANGED}}));
+    responses = watch_manager.processWatches("/b/c", Coordination::OpNum::Create);
+    ASSERT_EQ(notified(responses, "/b/c"), (std::vector<std::pair<int64_t, Coordination::Event>>{{1, Coordination::Event::CREATED}}));
+
+    /// Still there after triggered.
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 2);
+}
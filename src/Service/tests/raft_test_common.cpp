@@ -1,4 +1,5 @@
 #include <Poco/File.h>
+#include <fmt/format.h>
 
 #include <boost/program_options.hpp>
 #include <common/argsToConfig.h>
@@ -227,4 +228,31 @@ void removeZNode(NuRaftStateMachine & machine, const String & key)
     machine.commit(index, *(buf.get()));
 }
 
+Strings generateClickHousePaths(size_t count)
+{
+    Strings paths;
+    paths.reserve(count);
+
+    size_t seq = 0;
+    for (size_t table = 0; paths.size() < count; table++)
+    {
+        String table_path = fmt::format("/clickhouse/tables/{:02}/database_{}/table_{}", table % 8, table % 5, table);
+        for (size_t replica = 0; replica < 3 && paths.size() < count; replica++)
+        {
+            String replica_path = fmt::format("{}/replicas/replica_{}", table_path, replica);
+            for (const auto * name : {"is_active", "host", "log_pointer", "columns", "metadata", "mutation_pointer", "min_unprocessed_insert_time"})
+                paths.emplace_back(fmt::format("{}/{}", replica_path, name));
+            for (size_t i = 0; i < 50 && paths.size() < count; i++)
+                paths.emplace_back(fmt::format("{}/queue/queue-{:010}", replica_path, seq++));
+        }
+        for (size_t i = 0; i < 100 && paths.size() < count; i++)
+            paths.emplace_back(fmt::format("{}/log/log-{:010}", table_path, seq++));
+        for (size_t i = 0; i < 100 && paths.size() < count; i++, seq++)
+            paths.emplace_back(fmt::format("{}/blocks/202301_{}_{}", table_path, seq, 17 * seq + 5));
+    }
+
+    paths.resize(count);
+    return paths;
+}
+
 }
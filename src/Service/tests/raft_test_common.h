@@ -35,4 +35,17 @@ void createZNode(NuRaftStateMachine & machine, const String & key, const String
 void setZNode(NuRaftStateMachine & machine, const String & key, const String & data);
 void removeZNode(NuRaftStateMachine & machine, const String & key);
 
+/// Generate paths just like ClickHouse replicated tables:
+///     /clickhouse/tables/{shard}/{database}/{table}/replicas/{replica}/queue/queue-{seq}
+///     /clickhouse/tables/{shard}/{database}/{table}/log/log-{seq}
+///     /clickhouse/tables/{shard}/{database}/{table}/blocks/{partition}_{hash}
+Strings generateClickHousePaths(size_t count);
+
+template <typename DataTree>
+void fillDataTree(DataTree & tree, const Strings & paths)
+{
+    for (const auto & path : paths)
+        tree.emplace(path, KeeperNode::create());
+}
+
 }
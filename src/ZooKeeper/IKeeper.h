@@ -252,6 +252,42 @@ struct RemoveResponse : virtual Response
 {
 };
 
+struct RemoveRecursiveRequest : virtual Request
+{
+    String path;
+    /// Max count of nodes to remove including the node itself, nothing is removed if the subtree is larger.
+    uint32_t remove_nodes_limit = 1;
+
+    void addRootPath(const String & root_path) override;
+    String getPath() const override { return path; }
+};
+
+struct RemoveRecursiveResponse : virtual Response
+{
+};
+
+/// Same as ZooKeeper 3.6 AddWatchMode
+enum class AddWatchMode : int32_t
+{
+    /// Watch data and children changes of the node, not removed after triggered.
+    Persistent = 0,
+    /// Watch data changes of the node and all its descendants, not removed after triggered.
+    PersistentRecursive = 1,
+};
+
+struct AddWatchRequest : virtual Request
+{
+    String path;
+    AddWatchMode mode = AddWatchMode::Persistent;
+
+    void addRootPath(const String & root_path) override;
+    String getPath() const override { return path; }
+};
+
+struct AddWatchResponse : virtual Response
+{
+};
+
 struct ExistsRequest : virtual Request
 {
     String path;
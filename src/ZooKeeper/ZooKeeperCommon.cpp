@@ -2,6 +2,7 @@
 #include <array>
 #include "common/logger_useful.h"
 #include "ZooKeeperIO.h"
+#include <Common/IO/ReadBufferFromString.h>
 
 
 namespace Coordination
@@ -158,6 +159,45 @@ void ZooKeeperRemoveRequest::readImpl(ReadBuffer & in)
     Coordination::read(version, in);
 }
 
+void ZooKeeperRemoveRecursiveRequest::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(path, out);
+    Coordination::write(remove_nodes_limit, out);
+}
+
+void ZooKeeperRemoveRecursiveRequest::readImpl(ReadBuffer & in)
+{
+    Coordination::read(path, in);
+    Coordination::read(remove_nodes_limit, in);
+}
+
+void ZooKeeperAddWatchRequest::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(path, out);
+    Coordination::write(static_cast<int32_t>(mode), out);
+}
+
+void ZooKeeperAddWatchRequest::readImpl(ReadBuffer & in)
+{
+    Coordination::read(path, in);
+    int32_t raw_mode;
+    Coordination::read(raw_mode, in);
+    if (raw_mode != static_cast<int32_t>(AddWatchMode::Persistent) && raw_mode != static_cast<int32_t>(AddWatchMode::PersistentRecursive))
+        throw Exception("Unknown add watch mode " + std::to_string(raw_mode), Error::ZBADARGUMENTS);
+    mode = static_cast<AddWatchMode>(raw_mode);
+}
+
+void ZooKeeperAddWatchResponse::readImpl(ReadBuffer & in)
+{
+    Coordination::Error read_error;
+    Coordination::read(read_error, in);
+}
+
+void ZooKeeperAddWatchResponse::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(error, out);
+}
+
 void ZooKeeperExistsRequest::writeImpl(WriteBuffer & out) const
 {
     Coordination::write(path, out);
@@ -263,9 +303,33 @@ void ZooKeeperFilteredListRequest::readImpl(ReadBuffer & in)
     list_request_type = static_cast<ListRequestType>(read_request_type);
 }
 
+static std::vector<String> getResponseNames(const CompactStrings & names, const std::shared_ptr<const String> & serialized_names)
+{
+    if (!serialized_names)
+        return names.toStrings();
+
+    std::vector<String> res;
+    ReadBufferFromString in(*serialized_names);
+    Coordination::read(res, in);
+    return res;
+}
+
+std::vector<String> ZooKeeperListResponse::getNames() const
+{
+    return getResponseNames(names, serialized_names);
+}
+
+std::vector<String> ZooKeeperSimpleListResponse::getNames() const
+{
+    return getResponseNames(names, serialized_names);
+}
+
 void ZooKeeperListResponse::writeImpl(WriteBuffer & out) const
 {
-    Coordination::write(names, out);
+    if (serialized_names)
+        out.write(serialized_names->data(), serialized_names->size());
+    else
+        Coordination::write(names, out);
     Coordination::write(stat, out);
 }
 
@@ -276,7 +340,10 @@ void ZooKeeperSimpleListResponse::readImpl(ReadBuffer & in)
 
 void ZooKeeperSimpleListResponse::writeImpl(WriteBuffer & out) const
 {
-    Coordination::write(names, out);
+    if (serialized_names)
+        out.write(serialized_names->data(), serialized_names->size());
+    else
+        Coordination::write(names, out);
 }
 
 void ZooKeeperSetACLRequest::writeImpl(WriteBuffer & out) const
@@ -564,6 +631,11 @@ void ZooKeeperSetWatchesRequest::writeImpl(WriteBuffer & out) const
     Coordination::write(data_watches, out);
     Coordination::write(exist_watches, out);
     Coordination::write(list_watches, out);
+    if (op_num == OpNum::SetWatches2)
+    {
+        Coordination::write(persistent_watches, out);
+        Coordination::write(persistent_recursive_watches, out);
+    }
 }
 
 void ZooKeeperSetWatchesRequest::readImpl(ReadBuffer & in)
@@ -572,6 +644,11 @@ void ZooKeeperSetWatchesRequest::readImpl(ReadBuffer & in)
     Coordination::read(data_watches, in);
     Coordination::read(exist_watches, in);
     Coordination::read(list_watches, in);
+    if (op_num == OpNum::SetWatches2)
+    {
+        Coordination::read(persistent_watches, in);
+        Coordination::read(persistent_recursive_watches, in);
+    }
 }
 
 
@@ -581,6 +658,8 @@ ZooKeeperResponsePtr ZooKeeperSyncRequest::makeResponse() const { return std::ma
 ZooKeeperResponsePtr ZooKeeperAuthRequest::makeResponse() const { return std::make_shared<ZooKeeperAuthResponse>(); }
 ZooKeeperResponsePtr ZooKeeperCreateRequest::makeResponse() const { return std::make_shared<ZooKeeperCreateResponse>(); }
 ZooKeeperResponsePtr ZooKeeperRemoveRequest::makeResponse() const { return std::make_shared<ZooKeeperRemoveResponse>(); }
+ZooKeeperResponsePtr ZooKeeperRemoveRecursiveRequest::makeResponse() const { return std::make_shared<ZooKeeperRemoveRecursiveResponse>(); }
+ZooKeeperResponsePtr ZooKeeperAddWatchRequest::makeResponse() const { return std::make_shared<ZooKeeperAddWatchResponse>(); }
 ZooKeeperResponsePtr ZooKeeperExistsRequest::makeResponse() const { return std::make_shared<ZooKeeperExistsResponse>(); }
 ZooKeeperResponsePtr ZooKeeperGetRequest::makeResponse() const { return std::make_shared<ZooKeeperGetResponse>(); }
 ZooKeeperResponsePtr ZooKeeperSetRequest::makeResponse() const { return std::make_shared<ZooKeeperSetResponse>(); }
@@ -723,6 +802,8 @@ void registerZooKeeperRequest(ZooKeeperRequestFactory & factory)
             res->operation_type = ZooKeeperMultiRequest::OperationType::Read;
         else if constexpr (num == OpNum::Multi)
             res->operation_type = ZooKeeperMultiRequest::OperationType::Write;
+        else if constexpr (num == OpNum::SetWatches2)
+            res->op_num = OpNum::SetWatches2;
         return res;
     });
 }
@@ -735,7 +816,9 @@ ZooKeeperRequestFactory::ZooKeeperRequestFactory()
     registerZooKeeperRequest<OpNum::Close, ZooKeeperCloseRequest>(*this);
     registerZooKeeperRequest<OpNum::Create, ZooKeeperCreateRequest>(*this);
     registerZooKeeperRequest<OpNum::Remove, ZooKeeperRemoveRequest>(*this);
+    registerZooKeeperRequest<OpNum::RemoveRecursive, ZooKeeperRemoveRecursiveRequest>(*this);
     registerZooKeeperRequest<OpNum::Exists, ZooKeeperExistsRequest>(*this);
+    registerZooKeeperRequest<OpNum::AddWatch, ZooKeeperAddWatchRequest>(*this);
     registerZooKeeperRequest<OpNum::Get, ZooKeeperGetRequest>(*this);
     registerZooKeeperRequest<OpNum::Set, ZooKeeperSetRequest>(*this);
     registerZooKeeperRequest<OpNum::SimpleList, ZooKeeperSimpleListRequest>(*this);
@@ -747,6 +830,7 @@ ZooKeeperRequestFactory::ZooKeeperRequestFactory()
     registerZooKeeperRequest<OpNum::NewSession, ZooKeeperNewSessionRequest>(*this);
     registerZooKeeperRequest<OpNum::UpdateSession, ZooKeeperUpdateSessionRequest>(*this);
     registerZooKeeperRequest<OpNum::SetWatches, ZooKeeperSetWatchesRequest>(*this);
+    registerZooKeeperRequest<OpNum::SetWatches2, ZooKeeperSetWatchesRequest>(*this);
     registerZooKeeperRequest<OpNum::GetACL, ZooKeeperGetACLRequest>(*this);
     registerZooKeeperRequest<OpNum::SetACL, ZooKeeperSetACLRequest>(*this);
 }
@@ -102,7 +102,7 @@ struct ZooKeeperHeartbeatResponse final : ZooKeeperResponse
     OpNum getOpNum() const override { return OpNum::Heartbeat; }
 };
 
-/** Internal request.
+/** Internal request. Also SetWatches2 which carries persistent watches in addition.
  */
 struct ZooKeeperSetWatchesRequest final : ZooKeeperRequest
 {
@@ -110,9 +110,14 @@ struct ZooKeeperSetWatchesRequest final : ZooKeeperRequest
     std::vector<String> data_watches;
     std::vector<String> exist_watches;
     std::vector<String> list_watches;
+    /// Only for SetWatches2
+    std::vector<String> persistent_watches;
+    std::vector<String> persistent_recursive_watches;
+
+    OpNum op_num = OpNum::SetWatches;
 
     String getPath() const override { return {}; }
-    OpNum getOpNum() const override { return OpNum::SetWatches; }
+    OpNum getOpNum() const override { return op_num; }
     void writeImpl(WriteBuffer &) const override;
     void readImpl(ReadBuffer &) override;
     ZooKeeperResponsePtr makeResponse() const override;
@@ -279,6 +284,61 @@ struct ZooKeeperRemoveResponse final : RemoveResponse, ZooKeeperResponse
     OpNum getOpNum() const override { return OpNum::Remove; }
 };
 
+struct ZooKeeperRemoveRecursiveRequest final : RemoveRecursiveRequest, ZooKeeperRequest
+{
+    ZooKeeperRemoveRecursiveRequest() = default;
+    explicit ZooKeeperRemoveRecursiveRequest(const RemoveRecursiveRequest & base) : RemoveRecursiveRequest(base) { }
+
+    OpNum getOpNum() const override { return OpNum::RemoveRecursive; }
+    void writeImpl(WriteBuffer & out) const override;
+    void readImpl(ReadBuffer & in) override;
+
+    ZooKeeperResponsePtr makeResponse() const override;
+    bool isReadRequest() const override { return false; }
+    String toString() const override
+    {
+        return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", path " + path + ", remove_nodes_limit "
+            + std::to_string(remove_nodes_limit);
+    }
+};
+
+struct ZooKeeperRemoveRecursiveResponse final : RemoveRecursiveResponse, ZooKeeperResponse
+{
+    /// Removed paths from top to bottom, used by server to trigger watches and not serialized.
+    Strings removed_paths;
+
+    void readImpl(ReadBuffer &) override { }
+    void writeImpl(WriteBuffer &) const override { }
+    OpNum getOpNum() const override { return OpNum::RemoveRecursive; }
+};
+
+struct ZooKeeperAddWatchRequest final : AddWatchRequest, ZooKeeperRequest
+{
+    ZooKeeperAddWatchRequest() = default;
+    explicit ZooKeeperAddWatchRequest(const AddWatchRequest & base) : AddWatchRequest(base) { }
+
+    OpNum getOpNum() const override { return OpNum::AddWatch; }
+    void writeImpl(WriteBuffer & out) const override;
+    void readImpl(ReadBuffer & in) override;
+
+    ZooKeeperResponsePtr makeResponse() const override;
+    /// Watches are kept by the server the session connected to, just like watches of read requests.
+    bool isReadRequest() const override { return true; }
+    String toString() const override
+    {
+        return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", path " + path + ", mode "
+            + std::to_string(static_cast<int32_t>(mode));
+    }
+};
+
+/// ZooKeeper responds AddWatch with an ErrorResponse
+struct ZooKeeperAddWatchResponse final : AddWatchResponse, ZooKeeperResponse
+{
+    void readImpl(ReadBuffer & in) override;
+    void writeImpl(WriteBuffer & out) const override;
+    OpNum getOpNum() const override { return OpNum::AddWatch; }
+};
+
 struct ZooKeeperExistsRequest final : ExistsRequest, ZooKeeperRequest
 {
     ZooKeeperExistsRequest() = default;
@@ -448,6 +508,12 @@ struct ZooKeeperFilteredListRequest final : ZooKeeperListRequest
 
 struct ZooKeeperListResponse final : ListResponse, ZooKeeperResponse
 {
+    /// Names serialized in advance by server, written as is instead of 'names' if not null.
+    std::shared_ptr<const String> serialized_names;
+
+    /// Names of the response, parsed from 'serialized_names' if it is not null.
+    std::vector<String> getNames() const;
+
     void readImpl(ReadBuffer & in) override;
     void writeImpl(WriteBuffer & out) const override;
     OpNum getOpNum() const override { return OpNum::List; }
@@ -456,8 +522,8 @@ struct ZooKeeperListResponse final : ListResponse, ZooKeeperResponse
     {
         if (const ZooKeeperListResponse * list_response = dynamic_cast<const ZooKeeperListResponse *>(&response))
         {
-            std::vector<String> copy_other_nodes = list_response->names.toStrings();
-            std::vector<String> copy_nodes = names.toStrings();
+            std::vector<String> copy_other_nodes = list_response->getNames();
+            std::vector<String> copy_nodes = getNames();
             std::sort(copy_other_nodes.begin(), copy_other_nodes.end());
             std::sort(copy_nodes.begin(), copy_nodes.end());
             return ZooKeeperResponse::operator==(response) && list_response->stat == stat && copy_other_nodes == copy_nodes;
@@ -476,6 +542,12 @@ struct ZooKeeperListResponse final : ListResponse, ZooKeeperResponse
 
 struct ZooKeeperSimpleListResponse final : SimpleListResponse, ZooKeeperResponse
 {
+    /// Names serialized in advance by server, written as is instead of 'names' if not null.
+    std::shared_ptr<const String> serialized_names;
+
+    /// Names of the response, parsed from 'serialized_names' if it is not null.
+    std::vector<String> getNames() const;
+
     void readImpl(ReadBuffer & in) override;
     void writeImpl(WriteBuffer & out) const override;
     OpNum getOpNum() const override { return OpNum::SimpleList; }
@@ -484,8 +556,8 @@ struct ZooKeeperSimpleListResponse final : SimpleListResponse, ZooKeeperResponse
     {
         if (const ZooKeeperSimpleListResponse * list_response = dynamic_cast<const ZooKeeperSimpleListResponse *>(&response))
         {
-            std::vector<String> copy_other_nodes = list_response->names.toStrings();
-            std::vector<String> copy_nodes = names.toStrings();
+            std::vector<String> copy_other_nodes = list_response->getNames();
+            std::vector<String> copy_nodes = getNames();
             std::sort(copy_other_nodes.begin(), copy_other_nodes.end());
             std::sort(copy_nodes.begin(), copy_nodes.end());
             return ZooKeeperResponse::operator==(response) && copy_other_nodes == copy_nodes;
@@ -21,13 +21,16 @@ static const std::unordered_set<int32_t> VALID_OPERATIONS =
     static_cast<int32_t>(OpNum::Check),
     static_cast<int32_t>(OpNum::Multi),
     static_cast<int32_t>(OpNum::MultiRead),
+    static_cast<int32_t>(OpNum::AddWatch),
     static_cast<int32_t>(OpNum::Auth),
     static_cast<int32_t>(OpNum::NewSession),
     static_cast<int32_t>(OpNum::OldNewSession),
     static_cast<int32_t>(OpNum::SetWatches),
+    static_cast<int32_t>(OpNum::SetWatches2),
     static_cast<int32_t>(OpNum::SetACL),
     static_cast<int32_t>(OpNum::GetACL),
     static_cast<int32_t>(OpNum::FilteredList),
+    static_cast<int32_t>(OpNum::RemoveRecursive),
     static_cast<int32_t>(OpNum::UpdateSession),
 };
 
@@ -63,6 +66,8 @@ std::string toString(OpNum op_num)
             return "Multi";
         case OpNum::MultiRead:
             return "MultiRead";
+        case OpNum::AddWatch:
+            return "AddWatch";
         case OpNum::Heartbeat:
             return "Heartbeat";
         case OpNum::Auth:
@@ -73,6 +78,8 @@ std::string toString(OpNum op_num)
             return "OldNewSession";
         case OpNum::SetWatches:
             return "SetWatches";
+        case OpNum::SetWatches2:
+            return "SetWatches2";
         case OpNum::SetACL:
             return "SetACL";
         case OpNum::GetACL:
@@ -81,6 +88,8 @@ std::string toString(OpNum op_num)
             return "UpdateSession";
         case OpNum::FilteredList:
             return "FilteredList";
+        case OpNum::RemoveRecursive:
+            return "RemoveRecursive";
     }
     int32_t raw_op = static_cast<int32_t>(op_num);
     throw Exception("Operation " + std::to_string(raw_op) + " is unknown", Error::ZUNIMPLEMENTED);
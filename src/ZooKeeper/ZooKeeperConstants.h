@@ -37,12 +37,15 @@ enum class OpNum : int32_t
     Check = 13,
     Multi = 14,
     MultiRead = 22,
+    AddWatch = 106,
     Auth = 100,
     SetWatches = 101,
+    SetWatches2 = 105, /// SetWatches with persistent and persistent recursive watches.
     NewSession = -10, /// Used to create new session.
     OldNewSession = 997, /// Same with NewSession, just for backward compatibility
 
     FilteredList = 500, /// Special operation only used in ClickHouse.
+    RemoveRecursive = 503, /// Remove a node with its subtree, same opnum as ClickHouse Keeper.
     UpdateSession = 998, /// Special internal request. Used to session reconnect.
 };
 
@@ -17,7 +17,8 @@ node2 = cluster.add_instance('node2', main_configs=['configs/enable_keeper2.xml'
 node3 = cluster.add_instance('node3', main_configs=['configs/enable_keeper3.xml', 'configs/logs_conf.xml'],
                              stay_alive=True)
 
-simple_metrics = ["snap_time_ms", "snap_blocking_time_ms", "snap_count"]
+simple_metrics = ["snap_time_ms", "snap_blocking_time_ms", "snap_count", "snap_uncompressed_bytes", "snap_compressed_bytes",
+                  "snap_compression_time_us", "snap_decompression_time_us", "replay_log_entries_per_second"]
 basic_metrics = ["log_replication_batch_size"]
 advance_metrics = ["apply_read_request_time_ms", "apply_write_request_time_ms", "push_request_queue_time_ms", "readlatency", "updatelatency", ]
 
@@ -185,6 +186,9 @@ def test_cmd_mntr(started_cluster):
         assert int(result["zk_ephemerals_count"]) == 2
         assert int(result["zk_approximate_data_size"]) > 0
 
+        assert int(result["zk_log_cache_hits"]) >= 0
+        assert int(result["zk_log_cache_misses"]) >= 0
+
         assert int(result["zk_open_file_descriptor_count"]) > 0
         assert int(result["zk_max_file_descriptor_count"]) > 0
 
@@ -669,6 +673,8 @@ def test_cmd_lgif(started_cluster):
         assert int(result["leader_committed_log_idx"]) >= 1
         assert int(result["target_committed_log_idx"]) >= 1
         assert int(result["last_snapshot_idx"]) >= 1
+        assert int(result["removing_log_segments"]) >= 0
+        assert int(result["removing_log_bytes"]) >= 0
     finally:
         close_zk_client(zk)
 